@@ -0,0 +1,241 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *   http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial contribution
+ *******************************************************************************/
+
+/*
+
+ transport benchmark
+
+ Measures the round trip latency and CPU cost of an MQTT PUBLISH packet
+ through the Linux Network implementations, against an in-process echo peer
+ standing in for a co-located broker.  Each transport is run in turn, with the
+ default socket profile and then with the low-latency profile.  Spinning only
+ pays off when the peer has a core of its own: pin with --cpu on a machine
+ with at least two.
+
+ defaulted parameters:
+
+	--count 100000
+	--payload 100
+	--spin 50         spin budget of the low-latency profile, in microseconds
+	--cpu -1          core to pin the benchmark thread to, -1 not to pin
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "MQTTClient.h"
+
+
+struct opts_struct
+{
+	int count;
+	int payload;
+	int spin;
+	int cpu;
+} opts =
+{
+	100000, 100, 50, -1
+};
+
+
+void getopts(int argc, char** argv)
+{
+	int count = 1;
+
+	while (count < argc)
+	{
+		if (strcmp(argv[count], "--count") == 0 && ++count < argc)
+			opts.count = atoi(argv[count]);
+		else if (strcmp(argv[count], "--payload") == 0 && ++count < argc)
+			opts.payload = atoi(argv[count]);
+		else if (strcmp(argv[count], "--spin") == 0 && ++count < argc)
+			opts.spin = atoi(argv[count]);
+		else if (strcmp(argv[count], "--cpu") == 0 && ++count < argc)
+			opts.cpu = atoi(argv[count]);
+		else
+		{
+			printf("Usage: transportbench [--count <round trips>] [--payload <bytes>] [--spin <us>] [--cpu <core>]\n");
+			exit(-1);
+		}
+		count++;
+	}
+}
+
+
+/* echo everything back on the first connection accepted */
+static void* echo_peer(void* arg)
+{
+	int listen_socket = *(int*)arg;
+	int sock = accept(listen_socket, NULL, NULL);
+	unsigned char buf[4096];
+	int rc = 0;
+
+	while ((rc = read(sock, buf, sizeof(buf))) > 0)
+	{
+		if (write(sock, buf, rc) != rc)
+			break;
+	}
+	close(sock);
+	return NULL;
+}
+
+
+static int listen_tcp(int* port)
+{
+	struct sockaddr_in address;
+	socklen_t addrlen = sizeof(address);
+	int s = socket(AF_INET, SOCK_STREAM, 0);
+
+	memset(&address, '\0', sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(s, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(s, 1) != 0 ||
+	    getsockname(s, (struct sockaddr*)&address, &addrlen) != 0)
+		return -1;
+	*port = ntohs(address.sin_port);
+	return s;
+}
+
+
+static int listen_unix(const char* path)
+{
+	struct sockaddr_un address;
+	int s = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	unlink(path);
+	memset(&address, '\0', sizeof(address));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+	if (bind(s, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(s, 1) != 0)
+		return -1;
+	return s;
+}
+
+
+static long usecs(struct timeval* tv)
+{
+	return tv->tv_sec * 1000000L + tv->tv_usec;
+}
+
+
+static int compare_long(const void* a, const void* b)
+{
+	long la = *(const long*)a, lb = *(const long*)b;
+	return (la > lb) - (la < lb);
+}
+
+
+static void run(const char* name, Network* n, unsigned char* packet, int len, long* samples)
+{
+	unsigned char readbuf[4096];
+	struct timeval start, end;
+	struct rusage ru_start, ru_end;
+	long cpu = 0, total = 0;
+	int i;
+
+	getrusage(RUSAGE_SELF, &ru_start);
+	for (i = 0; i < opts.count; ++i)
+	{
+		gettimeofday(&start, NULL);
+		if (n->mqttwrite(n, packet, len, 1000) != len || n->mqttread(n, readbuf, len, 1000) != len)
+		{
+			printf("%s: round trip %d failed\n", name, i);
+			return;
+		}
+		gettimeofday(&end, NULL);
+		samples[i] = usecs(&end) - usecs(&start);
+		total += samples[i];
+	}
+	getrusage(RUSAGE_SELF, &ru_end);
+	cpu = usecs(&ru_end.ru_utime) - usecs(&ru_start.ru_utime) + usecs(&ru_end.ru_stime) - usecs(&ru_start.ru_stime);
+
+	qsort(samples, opts.count, sizeof(long), compare_long);
+	printf("%-28s mean %6.2f us  p50 %4ld us  p99 %4ld us  max %6ld us  cpu %6.2f us/msg\n", name,
+		(double)total / opts.count, samples[opts.count / 2], samples[(opts.count * 99) / 100],
+		samples[opts.count - 1], (double)cpu / opts.count);
+}
+
+
+static void bench(const char* name, char* uri, Network* n, NetworkLatencyOptions* latency,
+		unsigned char* packet, int len, long* samples)
+{
+	char unix_path[64];
+	pthread_t peer;
+	int listen_socket, port = 0;
+
+	if (strcmp(uri, UNIX_URI_PREFIX) == 0)
+	{
+		snprintf(unix_path, sizeof(unix_path), "/tmp/paho-bench-%d.sock", (int)getpid());
+		listen_socket = listen_unix(unix_path);
+	}
+	else
+		listen_socket = listen_tcp(&port);
+	if (listen_socket < 0)
+		return;
+	pthread_create(&peer, NULL, echo_peer, &listen_socket);
+
+	NetworkInit(n);
+	NetworkSetLowLatency(n, latency);
+	if (port == 0)
+	{
+		char unix_uri[80];
+		snprintf(unix_uri, sizeof(unix_uri), "%s%s", UNIX_URI_PREFIX, unix_path);
+		if (NetworkConnect(n, unix_uri, 0) == 0)
+			run(name, n, packet, len, samples);
+	}
+	else if (NetworkConnect(n, uri, port) == 0)
+		run(name, n, packet, len, samples);
+	NetworkDisconnect(n);
+	pthread_join(peer, NULL);
+	close(listen_socket);
+	if (port == 0)
+		unlink(unix_path);
+}
+
+
+int main(int argc, char** argv)
+{
+	NetworkLatencyOptions latency = NetworkLatencyOptions_initializer;
+	unsigned char* packet = NULL;
+	unsigned char* payload = NULL;
+	long* samples = NULL;
+	MQTTString topic = MQTTString_initializer;
+	Network n;
+	int len;
+
+	getopts(argc, argv);
+	payload = calloc(1, opts.payload);
+	packet = malloc(opts.payload + 64);
+	samples = malloc(sizeof(long) * opts.count);
+	topic.cstring = "transport/bench";
+	len = MQTTSerialize_publish(packet, opts.payload + 64, 0, 0, 0, 0, topic, payload, opts.payload);
+	printf("%d round trips of a %d byte PUBLISH packet\n", opts.count, len);
+	if (opts.cpu >= 0 && NetworkPinThread(opts.cpu) != 0)
+		printf("Could not pin to core %d\n", opts.cpu);
+	latency.spin_us = opts.spin;
+
+	bench("loopback TCP", "tcp://127.0.0.1", &n, NULL, packet, len, samples);
+	bench("loopback TCP, low latency", "tcp://127.0.0.1", &n, &latency, packet, len, samples);
+	bench("Unix socket", UNIX_URI_PREFIX, &n, NULL, packet, len, samples);
+	bench("Unix socket, low latency", UNIX_URI_PREFIX, &n, &latency, packet, len, samples);
+
+	free(samples);
+	free(packet);
+	free(payload);
+	return 0;
+}
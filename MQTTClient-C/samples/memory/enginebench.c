@@ -0,0 +1,210 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *   http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial contribution
+ *******************************************************************************/
+
+/*
+
+ protocol engine benchmark
+
+ Measures the cost per message of the client's protocol engine alone - cycle,
+ deliverMessage and the acknowledgement flows - on the in-memory platform,
+ against the scripted broker, so no time goes to the kernel.  The last row
+ publishes with outbound batching, and shows how many writes - socket system
+ calls on a real network - it takes per message.
+
+ defaulted parameters:
+
+	--count 1000000
+	--payload 100
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "MQTTClient.h"
+
+
+struct opts_struct
+{
+	int count;
+	int payload;
+} opts =
+{
+	1000000, 100
+};
+
+
+void getopts(int argc, char** argv)
+{
+	int count = 1;
+
+	while (count < argc)
+	{
+		if (strcmp(argv[count], "--count") == 0 && ++count < argc)
+			opts.count = atoi(argv[count]);
+		else if (strcmp(argv[count], "--payload") == 0 && ++count < argc)
+			opts.payload = atoi(argv[count]);
+		else
+		{
+			printf("Usage: enginebench [--count <messages>] [--payload <bytes>]\n");
+			exit(-1);
+		}
+		count++;
+	}
+}
+
+
+static MemoryBroker broker;
+static Network network;
+static MQTTClient client;
+static unsigned long arrived = 0;
+
+
+void messageArrived(MessageData* md)
+{
+	++arrived;
+}
+
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static double cpu_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static int start(unsigned char* sendbuf, unsigned char* readbuf, int buflen)
+{
+	MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+
+	MemoryClockReset();
+	MemoryBrokerInit(&broker);
+	NetworkInit(&network);
+	NetworkConnect(&network, &broker);
+	MQTTClientInit(&client, &network, 1000, sendbuf, buflen, readbuf, buflen);
+	data.clientID.cstring = "enginebench";
+	if (MQTTConnect(&client, &data) != SUCCESS)
+		return -1;
+	return MQTTSubscribe(&client, "bench/#", QOS2, messageArrived);
+}
+
+
+static void report(const char* name, double start, double start_cpu)
+{
+	printf("%-22s %8.1f ns/msg  cpu %8.1f ns/msg\n", name,
+		(now_ns() - start) / opts.count, (cpu_ns() - start_cpu) / opts.count);
+}
+
+
+int main(int argc, char** argv)
+{
+	unsigned char* sendbuf = NULL;
+	unsigned char* readbuf = NULL;
+	unsigned char* payload = NULL;
+	int buflen, qos, i;
+
+	getopts(argc, argv);
+	buflen = opts.payload + 64;
+	sendbuf = malloc(buflen);
+	readbuf = malloc(buflen);
+	payload = calloc(1, opts.payload);
+	printf("%d messages of %d bytes\n", opts.count, opts.payload);
+
+	for (qos = QOS0; qos <= QOS2; ++qos)
+	{
+		char name[32];
+		double t, c;
+
+		if (start(sendbuf, readbuf, buflen) != SUCCESS ||
+		    MemoryBrokerPublish(&broker, "bench/in", qos, payload, opts.payload, opts.count) != 0)
+			return -1;
+		arrived = 0;
+		t = now_ns();
+		c = cpu_ns();
+		while (arrived < opts.count)
+		{
+			if (MQTTYield(&client, 1000) != SUCCESS)
+				return -1;
+		}
+		snprintf(name, sizeof(name), "receive QoS %d", qos);
+		report(name, t, c);
+	}
+
+	for (qos = QOS0; qos <= QOS2; ++qos)
+	{
+		MQTTMessage message;
+		char name[32];
+		double t, c;
+
+		if (start(sendbuf, readbuf, buflen) != SUCCESS)
+			return -1;
+		message.qos = (enum QoS)qos;
+		message.retained = 0;
+		message.payload = payload;
+		message.payloadlen = opts.payload;
+		t = now_ns();
+		c = cpu_ns();
+		for (i = 0; i < opts.count; ++i)
+		{
+			if (MQTTPublish(&client, "bench/out", &message) != SUCCESS)
+				return -1;
+		}
+		snprintf(name, sizeof(name), "publish QoS %d", qos);
+		report(name, t, c);
+	}
+
+	{   /* QoS 0 again, coalesced into one write per batch buffer */
+		static unsigned char batchbuf[MEMORY_RING_SIZE]; /* as much as the broker takes in one write */
+		MQTTMessage message;
+		unsigned long writes;
+		double t, c;
+
+		if (start(sendbuf, readbuf, buflen) != SUCCESS ||
+		    MQTTSetBatching(&client, batchbuf, sizeof(batchbuf), 0, 1000) != SUCCESS)
+			return -1;
+		message.qos = QOS0;
+		message.retained = 0;
+		message.payload = payload;
+		message.payloadlen = opts.payload;
+		writes = broker.writes;
+		t = now_ns();
+		c = cpu_ns();
+		for (i = 0; i < opts.count; ++i)
+		{
+			if (MQTTPublish(&client, "bench/out", &message) != SUCCESS)
+				return -1;
+		}
+		if (MQTTFlush(&client) != SUCCESS)
+			return -1;
+		report("publish QoS 0 batched", t, c);
+		printf("%-22s %8.4f writes/msg\n", "", (double)(broker.writes - writes) / opts.count);
+	}
+
+	free(payload);
+	free(readbuf);
+	free(sendbuf);
+	return 0;
+}
@@ -23,6 +23,7 @@
 static void NewMessageData(MessageData* md, MQTTString* aTopicName, MQTTMessage* aMessage) {
     md->topicName = aTopicName;
     md->message = aMessage;
+    md->skipped = 0;
 }
 
 
@@ -31,14 +32,14 @@ static int getNextPacketId(MQTTClient *c) {
 }
 
 
-static int sendPacket(MQTTClient* c, int length, Timer* timer)
+static int sendBuffer(MQTTClient* c, unsigned char* buf, int length, Timer* timer)
 {
     int rc = FAILURE,
         sent = 0;
 
     while (sent < length && !TimerIsExpired(timer))
     {
-        rc = c->ipstack->mqttwrite(c->ipstack, &c->buf[sent], length, TimerLeftMS(timer));
+        rc = c->ipstack->mqttwrite(c->ipstack, &buf[sent], length - sent, TimerLeftMS(timer));
         if (rc < 0)  // there was an error writing the data
             break;
         sent += rc;
@@ -54,6 +55,147 @@ static int sendPacket(MQTTClient* c, int length, Timer* timer)
 }
 
 
+static int flushBatch(MQTTClient* c, Timer* timer)
+{
+    int rc = SUCCESS;
+
+    if (c->batch_len > 0)
+    {
+        rc = sendBuffer(c, c->batchbuf, c->batch_len, timer);
+        c->batch_len = 0;
+    }
+    return rc;
+}
+
+
+static int sendPacket(MQTTClient* c, int length, Timer* timer)
+{
+    int rc = flushBatch(c, timer); /* batched publishes go first, to keep the order they were made in */
+
+    if (rc == SUCCESS)
+        rc = sendBuffer(c, c->buf, length, timer);
+    return rc;
+}
+
+
+/* Account for len bytes just serialized onto the end of the batch */
+static int batchAdded(MQTTClient* c, int len, Timer* timer)
+{
+    if (c->batch_len == 0)
+    {
+#if defined(MQTTCLIENT_TIMER_US)
+        TimerCountdownUS(&c->batch_timer, c->batch_age_us);
+#else
+        TimerCountdownMS(&c->batch_timer, (c->batch_age_us + 999) / 1000);
+#endif
+    }
+    c->batch_len += len;
+    return (c->batch_len >= c->batch_threshold) ? flushBatch(c, timer) : SUCCESS;
+}
+
+
+/* Serialize a publish onto the end of the batch, flushing as needed.  Returns
+ * BUFFER_OVERFLOW, with nothing waiting, if it does not fit even an empty batch. */
+static int batchPublish(MQTTClient* c, MQTTString topic, MQTTMessage* message, Timer* timer)
+{
+    int rc = SUCCESS,
+        len = 0;
+
+    len = MQTTSerialize_publish(c->batchbuf + c->batch_len, c->batchbuf_size - c->batch_len, 0, message->qos,
+              message->retained, message->id, topic, (unsigned char*)message->payload, message->payloadlen);
+    if (len <= 0 && c->batch_len > 0 && (rc = flushBatch(c, timer)) == SUCCESS)
+        len = MQTTSerialize_publish(c->batchbuf, c->batchbuf_size, 0, message->qos,
+                  message->retained, message->id, topic, (unsigned char*)message->payload, message->payloadlen);
+    if (rc == SUCCESS)
+        rc = (len <= 0) ? BUFFER_OVERFLOW : batchAdded(c, len, timer);
+    return rc;
+}
+
+
+/* Send an acknowledgement.  When batching, it is added to the batch, so that the acks
+ * for a burst of incoming publishes are written together once the burst has been read. */
+static int sendAck(MQTTClient* c, unsigned char type, unsigned short packetid, Timer* timer)
+{
+    int rc = SUCCESS,
+        len = 0;
+
+    if (c->batchbuf != NULL)
+    {
+        len = MQTTSerialize_ack(c->batchbuf + c->batch_len, c->batchbuf_size - c->batch_len, type, 0, packetid);
+        if (len <= 0 && c->batch_len > 0 && (rc = flushBatch(c, timer)) == SUCCESS)
+            len = MQTTSerialize_ack(c->batchbuf, c->batchbuf_size, type, 0, packetid);
+        if (rc != SUCCESS || len > 0)
+            return (rc == SUCCESS) ? batchAdded(c, len, timer) : rc;
+    }
+    if ((len = MQTTSerialize_ack(c->buf, c->buf_size, type, 0, packetid)) <= 0)
+        return FAILURE;
+    return sendPacket(c, len, timer);
+}
+
+
+/* Swap the send buffer for a lent one of at least size bytes, or the largest lent if size is 0 */
+static int borrowSendBuffer(MQTTClient* c, size_t size)
+{
+    unsigned char* buf = NULL;
+    size_t lent = 0;
+
+    if (c->borrow == NULL || c->buf != c->buf_scratch)
+        return FAILURE;
+    if ((buf = c->borrow(c->lender_context, size, &lent)) == NULL)
+        return FAILURE;
+    c->buf = buf;
+    c->buf_size = lent;
+    return SUCCESS;
+}
+
+
+/* Make sure the send buffer holds a packet of rem_len, borrowing one if it is too small */
+static void sendBufferFor(MQTTClient* c, int rem_len)
+{
+    if (c->borrow != NULL && (size_t)MQTTPacket_len(rem_len) > c->buf_size)
+        borrowSendBuffer(c, MQTTPacket_len(rem_len));
+}
+
+
+static void giveBackSendBuffer(MQTTClient* c)
+{
+    if (c->giveBack != NULL && c->buf != c->buf_scratch)
+    {
+        c->giveBack(c->lender_context, c->buf);
+        c->buf = c->buf_scratch;
+        c->buf_size = c->buf_scratch_size;
+    }
+}
+
+
+/* Swap the read buffer for a lent one of at least size bytes, keeping the len bytes already read */
+static int borrowReadBuffer(MQTTClient* c, size_t size, int len)
+{
+    unsigned char* buf = NULL;
+    size_t lent = 0;
+
+    if (c->borrow == NULL || c->readbuf != c->readbuf_scratch)
+        return FAILURE;
+    if ((buf = c->borrow(c->lender_context, size, &lent)) == NULL)
+        return FAILURE;
+    memcpy(buf, c->readbuf, len);
+    c->readbuf = buf;
+    c->readbuf_size = lent;
+    return SUCCESS;
+}
+
+
+static void giveBackReadBuffer(MQTTClient* c)
+{
+    if (c->giveBack != NULL && c->readbuf != c->readbuf_scratch)
+    {
+        c->giveBack(c->lender_context, c->readbuf);
+        c->readbuf = c->readbuf_scratch;
+        c->readbuf_size = c->readbuf_scratch_size;
+    }
+}
+
+
 void MQTTClientInit(MQTTClient* c, Network* network, unsigned int command_timeout_ms,
 		unsigned char* sendbuf, size_t sendbuf_size, unsigned char* readbuf, size_t readbuf_size)
 {
@@ -61,7 +203,10 @@ void MQTTClientInit(MQTTClient* c, Network* network, unsigned int command_timeou
     c->ipstack = network;
 
     for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
+    {
         c->messageHandlers[i].topicFilter = 0;
+        c->messageHandlers[i].conflate = 0;
+    }
     c->command_timeout_ms = command_timeout_ms;
     c->buf = sendbuf;
     c->buf_size = sendbuf_size;
@@ -71,9 +216,36 @@ void MQTTClientInit(MQTTClient* c, Network* network, unsigned int command_timeou
     c->cleansession = 0;
     c->ping_outstanding = 0;
     c->defaultMessageHandler = NULL;
+    c->dispatcher = NULL;
+    c->dispatcher_context = NULL;
+    c->flow = NULL;
+    c->flow_context = NULL;
+    c->source = NULL;
+    c->source_context = NULL;
+    c->source_poll_ms = 0;
+    c->readbufs = NULL;
+    c->readbufs_context = NULL;
+    c->borrow = NULL;
+    c->giveBack = NULL;
+    c->lender_context = NULL;
+    c->buf_scratch = sendbuf;
+    c->buf_scratch_size = sendbuf_size;
+    c->readbuf_scratch = readbuf;
+    c->readbuf_scratch_size = readbuf_size;
+    c->conflated = NULL;
+    c->conflated_count = 0;
+    c->conflate_round = 0;
+    TimerInit(&c->conflate_timer);
+#if MQTTCLIENT_QOS2
+    MQTTPacketIdSet_clear(&c->incoming_qos2);
+#endif
 	  c->next_packetid = 1;
     TimerInit(&c->last_sent);
     TimerInit(&c->last_received);
+    c->batchbuf = NULL;
+    c->batchbuf_size = c->batch_len = c->batch_threshold = 0;
+    c->batch_age_us = 0;
+    TimerInit(&c->batch_timer);
 #if defined(MQTT_TASK)
 	  MutexInit(&c->mutex);
 #endif
@@ -108,14 +280,17 @@ exit:
 }
 
 
-static int readPacket(MQTTClient* c, Timer* timer)
+static int readPacket(MQTTClient* c, Timer* timer, int wait_ms)
 {
     MQTTHeader header = {0};
     int len = 0;
     int rem_len = 0;
+    int rc = 0;
+
+    giveBackReadBuffer(c); /* the last packet has been handled */
 
-    /* 1. read the header byte.  This has the packet type in it */
-    int rc = c->ipstack->mqttread(c->ipstack, c->readbuf, 1, TimerLeftMS(timer));
+    /* 1. read the header byte, waiting at most wait_ms for it.  This has the packet type in it */
+    rc = c->ipstack->mqttread(c->ipstack, c->readbuf, 1, wait_ms);
     if (rc != 1)
         goto exit;
 
@@ -124,7 +299,7 @@ static int readPacket(MQTTClient* c, Timer* timer)
     decodePacket(c, &rem_len, TimerLeftMS(timer));
     len += MQTTPacket_encode(c->readbuf + 1, rem_len); /* put the original remaining length back into the buffer */
 
-    if (rem_len > (c->readbuf_size - len))
+    if (rem_len > (c->readbuf_size - len) && borrowReadBuffer(c, len + rem_len, len) != SUCCESS)
     {
         rc = BUFFER_OVERFLOW;
         goto exit;
@@ -148,7 +323,7 @@ exit:
 // assume topic filter and name is in correct format
 // # can only be at end
 // + and # can only be next to separator
-static char isTopicMatched(char* topicFilter, MQTTString* topicName)
+char MQTTIsTopicMatched(char* topicFilter, MQTTString* topicName)
 {
     char* curf = topicFilter;
     char* curn = topicName->lenstring.data;
@@ -176,6 +351,244 @@ static char isTopicMatched(char* topicFilter, MQTTString* topicName)
 }
 
 
+static void dispatchMessage(MQTTClient* c, messageHandler fp, MessageData* md)
+{
+    if (c->dispatcher != NULL)
+        c->dispatcher(c->dispatcher_context, fp, md);
+    else
+        fp(md);
+}
+
+
+void MQTTSetDispatcher(MQTTClient* c, messageDispatcher dispatcher, void* context)
+{
+    c->dispatcher = dispatcher;
+    c->dispatcher_context = context;
+}
+
+
+void MQTTSetFlowControl(MQTTClient* c, flowControl flow, void* context)
+{
+    c->flow = flow;
+    c->flow_context = context;
+}
+
+
+void MQTTSetReadBuffers(MQTTClient* c, readBuffers readbufs, void* context)
+{
+    c->readbufs = readbufs;
+    c->readbufs_context = context;
+}
+
+
+void MQTTSetBufferLender(MQTTClient* c, bufferBorrow borrow, bufferGiveBack giveBack, void* context)
+{
+    giveBackSendBuffer(c);
+    giveBackReadBuffer(c);
+    c->borrow = borrow;
+    c->giveBack = giveBack;
+    c->lender_context = context;
+    c->buf_scratch = c->buf;
+    c->buf_scratch_size = c->buf_size;
+    c->readbuf_scratch = c->readbuf;
+    c->readbuf_scratch_size = c->readbuf_size;
+}
+
+
+/* Move to the buffer the next packet is to be read into.  Returns 0 if there is none free. */
+static int nextReadBuffer(MQTTClient* c, int wait_ms)
+{
+    unsigned char* buf = NULL;
+
+    if (c->readbufs == NULL)
+        return 1;
+    if ((buf = c->readbufs(c->readbufs_context, c->readbuf, wait_ms)) == NULL)
+        return 0;
+    c->readbuf = buf;
+    return 1;
+}
+
+
+void MQTTSetPublishSource(MQTTClient* c, publishSource source, void* context, int poll_ms)
+{
+    c->source = source;
+    c->source_context = context;
+    c->source_poll_ms = poll_ms;
+}
+
+
+/* Write one send buffer of the packets queued with the publish source.  Only one, so that
+ * however long the queue, reads, acks and pings wait for at most one buffer to be written. */
+static int sendQueued(MQTTClient* c)
+{
+    int rc = SUCCESS,
+        len = 0;
+    Timer timer;
+
+    if (c->borrow != NULL)
+    {
+        if (c->source(c->source_context, NULL, 0) == 0)
+            return SUCCESS; /* nothing waiting, so no buffer to borrow */
+        if (borrowSendBuffer(c, 0) != SUCCESS)
+            return SUCCESS; /* none free to fill - try again next cycle */
+    }
+    if ((len = c->source(c->source_context, c->buf, c->buf_size)) > 0)
+    {
+        TimerInit(&timer);
+        TimerCountdownMS(&timer, c->command_timeout_ms);
+        rc = sendPacket(c, len, &timer);
+    }
+    giveBackSendBuffer(c);
+    return rc;
+}
+
+
+int MQTTSetConflation(MQTTClient* c, MQTTConflatedSlot* slots, int count, unsigned char* buf, size_t size)
+{
+    int i;
+
+    if (count <= 0)
+        return FAILURE;
+    for (i = 0; i < count; ++i)
+    {
+        slots[i].buf = buf + i * (size / count);
+        slots[i].buf_size = size / count;
+        slots[i].topiclen = 0;
+        slots[i].skipped = 0;
+        slots[i].pending = 0;
+    }
+    c->conflated = slots;
+    c->conflated_count = count;
+    c->conflate_round = 0;
+    return SUCCESS;
+}
+
+
+/* Deliver the message in a slot, and free the slot for any topic */
+static void deliverSlot(MQTTClient* c, MQTTConflatedSlot* slot)
+{
+    MQTTString topicName = MQTTString_initializer;
+    MessageData md;
+
+    topicName.lenstring.data = (char*)slot->buf;
+    topicName.lenstring.len = slot->topiclen;
+    NewMessageData(&md, &topicName, &slot->message);
+    md.skipped = slot->skipped;
+    slot->pending = 0;
+    slot->skipped = 0;
+    dispatchMessage(c, c->messageHandlers[slot->handler].fp, &md);
+    slot->topiclen = 0;
+}
+
+
+/* Free the slots of a subscription, or of all of them if handler is -1, delivering the
+ * messages pending in them first if deliver is set, or dropping them. */
+static void releaseConflated(MQTTClient* c, int handler, int deliver)
+{
+    int i;
+
+    for (i = 0; i < c->conflated_count; ++i)
+    {
+        MQTTConflatedSlot* slot = &c->conflated[i];
+
+        if (slot->topiclen == 0 || (handler != -1 && slot->handler != handler))
+            continue;
+        if (deliver && slot->pending)
+            deliverSlot(c, slot);
+        slot->topiclen = 0;
+        slot->pending = 0;
+        slot->skipped = 0;
+    }
+    if (handler == -1)
+        c->conflate_round = 0;
+}
+
+
+int MQTTSetConflated(MQTTClient* c, const char* topicFilter, int conflate)
+{
+    int i;
+
+    for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
+    {
+        if (c->messageHandlers[i].topicFilter != NULL && strcmp(c->messageHandlers[i].topicFilter, topicFilter) == 0)
+        {
+            if (!conflate && c->messageHandlers[i].conflate)
+                releaseConflated(c, i, 1);
+            c->messageHandlers[i].conflate = (char)conflate;
+            return SUCCESS;
+        }
+    }
+    return FAILURE;
+}
+
+
+/* Overwrite the slot for this topic and subscription with a message.  Returns FAILURE if there
+ * is no slot for it, or it does not fit, so it must be delivered at once. */
+static int conflateMessage(MQTTClient* c, int handler, MQTTString* topicName, MQTTMessage* message)
+{
+    MQTTConflatedSlot* slot = NULL;
+    int i;
+
+    for (i = 0; i < c->conflated_count; ++i)
+    {
+        MQTTConflatedSlot* s = &c->conflated[i];
+
+        if (s->topiclen == 0)
+        {
+            if (slot == NULL)
+                slot = s; /* the first free, if this topic has none */
+        }
+        else if (s->handler == handler && s->topiclen == topicName->lenstring.len &&
+                memcmp(s->buf, topicName->lenstring.data, s->topiclen) == 0)
+        {
+            slot = s;
+            break;
+        }
+    }
+    if (slot == NULL)
+        return FAILURE;
+    if (topicName->lenstring.len + message->payloadlen > slot->buf_size)
+    {
+        if (slot->pending)
+            deliverSlot(c, slot); /* the older message first, to keep the order on the topic */
+        return FAILURE;
+    }
+
+    if (slot->topiclen == 0)
+    {
+        memcpy(slot->buf, topicName->lenstring.data, topicName->lenstring.len);
+        slot->topiclen = topicName->lenstring.len;
+        slot->handler = handler;
+    }
+    if (slot->pending)
+        slot->skipped++;
+    slot->message = *message;
+    slot->message.payload = slot->buf + slot->topiclen;
+    memcpy(slot->message.payload, message->payload, message->payloadlen);
+    slot->pending = 1;
+    if (!c->conflate_round)
+    {   /* the round ends when reading finds nothing, or this long from now at the latest */
+        c->conflate_round = 1;
+        TimerCountdownMS(&c->conflate_timer, MAX_CONFLATION_ROUND_MS);
+    }
+    return SUCCESS;
+}
+
+
+/* Deliver the latest message in each slot written since the last round */
+static void deliverConflated(MQTTClient* c)
+{
+    int i;
+
+    c->conflate_round = 0;
+    for (i = 0; i < c->conflated_count; ++i)
+    {
+        if (c->conflated[i].pending)
+            deliverSlot(c, &c->conflated[i]);
+    }
+}
+
+
 int deliverMessage(MQTTClient* c, MQTTString* topicName, MQTTMessage* message)
 {
     int i;
@@ -185,13 +598,17 @@ int deliverMessage(MQTTClient* c, MQTTString* topicName, MQTTMessage* message)
     for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
     {
         if (c->messageHandlers[i].topicFilter != 0 && (MQTTPacket_equals(topicName, (char*)c->messageHandlers[i].topicFilter) ||
-                isTopicMatched((char*)c->messageHandlers[i].topicFilter, topicName)))
+                MQTTIsTopicMatched((char*)c->messageHandlers[i].topicFilter, topicName)))
         {
             if (c->messageHandlers[i].fp != NULL)
             {
                 MessageData md;
-                NewMessageData(&md, topicName, message);
-                c->messageHandlers[i].fp(&md);
+                if (!c->messageHandlers[i].conflate ||
+                        conflateMessage(c, i, topicName, message) != SUCCESS)
+                {
+                    NewMessageData(&md, topicName, message);
+                    dispatchMessage(c, c->messageHandlers[i].fp, &md);
+                }
                 rc = SUCCESS;
             }
         }
@@ -201,7 +618,7 @@ int deliverMessage(MQTTClient* c, MQTTString* topicName, MQTTMessage* message)
     {
         MessageData md;
         NewMessageData(&md, topicName, message);
-        c->defaultMessageHandler(&md);
+        dispatchMessage(c, c->defaultMessageHandler, &md);
         rc = SUCCESS;
     }
 
@@ -236,12 +653,35 @@ exit:
 }
 
 
+/* While reads are paused, keep the broker's side of the keepalive going.  No PINGRESP
+ * can be read, so none is waited for. */
+static int pausedKeepalive(MQTTClient* c)
+{
+    int rc = SUCCESS;
+
+    if (c->keepAliveInterval > 0 && TimerIsExpired(&c->last_sent))
+    {
+        Timer timer;
+        TimerInit(&timer);
+        TimerCountdownMS(&timer, 1000);
+        int len = MQTTSerialize_pingreq(c->buf, c->buf_size);
+        if (len > 0)
+            rc = sendPacket(c, len, &timer); // send the ping packet
+    }
+    c->ping_outstanding = 0;
+    return rc;
+}
+
+
 void MQTTCleanSession(MQTTClient* c)
 {
     int i = 0;
 
     for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
         c->messageHandlers[i].topicFilter = NULL;
+#if MQTTCLIENT_QOS2
+    MQTTPacketIdSet_clear(&c->incoming_qos2);
+#endif
 }
 
 
@@ -249,6 +689,10 @@ void MQTTCloseSession(MQTTClient* c)
 {
     c->ping_outstanding = 0;
     c->isconnected = 0;
+    c->batch_len = 0; /* QoS 0 publishes not yet written are lost with the connection */
+    giveBackSendBuffer(c);
+    giveBackReadBuffer(c);
+    releaseConflated(c, -1, 0); /* as are the conflated messages not yet delivered */
     if (c->cleansession)
         MQTTCleanSession(c);
 }
@@ -256,10 +700,47 @@ void MQTTCloseSession(MQTTClient* c)
 
 int cycle(MQTTClient* c, Timer* timer)
 {
-    int len = 0,
-        rc = SUCCESS;
+    int rc = SUCCESS;
+    int packet_type = 0,
+        wait_ms = TimerLeftMS(timer);
 
-    int packet_type = readPacket(c, timer);     /* read the socket, see what work is due */
+    if (c->batch_len > 0)
+    {   /* only take packets which have already arrived, and write the batch once there are none */
+        if (TimerIsExpired(&c->batch_timer))
+            rc = flushBatch(c, timer);
+        else
+            wait_ms = 0;
+    }
+    if (c->source != NULL)
+    {
+        if (rc == SUCCESS && c->isconnected)
+            rc = sendQueued(c); /* while disconnected, publishes stay queued for the next connection */
+        if (wait_ms > c->source_poll_ms)
+            wait_ms = c->source_poll_ms;
+    }
+    if (rc == SUCCESS && ((c->flow != NULL && c->flow(c->flow_context, wait_ms) != 0) || !nextReadBuffer(c, wait_ms)))
+    {   /* reads are paused: leave the data unread, with its acks, so the broker slows down */
+        if ((rc = flushBatch(c, timer)) == SUCCESS)
+            rc = pausedKeepalive(c);
+        if (rc != SUCCESS)
+            rc = FAILURE;
+        goto exit;
+    }
+    if (rc == SUCCESS)
+        packet_type = readPacket(c, timer, wait_ms);     /* read the socket, see what work is due */
+    if (rc == SUCCESS && packet_type == 0)
+    {   /* nothing more has arrived: the end of a round */
+        if (c->conflated_count > 0)
+            deliverConflated(c);
+        rc = flushBatch(c, timer);
+    }
+    else if (rc == SUCCESS && c->conflate_round && TimerIsExpired(&c->conflate_timer))
+        deliverConflated(c); /* data keeps arriving, so don't hold the conflated messages back for ever */
+    if (rc != SUCCESS)
+    {
+        rc = FAILURE;
+        goto exit;
+    }
 
     switch (packet_type)
     {
@@ -284,17 +765,13 @@ int cycle(MQTTClient* c, Timer* timer)
                (unsigned char**)&msg.payload, (int*)&msg.payloadlen, c->readbuf, c->readbuf_size) != 1)
                 goto exit;
             msg.qos = (enum QoS)intQoS;
-            deliverMessage(c, &topicName, &msg);
+#if MQTTCLIENT_QOS2
+            if (msg.qos != QOS2 || MQTTPacketIdSet_add(&c->incoming_qos2, msg.id)) /* not a duplicate */
+#endif
+                deliverMessage(c, &topicName, &msg);
             if (msg.qos != QOS0)
             {
-                if (msg.qos == QOS1)
-                    len = MQTTSerialize_ack(c->buf, c->buf_size, PUBACK, 0, msg.id);
-                else if (msg.qos == QOS2)
-                    len = MQTTSerialize_ack(c->buf, c->buf_size, PUBREC, 0, msg.id);
-                if (len <= 0)
-                    rc = FAILURE;
-                else
-                    rc = sendPacket(c, len, timer);
+                rc = sendAck(c, (msg.qos == QOS1) ? PUBACK : PUBREC, msg.id, timer);
                 if (rc == FAILURE)
                     goto exit; // there was a problem
             }
@@ -307,13 +784,14 @@ int cycle(MQTTClient* c, Timer* timer)
             unsigned char dup, type;
             if (MQTTDeserialize_ack(&type, &dup, &mypacketid, c->readbuf, c->readbuf_size) != 1)
                 rc = FAILURE;
-            else if ((len = MQTTSerialize_ack(c->buf, c->buf_size,
-                (packet_type == PUBREC) ? PUBREL : PUBCOMP, 0, mypacketid)) <= 0)
-                rc = FAILURE;
-            else if ((rc = sendPacket(c, len, timer)) != SUCCESS) // send the PUBREL packet
+            else if ((rc = sendAck(c, (packet_type == PUBREC) ? PUBREL : PUBCOMP, mypacketid, timer)) != SUCCESS)
                 rc = FAILURE; // there was a problem
             if (rc == FAILURE)
                 goto exit; // there was a problem
+#if MQTTCLIENT_QOS2
+            if (packet_type == PUBREL)
+                MQTTPacketIdSet_remove(&c->incoming_qos2, mypacketid);
+#endif
             break;
         }
 
@@ -330,6 +808,8 @@ int cycle(MQTTClient* c, Timer* timer)
     }
 
 exit:
+    if (packet_type == PUBLISH)
+        giveBackReadBuffer(c); /* the message has been handled */
     if (rc == SUCCESS)
         rc = packet_type;
     else if (c->isconnected)
@@ -431,11 +911,17 @@ int MQTTConnectWithResults(MQTTClient* c, MQTTPacket_connectData* options, MQTTC
 
     c->keepAliveInterval = options->keepAliveInterval;
     c->cleansession = options->cleansession;
+#if MQTTCLIENT_QOS2
+    if (c->cleansession) /* a new session, which has no QoS 2 messages in flight */
+        MQTTPacketIdSet_clear(&c->incoming_qos2);
+#endif
     TimerCountdown(&c->last_received, c->keepAliveInterval);
+    sendBufferFor(c, MQTTSerialize_connectLength(options));
     if ((len = MQTTSerialize_connect(c->buf, c->buf_size, options)) <= 0)
         goto exit;
     if ((rc = sendPacket(c, len, &connect_timer)) != SUCCESS)  // send the connect packet
         goto exit; // there was a problem
+    giveBackSendBuffer(c);
 
     // this will be a blocking call, wait for the connack
     if (waitfor(c, CONNACK, &connect_timer) == CONNACK)
@@ -451,6 +937,7 @@ int MQTTConnectWithResults(MQTTClient* c, MQTTPacket_connectData* options, MQTTC
         rc = FAILURE;
 
 exit:
+    giveBackSendBuffer(c);
     if (rc == SUCCESS)
     {
         c->isconnected = 1;
@@ -484,8 +971,10 @@ int MQTTSetMessageHandler(MQTTClient* c, const char* topicFilter, messageHandler
         {
             if (messageHandler == NULL) /* remove existing */
             {
+                releaseConflated(c, i, 0);
                 c->messageHandlers[i].topicFilter = NULL;
                 c->messageHandlers[i].fp = NULL;
+                c->messageHandlers[i].conflate = 0;
             }
             rc = SUCCESS; /* return i when adding new subscription */
             break;
@@ -500,6 +989,7 @@ int MQTTSetMessageHandler(MQTTClient* c, const char* topicFilter, messageHandler
                 if (c->messageHandlers[i].topicFilter == NULL)
                 {
                     rc = SUCCESS;
+                    c->messageHandlers[i].conflate = 0;
                     break;
                 }
             }
@@ -532,11 +1022,13 @@ int MQTTSubscribeWithResults(MQTTClient* c, const char* topicFilter, enum QoS qo
     TimerInit(&timer);
     TimerCountdownMS(&timer, c->command_timeout_ms);
 
+    sendBufferFor(c, MQTTSerialize_subscribeLength(1, &topic));
     len = MQTTSerialize_subscribe(c->buf, c->buf_size, 0, getNextPacketId(c), 1, &topic, (int*)&qos);
     if (len <= 0)
         goto exit;
     if ((rc = sendPacket(c, len, &timer)) != SUCCESS) // send the subscribe packet
         goto exit;             // there was a problem
+    giveBackSendBuffer(c);
 
     if (waitfor(c, SUBACK, &timer) == SUBACK)      // wait for suback
     {
@@ -553,6 +1045,7 @@ int MQTTSubscribeWithResults(MQTTClient* c, const char* topicFilter, enum QoS qo
         rc = FAILURE;
 
 exit:
+    giveBackSendBuffer(c);
     if (rc == FAILURE)
         MQTTCloseSession(c);
 #if defined(MQTT_TASK)
@@ -587,10 +1080,12 @@ int MQTTUnsubscribe(MQTTClient* c, const char* topicFilter)
     TimerInit(&timer);
     TimerCountdownMS(&timer, c->command_timeout_ms);
 
+    sendBufferFor(c, MQTTSerialize_unsubscribeLength(1, &topic));
     if ((len = MQTTSerialize_unsubscribe(c->buf, c->buf_size, 0, getNextPacketId(c), 1, &topic)) <= 0)
         goto exit;
     if ((rc = sendPacket(c, len, &timer)) != SUCCESS) // send the subscribe packet
         goto exit; // there was a problem
+    giveBackSendBuffer(c);
 
     if (waitfor(c, UNSUBACK, &timer) == UNSUBACK)
     {
@@ -605,6 +1100,7 @@ int MQTTUnsubscribe(MQTTClient* c, const char* topicFilter)
         rc = FAILURE;
 
 exit:
+    giveBackSendBuffer(c);
     if (rc == FAILURE)
         MQTTCloseSession(c);
 #if defined(MQTT_TASK)
@@ -633,13 +1129,24 @@ int MQTTPublish(MQTTClient* c, const char* topicName, MQTTMessage* message)
 
     if (message->qos == QOS1 || message->qos == QOS2)
         message->id = getNextPacketId(c);
+    else if (c->batchbuf != NULL)
+    {
+        if (c->batch_len > 0 && TimerIsExpired(&c->batch_timer))
+            rc = flushBatch(c, &timer);
+        else
+            rc = SUCCESS;
+        if (rc != SUCCESS || (rc = batchPublish(c, topic, message, &timer)) != BUFFER_OVERFLOW)
+            goto exit; /* batched, or failed - anything too big for the batch is sent on its own */
+    }
 
+    sendBufferFor(c, MQTTSerialize_publishLength(message->qos, topic, message->payloadlen));
     len = MQTTSerialize_publish(c->buf, c->buf_size, 0, message->qos, message->retained, message->id,
               topic, (unsigned char*)message->payload, message->payloadlen);
     if (len <= 0)
         goto exit;
     if ((rc = sendPacket(c, len, &timer)) != SUCCESS) // send the subscribe packet
         goto exit; // there was a problem
+    giveBackSendBuffer(c); /* the acks fit the scratch area */
 
     if (message->qos == QOS1)
     {
@@ -667,6 +1174,7 @@ int MQTTPublish(MQTTClient* c, const char* topicName, MQTTMessage* message)
     }
 
 exit:
+    giveBackSendBuffer(c);
     if (rc == FAILURE)
         MQTTCloseSession(c);
 #if defined(MQTT_TASK)
@@ -676,6 +1184,141 @@ exit:
 }
 
 
+int MQTTPublishBatch(MQTTClient* c, const char** topicNames, MQTTMessage* messages, int count)
+{
+    int rc = FAILURE;
+    Timer timer;
+    MQTTString topic = MQTTString_initializer;
+    unsigned char* batchbuf = c->batchbuf;
+    size_t batchbuf_size = c->batchbuf_size,
+      batch_threshold = c->batch_threshold;
+    int i, acks = 0;
+
+#if defined(MQTT_TASK)
+	  MutexLock(&c->mutex);
+#endif
+	  if (!c->isconnected)
+		    goto exit;
+
+    TimerInit(&timer);
+    TimerCountdownMS(&timer, c->command_timeout_ms);
+
+    if (c->batchbuf == NULL)
+    {   /* no batch buffer set, so coalesce in the send buffer for the length of this call */
+        borrowSendBuffer(c, 0);
+        c->batchbuf = c->buf;
+        c->batchbuf_size = c->batch_threshold = c->buf_size;
+    }
+
+    for (i = 0; i < count; ++i)
+    {
+        topic.cstring = (char *)topicNames[i];
+        if (messages[i].qos == QOS1 || messages[i].qos == QOS2)
+        {
+            messages[i].id = getNextPacketId(c);
+            ++acks;
+        }
+        rc = batchPublish(c, topic, &messages[i], &timer);
+        if (rc == BUFFER_OVERFLOW && c->batchbuf != c->buf)
+        {   /* too big for the batch buffer, but it may fit the send buffer */
+            int len = 0;
+
+            sendBufferFor(c, MQTTSerialize_publishLength(messages[i].qos, topic, messages[i].payloadlen));
+            len = MQTTSerialize_publish(c->buf, c->buf_size, 0, messages[i].qos, messages[i].retained,
+                      messages[i].id, topic, (unsigned char*)messages[i].payload, messages[i].payloadlen);
+            rc = (len <= 0) ? BUFFER_OVERFLOW : sendPacket(c, len, &timer);
+            giveBackSendBuffer(c);
+        }
+        if (rc != SUCCESS)
+            goto exit;
+    }
+    if ((rc = flushBatch(c, &timer)) != SUCCESS)
+        goto exit;
+    if (c->batchbuf == c->buf)
+    {   /* the send buffer is needed for acks from here on */
+        c->batchbuf = batchbuf;
+        c->batchbuf_size = batchbuf_size;
+        c->batch_threshold = batch_threshold;
+        giveBackSendBuffer(c);
+    }
+
+    /* a PUBACK or PUBCOMP for each message at QoS 1 or 2 */
+    while (acks > 0)
+    {
+        int packet_type = TimerIsExpired(&timer) ? FAILURE : cycle(c, &timer);
+
+        if (packet_type < 0)
+        {
+            rc = FAILURE;
+            break;
+        }
+        if (packet_type == PUBACK || packet_type == PUBCOMP)
+            --acks;
+    }
+
+exit:
+    if (c->batchbuf == c->buf)
+    {
+        c->batchbuf = batchbuf;
+        c->batchbuf_size = batchbuf_size;
+        c->batch_threshold = batch_threshold;
+    }
+    giveBackSendBuffer(c);
+    if (rc == FAILURE)
+        MQTTCloseSession(c);
+#if defined(MQTT_TASK)
+	  MutexUnlock(&c->mutex);
+#endif
+    return rc;
+}
+
+
+int MQTTSetBatching(MQTTClient* c, unsigned char* batchbuf, size_t batchbuf_size,
+    size_t threshold, unsigned int max_age_us)
+{
+    int rc = SUCCESS;
+
+#if defined(MQTT_TASK)
+	  MutexLock(&c->mutex);
+#endif
+    if (c->batch_len > 0)
+    {
+        Timer timer;
+        TimerInit(&timer);
+        TimerCountdownMS(&timer, c->command_timeout_ms);
+        if ((rc = flushBatch(c, &timer)) != SUCCESS)
+            MQTTCloseSession(c);
+    }
+    c->batchbuf = batchbuf;
+    c->batchbuf_size = (batchbuf == NULL) ? 0 : batchbuf_size;
+    c->batch_threshold = (threshold == 0 || threshold > c->batchbuf_size) ? c->batchbuf_size : threshold;
+    c->batch_age_us = max_age_us;
+#if defined(MQTT_TASK)
+	  MutexUnlock(&c->mutex);
+#endif
+    return rc;
+}
+
+
+int MQTTFlush(MQTTClient* c)
+{
+    int rc = SUCCESS;
+    Timer timer;
+
+#if defined(MQTT_TASK)
+	  MutexLock(&c->mutex);
+#endif
+    TimerInit(&timer);
+    TimerCountdownMS(&timer, c->command_timeout_ms);
+    if ((rc = flushBatch(c, &timer)) != SUCCESS)
+        MQTTCloseSession(c);
+#if defined(MQTT_TASK)
+	  MutexUnlock(&c->mutex);
+#endif
+    return rc;
+}
+
+
 int MQTTDisconnect(MQTTClient* c)
 {
     int rc = FAILURE;
@@ -51,6 +51,14 @@
 #define MAX_MESSAGE_HANDLERS 5 /* redefinable - how many subscriptions do you want? */
 #endif
 
+#if !defined(MQTTCLIENT_QOS2)
+#define MQTTCLIENT_QOS2 1 /* redefinable - 0 to leave out the ids of inbound QoS 2 messages, and redeliver their duplicates */
+#endif
+
+#if !defined(MAX_CONFLATION_ROUND_MS)
+#define MAX_CONFLATION_ROUND_MS 100 /* redefinable - longest a conflated message waits while data keeps arriving */
+#endif
+
 enum QoS { QOS0, QOS1, QOS2, SUBFAIL=0x80 };
 
 /* all failure return codes must be negative */
@@ -72,6 +80,9 @@ extern char TimerIsExpired(Timer*);
 extern void TimerCountdownMS(Timer*, unsigned int);
 extern void TimerCountdown(Timer*, unsigned int);
 extern int TimerLeftMS(Timer*);
+/* A platform with a microsecond clock can also define MQTTCLIENT_TIMER_US and provide
+ * void TimerCountdownUS(Timer*, unsigned int), which times the age of batched publishes.
+ * Otherwise that age is rounded up to whole milliseconds. */
 
 typedef struct MQTTMessage
 {
@@ -87,6 +98,7 @@ typedef struct MessageData
 {
     MQTTMessage* message;
     MQTTString* topicName;
+    unsigned int skipped;  /* for a conflated subscription, the older messages this one replaced */
 } MessageData;
 
 typedef struct MQTTConnackData
@@ -102,6 +114,45 @@ typedef struct MQTTSubackData
 
 typedef void (*messageHandler)(MessageData*);
 
+/* Hands a received message to its handler.  Without one, the handler is called at once on
+ * the thread reading the network; a dispatcher can instead queue the message for another
+ * thread, copying what it needs, as md is only valid for the duration of the call. */
+typedef void (*messageDispatcher)(void* context, messageHandler fp, MessageData* md);
+
+/* Receive flow control: returns 0 once the client may read from the network, waiting up to
+ * timeout_ms for that, or nonzero if reads are still paused. */
+typedef int (*flowControl)(void* context, int timeout_ms);
+
+/* Outbound publish source: copies whole packets, already serialized, into buf, and returns
+ * the number of bytes copied, 0 if there are none waiting.  With buf NULL, copies nothing, and
+ * returns nonzero if there may be packets waiting, so a send buffer is only borrowed for them.
+ * Only called by the thread running cycle(), so other threads can queue packets without
+ * taking the client mutex. */
+typedef int (*publishSource)(void* context, unsigned char* buf, int size);
+
+/* Read buffer source: returns the buffer to read the next packet into, of the client's
+ * readbuf_size - current, if nothing received into it is still in use, or another.  Waits up
+ * to timeout_ms for one to be free, then returns NULL if none is, and reads pause. */
+typedef unsigned char* (*readBuffers)(void* context, unsigned char* current, int timeout_ms);
+
+/* Buffer lender: lends a buffer of at least size bytes, or of the largest size it lends if size
+ * is 0, setting lent to its size, or returns NULL if it has none.  Each buffer lent is given back
+ * with giveBack once the packet in it has been sent, or read and handled. */
+typedef unsigned char* (*bufferBorrow)(void* context, size_t size, size_t* lent);
+typedef void (*bufferGiveBack)(void* context, unsigned char* buf);
+
+/* The latest message on one topic for a conflated subscription - see MQTTSetConflation */
+typedef struct MQTTConflatedSlot
+{
+    unsigned char* buf;    /* the topic then the payload */
+    size_t buf_size;
+    int topiclen;          /* 0 while free */
+    MQTTMessage message;
+    int handler;           /* the index in messageHandlers of the subscription it is for */
+    unsigned int skipped;
+    char pending;          /* to be delivered at the end of this round of reading */
+} MQTTConflatedSlot;
+
 typedef struct MQTTClient
 {
     unsigned int next_packetid,
@@ -119,12 +170,43 @@ typedef struct MQTTClient
     {
         const char* topicFilter;
         void (*fp) (MessageData*);
+        char conflate;             /* deliver only the latest message on each topic, once per round */
     } messageHandlers[MAX_MESSAGE_HANDLERS];      /* Message handlers are indexed by subscription topic */
 
     void (*defaultMessageHandler) (MessageData*);
+    messageDispatcher dispatcher;  /* NULL to call handlers on the thread reading the network */
+    void* dispatcher_context;
+    flowControl flow;              /* NULL to always read */
+    void* flow_context;
+    publishSource source;          /* NULL when all publishes are made by MQTTPublish */
+    void* source_context;
+    int source_poll_ms;            /* longest a cycle waits to read before looking at the source again */
+    readBuffers readbufs;          /* NULL to read every packet into readbuf */
+    void* readbufs_context;
+    bufferBorrow borrow;           /* NULL when buf and readbuf hold every packet */
+    bufferGiveBack giveBack;
+    void* lender_context;
+    unsigned char *buf_scratch,    /* the buffers given to MQTTClientInit, while none are lent */
+      *readbuf_scratch;
+    size_t buf_scratch_size,
+      readbuf_scratch_size;
+    MQTTConflatedSlot* conflated;  /* a slot for each topic of the conflated subscriptions */
+    int conflated_count;
+    char conflate_round;           /* a slot is pending, and conflate_timer runs until they are delivered */
+    Timer conflate_timer;
+#if MQTTCLIENT_QOS2
+    MQTTPacketIdSet incoming_qos2; /* ids of QoS 2 messages delivered, and not yet released by a PUBREL */
+#endif
 
     Network* ipstack;
     Timer last_sent, last_received;
+
+    unsigned char* batchbuf;       /* outbound QoS 0 publishes and acks are coalesced here, NULL to send each at once */
+    size_t batchbuf_size,
+      batch_len,                   /* bytes of publishes waiting in batchbuf */
+      batch_threshold;             /* flush once this many bytes are waiting */
+    unsigned int batch_age_us;     /* flush once the oldest waiting publish is this old */
+    Timer batch_timer;
 #if defined(MQTT_TASK)
     Mutex mutex;
     Thread thread;
@@ -167,6 +249,37 @@ DLLExport int MQTTConnect(MQTTClient* client, MQTTPacket_connectData* options);
  */
 DLLExport int MQTTPublish(MQTTClient* client, const char*, MQTTMessage*);
 
+/** MQTT Publish Batch - send a number of publishes with one write where they fit, then wait
+ *  for the acks of those at QoS 1 and 2.  The client is locked once for the whole batch.
+ *  @param client - the client object to use
+ *  @param topicNames - the topic to publish each message to
+ *  @param messages - the messages to send
+ *  @param count - the number of messages
+ *  @return success code
+ */
+DLLExport int MQTTPublishBatch(MQTTClient* client, const char** topicNames, MQTTMessage* messages, int count);
+
+/** MQTT Set Batching - coalesce outbound QoS 0 publishes and acknowledgements.  Rather than
+ *  being written one by one, they are serialized back to back into batchbuf, which is written
+ *  when threshold bytes are waiting, when the oldest has waited max_age_us, on MQTTFlush,
+ *  before any other packet is sent, and when no more incoming packets have already arrived
+ *  - so the acks for a burst of QoS 1 or 2 publishes are written together after it is read.
+ *  @param client - the client object to use
+ *  @param batchbuf - the buffer, or NULL to stop batching after flushing what is waiting
+ *  @param batchbuf_size - the size of batchbuf
+ *  @param threshold - flush once this many bytes are waiting, 0 for the size of batchbuf
+ *  @param max_age_us - flush once the oldest waiting publish is this old
+ *  @return success code
+ */
+DLLExport int MQTTSetBatching(MQTTClient* client, unsigned char* batchbuf, size_t batchbuf_size,
+    size_t threshold, unsigned int max_age_us);
+
+/** MQTT Flush - write any batched publishes now
+ *  @param client - the client object to use
+ *  @return success code
+ */
+DLLExport int MQTTFlush(MQTTClient* client);
+
 /** MQTT SetMessageHandler - set or remove a per topic message handler
  *  @param client - the client object to use
  *  @param topicFilter - the topic filter set the message handler for
@@ -175,6 +288,86 @@ DLLExport int MQTTPublish(MQTTClient* client, const char*, MQTTMessage*);
  */
 DLLExport int MQTTSetMessageHandler(MQTTClient* c, const char* topicFilter, messageHandler messageHandler);
 
+/** MQTT SetDispatcher - hand received messages to a dispatcher, such as a worker pool,
+ *  rather than calling their handlers on the thread reading the network
+ *  @param client - the client object to use
+ *  @param dispatcher - the dispatcher, or NULL to call handlers directly
+ *  @param context - passed to each call of the dispatcher
+ */
+DLLExport void MQTTSetDispatcher(MQTTClient* c, messageDispatcher dispatcher, void* context);
+
+/** MQTT SetFlowControl - pause reading from the network while the application is behind.
+ *  While paused, incoming data stays in the kernel, so TCP flow control slows the broker,
+ *  and the acks for QoS 1 and 2 messages not yet read are withheld, so the broker stops
+ *  sending more.  Pings are still sent, and a missing PINGRESP is not an error until
+ *  reading resumes.  Calls waiting for a response, such as MQTTPublish at QoS 1, wait for
+ *  reading to resume too.
+ *  @param client - the client object to use
+ *  @param flow - the flow control function, or NULL to always read
+ *  @param context - passed to each call of flow
+ */
+DLLExport void MQTTSetFlowControl(MQTTClient* c, flowControl flow, void* context);
+
+/** MQTT SetPublishSource - send packets queued by other threads from the thread which calls
+ *  cycle(), in MQTTYield or MQTTRun.  Each cycle writes at most one send buffer of what the
+ *  source holds before reading, so acks, pings and replies are held up by at most one buffer
+ *  of a backlog.  The source is not called while disconnected, so what it holds waits for
+ *  the next connection.  The send buffer must be large enough for any packet queued.
+ *  @param client - the client object to use
+ *  @param source - the publish source, or NULL for none
+ *  @param context - passed to each call of source
+ *  @param poll_ms - the longest a cycle waits to read before looking at the source again,
+ *                   which bounds how long a queued packet waits when there is nothing to read
+ */
+DLLExport void MQTTSetPublishSource(MQTTClient* c, publishSource source, void* context, int poll_ms);
+
+/** MQTT SetReadBuffers - read each packet into a buffer from a source, rather than always into
+ *  readbuf, so that a handler can keep a message, or pass it to another thread, without copying
+ *  it: the source does not hand the buffer out again until the message is finished with.  While
+ *  no buffer is free, reads pause as for MQTTSetFlowControl.
+ *  @param client - the client object to use
+ *  @param readbufs - the read buffer source, or NULL to read into readbuf
+ *  @param context - passed to each call of readbufs
+ */
+DLLExport void MQTTSetReadBuffers(MQTTClient* c, readBuffers readbufs, void* context);
+
+/** MQTT SetBufferLender - borrow a buffer for each packet too big for the send or read buffer
+ *  given to MQTTClientInit, and give it back once the packet has been sent, or read and handled.
+ *  With a lender shared by many clients, those buffers can be a small scratch area, of at least
+ *  5 bytes, so that idle clients hold no more, and memory follows the traffic in flight rather
+ *  than the number of clients.  A message is only valid until its handler returns, so this is
+ *  not for use with MQTTSetReadBuffers, and a publish source is given a lent buffer to fill.
+ *  @param client - the client object to use
+ *  @param borrow - lends a buffer, or NULL to use only the buffers given to MQTTClientInit
+ *  @param giveBack - takes back a buffer lent
+ *  @param context - passed to each call of borrow and giveBack
+ */
+DLLExport void MQTTSetBufferLender(MQTTClient* c, bufferBorrow borrow, bufferGiveBack giveBack, void* context);
+
+/** MQTT SetConflation - give the client the storage for conflated subscriptions.  A message
+ *  for a conflated subscription overwrites the slot for its topic rather than being delivered
+ *  at once.  When a read finds no more data waiting, or MAX_CONFLATION_ROUND_MS after the first
+ *  was written, each slot written since is delivered once, with the newest message and, in
+ *  skipped, the number it replaced, and the slot is free for another topic.  A message which
+ *  fits no slot is delivered at once, after any older message pending for its topic.  Messages
+ *  pending for a subscription are dropped when it is removed, or the session closes.
+ *  @param client - the client object to use
+ *  @param slots - a slot for each topic written in one round, at most
+ *  @param count - the number of slots, at least 1
+ *  @param buf - shared equally between the slots, to hold a topic and payload each
+ *  @param size - the size of buf
+ *  @return success code
+ */
+DLLExport int MQTTSetConflation(MQTTClient* c, MQTTConflatedSlot* slots, int count, unsigned char* buf, size_t size);
+
+/** MQTT SetConflated - conflate, or stop conflating, the messages of a subscription
+ *  @param client - the client object to use
+ *  @param topicFilter - the topic filter of the subscription, which must have a handler
+ *  @param conflate - 1 to conflate, 0 to deliver every message, after any pending now
+ *  @return success code
+ */
+DLLExport int MQTTSetConflated(MQTTClient* c, const char* topicFilter, int conflate);
+
 /** MQTT Subscribe - send an MQTT subscribe packet and wait for suback before returning.
  *  @param client - the client object to use
  *  @param topicFilter - the topic filter to subscribe to
@@ -218,6 +411,13 @@ DLLExport int MQTTYield(MQTTClient* client, int time);
  */
 DLLExport int MQTTIsConnected(MQTTClient* client);
 
+/** MQTT isTopicMatched
+ *  @param topicFilter - a topic filter, which may have + and # wildcards
+ *  @param topicName - a topic name, with lenstring set
+ *  @return truth value indicating whether the topic name matches the filter
+ */
+DLLExport char MQTTIsTopicMatched(char* topicFilter, MQTTString* topicName);
+
 #if defined(MQTT_TASK)
 /** MQTT start background thread for a client.  After this, MQTTYield should not be called.
 *  @param client - the client object to use
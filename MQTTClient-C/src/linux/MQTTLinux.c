@@ -15,8 +15,13 @@
  *    Ian Craggs - return codes from linux_read
  *******************************************************************************/
 
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* for pthread_setaffinity_np */
+#endif
 #include "MQTTLinux.h"
 
+#include <sched.h>
+
 void TimerInit(Timer* timer)
 {
 	timer->end_time = (struct timeval){0, 0};
@@ -40,6 +45,15 @@ void TimerCountdownMS(Timer* timer, unsigned int timeout)
 }
 
 
+void TimerCountdownUS(Timer* timer, unsigned int timeout)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	struct timeval interval = {timeout / 1000000, timeout % 1000000};
+	timeradd(&now, &interval, &timer->end_time);
+}
+
+
 void TimerCountdown(Timer* timer, unsigned int timeout)
 {
 	struct timeval now;
@@ -59,9 +73,65 @@ int TimerLeftMS(Timer* timer)
 }
 
 
+static long linux_elapsed_us(struct timeval* start)
+{
+	struct timeval now, res;
+	gettimeofday(&now, NULL);
+	timersub(&now, start, &res);
+	return res.tv_sec * 1000000L + res.tv_usec;
+}
+
+
+void linux_connack_received(Network* n)
+{
+	n->timings.connack_us = linux_elapsed_us(&n->connected);
+	timerclear(&n->connected);
+}
+
+
+/* Spin on non-blocking reads for up to spin_us, so that data arriving within the
+ * budget is picked up without the thread being put to sleep and woken again.
+ * Returns the bytes read, or -1 on error.
+ */
+static int linux_spin_read(Network* n, unsigned char* buffer, int len, long spin_us)
+{
+	struct timeval start;
+	int bytes = 0;
+
+	gettimeofday(&start, NULL);
+	do
+	{
+		int rc = recv(n->my_socket, &buffer[bytes], (size_t)(len - bytes), MSG_DONTWAIT);
+		if (rc > 0)
+			bytes += rc;
+		else if (rc == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+			return -1;
+		else
+			sched_yield(); /* lets a peer sharing this core run */
+	} while (bytes < len && linux_elapsed_us(&start) < spin_us);
+	return bytes;
+}
+
+
 int linux_read(Network* n, unsigned char* buffer, int len, int timeout_ms)
 {
 	struct timeval interval = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+	int bytes = 0;
+
+	if (n->latency.spin_us > 0)
+	{
+		long spin_us = n->latency.spin_us;
+		if (timeout_ms > 0 && spin_us > timeout_ms * 1000L)
+			spin_us = timeout_ms * 1000L;
+		if ((bytes = linux_spin_read(n, buffer, len, spin_us)) < 0)
+			return -1;
+		if (bytes == len)
+			goto exit;
+		if (timeout_ms * 1000L <= spin_us)
+			return bytes;  /* the whole timeout has been spent spinning */
+		interval.tv_sec = (timeout_ms * 1000L - spin_us) / 1000000;
+		interval.tv_usec = (timeout_ms * 1000L - spin_us) % 1000000;
+	}
 	if (interval.tv_sec < 0 || (interval.tv_sec == 0 && interval.tv_usec <= 0))
 	{
 		interval.tv_sec = 0;
@@ -70,7 +140,6 @@ int linux_read(Network* n, unsigned char* buffer, int len, int timeout_ms)
 
 	setsockopt(n->my_socket, SOL_SOCKET, SO_RCVTIMEO, (char *)&interval, sizeof(struct timeval));
 
-	int bytes = 0;
 	while (bytes < len)
 	{
 		int rc = recv(n->my_socket, &buffer[bytes], (size_t)(len - bytes), 0);
@@ -88,6 +157,14 @@ int linux_read(Network* n, unsigned char* buffer, int len, int timeout_ms)
 		else
 			bytes += rc;
 	}
+exit:
+	if (bytes > 0 && n->latency.quickack)
+	{
+		int on = 1; /* the kernel clears quickack mode as it sees fit, so keep rearming it */
+		setsockopt(n->my_socket, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+	}
+	if (bytes > 0 && n->connected.tv_sec != 0)
+		linux_connack_received(n);
 	return bytes;
 }
 
@@ -105,65 +182,388 @@ int linux_write(Network* n, unsigned char* buffer, int len, int timeout_ms)
 }
 
 
+void linux_disconnect(Network* n)
+{
+	close(n->my_socket);
+}
+
+
 void NetworkInit(Network* n)
 {
 	signal(SIGPIPE, SIG_IGN);
 	n->my_socket = 0;
 	n->mqttread = linux_read;
 	n->mqttwrite = linux_write;
+	n->disconnect = linux_disconnect;
+	n->tls = NULL;
+	memset(&n->timings, '\0', sizeof(n->timings));
+	timerclear(&n->connected);
+	memset(&n->latency, '\0', sizeof(n->latency));
 }
 
 
-int NetworkConnect(Network* n, char* addr, int port)
+/* Apply the socket options of the low-latency profile.  The TCP options fail on
+ * Unix domain sockets, which have no Nagle or delayed acks to turn off anyway.
+ */
+static int linux_apply_latency(Network* n)
+{
+	int tcp = 0, rc = 0;
+	socklen_t len = sizeof(tcp);
+
+	if (getsockopt(n->my_socket, SOL_SOCKET, SO_DOMAIN, &tcp, &len) != 0)
+		return -1;
+	tcp = (tcp == AF_INET || tcp == AF_INET6);
+	if (tcp && n->latency.nodelay &&
+	    setsockopt(n->my_socket, IPPROTO_TCP, TCP_NODELAY, &n->latency.nodelay, sizeof(int)) != 0)
+		rc = -1;
+	if (tcp && n->latency.quickack &&
+	    setsockopt(n->my_socket, IPPROTO_TCP, TCP_QUICKACK, &n->latency.quickack, sizeof(int)) != 0)
+		rc = -1;
+#if defined(SO_BUSY_POLL)
+	if (n->latency.busy_poll_us > 0 &&
+	    setsockopt(n->my_socket, SOL_SOCKET, SO_BUSY_POLL, &n->latency.busy_poll_us, sizeof(int)) != 0)
+		rc = -1;
+#endif
+	return rc;
+}
+
+
+int NetworkSetLowLatency(Network* n, NetworkLatencyOptions* options)
 {
-	int type = SOCK_STREAM;
-	struct sockaddr_in address;
+	if (options == NULL)
+	{
+		memset(&n->latency, '\0', sizeof(n->latency));
+		return 0;
+	}
+	n->latency = *options;
+	return (n->my_socket > 0) ? linux_apply_latency(n) : 0;
+}
+
+
+int NetworkPinThread(int cpu)
+{
+	cpu_set_t cpus;
+
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0 ? 0 : -1;
+}
+
+
+static int linux_connect_unix(Network* n, const char* path)
+{
+	struct sockaddr_un address;
 	int rc = -1;
-	sa_family_t family = AF_INET;
-	struct addrinfo *result = NULL;
+
+	if (strlen(path) >= sizeof(address.sun_path))
+		goto exit;
+	memset(&address, '\0', sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+
+	n->my_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (n->my_socket != -1)
+		rc = connect(n->my_socket, (struct sockaddr*)&address, sizeof(address));
+exit:
+	return rc;
+}
+
+
+/* Resolved addresses are cached per hostname so that reconnects skip DNS.
+ * Addresses are kept in the RFC 8305 order in which connections are attempted:
+ * families interleaved, IPv6 first, with the address that last connected moved
+ * to the front.
+ */
+typedef struct
+{
+	char host[NI_MAXHOST];
+	struct sockaddr_storage addresses[MAX_DNS_ADDRESSES];
+	socklen_t addrlens[MAX_DNS_ADDRESSES];
+	int count;
+	struct timeval expires;
+} DNSCacheEntry;
+
+static DNSCacheEntry dns_cache[MAX_DNS_CACHE_ENTRIES];
+static unsigned int dns_cache_ttl = DNS_CACHE_TTL;
+static pthread_mutex_t dns_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+void NetworkSetDNSCacheTTL(unsigned int seconds)
+{
+	dns_cache_ttl = seconds;
+}
+
+
+void NetworkClearDNSCache(void)
+{
+	pthread_mutex_lock(&dns_cache_mutex);
+	memset(dns_cache, '\0', sizeof(dns_cache));
+	pthread_mutex_unlock(&dns_cache_mutex);
+}
+
+
+static DNSCacheEntry* linux_dns_find(const char* host)
+{
+	struct timeval now;
+	int i;
+
+	gettimeofday(&now, NULL);
+	for (i = 0; i < MAX_DNS_CACHE_ENTRIES; ++i)
+	{
+		if (dns_cache[i].count > 0 && timercmp(&now, &dns_cache[i].expires, <) &&
+		    strcmp(dns_cache[i].host, host) == 0)
+			return &dns_cache[i];
+	}
+	return NULL;
+}
+
+
+static int linux_resolve(const char* host, DNSCacheEntry* entry, long* resolve_us)
+{
 	struct addrinfo hints = {0, AF_UNSPEC, SOCK_STREAM, IPPROTO_TCP, 0, NULL, NULL, NULL};
+	struct addrinfo *result = NULL, *res = NULL;
+	struct addrinfo* byfamily[2][MAX_DNS_ADDRESSES];
+	int counts[2] = {0, 0};
+	struct timeval start;
+	DNSCacheEntry* cached = NULL;
+	int i, rc = -1;
+
+	*resolve_us = 0;
+	pthread_mutex_lock(&dns_cache_mutex);
+	if (dns_cache_ttl > 0 && (cached = linux_dns_find(host)) != NULL)
+		*entry = *cached;
+	pthread_mutex_unlock(&dns_cache_mutex);
+	if (cached)
+		return 0;
+
+	gettimeofday(&start, NULL);
+	if (getaddrinfo(host, NULL, &hints, &result) != 0)
+		goto exit;
+	*resolve_us = linux_elapsed_us(&start);
 
-	if ((rc = getaddrinfo(addr, NULL, &hints, &result)) == 0)
+	for (res = result; res; res = res->ai_next)
 	{
-		struct addrinfo* res = result;
+		int family = (res->ai_family == AF_INET6) ? 0 : (res->ai_family == AF_INET) ? 1 : -1;
+		if (family >= 0 && counts[family] < MAX_DNS_ADDRESSES)
+			byfamily[family][counts[family]++] = res;
+	}
+
+	memset(entry, '\0', sizeof(DNSCacheEntry));
+	strncpy(entry->host, host, sizeof(entry->host) - 1);
+	for (i = 0; entry->count < MAX_DNS_ADDRESSES && (i < counts[0] || i < counts[1]); ++i)
+	{
+		int family;
+		for (family = 0; family < 2 && entry->count < MAX_DNS_ADDRESSES; ++family)
+		{
+			if (i < counts[family])
+			{
+				memcpy(&entry->addresses[entry->count], byfamily[family][i]->ai_addr, byfamily[family][i]->ai_addrlen);
+				entry->addrlens[entry->count++] = byfamily[family][i]->ai_addrlen;
+			}
+		}
+	}
+	freeaddrinfo(result);
+	if (entry->count == 0)
+		goto exit;
+	rc = 0;
+
+	if (dns_cache_ttl > 0)
+	{
+		struct timeval ttl = {dns_cache_ttl, 0};
+		DNSCacheEntry* slot = &dns_cache[0];
+
+		gettimeofday(&start, NULL);
+		timeradd(&start, &ttl, &entry->expires);
+		pthread_mutex_lock(&dns_cache_mutex);
+		for (i = 0; i < MAX_DNS_CACHE_ENTRIES; ++i)
+		{
+			if (strcmp(dns_cache[i].host, host) == 0 || dns_cache[i].count == 0)
+			{
+				slot = &dns_cache[i];
+				break;
+			}
+			if (timercmp(&dns_cache[i].expires, &slot->expires, <))
+				slot = &dns_cache[i]; /* otherwise replace the entry closest to expiry */
+		}
+		*slot = *entry;
+		pthread_mutex_unlock(&dns_cache_mutex);
+	}
+exit:
+	return rc;
+}
+
+
+/* move the address which has just connected to the front of the cached list */
+/* the same host address, whatever the port - the cache holds addresses without one */
+static int linux_same_address(struct sockaddr_storage* a, struct sockaddr_storage* b)
+{
+	if (a->ss_family != b->ss_family)
+		return 0;
+	if (a->ss_family == AF_INET6)
+		return memcmp(&((struct sockaddr_in6*)a)->sin6_addr, &((struct sockaddr_in6*)b)->sin6_addr,
+			sizeof(struct in6_addr)) == 0;
+	return memcmp(&((struct sockaddr_in*)a)->sin_addr, &((struct sockaddr_in*)b)->sin_addr,
+		sizeof(struct in_addr)) == 0;
+}
+
 
-		/* prefer ip4 addresses */
-		while (res)
+static void linux_dns_prefer(const char* host, struct sockaddr_storage* address)
+{
+	DNSCacheEntry* entry = NULL;
+	int i;
+
+	pthread_mutex_lock(&dns_cache_mutex);
+	if ((entry = linux_dns_find(host)) != NULL)
+	{
+		for (i = 1; i < entry->count; ++i)
 		{
-			if (res->ai_family == AF_INET)
+			if (linux_same_address(&entry->addresses[i], address))
 			{
-				result = res;
+				struct sockaddr_storage preferred = entry->addresses[i];
+				socklen_t preferred_len = entry->addrlens[i];
+
+				memmove(&entry->addresses[1], &entry->addresses[0], i * sizeof(entry->addresses[0]));
+				memmove(&entry->addrlens[1], &entry->addrlens[0], i * sizeof(entry->addrlens[0]));
+				entry->addresses[0] = preferred;
+				entry->addrlens[0] = preferred_len;
 				break;
 			}
-			res = res->ai_next;
 		}
+	}
+	pthread_mutex_unlock(&dns_cache_mutex);
+}
+
+
+/* Race non-blocking connects to the candidate addresses (RFC 8305), starting the
+ * next attempt when the previous one fails or CONNECTION_ATTEMPT_DELAY_MS passes.
+ * Returns the index of the address connected to, or -1.
+ */
+static int linux_connect_race(Network* n, DNSCacheEntry* entry, int port, int timeout_ms)
+{
+	struct pollfd fds[MAX_DNS_ADDRESSES];
+	int which[MAX_DNS_ADDRESSES];
+	Timer timer, attempt_timer;
+	int next = 0, pending = 0, winner = -1;
+	int i;
+
+	TimerInit(&timer);
+	TimerInit(&attempt_timer);
+	TimerCountdownMS(&timer, timeout_ms);
 
-		if (result->ai_family == AF_INET)
+	while (winner < 0 && (next < entry->count || pending > 0) && !TimerIsExpired(&timer))
+	{
+		if (next < entry->count && (pending == 0 || TimerIsExpired(&attempt_timer)))
 		{
-			address.sin_port = htons(port);
-			address.sin_family = family = AF_INET;
-			address.sin_addr = ((struct sockaddr_in*)(result->ai_addr))->sin_addr;
+			struct sockaddr_storage* address = &entry->addresses[next];
+			int s = socket(address->ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+			if (address->ss_family == AF_INET6)
+				((struct sockaddr_in6*)address)->sin6_port = htons(port);
+			else
+				((struct sockaddr_in*)address)->sin_port = htons(port);
+			if (s != -1)
+			{
+				if (connect(s, (struct sockaddr*)address, entry->addrlens[next]) == 0)
+				{
+					fds[pending].fd = s;
+					which[pending++] = next;
+					winner = pending - 1;
+				}
+				else if (errno == EINPROGRESS)
+				{
+					fds[pending].fd = s;
+					fds[pending].events = POLLOUT;
+					which[pending++] = next;
+				}
+				else
+					close(s);
+			}
+			++next;
+			TimerCountdownMS(&attempt_timer, CONNECTION_ATTEMPT_DELAY_MS);
+			continue;
 		}
-		else
-			rc = -1;
 
-		freeaddrinfo(result);
+		int wait_ms = TimerLeftMS(&timer);
+		if (next < entry->count && TimerLeftMS(&attempt_timer) < wait_ms)
+			wait_ms = TimerLeftMS(&attempt_timer);
+		if (poll(fds, pending, wait_ms) <= 0)
+			continue;
+		for (i = pending - 1; i >= 0; --i)
+		{
+			int error = 0;
+			socklen_t len = sizeof(error);
+
+			if (fds[i].revents == 0)
+				continue;
+			if (getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0)
+			{
+				winner = i;
+				break;
+			}
+			close(fds[i].fd); /* this attempt failed - so the next can start straight away */
+			fds[i] = fds[--pending];
+			which[i] = which[pending];
+			TimerInit(&attempt_timer);
+		}
 	}
 
-	if (rc == 0)
+	for (i = 0; i < pending; ++i)
 	{
-		n->my_socket = socket(family, type, 0);
-		if (n->my_socket != -1)
-			rc = connect(n->my_socket, (struct sockaddr*)&address, sizeof(address));
-		else
-			rc = -1;
+		if (i != winner)
+			close(fds[i].fd);
 	}
+	if (winner < 0)
+		return -1;
+	n->my_socket = fds[winner].fd;
+	fcntl(n->my_socket, F_SETFL, fcntl(n->my_socket, F_GETFL) & ~O_NONBLOCK);
+	return which[winner];
+}
+
 
+int NetworkConnectTimeout(Network* n, char* addr, int port, int timeout_ms)
+{
+	DNSCacheEntry entry;
+	struct timeval start;
+	int rc = -1, index = 0;
+
+	memset(&n->timings, '\0', sizeof(n->timings));
+	timerclear(&n->connected);
+
+	/* the transport can be selected by URI: unix:///path/to/socket or tcp://host */
+	if (strncmp(addr, UNIX_URI_PREFIX, strlen(UNIX_URI_PREFIX)) == 0)
+	{
+		gettimeofday(&start, NULL);
+		if (linux_connect_unix(n, addr + strlen(UNIX_URI_PREFIX)) != 0)
+			goto exit;
+	}
+	else
+	{
+		if (strncmp(addr, TCP_URI_PREFIX, strlen(TCP_URI_PREFIX)) == 0)
+			addr += strlen(TCP_URI_PREFIX);
+		if (linux_resolve(addr, &entry, &n->timings.resolve_us) != 0)
+			goto exit;
+		gettimeofday(&start, NULL);
+		if ((index = linux_connect_race(n, &entry, port, timeout_ms)) < 0)
+			goto exit;
+		if (index > 0)
+			linux_dns_prefer(addr, &entry.addresses[index]);
+	}
+	n->timings.connect_us = linux_elapsed_us(&start);
+	gettimeofday(&n->connected, NULL);
+	linux_apply_latency(n); /* best effort - SO_BUSY_POLL may need privileges */
+	rc = 0;
+exit:
 	return rc;
 }
 
 
+int NetworkConnect(Network* n, char* addr, int port)
+{
+	return NetworkConnectTimeout(n, addr, port, NETWORK_CONNECT_TIMEOUT_MS);
+}
+
+
 void NetworkDisconnect(Network* n)
 {
-	close(n->my_socket);
+	n->disconnect(n);
 }
@@ -30,9 +30,12 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/param.h>
 #include <sys/time.h>
 #include <sys/select.h>
+#include <poll.h>
+#include <pthread.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
@@ -56,19 +59,95 @@ char TimerIsExpired(Timer*);
 void TimerCountdownMS(Timer*, unsigned int);
 void TimerCountdown(Timer*, unsigned int);
 int TimerLeftMS(Timer*);
+#define MQTTCLIENT_TIMER_US 1 /* TimerCountdownUS is provided */
+void TimerCountdownUS(Timer*, unsigned int);
+
+#if !defined(NETWORK_CONNECT_TIMEOUT_MS)
+#define NETWORK_CONNECT_TIMEOUT_MS 10000 /* redefinable - default limit on NetworkConnect */
+#endif
+#if !defined(CONNECTION_ATTEMPT_DELAY_MS)
+#define CONNECTION_ATTEMPT_DELAY_MS 250 /* RFC 8305 - time before racing the next address */
+#endif
+#if !defined(DNS_CACHE_TTL)
+#define DNS_CACHE_TTL 60 /* redefinable - seconds resolved addresses are reused for */
+#endif
+#if !defined(MAX_DNS_CACHE_ENTRIES)
+#define MAX_DNS_CACHE_ENTRIES 8 /* redefinable - how many hostnames are cached */
+#endif
+#define MAX_DNS_ADDRESSES 8  /* candidate addresses kept per hostname */
+
+/* Low-latency socket profile, for traffic where jitter matters more than CPU */
+typedef struct NetworkLatencyOptions
+{
+	int spin_us;       /* budget for spinning on non-blocking recv before blocking, 0 to block at once */
+	int busy_poll_us;  /* SO_BUSY_POLL - how long the kernel polls the device queue, 0 to leave unset */
+	int nodelay;       /* TCP_NODELAY - send small packets without waiting to coalesce them */
+	int quickack;      /* TCP_QUICKACK, rearmed after every read - no delayed acks */
+} NetworkLatencyOptions;
+
+#define NetworkLatencyOptions_initializer { 50, 50, 1, 1 }
+
+/* Durations of the phases of the last connect, in microseconds */
+typedef struct NetworkTimings
+{
+	long resolve_us;   /* name resolution, 0 when answered from the DNS cache */
+	long connect_us;   /* TCP connect, including racing the candidate addresses */
+	long connack_us;   /* from TCP connect to the first byte received - the CONNACK */
+} NetworkTimings;
 
 typedef struct Network
 {
 	int my_socket;
 	int (*mqttread) (struct Network*, unsigned char*, int, int);
 	int (*mqttwrite) (struct Network*, unsigned char*, int, int);
+	void (*disconnect) (struct Network*);
+	struct NetworkTLS* tls; /* TLS session state, NULL for plain TCP - see MQTTLinuxTLS.h */
+	NetworkTimings timings;
+	struct timeval connected;
+	NetworkLatencyOptions latency; /* all 0 for the default profile */
 } Network;
 
+#define UNIX_URI_PREFIX "unix://"
+#define TCP_URI_PREFIX "tcp://"
+
 int linux_read(Network*, unsigned char*, int, int);
 int linux_write(Network*, unsigned char*, int, int);
+void linux_disconnect(Network*);
+void linux_connack_received(Network*);
 
 DLLExport void NetworkInit(Network*);
+/** Connect a network object to an endpoint
+ *  @param addr - a hostname, tcp://hostname, or unix:///path/to/socket for a
+ *                Unix domain stream socket (a broker on the same host)
+ *  @param port - the TCP port, ignored for Unix domain sockets
+ *  @return 0 on success
+ */
 DLLExport int NetworkConnect(Network*, char*, int);
+
+/** Connect a network object to an endpoint, as NetworkConnect.  IPv6 and IPv4
+ *  addresses of the host are raced (RFC 8305 Happy Eyeballs) and the fastest to
+ *  connect is used.  Phase durations are left in the timings field.
+ *  @param timeout_ms - limit on the time to connect, excluding name resolution
+ *  @return 0 on success
+ */
+DLLExport int NetworkConnectTimeout(Network*, char*, int, int);
 DLLExport void NetworkDisconnect(Network*);
 
+/** Select the low-latency socket profile for a network, applied to the current
+ *  connection and to those made later by NetworkConnect.
+ *  @param options - the profile, or NULL to return to the default profile for later connections
+ *  @return 0 on success, -1 if an option could not be applied to the current connection
+ */
+DLLExport int NetworkSetLowLatency(Network*, NetworkLatencyOptions*);
+
+/** Pin the calling thread, normally the one calling MQTTYield, to a CPU core
+ *  @param cpu - the core number
+ *  @return 0 on success
+ */
+DLLExport int NetworkPinThread(int cpu);
+
+/** Set how long resolved addresses are cached for, 0 to disable the cache */
+DLLExport void NetworkSetDNSCacheTTL(unsigned int seconds);
+DLLExport void NetworkClearDNSCache(void);
+
 #endif
@@ -0,0 +1,167 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial read buffer pool
+ *******************************************************************************/
+
+#include "MQTTLinuxBufferPool.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+
+/* The buffer holding ptr, or NULL if it is not in the pool */
+static PooledBuffer* pool_find(BufferPool* pool, void* ptr)
+{
+	unsigned char* p = (unsigned char*)ptr;
+
+	if (p < pool->memory || p >= pool->memory + pool->count * pool->buffer_size)
+		return NULL;
+	return &pool->buffers[(p - pool->memory) / pool->buffer_size];
+}
+
+
+static void pool_push(BufferPool* pool, PooledBuffer* b)
+{
+	PooledBuffer* head = atomic_load_explicit(&pool->free, memory_order_relaxed);
+
+	do
+		b->next = head;
+	while (!atomic_compare_exchange_weak(&pool->free, &head, b)); /* seq_cst, against waiting */
+	if (atomic_load(&pool->waiting))
+	{
+		pthread_mutex_lock(&pool->mutex);
+		pthread_cond_signal(&pool->cond);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+}
+
+
+/* Only the client's thread pops, so a popped buffer cannot be pushed back between reading
+ * head->next and the compare and swap - there is no ABA */
+static PooledBuffer* pool_pop(BufferPool* pool)
+{
+	PooledBuffer* head = atomic_load(&pool->free);
+
+	while (head && !atomic_compare_exchange_weak_explicit(&pool->free, &head, head->next,
+	        memory_order_acquire, memory_order_acquire))
+		;
+	return head;
+}
+
+
+static void pool_unref(BufferPool* pool, PooledBuffer* b)
+{
+	if (atomic_fetch_sub_explicit(&b->refs, 1, memory_order_acq_rel) == 1)
+		pool_push(pool, b);
+}
+
+
+int BufferPoolInit(BufferPool* pool, int count, size_t buffer_size)
+{
+	int i;
+
+	pool->count = count;
+	pool->buffer_size = buffer_size;
+	pool->buffers = malloc(count * sizeof(PooledBuffer));
+	pool->memory = malloc(count * buffer_size);
+	if (pool->buffers == NULL || pool->memory == NULL)
+	{
+		free(pool->buffers);
+		free(pool->memory);
+		return -1;
+	}
+	atomic_init(&pool->free, NULL);
+	atomic_init(&pool->waiting, 0);
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	for (i = count - 1; i >= 0; --i)
+	{
+		PooledBuffer* b = &pool->buffers[i];
+
+		atomic_init(&b->refs, 0);
+		b->data = pool->memory + i * buffer_size;
+		b->next = atomic_load(&pool->free);
+		atomic_store(&pool->free, b);
+	}
+	return 0;
+}
+
+
+unsigned char* BufferPoolReadBuffer(void* context, unsigned char* current, int timeout_ms)
+{
+	BufferPool* pool = (BufferPool*)context;
+	PooledBuffer* b = pool_find(pool, current);
+	PooledBuffer* next = NULL;
+
+	if (b && atomic_load_explicit(&b->refs, memory_order_acquire) == 1)
+		return current; /* no loans on it, so it can be read into again */
+
+	if ((next = pool_pop(pool)) == NULL && timeout_ms > 0)
+	{
+		struct timespec until;
+
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_sec += timeout_ms / 1000;
+		until.tv_nsec += (timeout_ms % 1000) * 1000000L;
+		if (until.tv_nsec >= 1000000000L)
+		{
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000L;
+		}
+		pthread_mutex_lock(&pool->mutex);
+		atomic_store(&pool->waiting, 1);
+		while ((next = pool_pop(pool)) == NULL)
+		{
+			if (pthread_cond_timedwait(&pool->cond, &pool->mutex, &until) != 0)
+				break;
+		}
+		atomic_store(&pool->waiting, 0);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+	if (next == NULL)
+		return NULL; /* all on loan - keep the current one until one comes back */
+
+	atomic_store_explicit(&next->refs, 1, memory_order_relaxed);
+	if (b)
+		pool_unref(pool, b); /* the loans on it keep it until they are released */
+	return next->data;
+}
+
+
+PooledBuffer* BufferPoolRetain(BufferPool* pool, MessageData* md)
+{
+	PooledBuffer* b = pool_find(pool, md->topicName->lenstring.data);
+
+	if (b)
+		atomic_fetch_add_explicit(&b->refs, 1, memory_order_relaxed);
+	return b;
+}
+
+
+void BufferPoolRelease(BufferPool* pool, PooledBuffer* loan)
+{
+	if (loan)
+		pool_unref(pool, loan);
+}
+
+
+void BufferPoolDestroy(BufferPool* pool)
+{
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->buffers);
+	free(pool->memory);
+	pool->buffers = NULL;
+	pool->memory = NULL;
+}
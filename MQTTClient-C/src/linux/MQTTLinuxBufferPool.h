@@ -0,0 +1,82 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial read buffer pool
+ *******************************************************************************/
+
+#if !defined(__MQTT_LINUX_BUFFER_POOL_)
+#define __MQTT_LINUX_BUFFER_POOL_
+
+/* A pool of read buffers, so that a received message can be kept without copying.
+ * The client reads each packet into a pooled buffer; a handler which wants the
+ * message after it returns takes a loan on that buffer, and the buffer is not read
+ * into again until every loan on it has been released, from any thread.
+ *
+ *   BufferPool pool;
+ *   BufferPoolInit(&pool, 8, sizeof(readbuf));
+ *   MQTTSetReadBuffers(&client, BufferPoolReadBuffer, &pool);
+ *
+ *   void messageArrived(MessageData* md)
+ *   {
+ *       PooledBuffer* loan = BufferPoolRetain(&pool, md);
+ *       ... md->message->payload and md->topicName stay valid until
+ *       BufferPoolRelease(&pool, loan);
+ *   }
+ */
+
+#include "MQTTClient.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+typedef struct PooledBuffer
+{
+	atomic_int refs;       /* one for the client while it reads into it, and one for each loan */
+	struct PooledBuffer* next; /* in the free list */
+	unsigned char* data;
+} PooledBuffer;
+
+typedef struct BufferPool
+{
+	PooledBuffer* buffers;
+	unsigned char* memory;
+	size_t buffer_size;
+	int count;
+	_Atomic(PooledBuffer*) free; /* a stack, pushed by any thread and popped only by the client's */
+	atomic_int waiting;    /* the client is waiting for a buffer to be released */
+	pthread_mutex_t mutex; /* only for waiting */
+	pthread_cond_t cond;
+} BufferPool;
+
+/** Allocate the buffers of a pool
+ *  @param count - the number of buffers: one is read into while the others are on loan
+ *  @param buffer_size - the size of each, which must be the client's readbuf_size
+ *  @return 0 on success
+ */
+DLLExport int BufferPoolInit(BufferPool*, int count, size_t buffer_size);
+
+/** The readBuffers to pass to MQTTSetReadBuffers, with the pool as its context */
+DLLExport unsigned char* BufferPoolReadBuffer(void* pool, unsigned char* current, int timeout_ms);
+
+/** Take a loan on the buffer a message was received into, from its handler
+ *  @return the loan, to release, or NULL if the message is not in a buffer of this pool
+ */
+DLLExport PooledBuffer* BufferPoolRetain(BufferPool*, MessageData* md);
+
+/** Release a loan, from any thread.  The message must not be used after. */
+DLLExport void BufferPoolRelease(BufferPool*, PooledBuffer* loan);
+
+/** Free the buffers.  No loans may be outstanding, and the client must not read into them again. */
+DLLExport void BufferPoolDestroy(BufferPool*);
+
+#endif
@@ -0,0 +1,468 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial publish queue
+ *******************************************************************************/
+
+#include "MQTTLinuxPublishQueue.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SLOT_MASK (PUBLISH_QUEUE_SIZE - 1)
+#define CONFLATED_MASK (CONFLATED_TOPICS - 1)
+
+
+static void lane_free(PublishLane* lane)
+{
+	if (lane->conflated)
+		pthread_mutex_destroy(&lane->conflated->mutex);
+	if (lane->slots)
+		pthread_mutex_destroy(&lane->trim);
+	free(lane->conflated);
+	free(lane->slots);
+	lane->conflated = NULL;
+	lane->slots = NULL;
+}
+
+
+int PublishQueueInit(PublishQueue* q, PublishQueueOptions* options)
+{
+	PublishQueueOptions default_options = PublishQueueOptions_initializer;
+	unsigned int i;
+	int l;
+
+	if (options == NULL)
+		options = &default_options;
+	q->options = *options;
+	if (q->options.default_lane < 0 || q->options.default_lane >= PUBLISH_QUEUE_LANES)
+		q->options.default_lane = PUBLISH_QUEUE_LANES - 1;
+	memset(q->topic_lanes, '\0', sizeof(q->topic_lanes));
+	q->turn = q->credited = 0;
+	q->dropped = q->expired = q->conflated = 0;
+	atomic_init(&q->refused, 0);
+	atomic_init(&q->trimmed, 0);
+	for (l = 0; l < PUBLISH_QUEUE_LANES; ++l)
+	{
+		PublishLane* lane = &q->lanes[l];
+
+		lane->slots = NULL;
+		lane->conflated = NULL;
+		if (q->options.conflate[l])
+			lane->conflated = calloc(1, sizeof(ConflatedTopics));
+		else
+			lane->slots = malloc(PUBLISH_QUEUE_SIZE * sizeof(PublishSlot));
+		if (lane->slots == NULL && lane->conflated == NULL)
+		{
+			while (--l >= 0)
+				lane_free(&q->lanes[l]);
+			return -1;
+		}
+		if (lane->conflated)
+			pthread_mutex_init(&lane->conflated->mutex, NULL);
+		else
+			pthread_mutex_init(&lane->trim, NULL);
+		for (i = 0; lane->slots && i < PUBLISH_QUEUE_SIZE; ++i)
+			atomic_init(&lane->slots[i].sequence, i);
+		atomic_init(&lane->enqueue_pos, 0);
+		atomic_init(&lane->dequeue_pos, 0);
+		lane->deficit = 0;
+		if (q->options.weights[l] < 1)
+			q->options.weights[l] = 1;
+		if (q->options.limits[l] == 0 || q->options.limits[l] > PUBLISH_QUEUE_SIZE)
+			q->options.limits[l] = PUBLISH_QUEUE_SIZE;
+	}
+	return 0;
+}
+
+
+int PublishQueueSetTopicLane(PublishQueue* q, const char* topicFilter, int lane)
+{
+	int i;
+
+	if (lane < 0 || lane >= PUBLISH_QUEUE_LANES)
+		return FAILURE;
+	for (i = 0; i < MAX_TOPIC_LANES; ++i)
+	{
+		if (q->topic_lanes[i].topicFilter == NULL || strcmp(q->topic_lanes[i].topicFilter, topicFilter) == 0)
+		{
+			q->topic_lanes[i].topicFilter = topicFilter;
+			q->topic_lanes[i].lane = lane;
+			return SUCCESS;
+		}
+	}
+	return FAILURE;
+}
+
+
+int PublishQueuePublish(PublishQueue* q, const char* topicName, MQTTMessage* message)
+{
+	MQTTString topic = MQTTString_initializer;
+	int i;
+
+	topic.lenstring.data = (char*)topicName;
+	topic.lenstring.len = strlen(topicName);
+	for (i = 0; i < MAX_TOPIC_LANES && q->topic_lanes[i].topicFilter != NULL; ++i)
+	{
+		if (MQTTIsTopicMatched((char*)q->topic_lanes[i].topicFilter, &topic))
+			return PublishQueuePublishLane(q, q->topic_lanes[i].lane, topicName, message);
+	}
+	return PublishQueuePublishLane(q, q->options.default_lane, topicName, message);
+}
+
+
+int PublishQueuePublishLane(PublishQueue* q, int l, const char* topicName, MQTTMessage* message)
+{
+	if (l < 0 || l >= PUBLISH_QUEUE_LANES)
+		return FAILURE;
+	return PublishQueuePublishExpiring(q, l, topicName, message, q->options.expiry_ms[l]);
+}
+
+
+/* FNV-1a, to spread topics over a conflating lane */
+static unsigned int topic_hash(const char* topic, size_t len)
+{
+	unsigned int hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+		hash = (hash ^ (unsigned char)topic[i]) * 16777619u;
+	return hash;
+}
+
+
+/* Put a publish in the slot for its topic, replacing any there still waiting to be sent */
+static int conflate_publish(PublishQueue* q, ConflatedTopics* c, MQTTString topic, MQTTMessage* message,
+		unsigned int expiry_ms)
+{
+	int topic_len = strlen(topic.cstring),
+	    rem_len = 2 + topic_len + message->payloadlen,
+	    found = -1,
+	    unused = -1,
+	    rc = FAILURE;
+	unsigned int hash = topic_hash(topic.cstring, topic_len), i;
+
+	pthread_mutex_lock(&c->mutex);
+	for (i = 0; i < CONFLATED_TOPICS; ++i)
+	{
+		unsigned int index = (hash + i) & CONFLATED_MASK;
+		ConflatedSlot* slot = &c->slots[index];
+
+		if (slot->len <= 0)
+		{
+			if (unused == -1)
+				unused = index; /* the first free, if this topic has no slot further on */
+			if (slot->len == 0)
+				break; /* a freed slot doesn't end the search, one never used does */
+		}
+		else if (slot->topic_len == topic_len && memcmp(&slot->packet[slot->topic_offset], topic.cstring, topic_len) == 0)
+		{
+			found = index;
+			break;
+		}
+	}
+	if (found == -1 && (found = unused) == -1)
+		++q->refused; /* more topics waiting than CONFLATED_TOPICS */
+	else
+	{
+		ConflatedSlot* slot = &c->slots[found];
+
+		if (slot->pending)
+			q->conflated++;
+		else
+		{
+			slot->pending = 1;
+			c->order[c->head++ & CONFLATED_MASK] = found;
+		}
+		slot->len = MQTTSerialize_publish(slot->packet, PUBLISH_QUEUE_SLOT_SIZE, 0, QOS0, message->retained, 0,
+		    topic, (unsigned char*)message->payload, message->payloadlen);
+		slot->topic_offset = MQTTPacket_len(rem_len) - rem_len + 2;
+		slot->topic_len = topic_len;
+		if ((slot->expires = (expiry_ms > 0)))
+		{
+			TimerInit(&slot->expiry);
+			TimerCountdownMS(&slot->expiry, expiry_ms);
+		}
+		rc = SUCCESS;
+	}
+	pthread_mutex_unlock(&c->mutex);
+	return rc;
+}
+
+
+/* Hand a slot back to the publishing threads */
+static void lane_release(PublishLane* lane, PublishSlot* slot, unsigned int pos)
+{
+	atomic_store_explicit(&slot->sequence, pos + PUBLISH_QUEUE_SIZE, memory_order_release);
+	atomic_store_explicit(&lane->dequeue_pos, pos + 1, memory_order_release);
+}
+
+
+/* Discard the oldest publish of a DROP_OLDEST lane, if the lane is still at its limit, to make
+ * room for a new one */
+static void lane_trim(PublishQueue* q, int l)
+{
+	PublishLane* lane = &q->lanes[l];
+	unsigned int pos;
+
+	pthread_mutex_lock(&lane->trim);
+	pos = atomic_load_explicit(&lane->dequeue_pos, memory_order_relaxed);
+	while (atomic_load_explicit(&lane->enqueue_pos, memory_order_relaxed) - pos >= q->options.limits[l])
+	{
+		PublishSlot* slot = &lane->slots[pos & SLOT_MASK];
+
+		if (atomic_load_explicit(&slot->sequence, memory_order_acquire) == pos + 1)
+		{
+			lane_release(lane, slot, pos);
+			++q->trimmed;
+			break;
+		}
+		pthread_mutex_unlock(&lane->trim);
+		sched_yield(); /* the oldest is still being written, by a thread which will soon be done */
+		pthread_mutex_lock(&lane->trim);
+		pos = atomic_load_explicit(&lane->dequeue_pos, memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&lane->trim);
+}
+
+
+int PublishQueuePublishExpiring(PublishQueue* q, int l, const char* topicName, MQTTMessage* message,
+		unsigned int expiry_ms)
+{
+	MQTTString topic = MQTTString_initializer;
+	PublishLane* lane = NULL;
+	PublishSlot* slot = NULL;
+	unsigned int pos;
+
+	if (message->qos != QOS0 || l < 0 || l >= PUBLISH_QUEUE_LANES)
+		return FAILURE;
+	topic.cstring = (char*)topicName;
+	if (MQTTPacket_len(2 + MQTTstrlen(topic) + message->payloadlen) > PUBLISH_QUEUE_SLOT_SIZE)
+		return BUFFER_OVERFLOW;
+
+	lane = &q->lanes[l];
+	if (lane->conflated)
+		return conflate_publish(q, lane->conflated, topic, message, expiry_ms);
+
+	/* claim the slot at the enqueue position, once the network thread has emptied it */
+	pos = atomic_load_explicit(&lane->enqueue_pos, memory_order_relaxed);
+	while (1)
+	{
+		int diff;
+
+		slot = &lane->slots[pos & SLOT_MASK];
+		diff = (int)(atomic_load_explicit(&slot->sequence, memory_order_acquire) - pos);
+		if (diff < 0 || (diff == 0 &&
+		        pos - atomic_load_explicit(&lane->dequeue_pos, memory_order_relaxed) >= q->options.limits[l]))
+		{   /* at its limit, or full - the slot still holds a packet from a lap ago */
+			if (q->options.drops[l] == DROP_NEWEST)
+			{
+				++q->refused;
+				return FAILURE;
+			}
+			lane_trim(q, l);
+			pos = atomic_load_explicit(&lane->enqueue_pos, memory_order_relaxed);
+		}
+		else if (diff == 0)
+		{
+			if (atomic_compare_exchange_weak_explicit(&lane->enqueue_pos, &pos, pos + 1,
+			        memory_order_relaxed, memory_order_relaxed))
+				break;
+		}
+		else
+			pos = atomic_load_explicit(&lane->enqueue_pos, memory_order_relaxed); /* another thread took it */
+	}
+
+	slot->len = MQTTSerialize_publish(slot->packet, PUBLISH_QUEUE_SLOT_SIZE, 0, QOS0, message->retained, 0,
+	    topic, (unsigned char*)message->payload, message->payloadlen);
+	if ((slot->expires = (expiry_ms > 0)))
+	{
+		TimerInit(&slot->expiry);
+		TimerCountdownMS(&slot->expiry, expiry_ms);
+	}
+	atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release); /* the network thread can take it */
+	return SUCCESS;
+}
+
+
+/* Copy whole packets from a conflating lane to buf, up to limit bytes, as lane_take */
+static int conflated_take(PublishQueue* q, ConflatedTopics* c, unsigned char* buf, int limit, int size, int* empty)
+{
+	int copied = 0;
+
+	pthread_mutex_lock(&c->mutex);
+	while (c->tail != c->head)
+	{
+		ConflatedSlot* slot = &c->slots[c->order[c->tail & CONFLATED_MASK]];
+
+		if (slot->expires && TimerIsExpired(&slot->expiry))
+			q->expired++;
+		else if (slot->len > size)
+			q->dropped++; /* would never fit the send buffer */
+		else if (slot->len > limit - copied)
+			break;
+		else
+		{
+			memcpy(buf + copied, slot->packet, slot->len);
+			copied += slot->len;
+		}
+		slot->pending = 0;
+		slot->len = -1; /* sent, or discarded - the topic needs no slot until it is published to again */
+		c->freed++;
+		c->tail++;
+	}
+	if ((*empty = (c->tail == c->head)) && c->freed > 0)
+	{
+		unsigned int i;
+
+		/* every slot is free, so searches can stop at the first again */
+		for (i = 0; i < CONFLATED_TOPICS; ++i)
+			c->slots[i].len = 0;
+		c->freed = 0;
+	}
+	pthread_mutex_unlock(&c->mutex);
+	return copied;
+}
+
+
+/* Copy whole packets from a lane to buf, up to limit bytes.  Returns the number of bytes
+ * copied, and sets *empty if the lane has no more ready.  Publishes which have expired are
+ * discarded on the way. */
+static int lane_take(PublishQueue* q, int l, unsigned char* buf, int limit, int size, int* empty)
+{
+	PublishLane* lane = &q->lanes[l];
+	unsigned int pos;
+	int copied = 0;
+
+	if (lane->conflated)
+		return conflated_take(q, lane->conflated, buf, limit, size, empty);
+	*empty = 0;
+	if (q->options.drops[l] == DROP_OLDEST)
+		pthread_mutex_lock(&lane->trim); /* so a publishing thread does not discard what is being copied */
+	pos = atomic_load_explicit(&lane->dequeue_pos, memory_order_relaxed);
+	while (1)
+	{
+		PublishSlot* slot = &lane->slots[pos & SLOT_MASK];
+
+		if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != pos + 1)
+		{
+			*empty = 1; /* empty, or the next is still being written */
+			break;
+		}
+		if (slot->expires && TimerIsExpired(&slot->expiry))
+			q->expired++;
+		else if (slot->len > size)
+			q->dropped++; /* would never fit the send buffer */
+		else if (slot->len > limit - copied)
+			break;
+		else
+		{
+			memcpy(buf + copied, slot->packet, slot->len);
+			copied += slot->len;
+		}
+		lane_release(lane, slot, pos++);
+	}
+	if (q->options.drops[l] == DROP_OLDEST)
+		pthread_mutex_unlock(&lane->trim);
+	return copied;
+}
+
+
+/* Whether any lane has a publish ready to take, expired or not */
+static int queue_ready(PublishQueue* q)
+{
+	int l, ready = 0;
+
+	for (l = 0; l < PUBLISH_QUEUE_LANES && !ready; ++l)
+	{
+		PublishLane* lane = &q->lanes[l];
+
+		if (lane->conflated)
+		{
+			pthread_mutex_lock(&lane->conflated->mutex);
+			ready = (lane->conflated->tail != lane->conflated->head);
+			pthread_mutex_unlock(&lane->conflated->mutex);
+		}
+		else
+		{
+			unsigned int pos = atomic_load_explicit(&lane->dequeue_pos, memory_order_relaxed);
+
+			ready = (atomic_load_explicit(&lane->slots[pos & SLOT_MASK].sequence, memory_order_acquire) == pos + 1);
+		}
+	}
+	return ready;
+}
+
+
+int PublishQueueSource(void* context, unsigned char* buf, int size)
+{
+	PublishQueue* q = (PublishQueue*)context;
+	int copied = 0, empty = 0, idle = 0, l;
+
+	if (buf == NULL)
+		return queue_ready(q);
+	if (!q->options.weighted)
+	{
+		/* strict priority: only go down a lane once the one above is empty */
+		for (l = 0; l < PUBLISH_QUEUE_LANES; ++l)
+		{
+			copied += lane_take(q, l, buf + copied, size - copied, size, &empty);
+			if (!empty)
+				break;
+		}
+		return copied;
+	}
+
+	/* deficit round robin: each time its turn comes round, a lane is credited its weight in slots,
+	 * and sends while the credit lasts.  The turn carries over between calls, so every lane gets
+	 * its share however small the send buffer. */
+	while (copied < size && idle < PUBLISH_QUEUE_LANES)
+	{
+		PublishLane* lane = &q->lanes[q->turn];
+		long limit = 0;
+		int taken = 0, buffer_full = 0;
+
+		if (!q->credited)
+		{
+			lane->deficit += (long)q->options.weights[q->turn] * PUBLISH_QUEUE_SLOT_SIZE;
+			q->credited = 1;
+		}
+		limit = lane->deficit;
+		if (limit > size - copied)
+		{
+			limit = size - copied;
+			buffer_full = 1;
+		}
+		taken = lane_take(q, q->turn, buf + copied, (int)limit, size, &empty);
+		copied += taken;
+		lane->deficit -= taken;
+		idle = (taken == 0) ? idle + 1 : 0;
+		if (empty)
+			lane->deficit = 0;
+		else if (buffer_full)
+			break; /* the lane's turn goes on in the next buffer */
+		q->turn = (q->turn + 1) % PUBLISH_QUEUE_LANES;
+		q->credited = 0;
+	}
+	return copied;
+}
+
+
+void PublishQueueDestroy(PublishQueue* q)
+{
+	int l;
+
+	for (l = 0; l < PUBLISH_QUEUE_LANES; ++l)
+		lane_free(&q->lanes[l]);
+}
@@ -0,0 +1,189 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial publish queue
+ *******************************************************************************/
+
+#if !defined(__MQTT_LINUX_PUBLISH_QUEUE_)
+#define __MQTT_LINUX_PUBLISH_QUEUE_
+
+/* A queue of QoS 0 publishes from any number of application threads, written to
+ * the network by the one thread running the client.  Publishing threads serialize
+ * into a slot of a bounded ring, claimed with a compare and swap, so they neither
+ * take the client mutex nor wait for each other's writes; the network thread copies
+ * the packets out a send buffer at a time, so a burst goes in few writes.
+ *
+ * There are PUBLISH_QUEUE_LANES lanes, lane 0 first.  Each call of the source
+ * fills the send buffer from the lanes either in strict priority, so a lane is
+ * only taken from when those above it are empty, or by weight, so each lane gets
+ * a share of every buffer and bulk traffic is never starved.  Either way, a
+ * publish to a higher lane waits behind at most one buffer of a lower lane's
+ * backlog.  Acks and pings do not queue here at all: the client writes them
+ * directly, between buffers.
+ *
+ * Stale data can be dropped rather than delay fresh: a publish can be given an
+ * expiry, after which it is discarded as it reaches the front of its lane, and a
+ * lane can be limited in length, refusing new publishes or discarding its oldest
+ * once at the limit, or full.  The publishing thread discards, so a lane keeps its
+ * newest while nothing is being sent, as through a reconnect.
+ *
+ * A lane can instead conflate: it holds the latest publish for each topic, so a
+ * publish to a topic which has one waiting replaces it, in its place in the
+ * lane.  Conflating lanes are a hash table keyed by topic, under a mutex, and
+ * their memory and bandwidth are bounded by the number of topics waiting rather
+ * than by the rate of publishing - for topics which carry a current value.  A
+ * topic's slot is freed once its latest publish has been sent.
+ *
+ *   PublishQueue queue;
+ *   PublishQueueInit(&queue, NULL);
+ *   PublishQueueSetTopicLane(&queue, "commands/#", 0);
+ *   MQTTSetPublishSource(&client, PublishQueueSource, &queue, 1);
+ *   MQTTStartTask(&client);
+ *   ...
+ *   PublishQueuePublish(&queue, "sensors/1", &message);   on any thread
+ *
+ * QoS 1 and 2 publishes wait for their acks, so still go through MQTTPublish.
+ */
+
+#include "MQTTClient.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#if !defined(PUBLISH_QUEUE_SIZE)
+#define PUBLISH_QUEUE_SIZE 1024 /* redefinable - publishes queued, a power of 2 */
+#endif
+#if !defined(PUBLISH_QUEUE_SLOT_SIZE)
+#define PUBLISH_QUEUE_SLOT_SIZE 256 /* redefinable - largest publish packet queued */
+#endif
+#if !defined(PUBLISH_QUEUE_LANES)
+#define PUBLISH_QUEUE_LANES 4 /* redefinable - priority lanes, each of PUBLISH_QUEUE_SIZE slots */
+#endif
+#if !defined(CONFLATED_TOPICS)
+#define CONFLATED_TOPICS 64 /* redefinable - topics a conflating lane holds, a power of 2 */
+#endif
+#if !defined(MAX_TOPIC_LANES)
+#define MAX_TOPIC_LANES 8 /* redefinable - topic filters which can be given a lane */
+#endif
+
+enum PublishQueueDrop { DROP_NEWEST, DROP_OLDEST };
+
+typedef struct PublishQueueOptions
+{
+	int weighted;                     /* share each buffer by weight, rather than in strict priority */
+	int weights[PUBLISH_QUEUE_LANES]; /* slots' worth of each buffer a lane gets per round, when weighted */
+	int default_lane;                 /* the lane for topics not given one */
+	unsigned int limits[PUBLISH_QUEUE_LANES]; /* publishes a lane holds, at most, 0 for PUBLISH_QUEUE_SIZE */
+	enum PublishQueueDrop drops[PUBLISH_QUEUE_LANES]; /* what goes when a lane is at its limit */
+	unsigned int expiry_ms[PUBLISH_QUEUE_LANES]; /* expiry of publishes not given one, 0 for none */
+	int conflate[PUBLISH_QUEUE_LANES]; /* hold only the latest publish for each topic, with no limit or drops */
+} PublishQueueOptions;
+
+#define PublishQueueOptions_initializer { 0, { 8, 4, 2, 1 }, PUBLISH_QUEUE_LANES - 1, { 0 }, { DROP_NEWEST }, { 0 }, { 0 } }
+
+typedef struct PublishSlot
+{
+	atomic_uint sequence;  /* the position it can next be written at, or that position + 1 once written */
+	int len;
+	char expires;
+	Timer expiry;
+	unsigned char packet[PUBLISH_QUEUE_SLOT_SIZE];
+} PublishSlot;
+
+typedef struct ConflatedSlot
+{
+	int len;               /* 0 while unused, -1 once freed after being sent, until the lane empties */
+	int topic_offset;      /* the topic name in packet is the key */
+	int topic_len;
+	char pending;          /* waiting to be sent, so in order */
+	char expires;
+	Timer expiry;
+	unsigned char packet[PUBLISH_QUEUE_SLOT_SIZE];
+} ConflatedSlot;
+
+typedef struct ConflatedTopics
+{
+	pthread_mutex_t mutex;
+	ConflatedSlot slots[CONFLATED_TOPICS];  /* open addressed by a hash of the topic */
+	unsigned short order[CONFLATED_TOPICS]; /* the pending slots, in the order they became pending */
+	unsigned int head, tail;
+	unsigned int freed;    /* slots freed since the lane was last empty */
+} ConflatedTopics;
+
+typedef struct PublishLane
+{
+	PublishSlot* slots;
+	ConflatedTopics* conflated; /* for a conflating lane, instead of slots */
+	_Alignas(64) atomic_uint enqueue_pos; /* claimed by the publishing threads */
+	_Alignas(64) atomic_uint dequeue_pos; /* written by the network thread, and with DROP_OLDEST under trim */
+	long deficit;          /* bytes the lane can still send this round, when weighted */
+	pthread_mutex_t trim;  /* with DROP_OLDEST, held to take or discard from the front of the lane */
+} PublishLane;
+
+typedef struct PublishQueue
+{
+	PublishLane lanes[PUBLISH_QUEUE_LANES];
+	PublishQueueOptions options;
+	struct TopicLane
+	{
+		const char* topicFilter;
+		int lane;
+	} topic_lanes[MAX_TOPIC_LANES];
+	int turn, credited;    /* the lane whose turn it is, when weighted, and whether it has had its credit */
+	unsigned long dropped; /* packets too large for the send buffer, so never sent */
+	atomic_ulong refused;  /* publishes refused as their lane was at its limit with DROP_NEWEST */
+	atomic_ulong trimmed;  /* publishes discarded to make room in their lane, with DROP_OLDEST */
+	unsigned long expired; /* publishes discarded as they had expired */
+	unsigned long conflated; /* publishes replaced by a later one to the same topic before being sent */
+} PublishQueue;
+
+/** Allocate the slots of a queue
+ *  @param options - the queue options, or NULL for the defaults: strict priority, and
+ *                   topics without a lane in the lowest
+ *  @return 0 on success
+ */
+DLLExport int PublishQueueInit(PublishQueue*, PublishQueueOptions*);
+
+/** Give the topics matching a filter a lane.  Not thread safe: set the lanes up before
+ *  publishing starts.  The filter is not copied.
+ *  @return SUCCESS, or FAILURE if MAX_TOPIC_LANES filters already have lanes
+ */
+DLLExport int PublishQueueSetTopicLane(PublishQueue*, const char* topicFilter, int lane);
+
+/** Queue a QoS 0 publish, from any thread, in the lane for its topic.  The message is
+ *  serialized before returning.
+ *  @return SUCCESS, BUFFER_OVERFLOW if the packet does not fit a slot, or FAILURE if the
+ *          lane is at its limit with DROP_NEWEST, or the message is not QoS 0
+ */
+DLLExport int PublishQueuePublish(PublishQueue*, const char* topicName, MQTTMessage* message);
+
+/** Queue a QoS 0 publish, from any thread, in the given lane
+ *  @return as for PublishQueuePublish
+ */
+DLLExport int PublishQueuePublishLane(PublishQueue*, int lane, const char* topicName, MQTTMessage* message);
+
+/** Queue a QoS 0 publish, from any thread, in the given lane, to be discarded if it has not
+ *  been sent within expiry_ms
+ *  @param expiry_ms - the lifetime of the publish, 0 for no expiry
+ *  @return as for PublishQueuePublish
+ */
+DLLExport int PublishQueuePublishExpiring(PublishQueue*, int lane, const char* topicName, MQTTMessage* message,
+		unsigned int expiry_ms);
+
+/** The publishSource to pass to MQTTSetPublishSource, with the queue as its context */
+DLLExport int PublishQueueSource(void* queue, unsigned char* buf, int size);
+
+/** Free the slots, dropping anything still queued */
+DLLExport void PublishQueueDestroy(PublishQueue*);
+
+#endif
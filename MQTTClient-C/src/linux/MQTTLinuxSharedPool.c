@@ -0,0 +1,138 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial shared buffer pool
+ *******************************************************************************/
+
+#include "MQTTLinuxSharedPool.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+
+
+static size_t class_size(int size_class)
+{
+	return (size_t)SHARED_POOL_MIN_SIZE << size_class;
+}
+
+
+/* The smallest class holding size bytes */
+static int class_for(size_t size)
+{
+	int size_class = 0;
+
+	while (size_class < SHARED_POOL_CLASSES && class_size(size_class) < size)
+		++size_class;
+	return size_class;
+}
+
+
+int SharedPoolInit(SharedPool* pool, size_t max_size, int keep)
+{
+	int i;
+
+	if ((pool->class_count = class_for(max_size) + 1) > SHARED_POOL_CLASSES)
+		return -1;
+	pool->keep = keep;
+	atomic_init(&pool->lent, 0);
+	atomic_init(&pool->lent_bytes, 0);
+	atomic_init(&pool->held_bytes, 0);
+	for (i = 0; i < pool->class_count; ++i)
+	{
+		pthread_mutex_init(&pool->classes[i].mutex, NULL);
+		pool->classes[i].free = NULL;
+		pool->classes[i].free_count = 0;
+	}
+	return 0;
+}
+
+
+unsigned char* SharedPoolBorrow(void* context, size_t size, size_t* lent)
+{
+	SharedPool* pool = (SharedPool*)context;
+	int size_class = (size == 0) ? pool->class_count - 1 : class_for(size);
+	SharedPoolClass* cl = NULL;
+	SharedBuffer* b = NULL;
+
+	if (size_class >= pool->class_count)
+		return NULL;
+	cl = &pool->classes[size_class];
+	pthread_mutex_lock(&cl->mutex);
+	if ((b = cl->free) != NULL)
+	{
+		cl->free = b->next;
+		cl->free_count--;
+	}
+	pthread_mutex_unlock(&cl->mutex);
+
+	if (b == NULL)
+	{   /* none free in this class - the pool grows with the packets in flight */
+		if ((b = malloc(offsetof(SharedBuffer, data) + class_size(size_class))) == NULL)
+			return NULL;
+		b->size_class = size_class;
+		atomic_fetch_add(&pool->held_bytes, (long)class_size(size_class));
+	}
+	atomic_fetch_add(&pool->lent, 1);
+	atomic_fetch_add(&pool->lent_bytes, (long)class_size(size_class));
+	*lent = class_size(size_class);
+	return b->data;
+}
+
+
+void SharedPoolGiveBack(void* context, unsigned char* buf)
+{
+	SharedPool* pool = (SharedPool*)context;
+	SharedBuffer* b = (SharedBuffer*)(buf - offsetof(SharedBuffer, data));
+	SharedPoolClass* cl = &pool->classes[b->size_class];
+	long size = (long)class_size(b->size_class);
+
+	atomic_fetch_sub(&pool->lent, 1);
+	atomic_fetch_sub(&pool->lent_bytes, size);
+	pthread_mutex_lock(&cl->mutex);
+	if (cl->free_count < pool->keep)
+	{
+		b->next = cl->free;
+		cl->free = b;
+		cl->free_count++;
+		b = NULL;
+	}
+	pthread_mutex_unlock(&cl->mutex);
+
+	if (b != NULL)
+	{   /* enough of this size are kept free already */
+		atomic_fetch_sub(&pool->held_bytes, size);
+		free(b);
+	}
+}
+
+
+void SharedPoolDestroy(SharedPool* pool)
+{
+	int i;
+
+	for (i = 0; i < pool->class_count; ++i)
+	{
+		SharedPoolClass* cl = &pool->classes[i];
+
+		while (cl->free != NULL)
+		{
+			SharedBuffer* b = cl->free;
+
+			cl->free = b->next;
+			free(b);
+		}
+		cl->free_count = 0;
+		pthread_mutex_destroy(&cl->mutex);
+	}
+	atomic_store(&pool->held_bytes, 0);
+}
@@ -0,0 +1,87 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial shared buffer pool
+ *******************************************************************************/
+
+#if !defined(__MQTT_LINUX_SHARED_POOL_)
+#define __MQTT_LINUX_SHARED_POOL_
+
+/* A process-wide pool of buffers, in size classes, lent to any number of clients.
+ * Each client keeps only a small scratch area of its own, enough for acks and
+ * pings, and borrows a buffer from the pool for each larger packet, only while
+ * it is sent or read and handled.  The pool allocates buffers as they are first
+ * needed and keeps some of each size free once they are given back, so memory
+ * follows the packets in flight rather than the number of clients.
+ *
+ *   SharedPool pool;
+ *   SharedPoolInit(&pool, 64 * 1024, 16);
+ *
+ *   unsigned char sendbuf[16], readbuf[16];
+ *   MQTTClientInit(&client, &network, 1000, sendbuf, sizeof(sendbuf), readbuf, sizeof(readbuf));
+ *   MQTTSetBufferLender(&client, SharedPoolBorrow, SharedPoolGiveBack, &pool);
+ */
+
+#include "MQTTClient.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#if !defined(SHARED_POOL_MIN_SIZE)
+#define SHARED_POOL_MIN_SIZE 256 /* redefinable - bytes in a buffer of the smallest class, a power of 2 */
+#endif
+#if !defined(SHARED_POOL_CLASSES)
+#define SHARED_POOL_CLASSES 16 /* redefinable - each class lends buffers twice the size of the one before */
+#endif
+
+typedef struct SharedBuffer
+{
+	struct SharedBuffer* next; /* in the free list of its class */
+	size_t size_class;
+	unsigned char data[];
+} SharedBuffer;
+
+typedef struct SharedPoolClass
+{
+	pthread_mutex_t mutex;
+	SharedBuffer* free;
+	int free_count;
+} SharedPoolClass;
+
+typedef struct SharedPool
+{
+	SharedPoolClass classes[SHARED_POOL_CLASSES];
+	int class_count;       /* the classes up to the largest size lent */
+	int keep;              /* free buffers kept in each class, more are freed as they are given back */
+	atomic_long lent;      /* buffers lent now */
+	atomic_long lent_bytes;
+	atomic_long held_bytes; /* in buffers allocated, whether lent or free */
+} SharedPool;
+
+/** Set up a pool.  No buffers are allocated until they are borrowed.
+ *  @param max_size - the largest buffer lent, which is rounded up to a power of 2
+ *  @param keep - the free buffers to keep in each class
+ *  @return 0 on success, -1 if max_size is larger than the largest class
+ */
+DLLExport int SharedPoolInit(SharedPool*, size_t max_size, int keep);
+
+/** The bufferBorrow to pass to MQTTSetBufferLender, with the pool as its context.  Thread safe. */
+DLLExport unsigned char* SharedPoolBorrow(void* pool, size_t size, size_t* lent);
+
+/** The bufferGiveBack to pass to MQTTSetBufferLender, with the pool as its context.  Thread safe. */
+DLLExport void SharedPoolGiveBack(void* pool, unsigned char* buf);
+
+/** Free the buffers.  None may still be lent. */
+DLLExport void SharedPoolDestroy(SharedPool*);
+
+#endif
@@ -0,0 +1,438 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial OpenSSL network implementation
+ *******************************************************************************/
+
+#include "MQTTLinuxTLS.h"
+
+#include <pthread.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+
+struct NetworkTLS
+{
+	SSL_CTX* ctx;
+	SSL* ssl;
+	int ktls_send;            /* the kernel encrypts what we write to the socket */
+	char session_key[NI_MAXHOST + 8];
+};
+
+/* Session tickets received from each broker, so that a reconnect can resume
+ * the session instead of doing a full handshake.  Keyed by "host:port" and the
+ * SSL_CTX of the options connected with, so that a session is only resumed with
+ * the verification and certificate it was made with.  Least recently used entry
+ * replaced when full.
+ */
+static struct
+{
+	char key[NI_MAXHOST + 8];
+	SSL_CTX* ctx;
+	SSL_SESSION* session;
+	unsigned long last_used;
+} tls_sessions[MAX_TLS_SESSIONS];
+static unsigned long tls_session_clock = 0;
+static pthread_mutex_t tls_session_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* An SSL_CTX for each set of options in use, so that connects don't parse the trust
+ * store again.  Each connection holds its own reference to its SSL_CTX.
+ */
+static struct
+{
+	SSL_CTX* ctx;
+	NetworkTLSOptions options; /* with the strings copied */
+	unsigned long last_used;
+} tls_contexts[MAX_TLS_CONTEXTS];
+static unsigned long tls_context_clock = 0;
+static pthread_mutex_t tls_context_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static int tls_session_find(const char* key, SSL_CTX* ctx)
+{
+	int i;
+
+	for (i = 0; i < MAX_TLS_SESSIONS; ++i)
+	{
+		if (tls_sessions[i].session && tls_sessions[i].ctx == ctx && strcmp(tls_sessions[i].key, key) == 0)
+			return i;
+	}
+	return -1;
+}
+
+
+/* drop the sessions made with an SSL_CTX which is being freed, as another could get its address */
+static void tls_session_forget(SSL_CTX* ctx)
+{
+	int i;
+
+	pthread_mutex_lock(&tls_session_mutex);
+	for (i = 0; i < MAX_TLS_SESSIONS; ++i)
+	{
+		if (tls_sessions[i].session && tls_sessions[i].ctx == ctx)
+		{
+			SSL_SESSION_free(tls_sessions[i].session);
+			tls_sessions[i].session = NULL;
+		}
+	}
+	pthread_mutex_unlock(&tls_session_mutex);
+}
+
+
+/* called by OpenSSL for each session ticket the server sends - we keep the reference */
+static int tls_session_new(SSL* ssl, SSL_SESSION* session)
+{
+	struct NetworkTLS* tls = SSL_get_app_data(ssl);
+	int i, slot = 0;
+
+	if (tls == NULL || !SSL_SESSION_is_resumable(session))
+		return 0;
+
+	pthread_mutex_lock(&tls_session_mutex);
+	if ((slot = tls_session_find(tls->session_key, tls->ctx)) < 0)
+	{
+		slot = 0;
+		for (i = 0; i < MAX_TLS_SESSIONS; ++i)
+		{
+			if (tls_sessions[i].session == NULL)
+			{
+				slot = i;
+				break;
+			}
+			if (tls_sessions[i].last_used < tls_sessions[slot].last_used)
+				slot = i;
+		}
+	}
+	if (tls_sessions[slot].session)
+		SSL_SESSION_free(tls_sessions[slot].session);
+	strncpy(tls_sessions[slot].key, tls->session_key, sizeof(tls_sessions[slot].key) - 1);
+	tls_sessions[slot].ctx = tls->ctx;
+	tls_sessions[slot].session = session;
+	tls_sessions[slot].last_used = ++tls_session_clock;
+	pthread_mutex_unlock(&tls_session_mutex);
+	return 1;
+}
+
+
+static void tls_session_restore(struct NetworkTLS* tls)
+{
+	int slot;
+
+	pthread_mutex_lock(&tls_session_mutex);
+	if ((slot = tls_session_find(tls->session_key, tls->ctx)) >= 0)
+	{
+		SSL_set_session(tls->ssl, tls_sessions[slot].session); /* takes its own reference */
+		tls_sessions[slot].last_used = ++tls_session_clock;
+	}
+	pthread_mutex_unlock(&tls_session_mutex);
+}
+
+
+void NetworkTLSClearSessions(void)
+{
+	int i;
+
+	pthread_mutex_lock(&tls_session_mutex);
+	for (i = 0; i < MAX_TLS_SESSIONS; ++i)
+	{
+		if (tls_sessions[i].session)
+			SSL_SESSION_free(tls_sessions[i].session);
+		tls_sessions[i].session = NULL;
+	}
+	pthread_mutex_unlock(&tls_session_mutex);
+}
+
+
+static int tls_same_string(const char* a, const char* b)
+{
+	return (a == NULL || b == NULL) ? a == b : strcmp(a, b) == 0;
+}
+
+
+static char* tls_copy_string(const char* str)
+{
+	return (str) ? strdup(str) : NULL;
+}
+
+
+static void tls_context_free(int slot)
+{
+	tls_session_forget(tls_contexts[slot].ctx);
+	SSL_CTX_free(tls_contexts[slot].ctx);
+	free((char*)tls_contexts[slot].options.trustStore);
+	free((char*)tls_contexts[slot].options.keyStore);
+	free((char*)tls_contexts[slot].options.privateKey);
+	free((char*)tls_contexts[slot].options.enabledCipherSuites);
+	memset(&tls_contexts[slot], '\0', sizeof(tls_contexts[slot]));
+}
+
+
+static SSL_CTX* tls_context_new(NetworkTLSOptions* options)
+{
+	SSL_CTX* ctx = NULL;
+
+	if ((ctx = SSL_CTX_new(TLS_client_method())) == NULL)
+		goto exit;
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	if (options->trustStore)
+	{
+		if (SSL_CTX_load_verify_locations(ctx, options->trustStore, NULL) != 1)
+			goto error;
+	}
+	else
+		SSL_CTX_set_default_verify_paths(ctx);
+	if (options->keyStore)
+	{
+		if (SSL_CTX_use_certificate_chain_file(ctx, options->keyStore) != 1 ||
+		    SSL_CTX_use_PrivateKey_file(ctx, options->privateKey ? options->privateKey : options->keyStore,
+		        SSL_FILETYPE_PEM) != 1)
+			goto error;
+	}
+	if (options->enabledCipherSuites && SSL_CTX_set_cipher_list(ctx, options->enabledCipherSuites) != 1)
+		goto error;
+	SSL_CTX_set_verify(ctx, options->enableServerCertAuth ? SSL_VERIFY_PEER : SSL_VERIFY_NONE, NULL);
+#if defined(SSL_OP_ENABLE_KTLS)
+	if (options->kernelTLS)
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS); /* OpenSSL sets TCP_ULP "tls" after the handshake */
+#endif
+	if (options->sessionResumption)
+	{
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(ctx, tls_session_new);
+	}
+	goto exit;
+error:
+	SSL_CTX_free(ctx);
+	ctx = NULL;
+exit:
+	return ctx;
+}
+
+
+/* the SSL_CTX for a set of options, made on first use, with a reference for the caller */
+static SSL_CTX* tls_context_get(NetworkTLSOptions* options)
+{
+	SSL_CTX* ctx = NULL;
+	int i, slot = 0;
+
+	pthread_mutex_lock(&tls_context_mutex);
+	for (i = 0; i < MAX_TLS_CONTEXTS; ++i)
+	{
+		NetworkTLSOptions* o = &tls_contexts[i].options;
+
+		if (tls_contexts[i].ctx && tls_same_string(o->trustStore, options->trustStore) &&
+		    tls_same_string(o->keyStore, options->keyStore) && tls_same_string(o->privateKey, options->privateKey) &&
+		    tls_same_string(o->enabledCipherSuites, options->enabledCipherSuites) &&
+		    o->enableServerCertAuth == options->enableServerCertAuth &&
+		    o->sessionResumption == options->sessionResumption && o->kernelTLS == options->kernelTLS)
+		{
+			ctx = tls_contexts[i].ctx;
+			tls_contexts[i].last_used = ++tls_context_clock;
+			SSL_CTX_up_ref(ctx);
+			goto exit;
+		}
+	}
+	if ((ctx = tls_context_new(options)) == NULL)
+		goto exit;
+	for (i = 0; i < MAX_TLS_CONTEXTS; ++i)
+	{
+		if (tls_contexts[i].ctx == NULL)
+		{
+			slot = i;
+			break;
+		}
+		if (tls_contexts[i].last_used < tls_contexts[slot].last_used)
+			slot = i;
+	}
+	if (tls_contexts[slot].ctx)
+		tls_context_free(slot);
+	tls_contexts[slot].ctx = ctx;
+	tls_contexts[slot].options = *options;
+	tls_contexts[slot].options.trustStore = tls_copy_string(options->trustStore);
+	tls_contexts[slot].options.keyStore = tls_copy_string(options->keyStore);
+	tls_contexts[slot].options.privateKey = tls_copy_string(options->privateKey);
+	tls_contexts[slot].options.enabledCipherSuites = tls_copy_string(options->enabledCipherSuites);
+	tls_contexts[slot].last_used = ++tls_context_clock;
+	SSL_CTX_up_ref(ctx);
+exit:
+	pthread_mutex_unlock(&tls_context_mutex);
+	return ctx;
+}
+
+
+void NetworkTLSClearContexts(void)
+{
+	int i;
+
+	pthread_mutex_lock(&tls_context_mutex);
+	for (i = 0; i < MAX_TLS_CONTEXTS; ++i)
+	{
+		if (tls_contexts[i].ctx)
+			tls_context_free(i);
+	}
+	pthread_mutex_unlock(&tls_context_mutex);
+}
+
+
+static void tls_free(struct NetworkTLS* tls)
+{
+	if (tls->ssl)
+		SSL_free(tls->ssl);
+	if (tls->ctx)
+		SSL_CTX_free(tls->ctx);
+	free(tls);
+}
+
+
+int linux_tls_read(Network* n, unsigned char* buffer, int len, int timeout_ms)
+{
+	struct timeval interval = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+	if (interval.tv_sec < 0 || (interval.tv_sec == 0 && interval.tv_usec <= 0))
+	{
+		interval.tv_sec = 0;
+		interval.tv_usec = 100;
+	}
+
+	setsockopt(n->my_socket, SOL_SOCKET, SO_RCVTIMEO, (char *)&interval, sizeof(struct timeval));
+
+	int bytes = 0;
+	while (bytes < len)
+	{
+		int rc = SSL_read(n->tls->ssl, &buffer[bytes], len - bytes);
+		if (rc > 0)
+			bytes += rc;
+		else
+		{
+			int err = SSL_get_error(n->tls->ssl, rc);
+			if (err == SSL_ERROR_ZERO_RETURN)
+				bytes = 0;  /* close_notify from the server */
+			else if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE)
+				bytes = -1; /* anything but a read timeout is fatal */
+			break;
+		}
+	}
+	if (bytes > 0 && n->connected.tv_sec != 0)
+		linux_connack_received(n);
+	return bytes;
+}
+
+
+int linux_tls_write(Network* n, unsigned char* buffer, int len, int timeout_ms)
+{
+	struct timeval tv;
+	int rc;
+
+	tv.tv_sec = 0;
+	tv.tv_usec = timeout_ms * 1000;
+
+	setsockopt(n->my_socket, SOL_SOCKET, SO_SNDTIMEO, (char *)&tv,sizeof(struct timeval));
+	if (n->tls->ktls_send)
+		/* the kernel owns the record layer, so write the plaintext straight to the socket */
+		rc = write(n->my_socket, buffer, len);
+	else if ((rc = SSL_write(n->tls->ssl, buffer, len)) <= 0)
+	{
+		int err = SSL_get_error(n->tls->ssl, rc);
+		rc = (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) ? 0 : -1;
+	}
+	return rc;
+}
+
+
+void linux_tls_disconnect(Network* n)
+{
+	if (n->tls)
+	{
+		SSL_shutdown(n->tls->ssl);
+		tls_free(n->tls);
+		n->tls = NULL;
+	}
+	linux_disconnect(n);
+	n->mqttread = linux_read;
+	n->mqttwrite = linux_write;
+	n->disconnect = linux_disconnect;
+}
+
+
+int NetworkConnectTLS(Network* n, char* addr, int port, NetworkTLSOptions* options)
+{
+	NetworkTLSOptions default_options = NetworkTLSOptions_initializer;
+	struct NetworkTLS* tls = NULL;
+	const char* hostname = addr; /* for SNI and verification: without the transport, none for a Unix socket */
+	int connected = 0;
+	int rc = -1;
+
+	if (options == NULL)
+		options = &default_options;
+
+	if ((rc = NetworkConnect(n, addr, port)) != 0)
+		goto exit;
+	connected = 1;
+	rc = -1;
+
+	if ((tls = calloc(1, sizeof(struct NetworkTLS))) == NULL)
+		goto exit;
+	if (strncmp(addr, UNIX_URI_PREFIX, strlen(UNIX_URI_PREFIX)) == 0)
+		hostname = NULL;
+	else if (strncmp(addr, TCP_URI_PREFIX, strlen(TCP_URI_PREFIX)) == 0)
+		hostname += strlen(TCP_URI_PREFIX);
+	snprintf(tls->session_key, sizeof(tls->session_key), "%s:%d", hostname ? hostname : addr, port);
+
+	if ((tls->ctx = tls_context_get(options)) == NULL)
+		goto exit;
+	if ((tls->ssl = SSL_new(tls->ctx)) == NULL)
+		goto exit;
+	SSL_set_app_data(tls->ssl, tls);
+	SSL_set_fd(tls->ssl, n->my_socket);
+	if (hostname)
+	{
+		SSL_set_tlsext_host_name(tls->ssl, hostname);
+		if (options->enableServerCertAuth)
+			SSL_set1_host(tls->ssl, hostname);
+	}
+	if (options->sessionResumption)
+		tls_session_restore(tls);
+
+	if (SSL_connect(tls->ssl) != 1)
+		goto exit;
+	tls->ktls_send = BIO_get_ktls_send(SSL_get_wbio(tls->ssl));
+
+	n->tls = tls;
+	n->mqttread = linux_tls_read;
+	n->mqttwrite = linux_tls_write;
+	n->disconnect = linux_tls_disconnect;
+	rc = 0;
+
+exit:
+	if (rc != 0)
+	{
+		ERR_clear_error();
+		if (tls)
+			tls_free(tls);
+		if (connected)
+			linux_disconnect(n);
+	}
+	return rc;
+}
+
+
+int NetworkTLSSessionReused(Network* n)
+{
+	return (n->tls && SSL_session_reused(n->tls->ssl)) ? 1 : 0;
+}
+
+
+int NetworkTLSKernelOffload(Network* n)
+{
+	return (n->tls && n->tls->ktls_send) ? 1 : 0;
+}
@@ -0,0 +1,73 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial OpenSSL network implementation
+ *******************************************************************************/
+
+#if !defined(__MQTT_LINUX_TLS_)
+#define __MQTT_LINUX_TLS_
+
+#include "MQTTLinux.h"
+
+#if !defined(MAX_TLS_SESSIONS)
+#define MAX_TLS_SESSIONS 8 /* redefinable - how many brokers to keep resumable sessions for */
+#endif
+#if !defined(MAX_TLS_CONTEXTS)
+#define MAX_TLS_CONTEXTS 4 /* redefinable - how many different sets of options to keep an SSL_CTX for */
+#endif
+
+typedef struct NetworkTLSOptions
+{
+	const char* trustStore;          /**< PEM file of trusted CA certificates, NULL for the system defaults */
+	const char* keyStore;            /**< PEM file of the client certificate chain, NULL if not used */
+	const char* privateKey;          /**< PEM file of the client private key, NULL if it is in keyStore */
+	const char* enabledCipherSuites; /**< OpenSSL cipher list, NULL for the library default */
+	int enableServerCertAuth;        /**< verify the server certificate chain and hostname */
+	int sessionResumption;           /**< cache session tickets per broker and offer them on reconnect */
+	int kernelTLS;                   /**< hand the record layer to the kernel (kTLS) where it is supported */
+} NetworkTLSOptions;
+
+#define NetworkTLSOptions_initializer { NULL, NULL, NULL, NULL, 1, 1, 1 }
+
+int linux_tls_read(Network*, unsigned char*, int, int);
+int linux_tls_write(Network*, unsigned char*, int, int);
+void linux_tls_disconnect(Network*);
+
+/** Connect a network object to a TLS endpoint.  The Network must have been initialized
+ *  with NetworkInit, and is closed with NetworkDisconnect as for plain TCP.  The address
+ *  is as for NetworkConnect.  Over a Unix domain socket no server name is sent, and the
+ *  server certificate chain is verified but not its hostname.
+ *  @param options - TLS options, or NULL for the defaults
+ *  @return 0 on success, -1 on failure
+ */
+DLLExport int NetworkConnectTLS(Network*, char*, int, NetworkTLSOptions*);
+
+/** Was the TLS session of the current connection resumed from the session cache?
+ *  @return 1 if resumed, 0 if a full handshake was done
+ */
+DLLExport int NetworkTLSSessionReused(Network*);
+
+/** Are sends on the current connection encrypted by the kernel (kTLS)?
+ *  @return 1 if kTLS transmit offload is active, 0 otherwise
+ */
+DLLExport int NetworkTLSKernelOffload(Network*);
+
+/** Discard all cached TLS sessions, forcing full handshakes on the next connects */
+DLLExport void NetworkTLSClearSessions(void);
+
+/** Discard the cached SSL_CTXs, so the next connects read the trust and key stores again.
+ *  Connections already made keep theirs until they are disconnected.
+ */
+DLLExport void NetworkTLSClearContexts(void);
+
+#endif
@@ -0,0 +1,318 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial worker pool dispatcher
+ *******************************************************************************/
+
+#include "MQTTLinuxWorkers.h"
+
+#include <sched.h>
+#include <time.h>
+
+#define QUEUE_MASK (WORKER_QUEUE_SIZE - 1)
+
+
+/* FNV-1a, to spread topics over the workers */
+static unsigned int worker_hash(const unsigned char* data, size_t len)
+{
+	unsigned int hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+		hash = (hash ^ data[i]) * 16777619u;
+	return hash;
+}
+
+
+static void worker_handle(WorkerMessage* m)
+{
+	MQTTString topic = MQTTString_initializer;
+	MessageData md;
+
+	topic.lenstring.len = m->topiclen;
+	topic.lenstring.data = (char*)m->data;
+	md.topicName = &topic;
+	md.message = &m->message;
+	md.skipped = m->skipped;
+	m->fp(&md);
+	if (m->data != m->inline_data)
+		free(m->data);
+}
+
+
+/* Account for a message handled, resuming reads if they were paused and the pool is now low enough */
+static void worker_done(WorkerPool* pool, long bytes)
+{
+	long messages = atomic_fetch_sub(&pool->queued_messages, 1) - 1;
+	int resumed = 0;
+
+	bytes = atomic_fetch_sub(&pool->queued_bytes, bytes) - bytes;
+	if (!atomic_load(&pool->paused) ||
+	    (pool->options.high_water_messages > 0 && messages > pool->options.low_water_messages) ||
+	    (pool->options.high_water_bytes > 0 && bytes > pool->options.low_water_bytes))
+		return;
+
+	pthread_mutex_lock(&pool->flow_mutex);
+	if (atomic_load(&pool->paused))
+	{
+		atomic_store(&pool->paused, 0);
+		pthread_cond_broadcast(&pool->flow_cond);
+		resumed = 1;
+	}
+	pthread_mutex_unlock(&pool->flow_mutex);
+	if (resumed && pool->options.on_low_water)
+		pool->options.on_low_water(pool->options.context);
+}
+
+
+static void* worker_run(void* arg)
+{
+	Worker* w = (Worker*)arg;
+	unsigned int tail = atomic_load_explicit(&w->tail, memory_order_relaxed);
+	WorkerMessage* m = NULL;
+	long bytes = 0;
+
+	while (1)
+	{
+		if (tail == atomic_load_explicit(&w->head, memory_order_acquire))
+		{
+			if (atomic_load(&w->pool->stopping))
+				break;
+			/* nothing queued - sleep until the dispatcher sees sleeping set and wakes us */
+			pthread_mutex_lock(&w->mutex);
+			atomic_store(&w->sleeping, 1);
+			while (tail == atomic_load(&w->head) && !atomic_load(&w->pool->stopping))
+				pthread_cond_wait(&w->cond, &w->mutex);
+			atomic_store(&w->sleeping, 0);
+			pthread_mutex_unlock(&w->mutex);
+			continue;
+		}
+		m = &w->queue[tail & QUEUE_MASK];
+		bytes = m->topiclen + m->message.payloadlen;
+		worker_handle(m);
+		atomic_store(&w->tail, ++tail); /* the slot can be reused */
+		if (atomic_load(&w->waiting))
+		{
+			pthread_mutex_lock(&w->mutex);
+			pthread_cond_signal(&w->room);
+			pthread_mutex_unlock(&w->mutex);
+		}
+		worker_done(w->pool, bytes);
+	}
+	return NULL;
+}
+
+
+static void worker_wake(Worker* w)
+{
+	pthread_mutex_lock(&w->mutex);
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+}
+
+
+/* Block the dispatching thread, and so reading from the network, until the worker has made room */
+static void worker_wait_room(Worker* w, unsigned int head)
+{
+	pthread_mutex_lock(&w->mutex);
+	atomic_store(&w->waiting, 1);
+	while (head - atomic_load(&w->tail) == WORKER_QUEUE_SIZE)
+		pthread_cond_wait(&w->room, &w->mutex);
+	atomic_store(&w->waiting, 0);
+	pthread_mutex_unlock(&w->mutex);
+}
+
+
+static void worker_join(WorkerPool* pool, int count)
+{
+	int i;
+
+	atomic_store(&pool->stopping, 1);
+	for (i = 0; i < count; ++i)
+	{
+		worker_wake(&pool->workers[i]);
+		pthread_join(pool->workers[i].thread, NULL);
+		pthread_cond_destroy(&pool->workers[i].room);
+		pthread_cond_destroy(&pool->workers[i].cond);
+		pthread_mutex_destroy(&pool->workers[i].mutex);
+	}
+	free(pool->workers);
+	pool->workers = NULL;
+	pthread_cond_destroy(&pool->flow_cond);
+	pthread_mutex_destroy(&pool->flow_mutex);
+}
+
+
+int WorkerPoolStart(WorkerPool* pool, WorkerPoolOptions* options)
+{
+	WorkerPoolOptions default_options = WorkerPoolOptions_initializer;
+	int i;
+
+	if (options == NULL)
+		options = &default_options;
+	pool->options = *options;
+	if (pool->options.workers < 1)
+		pool->options.workers = 1;
+	else if (pool->options.workers > MAX_WORKERS)
+		pool->options.workers = MAX_WORKERS;
+	if (pool->options.low_water_messages <= 0 || pool->options.low_water_messages > pool->options.high_water_messages)
+		pool->options.low_water_messages = pool->options.high_water_messages / 2;
+	if (pool->options.low_water_bytes <= 0 || pool->options.low_water_bytes > pool->options.high_water_bytes)
+		pool->options.low_water_bytes = pool->options.high_water_bytes / 2;
+	pool->dropped = 0;
+	atomic_init(&pool->stopping, 0);
+	atomic_init(&pool->queued_messages, 0);
+	atomic_init(&pool->queued_bytes, 0);
+	atomic_init(&pool->paused, 0);
+	if ((pool->workers = calloc(pool->options.workers, sizeof(Worker))) == NULL)
+		return -1;
+	pthread_mutex_init(&pool->flow_mutex, NULL);
+	pthread_cond_init(&pool->flow_cond, NULL);
+
+	for (i = 0; i < pool->options.workers; ++i)
+	{
+		Worker* w = &pool->workers[i];
+
+		atomic_init(&w->head, 0);
+		atomic_init(&w->tail, 0);
+		atomic_init(&w->sleeping, 0);
+		atomic_init(&w->waiting, 0);
+		pthread_mutex_init(&w->mutex, NULL);
+		pthread_cond_init(&w->cond, NULL);
+		pthread_cond_init(&w->room, NULL);
+		w->pool = pool;
+		if (pthread_create(&w->thread, NULL, worker_run, w) != 0)
+		{
+			pthread_cond_destroy(&w->room);
+			pthread_cond_destroy(&w->cond);
+			pthread_mutex_destroy(&w->mutex);
+			worker_join(pool, i);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+void WorkerPoolDispatch(void* context, messageHandler fp, MessageData* md)
+{
+	WorkerPool* pool = (WorkerPool*)context;
+	const char* topic = md->topicName->cstring;
+	int topiclen = 0;
+	size_t len = 0;
+	long messages, bytes;
+	unsigned int hash, head;
+	Worker* w = NULL;
+	WorkerMessage* m = NULL;
+
+	if (topic)
+		topiclen = strlen(topic);
+	else
+	{
+		topic = md->topicName->lenstring.data;
+		topiclen = md->topicName->lenstring.len;
+	}
+	if (pool->options.order_by_handler)
+		hash = worker_hash((unsigned char*)&fp, sizeof(fp));
+	else
+		hash = worker_hash((const unsigned char*)topic, topiclen);
+	w = &pool->workers[hash % pool->options.workers];
+
+	head = atomic_load_explicit(&w->head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&w->tail, memory_order_acquire) == WORKER_QUEUE_SIZE)
+	{
+		if (pool->options.drop_when_full)
+		{
+			pool->dropped++;
+			return;
+		}
+		worker_wait_room(w, head);
+	}
+
+	m = &w->queue[head & QUEUE_MASK];
+	len = topiclen + md->message->payloadlen;
+	m->data = (len <= WORKER_MESSAGE_SIZE) ? m->inline_data : malloc(len);
+	if (m->data == NULL)
+	{
+		pool->dropped++;
+		return;
+	}
+	memcpy(m->data, topic, topiclen);
+	memcpy(m->data + topiclen, md->message->payload, md->message->payloadlen);
+	m->fp = fp;
+	m->topiclen = topiclen;
+	m->skipped = md->skipped;
+	m->message = *md->message;
+	m->message.payload = m->data + topiclen;
+
+	messages = atomic_fetch_add(&pool->queued_messages, 1) + 1;
+	bytes = atomic_fetch_add(&pool->queued_bytes, (long)len) + (long)len;
+	/* pause before the message is visible to the worker, so that the worker_done
+	 * for it - or for a later message - is sure to see paused and resume */
+	if (((pool->options.high_water_messages > 0 && messages >= pool->options.high_water_messages) ||
+	     (pool->options.high_water_bytes > 0 && bytes >= pool->options.high_water_bytes)) &&
+	    !atomic_exchange(&pool->paused, 1) && pool->options.on_high_water)
+		pool->options.on_high_water(pool->options.context);
+	atomic_store(&w->head, head + 1);
+	if (atomic_load(&w->sleeping))
+		worker_wake(w);
+}
+
+
+int WorkerPoolFlowWait(void* context, int timeout_ms)
+{
+	WorkerPool* pool = (WorkerPool*)context;
+
+	if (atomic_load(&pool->paused) && timeout_ms > 0)
+	{
+		struct timespec until;
+
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_sec += timeout_ms / 1000;
+		until.tv_nsec += (timeout_ms % 1000) * 1000000L;
+		if (until.tv_nsec >= 1000000000L)
+		{
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000L;
+		}
+		pthread_mutex_lock(&pool->flow_mutex);
+		while (atomic_load(&pool->paused))
+		{
+			if (pthread_cond_timedwait(&pool->flow_cond, &pool->flow_mutex, &until) != 0)
+				break;
+		}
+		pthread_mutex_unlock(&pool->flow_mutex);
+	}
+	return atomic_load(&pool->paused);
+}
+
+
+void WorkerPoolDrain(WorkerPool* pool)
+{
+	int i;
+
+	for (i = 0; i < pool->options.workers; ++i)
+	{
+		Worker* w = &pool->workers[i];
+
+		while (atomic_load(&w->tail) != atomic_load(&w->head))
+			sched_yield();
+	}
+}
+
+
+void WorkerPoolStop(WorkerPool* pool)
+{
+	if (pool->workers)
+		worker_join(pool, pool->options.workers);
+}
@@ -0,0 +1,127 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial worker pool dispatcher
+ *******************************************************************************/
+
+#if !defined(__MQTT_LINUX_WORKERS_)
+#define __MQTT_LINUX_WORKERS_
+
+/* A pool of worker threads which run message handlers, so that a slow handler
+ * does not hold up reading the network, keepalive or acknowledgements.  Each
+ * message is copied into the queue of one worker, chosen by a hash of its topic
+ * (or of its handler), so messages on a topic are still handled in order.  The
+ * queues are single producer, single consumer rings: the thread reading the
+ * network adds to them without taking a lock.
+ *
+ *   WorkerPool pool;
+ *   WorkerPoolOptions options = WorkerPoolOptions_initializer;
+ *   WorkerPoolStart(&pool, &options);
+ *   MQTTSetDispatcher(&client, WorkerPoolDispatch, &pool);
+ *
+ * With high water marks set, the pool also bounds the messages and bytes queued:
+ * when either reaches its high water mark, the client stops reading from the
+ * network until both are back under their low water marks.
+ *
+ *   MQTTSetFlowControl(&client, WorkerPoolFlowWait, &pool);
+ */
+
+#include "MQTTClient.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#if !defined(MAX_WORKERS)
+#define MAX_WORKERS 16 /* redefinable - most threads in a pool */
+#endif
+#if !defined(WORKER_QUEUE_SIZE)
+#define WORKER_QUEUE_SIZE 64 /* redefinable - messages queued for each worker, a power of 2 */
+#endif
+#if !defined(WORKER_MESSAGE_SIZE)
+#define WORKER_MESSAGE_SIZE 256 /* redefinable - topic and payload bytes held in the queue, larger are allocated */
+#endif
+
+typedef struct WorkerPoolOptions
+{
+	int workers;           /* number of threads, at most MAX_WORKERS */
+	int order_by_handler;  /* keep order per handler rather than per topic */
+	int drop_when_full;    /* drop messages for a full queue, rather than stop reading until there is room */
+	long high_water_messages; /* pause reading at this many messages queued, 0 for no limit */
+	long low_water_messages;  /* resume at this many, 0 for half the high water mark */
+	long high_water_bytes;    /* pause reading at this many topic and payload bytes queued, 0 for no limit */
+	long low_water_bytes;     /* resume at this many, 0 for half the high water mark */
+	void (*on_high_water)(void* context); /* called on the dispatching thread when reading pauses */
+	void (*on_low_water)(void* context);  /* called on a worker thread when reading resumes */
+	void* context;
+} WorkerPoolOptions;
+
+#define WorkerPoolOptions_initializer { 4, 0, 0, 0, 0, 0, 0, NULL, NULL, NULL }
+
+typedef struct WorkerMessage
+{
+	messageHandler fp;
+	MQTTMessage message;
+	int topiclen;
+	unsigned int skipped;
+	unsigned char* data;   /* the topic then the payload - points to inline_data, or is allocated */
+	unsigned char inline_data[WORKER_MESSAGE_SIZE];
+} WorkerMessage;
+
+typedef struct Worker
+{
+	pthread_t thread;
+	WorkerMessage queue[WORKER_QUEUE_SIZE];
+	atomic_uint head;      /* written by the dispatching thread only */
+	atomic_uint tail;      /* written by the worker only, once the handler has returned */
+	atomic_int sleeping;
+	atomic_int waiting;    /* the dispatching thread is blocked for room in the queue */
+	pthread_mutex_t mutex; /* only for sleeping and waking the worker, or the dispatching thread */
+	pthread_cond_t cond;
+	pthread_cond_t room;
+	struct WorkerPool* pool;
+} Worker;
+
+typedef struct WorkerPool
+{
+	Worker* workers;
+	WorkerPoolOptions options;
+	atomic_int stopping;
+	unsigned long dropped; /* messages dropped because their queue was full */
+	atomic_long queued_messages;
+	atomic_long queued_bytes;
+	atomic_int paused;     /* over a high water mark, and not yet back under the low water marks */
+	pthread_mutex_t flow_mutex;
+	pthread_cond_t flow_cond;
+} WorkerPool;
+
+/** Start the threads of a pool
+ *  @param options - the pool options, or NULL for the defaults
+ *  @return 0 on success
+ */
+DLLExport int WorkerPoolStart(WorkerPool*, WorkerPoolOptions*);
+
+/** The messageDispatcher to pass to MQTTSetDispatcher, with the pool as its context.
+ *  Must only be called from one thread - the one reading the network.
+ */
+DLLExport void WorkerPoolDispatch(void* pool, messageHandler fp, MessageData* md);
+
+/** The flowControl to pass to MQTTSetFlowControl, with the pool as its context */
+DLLExport int WorkerPoolFlowWait(void* pool, int timeout_ms);
+
+/** Wait until every message queued so far has been handled */
+DLLExport void WorkerPoolDrain(WorkerPool*);
+
+/** Handle every message queued, then stop the threads */
+DLLExport void WorkerPoolStop(WorkerPool*);
+
+#endif
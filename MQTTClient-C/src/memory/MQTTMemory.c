@@ -0,0 +1,327 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial in-memory platform
+ *******************************************************************************/
+
+#include "MQTTMemory.h"
+#include "MQTTPacket.h"
+
+#define RING_MASK (MEMORY_RING_SIZE - 1)
+
+static unsigned long virtual_clock = 0;
+
+
+unsigned long MemoryClockNow(void)
+{
+	return virtual_clock;
+}
+
+
+void MemoryClockAdvance(unsigned long ms)
+{
+	virtual_clock += ms;
+}
+
+
+void MemoryClockReset(void)
+{
+	virtual_clock = 0;
+}
+
+
+void TimerInit(Timer* timer)
+{
+	timer->end_time = 0;
+}
+
+
+char TimerIsExpired(Timer* timer)
+{
+	return (long)(timer->end_time - virtual_clock) <= 0;
+}
+
+
+void TimerCountdownMS(Timer* timer, unsigned int timeout)
+{
+	timer->end_time = virtual_clock + timeout;
+}
+
+
+void TimerCountdown(Timer* timer, unsigned int timeout)
+{
+	timer->end_time = virtual_clock + timeout * 1000UL;
+}
+
+
+int TimerLeftMS(Timer* timer)
+{
+	long left = (long)(timer->end_time - virtual_clock);
+	return (left < 0) ? 0 : (int)left;
+}
+
+
+static unsigned int ring_used(MemoryRing* r)
+{
+	return r->head - r->tail;
+}
+
+
+static int ring_put(MemoryRing* r, unsigned char* buf, unsigned int len)
+{
+	unsigned int start = r->head & RING_MASK;
+	unsigned int first = MEMORY_RING_SIZE - start;
+
+	if (len > MEMORY_RING_SIZE - ring_used(r))
+		return -1;
+	if (first > len)
+		first = len;
+	memcpy(&r->data[start], buf, first);
+	memcpy(r->data, buf + first, len - first);
+	r->head += len;
+	return 0;
+}
+
+
+static void ring_peek(MemoryRing* r, unsigned char* buf, unsigned int len)
+{
+	unsigned int start = r->tail & RING_MASK;
+	unsigned int first = MEMORY_RING_SIZE - start;
+
+	if (first > len)
+		first = len;
+	memcpy(buf, &r->data[start], first);
+	memcpy(buf + first, r->data, len - first);
+}
+
+
+static void ring_get(MemoryRing* r, unsigned char* buf, unsigned int len)
+{
+	ring_peek(r, buf, len);
+	r->tail += len;
+}
+
+
+static int memory_broker_queue(MemoryBroker* b, unsigned char* buf, int len)
+{
+	if (len <= 0 || ring_put(&b->toclient, buf, len) != 0)
+		return -1;
+	b->sent[buf[0] >> 4]++;
+	return 0;
+}
+
+
+/* top up the client's ring from the PUBLISH burst, as far as it will go */
+static void memory_broker_refill(MemoryBroker* b)
+{
+	while (b->burst_remaining > 0 && ring_used(&b->toclient) + b->burst_len <= MEMORY_RING_SIZE)
+	{
+		if (b->burst_packetid_offset > 0)
+		{
+			if (b->inflight >= b->max_inflight)
+				break;
+			b->inflight++;
+			if (++b->next_packetid == 0)
+				b->next_packetid = 1;
+			b->burst[b->burst_packetid_offset] = b->next_packetid >> 8;
+			b->burst[b->burst_packetid_offset + 1] = b->next_packetid & 0xFF;
+		}
+		memory_broker_queue(b, b->burst, b->burst_len);
+		b->burst_remaining--;
+	}
+}
+
+
+/* answer one complete packet from the client, which is in b->packet */
+static void memory_broker_handle(MemoryBroker* b, int len)
+{
+	unsigned char reply[16];
+	unsigned char type = b->packet[0] >> 4, dup = 0;
+	unsigned short packetid = 0;
+	MQTTString topics[8];
+	int granted[8];
+	int count = 0, qos = 0, i;
+
+	b->received[type]++;
+	switch (type)
+	{
+		case CONNECT:
+			memory_broker_queue(b, reply, MQTTSerialize_connack(reply, sizeof(reply), b->connack_rc, b->session_present));
+			break;
+		case SUBSCRIBE:
+			if (MQTTDeserialize_subscribe(&dup, &packetid, 8, &count, topics, granted, b->packet, len) == 1)
+			{
+				for (i = 0; i < count; ++i)
+					granted[i] = b->granted_qos;
+				memory_broker_queue(b, reply, MQTTSerialize_suback(reply, sizeof(reply), packetid, count, granted));
+			}
+			break;
+		case UNSUBSCRIBE:
+			if (MQTTDeserialize_unsubscribe(&dup, &packetid, 8, &count, topics, b->packet, len) == 1)
+				memory_broker_queue(b, reply, MQTTSerialize_unsuback(reply, sizeof(reply), packetid));
+			break;
+		case PUBLISH:
+		{
+			unsigned char retained;
+			unsigned char* payload;
+			int payloadlen;
+
+			if (b->respond_publishes &&
+			    MQTTDeserialize_publish(&dup, &qos, &retained, &packetid, &topics[0], &payload, &payloadlen, b->packet, len) == 1 &&
+			    qos > 0)
+				memory_broker_queue(b, reply, MQTTSerialize_ack(reply, sizeof(reply), (qos == 1) ? PUBACK : PUBREC, 0, packetid));
+			break;
+		}
+		case PUBREC:
+		case PUBREL:
+			if (b->respond_publishes && MQTTDeserialize_ack(&type, &dup, &packetid, b->packet, len) == 1)
+				memory_broker_queue(b, reply, MQTTSerialize_ack(reply, sizeof(reply), (type == PUBREC) ? PUBREL : PUBCOMP, 0, packetid));
+			break;
+		case PUBACK:
+		case PUBCOMP:
+			if (b->inflight > 0)
+				b->inflight--;
+			break;
+		case PINGREQ:
+			if (b->respond_pings)
+			{
+				reply[0] = PINGRESP << 4;
+				reply[1] = 0;
+				memory_broker_queue(b, reply, 2);
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+
+/* take each complete packet the client has written and answer it */
+static int memory_broker_receive(MemoryBroker* b)
+{
+	MemoryRing* r = &b->tobroker;
+
+	while (ring_used(r) >= 2)
+	{
+		unsigned char header[5];
+		int rem_len = 0, multiplier = 1, len = 1;
+		unsigned int avail = ring_used(r) < sizeof(header) ? ring_used(r) : sizeof(header);
+
+		ring_peek(r, header, avail);
+		do
+		{
+			if (len >= avail)
+				return (avail == sizeof(header)) ? -1 : 0; /* bad length, or not all here yet */
+			rem_len += (header[len] & 127) * multiplier;
+			multiplier *= 128;
+		} while ((header[len++] & 128) != 0);
+
+		if (len + rem_len > sizeof(b->packet))
+			return -1;
+		if (ring_used(r) < len + rem_len)
+			break;
+		ring_get(r, b->packet, len + rem_len);
+		memory_broker_handle(b, len + rem_len);
+	}
+	return 0;
+}
+
+
+void MemoryBrokerInit(MemoryBroker* b)
+{
+	memset(b, '\0', sizeof(MemoryBroker));
+	b->granted_qos = 2;
+	b->respond_pings = 1;
+	b->respond_publishes = 1;
+	b->max_inflight = 10;
+}
+
+
+int MemoryBrokerSend(MemoryBroker* b, unsigned char* buf, int len)
+{
+	return memory_broker_queue(b, buf, len);
+}
+
+
+int MemoryBrokerPublish(MemoryBroker* b, const char* topicName, int qos,
+		unsigned char* payload, int payloadlen, unsigned long count)
+{
+	MQTTString topic = MQTTString_initializer;
+	int len = 0;
+
+	topic.cstring = (char*)topicName;
+	if ((len = MQTTSerialize_publish(b->burst, sizeof(b->burst), 0, qos, 0, 1, topic, payload, payloadlen)) <= 0)
+		return -1;
+	b->burst_len = len;
+	b->burst_packetid_offset = (qos > 0) ? len - payloadlen - 2 : 0;
+	b->burst_remaining = count;
+	b->inflight = 0;
+	memory_broker_refill(b);
+	return 0;
+}
+
+
+int memory_read(Network* n, unsigned char* buffer, int len, int timeout_ms)
+{
+	MemoryRing* r = NULL;
+	int bytes = 0;
+
+	if (n->broker == NULL)
+		return -1;
+	memory_broker_refill(n->broker);
+	r = &n->broker->toclient;
+	bytes = (ring_used(r) < len) ? ring_used(r) : len;
+	ring_get(r, buffer, bytes);
+	if (bytes < len && timeout_ms > 0)
+		MemoryClockAdvance(timeout_ms); /* a real read would have waited this long for the rest */
+	return bytes;
+}
+
+
+int memory_write(Network* n, unsigned char* buffer, int len, int timeout_ms)
+{
+	if (n->broker == NULL || ring_put(&n->broker->tobroker, buffer, len) != 0)
+		return -1;
+	n->broker->writes++;
+	if (memory_broker_receive(n->broker) != 0)
+		return -1;
+	return len;
+}
+
+
+void memory_disconnect(Network* n)
+{
+	n->broker = NULL;
+}
+
+
+void NetworkInit(Network* n)
+{
+	n->mqttread = memory_read;
+	n->mqttwrite = memory_write;
+	n->disconnect = memory_disconnect;
+	n->broker = NULL;
+}
+
+
+int NetworkConnect(Network* n, MemoryBroker* broker)
+{
+	n->broker = broker;
+	return 0;
+}
+
+
+void NetworkDisconnect(Network* n)
+{
+	n->disconnect(n);
+}
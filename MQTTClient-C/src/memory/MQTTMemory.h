@@ -0,0 +1,130 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial in-memory platform
+ *******************************************************************************/
+
+#if !defined(__MQTT_MEMORY_)
+#define __MQTT_MEMORY_
+
+/* An in-process platform for the client: the Network reads and writes ring
+ * buffers shared with a scripted broker, and Timers run on a virtual clock.
+ * Nothing blocks - a read which finds too little data advances the virtual
+ * clock by its timeout, as if it had waited that long - so runs are
+ * deterministic, and keepalive intervals pass at full speed.
+ */
+
+#if defined(WIN32_DLL) || defined(WIN64_DLL)
+  #define DLLImport __declspec(dllimport)
+  #define DLLExport __declspec(dllexport)
+#elif defined(LINUX_SO)
+  #define DLLImport extern
+  #define DLLExport  __attribute__ ((visibility ("default")))
+#else
+  #define DLLImport
+  #define DLLExport
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(MEMORY_RING_SIZE)
+#define MEMORY_RING_SIZE 4096 /* redefinable - bytes buffered in each direction, a power of 2 */
+#endif
+
+typedef struct Timer
+{
+	unsigned long end_time; /* on the virtual clock, in milliseconds */
+} Timer;
+
+void TimerInit(Timer*);
+char TimerIsExpired(Timer*);
+void TimerCountdownMS(Timer*, unsigned int);
+void TimerCountdown(Timer*, unsigned int);
+int TimerLeftMS(Timer*);
+
+/** The virtual clock, in milliseconds since it was last reset */
+DLLExport unsigned long MemoryClockNow(void);
+DLLExport void MemoryClockAdvance(unsigned long ms);
+DLLExport void MemoryClockReset(void);
+
+/* Indices run freely and are masked on access, so head - tail is the number of bytes held */
+typedef struct MemoryRing
+{
+	unsigned char data[MEMORY_RING_SIZE];
+	unsigned int head, tail;
+} MemoryRing;
+
+/* The peer at the other end of the Network.  Each packet the client writes is
+ * answered at once, as set up by the fields below, and bursts of PUBLISH packets
+ * can be queued for the client to read.
+ */
+typedef struct MemoryBroker
+{
+	MemoryRing toclient, tobroker;
+	int connack_rc;            /* return code of the CONNACK sent for each CONNECT */
+	int session_present;       /* session present flag of the CONNACK */
+	int granted_qos;           /* granted QoS of the SUBACK for each SUBSCRIBE, 0x80 to refuse */
+	int respond_pings;         /* answer PINGREQ with PINGRESP, 0 to play a dead broker */
+	int respond_publishes;     /* answer PUBLISH with PUBACK or PUBREC, and PUBREL with PUBCOMP */
+	int max_inflight;          /* QoS 1 and 2 burst messages sent and not yet acknowledged, at most */
+	unsigned long received[16]; /* packets received from the client, by type */
+	unsigned long sent[16];     /* packets sent to the client, by type */
+	unsigned long writes;       /* writes made by the client - the system calls a socket would take */
+	/* PUBLISH burst: the packet is replayed count times, with a new packet id each time */
+	unsigned char burst[MEMORY_RING_SIZE / 2];
+	int burst_len;
+	int burst_packetid_offset;  /* 0 for QoS 0 */
+	unsigned long burst_remaining;
+	int inflight;
+	unsigned short next_packetid;
+	unsigned char packet[MEMORY_RING_SIZE]; /* the packet being handled */
+} MemoryBroker;
+
+/** Reset a broker to its defaults: CONNACK accepted, SUBACK granted QoS 2, pings and publishes
+ *  answered, and 10 messages in flight
+ */
+DLLExport void MemoryBrokerInit(MemoryBroker*);
+
+/** Queue a packet, or any bytes, for the client to read
+ *  @return 0 on success, -1 if there is no room
+ */
+DLLExport int MemoryBrokerSend(MemoryBroker*, unsigned char* buf, int len);
+
+/** Queue a burst of PUBLISH packets for the client to read.  They are written
+ *  into the ring as the client reads, so a burst can be of any length.
+ *  @return 0 on success, -1 if the packet does not fit
+ */
+DLLExport int MemoryBrokerPublish(MemoryBroker*, const char* topicName, int qos,
+		unsigned char* payload, int payloadlen, unsigned long count);
+
+typedef struct Network
+{
+	int (*mqttread) (struct Network*, unsigned char*, int, int);
+	int (*mqttwrite) (struct Network*, unsigned char*, int, int);
+	void (*disconnect) (struct Network*);
+	MemoryBroker* broker; /* NULL when not connected */
+} Network;
+
+int memory_read(Network*, unsigned char*, int, int);
+int memory_write(Network*, unsigned char*, int, int);
+void memory_disconnect(Network*);
+
+DLLExport void NetworkInit(Network*);
+/** Connect a network object to a scripted broker
+ *  @return 0 on success
+ */
+DLLExport int NetworkConnect(Network*, MemoryBroker*);
+DLLExport void NetworkDisconnect(Network*);
+
+#endif
@@ -0,0 +1,1529 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial implementation
+ *******************************************************************************/
+
+
+/**
+ * @file
+ * Tests for the Paho embedded C client on the in-memory platform, against the
+ * scripted broker and the virtual clock.  No MQTT server is needed.
+ */
+
+
+#include "MQTTClient.h"
+#include "MQTTLinuxWorkers.h"
+#include "MQTTLinuxPublishQueue.h"
+#include "MQTTLinuxBufferPool.h"
+#include "MQTTLinuxSharedPool.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <sched.h>
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
+
+struct Options
+{
+	int verbose;
+	int test_no;
+} options =
+{
+	0,
+	0,
+};
+
+void getopts(int argc, char** argv)
+{
+	int count = 1;
+
+	while (count < argc)
+	{
+		if (strcmp(argv[count], "--test_no") == 0)
+		{
+			if (++count < argc)
+				options.test_no = atoi(argv[count]);
+		}
+		else if (strcmp(argv[count], "--verbose") == 0)
+			options.verbose = 1;
+		count++;
+	}
+}
+
+
+#define LOGA_DEBUG 0
+#define LOGA_INFO 1
+void MyLog(int LOGA_level, char* format, ...)
+{
+	static char msg_buf[256];
+	va_list args;
+	struct timeval ts;
+	struct tm *timeinfo;
+
+	if (LOGA_level == LOGA_DEBUG && options.verbose == 0)
+	  return;
+
+	gettimeofday(&ts, NULL);
+	timeinfo = localtime(&ts.tv_sec);
+	strftime(msg_buf, 80, "%Y%m%d %H%M%S", timeinfo);
+
+	sprintf(&msg_buf[strlen(msg_buf)], ".%.3d ", (int)(ts.tv_usec / 1000));
+
+	va_start(args, format);
+	vsnprintf(&msg_buf[strlen(msg_buf)], sizeof(msg_buf) - strlen(msg_buf), format, args);
+	va_end(args);
+
+	printf("%s\n", msg_buf);
+	fflush(stdout);
+}
+
+
+#define assert(a, b, ...) myassert(__FILE__, __LINE__, a, b, __VA_ARGS__)
+
+int tests = 0;
+int failures = 0;
+
+
+void myassert(char* filename, int lineno, char* description, int value, char* format, ...)
+{
+	++tests;
+	if (!value)
+	{
+		va_list args;
+
+		++failures;
+		MyLog(LOGA_INFO, "Assertion failed, file %s, line %d, description: %s\n", filename, lineno, description);
+
+		va_start(args, format);
+		vprintf(format, args);
+		va_end(args);
+	}
+	else
+		MyLog(LOGA_DEBUG, "Assertion succeeded, file %s, line %d, description: %s", filename, lineno, description);
+}
+
+
+static MemoryBroker broker;
+static Network network;
+static MQTTClient client;
+static unsigned char sendbuf[256], readbuf[256];
+static int messages_arrived = 0;
+
+void messageArrived(MessageData* md)
+{
+	++messages_arrived;
+}
+
+
+static int connect_client(int keepalive)
+{
+	MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+
+	MemoryClockReset();
+	NetworkInit(&network);
+	NetworkConnect(&network, &broker);
+	MQTTClientInit(&client, &network, 1000, sendbuf, sizeof(sendbuf), readbuf, sizeof(readbuf));
+	data.keepAliveInterval = keepalive;
+	data.clientID.cstring = "test_memory";
+	return MQTTConnect(&client, &data);
+}
+
+
+/*********************************************************************
+
+Test 1: the request/response flows against the scripted broker
+
+*********************************************************************/
+int test1(struct Options options)
+{
+	MQTTMessage message;
+	char* payload = "a QoS message";
+	int rc = 0, qos;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 1 - connect, subscribe, publish and unsubscribe");
+
+	MemoryBrokerInit(&broker);
+	rc = connect_client(60);
+	assert("Good rc from connect", rc == SUCCESS, "rc was %d\n", rc);
+	assert("CONNECT received", broker.received[CONNECT] == 1, "received %lu\n", broker.received[CONNECT]);
+
+	rc = MQTTSubscribe(&client, "test/+", QOS2, messageArrived);
+	assert("Good rc from subscribe", rc == SUCCESS, "rc was %d\n", rc);
+
+	for (qos = QOS0; qos <= QOS2; ++qos)
+	{
+		message.qos = (enum QoS)qos;
+		message.retained = 0;
+		message.payload = payload;
+		message.payloadlen = strlen(payload);
+		rc = MQTTPublish(&client, "test/memory", &message);
+		assert("Good rc from publish", rc == SUCCESS, "qos %d rc was %d\n", qos, rc);
+	}
+	assert("All publishes received", broker.received[PUBLISH] == 3, "received %lu\n", broker.received[PUBLISH]);
+	assert("QoS 2 flow completed", broker.received[PUBREL] == 1 && broker.sent[PUBCOMP] == 1,
+	    "PUBREL %lu PUBCOMP %lu\n", broker.received[PUBREL], broker.sent[PUBCOMP]);
+
+	rc = MQTTUnsubscribe(&client, "test/+");
+	assert("Good rc from unsubscribe", rc == SUCCESS, "rc was %d\n", rc);
+	rc = MQTTDisconnect(&client);
+	assert("Good rc from disconnect", rc == SUCCESS, "rc was %d\n", rc);
+	assert("DISCONNECT received", broker.received[DISCONNECT] == 1, "received %lu\n", broker.received[DISCONNECT]);
+	assert("No virtual time passed", MemoryClockNow() == 0, "clock was %lu\n", MemoryClockNow());
+
+	/* a refused connection */
+	MemoryBrokerInit(&broker);
+	broker.connack_rc = 5;
+	rc = connect_client(60);
+	assert("Connect refused", rc == 5, "rc was %d\n", rc);
+	assert("Not connected", MQTTIsConnected(&client) == 0, "isconnected was %d\n", MQTTIsConnected(&client));
+
+	MyLog(LOGA_INFO, "TEST1: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 2: a burst of incoming publishes, each acknowledged
+
+*********************************************************************/
+int test2(struct Options options)
+{
+	unsigned char payload[32];
+	int rc = 0, qos;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 2 - incoming PUBLISH bursts");
+
+	memset(payload, 'x', sizeof(payload));
+	for (qos = QOS0; qos <= QOS2; ++qos)
+	{
+		MemoryBrokerInit(&broker);
+		rc = connect_client(60);
+		assert("Good rc from connect", rc == SUCCESS, "rc was %d\n", rc);
+		rc = MQTTSubscribe(&client, "burst/#", QOS2, messageArrived);
+		assert("Good rc from subscribe", rc == SUCCESS, "rc was %d\n", rc);
+
+		messages_arrived = 0;
+		rc = MemoryBrokerPublish(&broker, "burst/test", qos, payload, sizeof(payload), 1000);
+		assert("Burst queued", rc == 0, "rc was %d\n", rc);
+		rc = MQTTYield(&client, 100);
+		assert("Good rc from yield", rc == SUCCESS, "rc was %d\n", rc);
+		assert("All messages delivered", messages_arrived == 1000, "qos %d arrived %d\n", qos, messages_arrived);
+		if (qos == QOS1)
+			assert("All PUBACKs sent", broker.received[PUBACK] == 1000, "received %lu\n", broker.received[PUBACK]);
+		else if (qos == QOS2)
+			assert("All PUBCOMPs sent", broker.received[PUBREC] == 1000 && broker.received[PUBCOMP] == 1000,
+			    "PUBREC %lu PUBCOMP %lu\n", broker.received[PUBREC], broker.received[PUBCOMP]);
+		MQTTDisconnect(&client);
+	}
+
+	MyLog(LOGA_INFO, "TEST2: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 3: keepalive, over minutes of virtual time
+
+*********************************************************************/
+int test3(struct Options options)
+{
+	int i, rc = 0;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 3 - keepalive on the virtual clock");
+
+	MemoryBrokerInit(&broker);
+	rc = connect_client(10);
+	assert("Good rc from connect", rc == SUCCESS, "rc was %d\n", rc);
+
+	/* yield a second at a time, as an application loop would */
+	for (i = 0; i < 65 && rc == SUCCESS; ++i)
+		rc = MQTTYield(&client, 1000);
+	assert("Good rc from yield", rc == SUCCESS, "rc was %d\n", rc);
+	assert("65 seconds of virtual time passed", MemoryClockNow() == 65000, "clock was %lu\n", MemoryClockNow());
+	assert("A ping every keepalive interval", broker.received[PINGREQ] == 6,
+	    "received %lu PINGREQs\n", broker.received[PINGREQ]);
+	assert("Still connected", MQTTIsConnected(&client) == 1, "isconnected was %d\n", MQTTIsConnected(&client));
+
+	/* the broker stops answering - the client must notice within two intervals */
+	broker.respond_pings = 0;
+	for (i = 0; i < 30 && rc == SUCCESS; ++i)
+		rc = MQTTYield(&client, 1000);
+	assert("Yield fails on missing PINGRESP", rc == FAILURE, "rc was %d\n", rc);
+	assert("Disconnected", MQTTIsConnected(&client) == 0, "isconnected was %d\n", MQTTIsConnected(&client));
+	assert("Within two keepalive intervals", MemoryClockNow() <= 65000 + 20000,
+	    "clock was %lu\n", MemoryClockNow());
+
+	MyLog(LOGA_INFO, "TEST3: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 4: outbound batching, counting the writes made to the network
+
+*********************************************************************/
+int test4(struct Options options)
+{
+	unsigned char batchbuf[1024];
+	const char* topics[20];
+	MQTTMessage messages[20];
+	MQTTMessage message;
+	char* payload = "0123456789";
+	unsigned long writes = 0;
+	int i, rc = 0;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 4 - outbound batching");
+
+	MemoryBrokerInit(&broker);
+	rc = connect_client(60);
+	assert("Good rc from connect", rc == SUCCESS, "rc was %d\n", rc);
+	rc = MQTTSetBatching(&client, batchbuf, sizeof(batchbuf), 0, 1000000);
+	assert("Good rc from set batching", rc == SUCCESS, "rc was %d\n", rc);
+
+	/* 100 publishes of 25 bytes each are written as whole buffers */
+	message.qos = QOS0;
+	message.retained = 0;
+	message.payload = payload;
+	message.payloadlen = strlen(payload);
+	writes = broker.writes;
+	for (i = 0; i < 100 && rc == SUCCESS; ++i)
+		rc = MQTTPublish(&client, "test/memory", &message);
+	assert("Good rc from publish", rc == SUCCESS, "rc was %d\n", rc);
+	assert("Only full buffers written", broker.received[PUBLISH] == 80, "received %lu\n", broker.received[PUBLISH]);
+	rc = MQTTFlush(&client);
+	assert("Good rc from flush", rc == SUCCESS, "rc was %d\n", rc);
+	assert("All publishes received", broker.received[PUBLISH] == 100, "received %lu\n", broker.received[PUBLISH]);
+	assert("Three writes", broker.writes - writes == 3, "writes %lu\n", broker.writes - writes);
+
+	/* the age threshold, and waiting for the network, flush */
+	MQTTPublish(&client, "test/memory", &message);
+	MemoryClockAdvance(1000);
+	MQTTPublish(&client, "test/memory", &message);
+	assert("Aged publish written", broker.received[PUBLISH] == 101, "received %lu\n", broker.received[PUBLISH]);
+	rc = MQTTYield(&client, 10);
+	assert("Good rc from yield", rc == SUCCESS, "rc was %d\n", rc);
+	assert("Yield flushed", broker.received[PUBLISH] == 102, "received %lu\n", broker.received[PUBLISH]);
+
+	/* a mixed QoS batch, coalesced in the send buffer when batching is off */
+	rc = MQTTSetBatching(&client, NULL, 0, 0, 0);
+	assert("Good rc from set batching", rc == SUCCESS, "rc was %d\n", rc);
+	for (i = 0; i < ARRAY_SIZE(messages); ++i)
+	{
+		topics[i] = "test/batch";
+		messages[i] = message;
+		messages[i].qos = (enum QoS)(i % 2);
+	}
+	writes = broker.writes;
+	rc = MQTTPublishBatch(&client, topics, messages, ARRAY_SIZE(messages));
+	assert("Good rc from publish batch", rc == SUCCESS, "rc was %d\n", rc);
+	assert("All publishes received", broker.received[PUBLISH] == 122, "received %lu\n", broker.received[PUBLISH]);
+	assert("All acknowledged", broker.sent[PUBACK] == 10, "sent %lu PUBACKs\n", broker.sent[PUBACK]);
+	assert("Two writes", broker.writes - writes == 2, "writes %lu\n", broker.writes - writes);
+
+	rc = MQTTDisconnect(&client);
+	assert("Good rc from disconnect", rc == SUCCESS, "rc was %d\n", rc);
+
+	MyLog(LOGA_INFO, "TEST4: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 5: the acks for an incoming burst are coalesced
+
+*********************************************************************/
+int test5(struct Options options)
+{
+	unsigned char batchbuf[256];
+	unsigned char payload[32];
+	unsigned long writes = 0;
+	int rc = 0, qos;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 5 - coalesced acknowledgements");
+
+	memset(payload, 'x', sizeof(payload));
+	for (qos = QOS1; qos <= QOS2; ++qos)
+	{
+		MemoryBrokerInit(&broker);
+		rc = connect_client(60);
+		assert("Good rc from connect", rc == SUCCESS, "rc was %d\n", rc);
+		rc = MQTTSubscribe(&client, "burst/#", QOS2, messageArrived);
+		assert("Good rc from subscribe", rc == SUCCESS, "rc was %d\n", rc);
+		rc = MQTTSetBatching(&client, batchbuf, sizeof(batchbuf), 0, 1000);
+		assert("Good rc from set batching", rc == SUCCESS, "rc was %d\n", rc);
+
+		messages_arrived = 0;
+		writes = broker.writes;
+		rc = MemoryBrokerPublish(&broker, "burst/test", qos, payload, sizeof(payload), 1000);
+		assert("Burst queued", rc == 0, "rc was %d\n", rc);
+		rc = MQTTYield(&client, 100);
+		assert("Good rc from yield", rc == SUCCESS, "rc was %d\n", rc);
+		assert("All messages delivered", messages_arrived == 1000, "qos %d arrived %d\n", qos, messages_arrived);
+		if (qos == QOS1)
+			assert("All PUBACKs sent", broker.received[PUBACK] == 1000, "received %lu\n", broker.received[PUBACK]);
+		else
+			assert("All PUBCOMPs sent", broker.received[PUBREC] == 1000 && broker.received[PUBCOMP] == 1000,
+			    "PUBREC %lu PUBCOMP %lu\n", broker.received[PUBREC], broker.received[PUBCOMP]);
+		/* each window of 10 messages in flight is acknowledged with one write per ack type */
+		assert("One write per window", broker.writes - writes == qos * 1000 / broker.max_inflight,
+		    "qos %d writes %lu\n", qos, broker.writes - writes);
+		MQTTDisconnect(&client);
+	}
+
+	MyLog(LOGA_INFO, "TEST5: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 6: handlers run on a worker pool, in order for each topic
+
+*********************************************************************/
+#define WORKER_TOPICS 8
+
+static int worker_sequence[WORKER_TOPICS];  /* each only touched by the worker for its topic */
+static pthread_t worker_thread[WORKER_TOPICS];
+static atomic_int worker_errors;
+static atomic_int worker_arrived;
+static pthread_t reader_thread;
+
+void workerMessageArrived(MessageData* md)
+{
+	int topic = md->topicName->lenstring.data[md->topicName->lenstring.len - 1] - '0';
+	int sequence = 0;
+
+	memcpy(&sequence, md->message->payload, sizeof(sequence));
+	if (pthread_equal(pthread_self(), reader_thread))
+		++worker_errors; /* ran on the thread reading the network */
+	if (worker_thread[topic] == 0)
+		worker_thread[topic] = pthread_self();
+	else if (!pthread_equal(worker_thread[topic], pthread_self()))
+		++worker_errors; /* a topic moved between workers */
+	if (sequence != worker_sequence[topic] + 1)
+		++worker_errors; /* out of order */
+	worker_sequence[topic] = sequence;
+	++worker_arrived;
+}
+
+
+int test6(struct Options options)
+{
+	WorkerPool pool;
+	WorkerPoolOptions pool_options = WorkerPoolOptions_initializer;
+	unsigned char packet[64];
+	int sequence[WORKER_TOPICS];
+	int i, rc = 0;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 6 - worker pool dispatch");
+
+	memset(worker_sequence, '\0', sizeof(worker_sequence));
+	memset(worker_thread, '\0', sizeof(worker_thread));
+	memset(sequence, '\0', sizeof(sequence));
+	atomic_init(&worker_errors, 0);
+	atomic_init(&worker_arrived, 0);
+	reader_thread = pthread_self();
+
+	rc = WorkerPoolStart(&pool, &pool_options);
+	assert("Good rc from pool start", rc == 0, "rc was %d\n", rc);
+	MemoryBrokerInit(&broker);
+	rc = connect_client(60);
+	assert("Good rc from connect", rc == SUCCESS, "rc was %d\n", rc);
+	rc = MQTTSubscribe(&client, "workers/#", QOS1, workerMessageArrived);
+	assert("Good rc from subscribe", rc == SUCCESS, "rc was %d\n", rc);
+	MQTTSetDispatcher(&client, WorkerPoolDispatch, &pool);
+
+	/* interleave the topics, with a sequence number in each payload */
+	for (i = 0; i < 4000 && rc == SUCCESS; ++i)
+	{
+		char topicName[16];
+		MQTTString topic = MQTTString_initializer;
+		int t = i % WORKER_TOPICS, len;
+
+		snprintf(topicName, sizeof(topicName), "workers/%d", t);
+		topic.cstring = topicName;
+		++sequence[t];
+		len = MQTTSerialize_publish(packet, sizeof(packet), 0, QOS1, 0, i % 1000 + 1, topic,
+		    (unsigned char*)&sequence[t], sizeof(sequence[t]));
+		while (MemoryBrokerSend(&broker, packet, len) != 0 && rc == SUCCESS)
+			rc = MQTTYield(&client, 10); /* the ring is full - let the client read some */
+	}
+	while (broker.received[PUBACK] < 4000 && rc == SUCCESS)
+		rc = MQTTYield(&client, 10);
+	assert("Good rc from yield", rc == SUCCESS, "rc was %d\n", rc);
+
+	WorkerPoolDrain(&pool);
+	assert("All messages handled", worker_arrived == 4000, "arrived %d\n", (int)worker_arrived);
+	assert("In order on one worker for each topic", worker_errors == 0, "errors %d\n", (int)worker_errors);
+	assert("None dropped", pool.dropped == 0, "dropped %lu\n", pool.dropped);
+
+	MQTTSetDispatcher(&client, NULL, NULL);
+	WorkerPoolStop(&pool);
+	MQTTDisconnect(&client);
+
+	MyLog(LOGA_INFO, "TEST6: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 7: a slow worker pool pauses reading at its high water mark
+
+*********************************************************************/
+#define FLOW_HIGH_WATER 20
+#define FLOW_LOW_WATER 5
+
+static WorkerPool flow_pool;
+static atomic_long flow_max_queued;
+static atomic_int flow_arrived;
+static int flow_high_waters;  /* only touched by the reading thread */
+static atomic_int flow_low_waters;
+
+void flowMessageArrived(MessageData* md)
+{
+	long queued = atomic_load(&flow_pool.queued_messages);
+
+	if (queued > atomic_load(&flow_max_queued))
+		atomic_store(&flow_max_queued, queued); /* one worker, so no other writer */
+	usleep(1000); /* a slow handler */
+	++flow_arrived;
+}
+
+void flowHighWater(void* context)
+{
+	++flow_high_waters;
+}
+
+void flowLowWater(void* context)
+{
+	++flow_low_waters;
+}
+
+
+int test7(struct Options options)
+{
+	WorkerPoolOptions pool_options = WorkerPoolOptions_initializer;
+	unsigned char payload[16];
+	int rc = 0;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 7 - receive flow control");
+
+	atomic_init(&flow_max_queued, 0);
+	atomic_init(&flow_arrived, 0);
+	atomic_init(&flow_low_waters, 0);
+	flow_high_waters = 0;
+	memset(payload, 'f', sizeof(payload));
+
+	pool_options.workers = 1;
+	pool_options.high_water_messages = FLOW_HIGH_WATER;
+	pool_options.low_water_messages = FLOW_LOW_WATER;
+	pool_options.on_high_water = flowHighWater;
+	pool_options.on_low_water = flowLowWater;
+	rc = WorkerPoolStart(&flow_pool, &pool_options);
+	assert("Good rc from pool start", rc == 0, "rc was %d\n", rc);
+	MemoryBrokerInit(&broker);
+	broker.max_inflight = 1000;
+	rc = connect_client(60);
+	assert("Good rc from connect", rc == SUCCESS, "rc was %d\n", rc);
+	rc = MQTTSubscribe(&client, "flow/#", QOS1, flowMessageArrived);
+	assert("Good rc from subscribe", rc == SUCCESS, "rc was %d\n", rc);
+	MQTTSetDispatcher(&client, WorkerPoolDispatch, &flow_pool);
+	MQTTSetFlowControl(&client, WorkerPoolFlowWait, &flow_pool);
+
+	rc = MemoryBrokerPublish(&broker, "flow/slow", QOS1, payload, sizeof(payload), 200);
+	assert("Good rc from broker publish", rc == 0, "rc was %d\n", rc);
+	while (broker.received[PUBACK] < 200 && rc == SUCCESS)
+		rc = MQTTYield(&client, 10);
+	assert("Good rc from yield", rc == SUCCESS, "rc was %d\n", rc);
+
+	WorkerPoolDrain(&flow_pool);
+	assert("All messages handled", flow_arrived == 200, "arrived %d\n", (int)flow_arrived);
+	assert("All messages acknowledged", broker.received[PUBACK] == 200, "pubacks %lu\n", broker.received[PUBACK]);
+	assert("Queue held to the high water mark", flow_max_queued <= FLOW_HIGH_WATER,
+	    "most queued %ld\n", (long)flow_max_queued);
+	assert("Reading paused", flow_high_waters > 0, "high waters %d\n", flow_high_waters);
+	assert("Reading resumed", flow_low_waters > 0, "low waters %d\n", (int)flow_low_waters);
+	assert("Not left paused", !atomic_load(&flow_pool.paused), "paused %d\n", (int)flow_pool.paused);
+	assert("None dropped", flow_pool.dropped == 0, "dropped %lu\n", flow_pool.dropped);
+	assert("Still connected", MQTTIsConnected(&client), "isconnected was %d\n", MQTTIsConnected(&client));
+
+	MQTTSetFlowControl(&client, NULL, NULL);
+	MQTTSetDispatcher(&client, NULL, NULL);
+	WorkerPoolStop(&flow_pool);
+	MQTTDisconnect(&client);
+
+	MyLog(LOGA_INFO, "TEST7: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 8: publishes queued by many threads, written by the network thread
+
+*********************************************************************/
+#define QUEUE_PRODUCERS 4
+#define QUEUE_MESSAGES 1000
+
+static PublishQueue publish_queue;
+static atomic_int queue_full;
+
+void* queueProducer(void* arg)
+{
+	int producer = (int)(long)arg, i;
+	char topicName[16];
+
+	snprintf(topicName, sizeof(topicName), "queue/%d", producer);
+	for (i = 0; i < QUEUE_MESSAGES; ++i)
+	{
+		int payload[2] = {producer, i};
+		MQTTMessage message = {QOS0, 0, 0, 0, payload, sizeof(payload)};
+
+		while (PublishQueuePublish(&publish_queue, topicName, &message) == FAILURE)
+		{
+			++queue_full;
+			sched_yield(); /* full - wait for the network thread */
+		}
+	}
+	return NULL;
+}
+
+
+int test8(struct Options options)
+{
+	pthread_t producers[QUEUE_PRODUCERS];
+	unsigned char big[PUBLISH_QUEUE_SLOT_SIZE];
+	MQTTMessage message = {QOS0, 0, 0, 0, big, sizeof(big)};
+	int i, rc = 0;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 8 - multi-producer publish queue");
+
+	atomic_init(&queue_full, 0);
+	rc = PublishQueueInit(&publish_queue, NULL);
+	assert("Good rc from queue init", rc == 0, "rc was %d\n", rc);
+	MemoryBrokerInit(&broker);
+	rc = connect_client(60);
+	assert("Good rc from connect", rc == SUCCESS, "rc was %d\n", rc);
+	MQTTSetPublishSource(&client, PublishQueueSource, &publish_queue, 1);
+
+	rc = PublishQueuePublish(&publish_queue, "queue/big", &message);
+	assert("Too big for a slot", rc == BUFFER_OVERFLOW, "rc was %d\n", rc);
+	message.qos = QOS1;
+	message.payloadlen = 8;
+	rc = PublishQueuePublish(&publish_queue, "queue/qos1", &message);
+	assert("QoS 1 refused", rc == FAILURE, "rc was %d\n", rc);
+
+	for (i = 0; i < QUEUE_PRODUCERS; ++i)
+		pthread_create(&producers[i], NULL, queueProducer, (void*)(long)i);
+	rc = SUCCESS;
+	while (broker.received[PUBLISH] < QUEUE_PRODUCERS * QUEUE_MESSAGES && rc == SUCCESS)
+		rc = MQTTYield(&client, 10);
+	assert("Good rc from yield", rc == SUCCESS, "rc was %d\n", rc);
+	for (i = 0; i < QUEUE_PRODUCERS; ++i)
+		pthread_join(producers[i], NULL);
+
+	assert("All publishes sent", broker.received[PUBLISH] == QUEUE_PRODUCERS * QUEUE_MESSAGES,
+	    "publishes %lu\n", broker.received[PUBLISH]);
+	assert("Written in batches", broker.writes < QUEUE_PRODUCERS * QUEUE_MESSAGES / 4,
+	    "writes %lu\n", broker.writes);
+	assert("None dropped", publish_queue.dropped == 0, "dropped %lu\n", publish_queue.dropped);
+	MyLog(LOGA_INFO, "%lu writes for %d publishes, queue full %d times", broker.writes,
+	    QUEUE_PRODUCERS * QUEUE_MESSAGES, (int)queue_full);
+
+	/* publishes queued while disconnected wait for the next connection */
+	rc = MQTTDisconnect(&client);
+	message.qos = QOS0;
+	for (i = 0, rc = SUCCESS; i < 10; ++i)
+		rc += PublishQueuePublish(&publish_queue, "queue/later", &message);
+	assert("Good rc from publishes", rc == SUCCESS, "rc was %d\n", rc);
+	for (i = 0; i < 3; ++i)
+		MQTTYield(&client, 10);
+	assert("None sent while disconnected", broker.received[PUBLISH] == QUEUE_PRODUCERS * QUEUE_MESSAGES,
+	    "publishes %lu\n", broker.received[PUBLISH]);
+	{
+		MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+
+		data.clientID.cstring = "test_memory";
+		rc = MQTTConnect(&client, &data);
+		assert("Good rc from reconnect", rc == SUCCESS, "rc was %d\n", rc);
+	}
+	while (broker.received[PUBLISH] < QUEUE_PRODUCERS * QUEUE_MESSAGES + 10 && rc == SUCCESS)
+		rc = MQTTYield(&client, 10);
+	assert("Sent once reconnected", broker.received[PUBLISH] == QUEUE_PRODUCERS * QUEUE_MESSAGES + 10,
+	    "publishes %lu\n", broker.received[PUBLISH]);
+
+	MQTTSetPublishSource(&client, NULL, NULL, 0);
+	PublishQueueDestroy(&publish_queue);
+	MQTTDisconnect(&client);
+
+	MyLog(LOGA_INFO, "TEST8: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 9: priority lanes in the publish queue
+
+*********************************************************************/
+
+/* Count the packets in buf from the source, by the lane their topic names: lane/<n> */
+static int count_lanes(unsigned char* buf, int len, int* counts, char* first)
+{
+	int pos = 0, packets = 0;
+
+	while (pos < len)
+	{
+		unsigned char dup, retained;
+		unsigned short packetid;
+		int qos, payloadlen, rem_len = 0;
+		unsigned char* payload;
+		MQTTString topic = MQTTString_initializer;
+		int packetlen = 1 + MQTTPacket_decodeBuf(&buf[pos + 1], &rem_len) + rem_len;
+
+		if (MQTTDeserialize_publish(&dup, &qos, &retained, &packetid, &topic, &payload, &payloadlen,
+		        &buf[pos], packetlen) != 1)
+			return -1;
+		if (packets++ == 0 && first)
+			*first = topic.lenstring.data[topic.lenstring.len - 1];
+		counts[topic.lenstring.data[topic.lenstring.len - 1] - '0']++;
+		pos += packetlen;
+	}
+	return packets;
+}
+
+
+int test9(struct Options options)
+{
+	PublishQueueOptions queue_options = PublishQueueOptions_initializer;
+	unsigned char payload[20], buf[256];
+	MQTTMessage message = {QOS0, 0, 0, 0, payload, sizeof(payload)};
+	int counts[PUBLISH_QUEUE_LANES];
+	char first = 0;
+	int i, len, rc = 0;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 9 - publish queue priority lanes");
+	memset(payload, 'p', sizeof(payload));
+
+	/* strict: a command queued after a bulk backlog is the first packet out */
+	rc = PublishQueueInit(&publish_queue, NULL);
+	assert("Good rc from queue init", rc == 0, "rc was %d\n", rc);
+	rc = PublishQueueSetTopicLane(&publish_queue, "lane/+", 0);
+	assert("Good rc from set topic lane", rc == SUCCESS, "rc was %d\n", rc);
+	for (i = 0; i < 500; ++i)
+		rc += PublishQueuePublishLane(&publish_queue, 3, "lane/3", &message);
+	rc += PublishQueuePublish(&publish_queue, "lane/0", &message);
+	assert("Good rc from publishes", rc == SUCCESS, "rc was %d\n", rc);
+	len = PublishQueueSource(&publish_queue, buf, sizeof(buf));
+	memset(counts, '\0', sizeof(counts));
+	rc = count_lanes(buf, len, counts, &first);
+	assert("A buffer of packets", rc > 1, "packets %d\n", rc);
+	assert("Command first", first == '0', "first from lane %c\n", first);
+	PublishQueueDestroy(&publish_queue);
+
+	/* weighted: both lanes are sent from, in proportion to their weights */
+	queue_options.weighted = 1;
+	rc = PublishQueueInit(&publish_queue, &queue_options);
+	assert("Good rc from queue init", rc == 0, "rc was %d\n", rc);
+	for (i = 0, rc = 0; i < 900; ++i)
+	{
+		rc += PublishQueuePublishLane(&publish_queue, 0, "lane/0", &message);
+		rc += PublishQueuePublishLane(&publish_queue, 3, "lane/3", &message);
+	}
+	assert("Good rc from publishes", rc == SUCCESS, "rc was %d\n", rc);
+	memset(counts, '\0', sizeof(counts));
+	for (i = 0; i < 50; ++i)
+	{
+		len = PublishQueueSource(&publish_queue, buf, sizeof(buf));
+		count_lanes(buf, len, counts, NULL);
+	}
+	MyLog(LOGA_INFO, "Weighted 8:1 - lane 0 sent %d, lane 3 sent %d", counts[0], counts[3]);
+	assert("Bulk lane not starved", counts[3] > 0, "lane 3 sent %d\n", counts[3]);
+	assert("Top lane gets its weight", counts[0] >= counts[3] * 7 && counts[0] <= counts[3] * 9,
+	    "lane 0 sent %d, lane 3 sent %d\n", counts[0], counts[3]);
+	PublishQueueDestroy(&publish_queue);
+
+	MyLog(LOGA_INFO, "TEST9: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 10: expiry and drop policies in the publish queue
+
+*********************************************************************/
+int test10(struct Options options)
+{
+	PublishQueueOptions queue_options = PublishQueueOptions_initializer;
+	unsigned char buf[1024];
+	int sequence = 0;
+	MQTTMessage message = {QOS0, 0, 0, 0, &sequence, sizeof(sequence)};
+	int counts[PUBLISH_QUEUE_LANES];
+	int i, len, refused = 0, first_sequence = 0, rc = 0;
+	char first = 0;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 10 - publish queue expiry and drop policies");
+
+	MemoryClockReset();
+	queue_options.limits[1] = 5;                /* DROP_NEWEST */
+	queue_options.limits[2] = 10;
+	queue_options.drops[2] = DROP_OLDEST;
+	queue_options.expiry_ms[3] = 100;
+	rc = PublishQueueInit(&publish_queue, &queue_options);
+	assert("Good rc from queue init", rc == 0, "rc was %d\n", rc);
+
+	for (i = 0; i < 8; ++i)
+		refused += (PublishQueuePublishLane(&publish_queue, 1, "lane/1", &message) == FAILURE);
+	assert("Newest refused at the limit", refused == 3, "refused %d\n", refused);
+	for (sequence = 0; sequence < 30; ++sequence)
+		rc += PublishQueuePublishLane(&publish_queue, 2, "lane/2", &message);
+	for (i = 0; i < 5; ++i)
+		rc += PublishQueuePublishLane(&publish_queue, 3, "lane/3", &message); /* lane 3's 100ms expiry */
+	rc += PublishQueuePublishExpiring(&publish_queue, 0, "lane/0", &message, 50);
+	assert("Good rc from publishes", rc == SUCCESS, "rc was %d\n", rc);
+
+	MemoryClockAdvance(200);
+	for (i = 0; i < 3; ++i)
+		rc += PublishQueuePublishLane(&publish_queue, 3, "lane/3", &message);
+	rc += PublishQueuePublishExpiring(&publish_queue, 3, "lane/3", &message, 0);
+	assert("Good rc from publishes", rc == SUCCESS, "rc was %d\n", rc);
+
+	len = PublishQueueSource(&publish_queue, buf, sizeof(buf));
+	memset(counts, '\0', sizeof(counts));
+	rc = count_lanes(buf, len, counts, &first);
+	assert("Expired command discarded", counts[0] == 0, "lane 0 sent %d\n", counts[0]);
+	assert("Lane 1 held to its limit", counts[1] == 5, "lane 1 sent %d\n", counts[1]);
+	assert("Lane 2 kept its newest", counts[2] == 10, "lane 2 sent %d\n", counts[2]);
+	assert("Lane 3 only fresh", counts[3] == 4, "lane 3 sent %d\n", counts[3]);
+	assert("Refused counted", publish_queue.refused == 3, "refused %lu\n", (unsigned long)publish_queue.refused);
+	assert("Trimmed counted", publish_queue.trimmed == 20, "trimmed %lu\n", (unsigned long)publish_queue.trimmed);
+	assert("Expired counted", publish_queue.expired == 6, "expired %lu\n", publish_queue.expired);
+
+	/* the first of lane 2 sent is the oldest kept, sequence 20 */
+	for (i = 0, rc = 0; i < 5; ++i)
+		rc += 1 + MQTTPacket_decodeBuf(&buf[rc + 1], &len) + len;
+	memcpy(&sequence, &buf[rc + 2 + 2 + 6], sizeof(sequence));
+	assert("Oldest dropped", sequence == 20, "first sequence %d\n", sequence);
+
+	PublishQueueDestroy(&publish_queue);
+
+	/* a full lane which drops its oldest keeps taking publishes while nothing is sent */
+	memset(&queue_options.limits, '\0', sizeof(queue_options.limits));
+	queue_options.drops[0] = DROP_OLDEST;
+	rc = PublishQueueInit(&publish_queue, &queue_options);
+	assert("Good rc from queue init", rc == 0, "rc was %d\n", rc);
+	for (sequence = 0, rc = 0; sequence < PUBLISH_QUEUE_SIZE + 100; ++sequence)
+		rc += PublishQueuePublishLane(&publish_queue, 0, "lane/0", &message);
+	assert("None refused", rc == SUCCESS && publish_queue.refused == 0, "rc was %d, refused %lu\n", rc,
+	    (unsigned long)publish_queue.refused);
+	assert("Oldest trimmed", publish_queue.trimmed == 100, "trimmed %lu\n", (unsigned long)publish_queue.trimmed);
+	for (i = 0; (len = PublishQueueSource(&publish_queue, buf, sizeof(buf))) > 0; )
+	{
+		int pos, rem_len = 0;
+
+		for (pos = 0; pos < len; pos += 1 + MQTTPacket_decodeBuf(&buf[pos + 1], &rem_len) + rem_len)
+		{
+			memcpy(&sequence, &buf[pos + 2 + 2 + 6], sizeof(sequence));
+			if (i++ == 0)
+				first_sequence = sequence;
+		}
+	}
+	assert("The newest kept", i == PUBLISH_QUEUE_SIZE && first_sequence == 100 && sequence == PUBLISH_QUEUE_SIZE + 99,
+	    "%d sent, from %d to %d\n", i, first_sequence, sequence);
+	PublishQueueDestroy(&publish_queue);
+
+	MyLog(LOGA_INFO, "TEST10: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 11: a conflating lane sends only the latest publish for each topic
+
+*********************************************************************/
+#define CONFLATE_PRODUCERS 4
+#define CONFLATE_MESSAGES 10000
+
+static atomic_int conflate_done;
+
+void* conflateProducer(void* arg)
+{
+	int i;
+
+	for (i = 0; i < CONFLATE_MESSAGES; ++i)
+	{
+		char topicName[16];
+		MQTTMessage message = {QOS0, 0, 0, 0, &i, sizeof(i)};
+
+		snprintf(topicName, sizeof(topicName), "state/%d", i % 8);
+		PublishQueuePublishLane(&publish_queue, 1, topicName, &message);
+	}
+	++conflate_done;
+	return NULL;
+}
+
+
+int test11(struct Options options)
+{
+	PublishQueueOptions queue_options = PublishQueueOptions_initializer;
+	pthread_t producers[CONFLATE_PRODUCERS];
+	unsigned char buf[1024];
+	int value = 0;
+	MQTTMessage message = {QOS0, 0, 0, 0, &value, sizeof(value)};
+	int i, len, pos, rc = 0;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 11 - conflating lane");
+
+	queue_options.conflate[1] = 1;
+	rc = PublishQueueInit(&publish_queue, &queue_options);
+	assert("Good rc from queue init", rc == 0, "rc was %d\n", rc);
+
+	/* 100 values for each of 8 topics: only the last of each is sent, in the order the topics came */
+	for (value = 0; value < 100; ++value)
+	{
+		for (i = 0; i < 8; ++i)
+		{
+			char topicName[16];
+
+			snprintf(topicName, sizeof(topicName), "state/%d", i);
+			rc += PublishQueuePublishLane(&publish_queue, 1, topicName, &message);
+		}
+	}
+	assert("Good rc from publishes", rc == SUCCESS, "rc was %d\n", rc);
+	len = PublishQueueSource(&publish_queue, buf, sizeof(buf));
+	for (i = 0, pos = 0; pos < len; ++i)
+	{
+		unsigned char dup, retained;
+		unsigned short packetid;
+		int qos, payloadlen;
+		unsigned char* payload;
+		MQTTString topic = MQTTString_initializer;
+		int rem_len = 0, packetlen = 1 + MQTTPacket_decodeBuf(&buf[pos + 1], &rem_len) + rem_len;
+
+		MQTTDeserialize_publish(&dup, &qos, &retained, &packetid, &topic, &payload, &payloadlen, &buf[pos], packetlen);
+		memcpy(&value, payload, sizeof(value));
+		assert("Topics in order", topic.lenstring.data[topic.lenstring.len - 1] == '0' + i,
+		    "topic %.*s\n", topic.lenstring.len, topic.lenstring.data);
+		assert("Latest value", value == 99, "value %d\n", value);
+		pos += packetlen;
+	}
+	assert("One for each topic", i == 8, "packets %d\n", i);
+	assert("Conflated counted", publish_queue.conflated == 792, "conflated %lu\n", publish_queue.conflated);
+	len = PublishQueueSource(&publish_queue, buf, sizeof(buf));
+	assert("Nothing more", len == 0, "len %d\n", len);
+
+	/* slots are freed once sent, so more topics than CONFLATED_TOPICS can pass through in turn */
+	for (value = 0, rc = 0; value < CONFLATED_TOPICS * 4; ++value)
+	{
+		char topicName[16];
+
+		snprintf(topicName, sizeof(topicName), "many/%d", value);
+		rc += PublishQueuePublishLane(&publish_queue, 1, topicName, &message);
+		if (value % 8 == 7)
+			len = PublishQueueSource(&publish_queue, buf, sizeof(buf));
+	}
+	assert("Good rc from publishes", rc == SUCCESS, "rc was %d\n", rc);
+	assert("None refused", publish_queue.refused == 0, "refused %lu\n", (unsigned long)publish_queue.refused);
+	PublishQueueDestroy(&publish_queue);
+
+	/* threads publishing through the client: each publish is either sent, or replaced by a later one */
+	rc = PublishQueueInit(&publish_queue, &queue_options);
+	assert("Good rc from queue init", rc == 0, "rc was %d\n", rc);
+	MemoryBrokerInit(&broker);
+	rc = connect_client(60);
+	assert("Good rc from connect", rc == SUCCESS, "rc was %d\n", rc);
+	MQTTSetPublishSource(&client, PublishQueueSource, &publish_queue, 1);
+	atomic_init(&conflate_done, 0);
+	for (i = 0; i < CONFLATE_PRODUCERS; ++i)
+		pthread_create(&producers[i], NULL, conflateProducer, NULL);
+	while (conflate_done < CONFLATE_PRODUCERS && rc == SUCCESS)
+		rc = MQTTYield(&client, 10);
+	for (i = 0; i < CONFLATE_PRODUCERS; ++i)
+		pthread_join(producers[i], NULL);
+	while (broker.received[PUBLISH] + publish_queue.conflated < CONFLATE_PRODUCERS * CONFLATE_MESSAGES &&
+	    rc == SUCCESS)
+		rc = MQTTYield(&client, 10);
+	assert("Good rc from yield", rc == SUCCESS, "rc was %d\n", rc);
+	MyLog(LOGA_INFO, "%lu sent, %lu conflated, of %d publishes", broker.received[PUBLISH],
+	    publish_queue.conflated, CONFLATE_PRODUCERS * CONFLATE_MESSAGES);
+	assert("Sent or conflated", broker.received[PUBLISH] + publish_queue.conflated == CONFLATE_PRODUCERS * CONFLATE_MESSAGES,
+	    "sent %lu, conflated %lu\n", broker.received[PUBLISH], publish_queue.conflated);
+	assert("None refused", publish_queue.refused == 0, "refused %lu\n", (unsigned long)publish_queue.refused);
+
+	MQTTSetPublishSource(&client, NULL, NULL, 0);
+	PublishQueueDestroy(&publish_queue);
+	MQTTDisconnect(&client);
+
+	MyLog(LOGA_INFO, "TEST11: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 12: conflated subscriptions deliver the latest message on each topic
+
+*********************************************************************/
+static int conflated_calls[2];
+static int conflated_value[2];
+static unsigned int conflated_skipped[2];
+static int raw_arrived = 0;
+
+void conflatedMessageArrived(MessageData* md)
+{
+	int topic = md->topicName->lenstring.data[md->topicName->lenstring.len - 1] - '0';
+
+	conflated_calls[topic]++;
+	memcpy(&conflated_value[topic], md->message->payload, sizeof(int));
+	conflated_skipped[topic] += md->skipped;
+}
+
+void rawMessageArrived(MessageData* md)
+{
+	++raw_arrived;
+}
+
+#define MANY_ROUNDS 3
+static int many_calls[MANY_ROUNDS * 4];
+static unsigned int many_skipped;
+
+void manyMessageArrived(MessageData* md)
+{
+	many_calls[atoi(md->topicName->lenstring.data + 5)]++;
+	many_skipped += md->skipped;
+}
+
+
+int test12(struct Options options)
+{
+	MQTTConflatedSlot slots[4];
+	unsigned char slot_buf[4 * 32], packet[64];
+	int i, rc = 0;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 12 - conflated subscriptions");
+
+	memset(conflated_calls, '\0', sizeof(conflated_calls));
+	memset(conflated_skipped, '\0', sizeof(conflated_skipped));
+	raw_arrived = 0;
+	MemoryBrokerInit(&broker);
+	rc = connect_client(60);
+	assert("Good rc from connect", rc == SUCCESS, "rc was %d\n", rc);
+	MQTTSetConflation(&client, slots, 4, slot_buf, sizeof(slot_buf));
+	rc = MQTTSubscribe(&client, "ui/#", QOS1, conflatedMessageArrived);
+	assert("Good rc from subscribe", rc == SUCCESS, "rc was %d\n", rc);
+	rc = MQTTSubscribe(&client, "raw/#", QOS1, rawMessageArrived);
+	assert("Good rc from subscribe", rc == SUCCESS, "rc was %d\n", rc);
+	rc = MQTTSetConflated(&client, "ui/#", 1);
+	assert("Good rc from set conflated", rc == SUCCESS, "rc was %d\n", rc);
+	rc = MQTTSetConflated(&client, "none/#", 1);
+	assert("No such subscription", rc == FAILURE, "rc was %d\n", rc);
+
+	/* a burst of 60 values on each of two conflated topics, interleaved with a plain one */
+	for (i = 1; i <= 60; ++i)
+	{
+		MQTTString topic = MQTTString_initializer;
+		const char* names[] = {"ui/0", "ui/1", "raw/0"};
+		int t, len;
+
+		for (t = 0; t < 3; ++t)
+		{
+			topic.cstring = (char*)names[t];
+			len = MQTTSerialize_publish(packet, sizeof(packet), 0, QOS1, 0, (i * 3 + t) % 65535 + 1, topic,
+			    (unsigned char*)&i, sizeof(i));
+			rc = MemoryBrokerSend(&broker, packet, len);
+		}
+	}
+	assert("Burst queued", rc == 0, "rc was %d\n", rc);
+	rc = MQTTYield(&client, 10);
+	assert("Good rc from yield", rc == SUCCESS, "rc was %d\n", rc);
+
+	for (i = 0; i < 2; ++i)
+	{
+		assert("Handler called once", conflated_calls[i] == 1, "calls %d\n", conflated_calls[i]);
+		assert("With the latest value", conflated_value[i] == 60, "value %d\n", conflated_value[i]);
+		assert("And the count skipped", conflated_skipped[i] == 59, "skipped %u\n", conflated_skipped[i]);
+	}
+	assert("Plain subscription gets every message", raw_arrived == 60, "arrived %d\n", raw_arrived);
+	assert("Every message acknowledged", broker.received[PUBACK] == 180, "pubacks %lu\n", broker.received[PUBACK]);
+
+	/* the next round delivers again */
+	rc = MemoryBrokerPublish(&broker, "ui/1", QOS0, (unsigned char*)&i, sizeof(i), 5);
+	rc = MQTTYield(&client, 10);
+	assert("Good rc from yield", rc == SUCCESS, "rc was %d\n", rc);
+	assert("Handler called in the next round", conflated_calls[1] == 2, "calls %d\n", conflated_calls[1]);
+	assert("Skipped 4 more", conflated_skipped[1] == 59 + 4, "skipped %u\n", conflated_skipped[1]);
+
+	/* a message too large for its slot is delivered after the older one pending there */
+	{
+		MQTTString topic = MQTTString_initializer;
+		unsigned char large[40];
+		int len;
+
+		topic.cstring = "ui/0";
+		i = 61;
+		len = MQTTSerialize_publish(packet, sizeof(packet), 0, QOS0, 0, 0, topic, (unsigned char*)&i, sizeof(i));
+		rc = MemoryBrokerSend(&broker, packet, len);
+		i = 62;
+		memset(large, 'l', sizeof(large));
+		memcpy(large, &i, sizeof(i));
+		len = MQTTSerialize_publish(packet, sizeof(packet), 0, QOS0, 0, 0, topic, large, sizeof(large));
+		rc = MemoryBrokerSend(&broker, packet, len);
+		rc = MQTTYield(&client, 10);
+		assert("Good rc from yield", rc == SUCCESS, "rc was %d\n", rc);
+		assert("Both delivered", conflated_calls[0] == 3, "calls %d\n", conflated_calls[0]);
+		assert("In order", conflated_value[0] == 62, "value %d\n", conflated_value[0]);
+	}
+
+	/* a slot is freed once delivered, so more topics than slots go through over the rounds */
+	memset(many_calls, '\0', sizeof(many_calls));
+	many_skipped = 0;
+	rc = MQTTSubscribe(&client, "many/#", QOS0, manyMessageArrived);
+	assert("Good rc from subscribe", rc == SUCCESS, "rc was %d\n", rc);
+	rc = MQTTSetConflated(&client, "many/#", 1);
+	for (i = 0; i < MANY_ROUNDS; ++i)
+	{
+		int t, n, before = 0;
+
+		for (t = 0; t < i * 4; ++t)
+			before += many_calls[t];
+		for (n = 0; n < 3; ++n)
+		{
+			for (t = i * 4; t < i * 4 + 4; ++t)
+			{
+				char name[16];
+
+				sprintf(name, "many/%d", t);
+				rc = MemoryBrokerPublish(&broker, name, QOS0, (unsigned char*)&n, sizeof(n), 1);
+			}
+		}
+		rc = MQTTYield(&client, 10);
+		assert("Good rc from yield", rc == SUCCESS, "rc was %d\n", rc);
+		for (t = i * 4; t < i * 4 + 4; ++t)
+			assert("Each topic delivered once", many_calls[t] == 1, "topic %d calls %d\n", t, many_calls[t]);
+		for (t = 0; t < i * 4; ++t)
+			before -= many_calls[t];
+		assert("Earlier topics not delivered again", before == 0, "%d more\n", -before);
+	}
+	assert("Every round conflated", many_skipped == MANY_ROUNDS * 4 * 2, "skipped %u\n", many_skipped);
+
+	/* stopping conflation delivers what is pending at once */
+	i = 63;
+	rc = MemoryBrokerPublish(&broker, "ui/0", QOS0, (unsigned char*)&i, sizeof(i), 1);
+	rc = MQTTYield(&client, 0);
+	assert("Pending", conflated_calls[0] == 3, "calls %d\n", conflated_calls[0]);
+	rc = MQTTSetConflated(&client, "ui/#", 0);
+	assert("Delivered when conflation stops", conflated_calls[0] == 4 && conflated_value[0] == 63,
+	    "calls %d, value %d\n", conflated_calls[0], conflated_value[0]);
+	rc = MQTTSetConflated(&client, "ui/#", 1);
+
+	/* removing a subscription drops what is pending for it */
+	rc = MemoryBrokerPublish(&broker, "ui/1", QOS0, (unsigned char*)&i, sizeof(i), 1);
+	rc = MQTTYield(&client, 0);
+	rc = MQTTSetMessageHandler(&client, "ui/#", NULL);
+	rc = MQTTYield(&client, 10);
+	assert("Not delivered once removed", conflated_calls[1] == 2, "calls %d\n", conflated_calls[1]);
+	for (i = 0; i < 4; ++i)
+		assert("Slots free", slots[i].topiclen == 0, "slot %d topiclen %d\n", i, slots[i].topiclen);
+	rc = MQTTSetConflation(&client, slots, 0, slot_buf, sizeof(slot_buf));
+	assert("No slots refused", rc == FAILURE, "rc was %d\n", rc);
+
+	MQTTDisconnect(&client);
+
+	MyLog(LOGA_INFO, "TEST12: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 13: handlers keep messages on loan from a pool of read buffers
+
+*********************************************************************/
+#define LOAN_BUFFERS 4
+#define LOAN_MESSAGES 6
+
+static BufferPool read_pool;
+static PooledBuffer* loans[LOAN_MESSAGES];
+static int* loaned_payloads[LOAN_MESSAGES];
+static atomic_int loans_taken;
+static int loans_paused, loans_intact; /* written by the releaser, read after joining it */
+
+void loanMessageArrived(MessageData* md)
+{
+	int i = loans_taken;
+
+	loans[i] = BufferPoolRetain(&read_pool, md);
+	loaned_payloads[i] = (int*)md->message->payload; /* kept without a copy */
+	++loans_taken;
+}
+
+/* give the loans back once the pool has run out, as another thread finishing with them would */
+void* loanReleaser(void* arg)
+{
+	int i;
+
+	while (loans_taken < LOAN_BUFFERS)
+		usleep(1000);
+	usleep(5000);
+	loans_paused = (loans_taken == LOAN_BUFFERS); /* nothing more read while every buffer is on loan */
+	loans_intact = 0;
+	for (i = 0; i < LOAN_BUFFERS; ++i)
+		loans_intact += (loans[i] != NULL && *loaned_payloads[i] == i);
+	for (i = 0; i < LOAN_BUFFERS; ++i)
+		BufferPoolRelease(&read_pool, loans[i]);
+	return NULL;
+}
+
+
+int test13(struct Options options)
+{
+	pthread_t releaser;
+	unsigned char packet[64];
+	int i, rc = 0;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 13 - loaned read buffers");
+
+	atomic_init(&loans_taken, 0);
+	rc = BufferPoolInit(&read_pool, LOAN_BUFFERS, sizeof(readbuf));
+	assert("Good rc from pool init", rc == 0, "rc was %d\n", rc);
+	MemoryBrokerInit(&broker);
+	rc = connect_client(60);
+	assert("Good rc from connect", rc == SUCCESS, "rc was %d\n", rc);
+	rc = MQTTSubscribe(&client, "loan/#", QOS1, loanMessageArrived);
+	assert("Good rc from subscribe", rc == SUCCESS, "rc was %d\n", rc);
+	MQTTSetReadBuffers(&client, BufferPoolReadBuffer, &read_pool);
+
+	for (i = 0; i < LOAN_MESSAGES; ++i)
+	{
+		MQTTString topic = MQTTString_initializer;
+		int len;
+
+		topic.cstring = "loan/x";
+		len = MQTTSerialize_publish(packet, sizeof(packet), 0, QOS1, 0, i + 1, topic, (unsigned char*)&i, sizeof(i));
+		rc = MemoryBrokerSend(&broker, packet, len);
+	}
+	assert("Messages queued", rc == 0, "rc was %d\n", rc);
+
+	/* every buffer ends up on loan, so reading pauses until they are released */
+	pthread_create(&releaser, NULL, loanReleaser, NULL);
+	while (loans_taken < LOAN_MESSAGES && rc == SUCCESS)
+		rc = MQTTYield(&client, 10);
+	assert("Good rc from yield", rc == SUCCESS, "rc was %d\n", rc);
+	pthread_join(releaser, NULL);
+	assert("Reads paused", loans_paused, "loans_paused %d\n", loans_paused);
+	assert("Loaned messages intact", loans_intact == LOAN_BUFFERS, "intact %d\n", loans_intact);
+	assert("Reads resumed", broker.received[PUBACK] == LOAN_MESSAGES, "pubacks %lu\n", broker.received[PUBACK]);
+	assert("Last payloads", *loaned_payloads[LOAN_MESSAGES - 1] == LOAN_MESSAGES - 1,
+	    "payload %d\n", *loaned_payloads[LOAN_MESSAGES - 1]);
+	for (i = LOAN_BUFFERS; i < LOAN_MESSAGES; ++i)
+		BufferPoolRelease(&read_pool, loans[i]);
+
+	MQTTSetReadBuffers(&client, NULL, NULL);
+	client.readbuf = readbuf;
+	MQTTDisconnect(&client);
+	BufferPoolDestroy(&read_pool);
+
+	MyLog(LOGA_INFO, "TEST13: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 14: clients with only a scratch area borrow from a shared pool
+
+*********************************************************************/
+#define SHARED_CLIENTS 4
+#define SHARED_PAYLOAD 1000
+
+static SharedPool shared_pool;
+static MemoryBroker shared_brokers[SHARED_CLIENTS];
+static Network shared_networks[SHARED_CLIENTS];
+static MQTTClient shared_clients[SHARED_CLIENTS];
+static unsigned char shared_scratch[SHARED_CLIENTS][2][8];
+static unsigned char shared_payload[SHARED_PAYLOAD];
+static int shared_arrived, shared_intact;
+static long shared_lent; /* buffers lent while a handler runs */
+
+void sharedMessageArrived(MessageData* md)
+{
+	++shared_arrived;
+	shared_intact += (md->message->payloadlen == SHARED_PAYLOAD &&
+	    memcmp(md->message->payload, shared_payload, SHARED_PAYLOAD) == 0);
+	shared_lent = atomic_load(&shared_pool.lent);
+}
+
+static int shared_borrows;
+
+unsigned char* countedBorrow(void* pool, size_t size, size_t* lent)
+{
+	++shared_borrows;
+	return SharedPoolBorrow(pool, size, lent);
+}
+
+
+int test14(struct Options options)
+{
+	MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+	MQTTMessage message;
+	int i, rc = 0;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 14 - shared buffer pool");
+
+	for (i = 0; i < SHARED_PAYLOAD; ++i)
+		shared_payload[i] = (unsigned char)i;
+	rc = SharedPoolInit(&shared_pool, 4096, 2);
+	assert("Good rc from pool init", rc == 0, "rc was %d\n", rc);
+	MemoryClockReset();
+	shared_arrived = shared_intact = 0;
+
+	for (i = 0; i < SHARED_CLIENTS && rc == SUCCESS; ++i)
+	{
+		MQTTClient* c = &shared_clients[i];
+
+		MemoryBrokerInit(&shared_brokers[i]);
+		NetworkInit(&shared_networks[i]);
+		NetworkConnect(&shared_networks[i], &shared_brokers[i]);
+		MQTTClientInit(c, &shared_networks[i], 1000, shared_scratch[i][0], sizeof(shared_scratch[i][0]),
+		    shared_scratch[i][1], sizeof(shared_scratch[i][1]));
+		MQTTSetBufferLender(c, SharedPoolBorrow, SharedPoolGiveBack, &shared_pool);
+		data.keepAliveInterval = 60;
+		data.clientID.cstring = "test_memory_shared";
+		if ((rc = MQTTConnect(c, &data)) == SUCCESS)
+			rc = MQTTSubscribe(c, "shared/#", QOS1, sharedMessageArrived);
+	}
+	assert("Good rc from connect and subscribe", rc == SUCCESS, "rc was %d\n", rc);
+	assert("Nothing lent while idle", atomic_load(&shared_pool.lent) == 0, "lent %ld\n", atomic_load(&shared_pool.lent));
+
+	/* a packet far larger than the scratch area, each way, for every client */
+	for (i = 0; i < SHARED_CLIENTS && rc == SUCCESS; ++i)
+	{
+		message.qos = QOS1;
+		message.retained = 0;
+		message.payload = shared_payload;
+		message.payloadlen = SHARED_PAYLOAD;
+		if ((rc = MQTTPublish(&shared_clients[i], "shared/out", &message)) == SUCCESS &&
+		    (rc = MemoryBrokerPublish(&shared_brokers[i], "shared/in", QOS1, shared_payload, SHARED_PAYLOAD, 1)) == 0)
+			rc = MQTTYield(&shared_clients[i], 10);
+		assert("Publish received", shared_brokers[i].received[PUBLISH] == 1, "received %lu\n", shared_brokers[i].received[PUBLISH]);
+		assert("Publish acknowledged", shared_brokers[i].received[PUBACK] == 1, "pubacks %lu\n", shared_brokers[i].received[PUBACK]);
+	}
+	assert("Good rc from publish and yield", rc == SUCCESS, "rc was %d\n", rc);
+	assert("Every message arrived", shared_arrived == SHARED_CLIENTS, "arrived %d\n", shared_arrived);
+	assert("Messages intact", shared_intact == SHARED_CLIENTS, "intact %d\n", shared_intact);
+	assert("One buffer lent while handling", shared_lent == 1, "lent %ld\n", shared_lent);
+	assert("Nothing lent while idle", atomic_load(&shared_pool.lent) == 0, "lent %ld\n", atomic_load(&shared_pool.lent));
+	/* one at a time, so the pool holds no more than one buffer of each size used */
+	assert("Pool memory follows the traffic", atomic_load(&shared_pool.held_bytes) <= 2 * 1024 + 256,
+	    "held %ld\n", atomic_load(&shared_pool.held_bytes));
+
+	/* a publish source with nothing waiting borrows nothing */
+	rc = PublishQueueInit(&publish_queue, NULL);
+	MQTTSetBufferLender(&shared_clients[0], countedBorrow, SharedPoolGiveBack, &shared_pool);
+	MQTTSetPublishSource(&shared_clients[0], PublishQueueSource, &publish_queue, 1);
+	shared_borrows = 0;
+	rc = MQTTYield(&shared_clients[0], 50);
+	assert("Good rc from yield", rc == SUCCESS, "rc was %d\n", rc);
+	assert("Nothing borrowed by idle cycles", shared_borrows == 0, "borrowed %d times\n", shared_borrows);
+	message.qos = QOS0;
+	message.payloadlen = 16;
+	rc = PublishQueuePublish(&publish_queue, "shared/queued", &message);
+	rc = MQTTYield(&shared_clients[0], 10);
+	assert("Queued publish sent", shared_brokers[0].received[PUBLISH] == 2, "received %lu\n", shared_brokers[0].received[PUBLISH]);
+	assert("Borrowed to send it", shared_borrows == 1, "borrowed %d times\n", shared_borrows);
+	MQTTSetPublishSource(&shared_clients[0], NULL, NULL, 0);
+	PublishQueueDestroy(&publish_queue);
+
+	for (i = 0; i < SHARED_CLIENTS; ++i)
+		MQTTDisconnect(&shared_clients[i]);
+	SharedPoolDestroy(&shared_pool);
+
+	MyLog(LOGA_INFO, "TEST14: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 15: inbound QoS 2 duplicates, with many messages waiting for their PUBREL
+
+*********************************************************************/
+int test15(struct Options options)
+{
+	MQTTString topic = MQTTString_initializer;
+	unsigned char payload[16], packet[64];
+	int len = 0, rc = 0;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 15 - QoS 2 duplicate detection");
+
+	memset(payload, 'x', sizeof(payload));
+	MemoryBrokerInit(&broker);
+	broker.respond_publishes = 0; /* hold back the PUBRELs, so every id stays in flight */
+	broker.max_inflight = 1000;
+	rc = connect_client(60);
+	assert("Good rc from connect", rc == SUCCESS, "rc was %d\n", rc);
+	rc = MQTTSubscribe(&client, "dup/#", QOS2, messageArrived);
+	assert("Good rc from subscribe", rc == SUCCESS, "rc was %d\n", rc);
+
+	messages_arrived = 0;
+	rc = MemoryBrokerPublish(&broker, "dup/a", QOS2, payload, sizeof(payload), 1000);
+	rc = MQTTYield(&client, 100);
+	assert("Good rc from yield", rc == SUCCESS, "rc was %d\n", rc);
+	assert("Every message delivered", messages_arrived == 1000, "arrived %d\n", messages_arrived);
+
+	topic.cstring = "dup/a";
+	len = MQTTSerialize_publish(packet, sizeof(packet), 1, QOS2, 0, 500, topic, payload, sizeof(payload));
+	MemoryBrokerSend(&broker, packet, len);
+	rc = MQTTYield(&client, 100);
+	assert("Duplicate not delivered", messages_arrived == 1000, "arrived %d\n", messages_arrived);
+	assert("Duplicate acknowledged", broker.received[PUBREC] == 1001, "PUBREC %lu\n", broker.received[PUBREC]);
+
+	MemoryBrokerSend(&broker, packet, MQTTSerialize_ack(packet, sizeof(packet), PUBREL, 0, 500));
+	rc = MQTTYield(&client, 100);
+	assert("Release completed", broker.received[PUBCOMP] == 1, "PUBCOMP %lu\n", broker.received[PUBCOMP]);
+	len = MQTTSerialize_publish(packet, sizeof(packet), 0, QOS2, 0, 500, topic, payload, sizeof(payload));
+	MemoryBrokerSend(&broker, packet, len);
+	rc = MQTTYield(&client, 100);
+	assert("Released id reused", messages_arrived == 1001, "arrived %d\n", messages_arrived);
+	MQTTDisconnect(&client);
+
+	MyLog(LOGA_INFO, "TEST15: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 16: the function profiler of a PAHO_WITH_PROFILE build
+
+*********************************************************************/
+int test16(struct Options options)
+{
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 16 - function profiler");
+
+#if defined(MQTT_PROFILE)
+	{
+		MQTTString topic = MQTTString_initializer, topicName = MQTTString_initializer;
+		unsigned char payload[16], packet[64], dup, retained, *payload_out;
+		unsigned short packetid;
+		unsigned long calls = 0;
+		unsigned long long total = 0, self = 0;
+		int qos, payloadlen, len = 0, i;
+		char folded[2048];
+		FILE* f = tmpfile();
+
+		memset(payload, 'x', sizeof(payload));
+		topic.cstring = "profile/a";
+		StackTrace_reset();
+		for (i = 0; i < 1000; ++i)
+		{
+			len = MQTTSerialize_publish(packet, sizeof(packet), 0, 1, 0, i + 1, topic, payload, sizeof(payload));
+			MQTTDeserialize_publish(&dup, &qos, &retained, &packetid, &topicName, &payload_out, &payloadlen, packet, len);
+		}
+
+		StackTrace_getStats("MQTTSerialize_publish", &calls, &total, &self);
+		assert("Serialize calls counted", calls == 1000, "calls %lu\n", calls);
+		StackTrace_getStats("MQTTDeserialize_publish", &calls, &total, &self);
+		assert("Deserialize calls counted", calls == 1000, "calls %lu\n", calls);
+		assert("Self time within total", self > 0 && self <= total, "self %llu total %llu\n", self, total);
+		StackTrace_getStats("readMQTTLenString", &calls, &total, &self);
+		assert("Nested calls counted", calls == 1000, "calls %lu\n", calls);
+
+		StackTrace_dumpFolded(f);
+		rewind(f);
+		folded[fread(folded, 1, sizeof(folded) - 1, f)] = '\0';
+		fclose(f);
+		assert("Call paths folded", strstr(folded, "MQTTDeserialize_publish;readMQTTLenString ") != NULL,
+			"folded was %s\n", folded);
+		if (options.verbose)
+			StackTrace_dump(stdout);
+
+		StackTrace_reset();
+		StackTrace_getStats("MQTTSerialize_publish", &calls, &total, &self);
+		assert("Counts reset", calls == 0 && total == 0, "calls %lu\n", calls);
+	}
+#else
+	MyLog(LOGA_INFO, "Not a PAHO_WITH_PROFILE build, so nothing to test");
+#endif
+
+	MyLog(LOGA_INFO, "TEST16: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+int main(int argc, char** argv)
+{
+	int rc = 0;
+	int (*tests[])(struct Options) = {NULL, test1, test2, test3, test4, test5, test6, test7, test8, test9, test10, test11, test12, test13, test14, test15, test16};
+
+	getopts(argc, argv);
+
+	if (options.test_no == 0)
+	{ /* run all the tests */
+		for (options.test_no = 1; options.test_no < ARRAY_SIZE(tests); ++options.test_no)
+			rc += tests[options.test_no](options); /* return number of failures.  0 = test succeeded */
+	}
+	else
+		rc = tests[options.test_no](options); /* run just the selected test */
+
+	if (rc == 0)
+		MyLog(LOGA_INFO, "verdict pass");
+	else
+		MyLog(LOGA_INFO, "verdict fail");
+	return rc;
+}
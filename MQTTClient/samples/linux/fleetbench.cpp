@@ -0,0 +1,291 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *   http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial contribution
+ *******************************************************************************/
+
+/*
+
+ fleet benchmark
+
+ Connects many MQTT::Client objects over loopback TCP and drives them all from
+ one thread with a PollDriver, as a device fleet simulator would, then reports
+ the cost of connecting them, of keeping them alive, and the memory each takes.
+ Without --host, the broker is an in-process peer which only answers CONNECT and
+ PINGREQ.  Each client takes a file descriptor, and two with the in-process peer,
+ so the open file limit is raised to its hard limit first.
+
+ defaulted parameters:
+
+	--clients 10000
+	--keepalive 5     seconds
+	--duration 12     seconds to drive the connected fleet for
+	--host none       an MQTT broker to connect to, instead of the in-process peer
+	--port 1883
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include "MQTTClient.h"
+#include "linuxpoll.cpp"
+
+
+struct opts_struct
+{
+	int clients;
+	int keepalive;
+	int duration;
+	const char* host;
+	int port;
+} opts =
+{
+	10000, 5, 12, NULL, 1883
+};
+
+
+void getopts(int argc, char** argv)
+{
+	int count = 1;
+
+	while (count < argc)
+	{
+		if (strcmp(argv[count], "--clients") == 0 && ++count < argc)
+			opts.clients = atoi(argv[count]);
+		else if (strcmp(argv[count], "--keepalive") == 0 && ++count < argc)
+			opts.keepalive = atoi(argv[count]);
+		else if (strcmp(argv[count], "--duration") == 0 && ++count < argc)
+			opts.duration = atoi(argv[count]);
+		else if (strcmp(argv[count], "--host") == 0 && ++count < argc)
+			opts.host = argv[count];
+		else if (strcmp(argv[count], "--port") == 0 && ++count < argc)
+			opts.port = atoi(argv[count]);
+		else
+		{
+			printf("Usage: fleetbench [--clients <n>] [--keepalive <s>] [--duration <s>] [--host <broker>] [--port <port>]\n");
+			exit(-1);
+		}
+		count++;
+	}
+}
+
+
+typedef MQTT::Client<IPStack, Countdown, 100, 1> Client;
+
+static volatile int peer_stopping = 0;
+static unsigned long peer_pings = 0;
+static int lost = 0;
+
+
+void connectionLost(Client& client, void* context)
+{
+	++lost;
+}
+
+
+// The in-process broker: answers each CONNECT with a CONNACK and each PINGREQ with a PINGRESP.
+// Client packets are small and sent whole, so each read is taken to hold whole packets.
+static void* peer_run(void* arg)
+{
+	int listen_socket = *(int*)arg;
+	int epfd = epoll_create1(0);
+	struct epoll_event event, events[MAX_POLL_EVENTS];
+	unsigned char buf[1024], reply[8];
+
+	event.events = EPOLLIN;
+	event.data.fd = listen_socket;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, listen_socket, &event);
+	while (!peer_stopping)
+	{
+		int n = epoll_wait(epfd, events, MAX_POLL_EVENTS, 100);
+
+		for (int i = 0; i < n; ++i)
+		{
+			int fd = events[i].data.fd, rc = 0;
+
+			if (fd == listen_socket)
+			{
+				if ((fd = accept(listen_socket, NULL, NULL)) < 0)
+					continue;
+				event.data.fd = fd;
+				epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event);
+				continue;
+			}
+			if ((rc = read(fd, buf, sizeof(buf))) <= 0)
+			{
+				close(fd);
+				continue;
+			}
+			for (int pos = 0; pos + 1 < rc; )
+			{
+				int rem_len = 0, len = MQTTPacket_decodeBuf(&buf[pos + 1], &rem_len);
+				int type = buf[pos] >> 4, reply_len = 0;
+
+				if (type == CONNECT)
+				{
+					reply_len = MQTTSerialize_connack(reply, sizeof(reply), 0, 0);
+					if (write(fd, reply, reply_len) != reply_len)
+						break;
+				}
+				else if (type == PINGREQ)
+				{
+					reply[0] = PINGRESP << 4;
+					reply[1] = 0;
+					reply_len = 2;
+					if (write(fd, reply, reply_len) != reply_len)
+						break;
+					peer_pings++;
+				}
+				pos += 1 + len + rem_len;
+			}
+		}
+	}
+	close(epfd);
+	return NULL;
+}
+
+
+static int listen_tcp(int* port)
+{
+	struct sockaddr_in address;
+	socklen_t addrlen = sizeof(address);
+	int s = socket(AF_INET, SOCK_STREAM, 0);
+
+	memset(&address, '\0', sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(s, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(s, SOMAXCONN) != 0 ||
+	    getsockname(s, (struct sockaddr*)&address, &addrlen) != 0)
+		return -1;
+	*port = ntohs(address.sin_port);
+	return s;
+}
+
+
+static double elapsed_s(struct timeval& start)
+{
+	struct timeval now, res;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, &start, &res);
+	return res.tv_sec + res.tv_usec / 1000000.0;
+}
+
+
+static double cpu_s()
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+}
+
+
+static long rss_kb()
+{
+	long pages = 0, resident = 0;
+	FILE* f = fopen("/proc/self/statm", "r");
+
+	if (f)
+	{
+		if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+		fclose(f);
+	}
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+
+int main(int argc, char** argv)
+{
+	struct rlimit limit;
+	pthread_t peer;
+	int listen_socket = -1, port = 0, connected = 0;
+	const char* host = "127.0.0.1";
+	unsigned long serviced = 0;
+	struct timeval start;
+	double cpu = 0;
+	long rss = 0;
+
+	getopts(argc, argv);
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+	if (opts.host)
+	{
+		host = opts.host;
+		port = opts.port;
+	}
+	else
+	{
+		if ((listen_socket = listen_tcp(&port)) < 0)
+			return -1;
+		pthread_create(&peer, NULL, peer_run, &listen_socket);
+	}
+
+	IPStack* stacks = new IPStack[opts.clients];
+	Client** clients = new Client*[opts.clients]();
+	PollDriver<Client> driver(opts.clients);
+	MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+	char clientid[32];
+
+	driver.setLostHandler(connectionLost, NULL);
+	data.keepAliveInterval = opts.keepalive;
+	data.clientID.cstring = clientid;
+	rss = rss_kb();
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < opts.clients; ++i)
+	{
+		clients[i] = new Client(stacks[i]);
+		snprintf(clientid, sizeof(clientid), "fleet-%d", i);
+		if (stacks[i].connect(host, port) != 0 || clients[i]->connect(data) != MQTT::SUCCESS ||
+		    driver.add(*clients[i], stacks[i].getSocket()) != 0)
+		{
+			printf("Client %d failed to connect\n", i);
+			break;
+		}
+		connected++;
+	}
+	printf("%d clients connected in %.2f s, taking %ld KB resident (%lu bytes of each is the Client)\n",
+		connected, elapsed_s(start), rss_kb() - rss, (unsigned long)sizeof(Client));
+
+	cpu = cpu_s();
+	gettimeofday(&start, NULL);
+	while (elapsed_s(start) < opts.duration && driver.count() > 0)
+		serviced += driver.run(100);
+	cpu = cpu_s() - cpu;
+	printf("Drove %d clients for %d s with %d s keepalive: %lu services, %d connections lost, "
+		"%.3f s CPU (%.2f us per client per second)\n", connected, opts.duration, opts.keepalive,
+		serviced, lost, cpu, cpu * 1000000.0 / ((double)connected * opts.duration));
+
+	for (int i = 0; i < connected; ++i)
+	{
+		clients[i]->disconnect();
+		stacks[i].disconnect();
+	}
+	for (int i = 0; i < opts.clients; ++i)
+		delete clients[i];
+	delete[] clients;
+	delete[] stacks;
+	if (listen_socket >= 0)
+	{
+		peer_stopping = 1;
+		pthread_join(peer, NULL);
+		close(listen_socket);
+		printf("%lu pings answered by the in-process peer\n", peer_pings);
+	}
+	return (lost == 0) ? 0 : 1;
+}
@@ -0,0 +1,463 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *   http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial contribution
+ *******************************************************************************/
+
+/*
+
+ capture replay
+
+ Replays a capture written by CaptureNetwork (src/linux/linuxcapture.cpp), to
+ measure the packet parser and the client's dispatch on real traffic:
+
+ 1. decode: each frame, in both directions, is passed to its MQTTDeserialize_ function
+ 2. dispatch: the frames each connection received are fed to an MQTT::Client of its own,
+    which reads them through cycle() as from a socket - delivering PUBLISHes to a
+    handler, and acknowledging them to a network which discards what is written
+
+ At --speed max frames are fed as fast as they are taken, and --iterations repeats
+ both passes.  At --speed recorded, the dispatch pass feeds each frame at its
+ recorded time, for one iteration.  Truncated frames are counted, but not replayed.
+
+ --pcap writes the capture as a pcap file of IPv4 and TCP packets, with each
+ connection from its own port to 1883, for Wireshark and tcpdump to decode.
+
+ defaulted parameters:
+
+	--speed max          or recorded
+	--iterations 1
+	--pcap none          a pcap file to write
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MQTTCLIENT_QOS2 1
+#include "MQTTClient.h"
+#include "linux.cpp"
+#include "linuxcapture.cpp"
+
+
+struct opts_struct
+{
+	int recorded;
+	int iterations;
+	const char* pcap;
+	const char* capture;
+} opts =
+{
+	0, 1, NULL, NULL
+};
+
+
+void usage()
+{
+	printf("Usage: mqttreplay [--speed max|recorded] [--iterations <n>] [--pcap <file>] <capture file>\n");
+	exit(-1);
+}
+
+
+void getopts(int argc, char** argv)
+{
+	int count = 1;
+
+	while (count < argc)
+	{
+		if (strcmp(argv[count], "--speed") == 0 && ++count < argc)
+			opts.recorded = (strcmp(argv[count], "recorded") == 0);
+		else if (strcmp(argv[count], "--iterations") == 0 && ++count < argc)
+			opts.iterations = atoi(argv[count]);
+		else if (strcmp(argv[count], "--pcap") == 0 && ++count < argc)
+			opts.pcap = argv[count];
+		else if (argv[count][0] != '-' && opts.capture == NULL)
+			opts.capture = argv[count];
+		else
+			usage();
+		count++;
+	}
+	if (opts.capture == NULL || opts.iterations < 1)
+		usage();
+}
+
+
+/**
+ * The Network of a replayed connection: reads take the bytes of the frame being
+ * fed, and writes are counted and discarded.
+ */
+class ReplayStack
+{
+public:
+	ReplayStack() : data(0), len(0), pos(0), written(0)
+	{
+
+	}
+
+	void feed(const unsigned char* bytes, int length)
+	{
+		data = bytes;
+		len = length;
+		pos = 0;
+	}
+
+	int pending()
+	{
+		return len - pos;
+	}
+
+	int read(unsigned char* buffer, int count, int timeout_ms)
+	{
+		if (count > len - pos)
+			count = len - pos;
+		memcpy(buffer, &data[pos], count);
+		pos += count;
+		return count;
+	}
+
+	int write(unsigned char* buffer, int count, int timeout)
+	{
+		written++;
+		return count;
+	}
+
+	const unsigned char* data;
+	int len;
+	int pos;
+	unsigned long written;
+};
+
+
+typedef MQTT::Client<ReplayStack, Countdown, MAX_CAPTURE_FRAME, 1> Client;
+
+static unsigned long delivered = 0;
+
+
+void messageArrived(MQTT::MessageData& md)
+{
+	++delivered;
+}
+
+
+static void unload(CaptureFrame* frames, int count)
+{
+	for (int i = 0; i < count; ++i)
+		free(frames[i].data);
+	free(frames);
+}
+
+
+static CaptureFrame* load(const char* filename, int* count)
+{
+	CaptureReader reader;
+	CaptureFrame frame, *frames = NULL;
+	int max = 0, rc = 0;
+
+	*count = 0;
+	if (reader.open(filename) != 0)
+		return NULL;
+	while ((rc = reader.next(frame)) == 1)
+	{
+		unsigned char* data = NULL;
+
+		if (*count == max)
+		{
+			CaptureFrame* more = NULL;
+
+			max = (max == 0) ? 1024 : max * 2;
+			if ((more = (CaptureFrame*)realloc(frames, max * sizeof(CaptureFrame))) == NULL)
+				goto nomem;
+			frames = more;
+		}
+		if ((data = (unsigned char*)malloc(frame.captured + 1)) == NULL)
+			goto nomem;
+		frame.data = (unsigned char*)memcpy(data, frame.data, frame.captured);
+		frames[(*count)++] = frame;
+	}
+	if (rc < 0)
+		printf("Capture cut off after %d frames\n", *count);
+	return frames;
+
+nomem:
+	printf("Out of memory loading frame %d\n", *count);
+	unload(frames, *count);
+	*count = 0;
+	return NULL;
+}
+
+
+static double now_s()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+
+// pass a frame to the MQTTDeserialize_ function for its type
+static int decode(CaptureFrame& frame)
+{
+	MQTTString topics[8];
+	int qoss[8];
+	unsigned char dup, retained, c1, c2;
+	unsigned short packetid;
+	int qos, count, payloadlen;
+	unsigned char* payload;
+
+	switch (frame.data[0] >> 4)
+	{
+		case CONNECT:
+		{
+			MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+			return MQTTDeserialize_connect(&data, frame.data, frame.captured);
+		}
+		case CONNACK:
+			return MQTTDeserialize_connack(&c1, &c2, frame.data, frame.captured);
+		case PUBLISH:
+			return MQTTDeserialize_publish(&dup, &qos, &retained, &packetid, &topics[0], &payload, &payloadlen,
+				frame.data, frame.captured);
+		case PUBACK:
+		case PUBREC:
+		case PUBREL:
+		case PUBCOMP:
+			return MQTTDeserialize_ack(&c1, &dup, &packetid, frame.data, frame.captured);
+		case SUBSCRIBE:
+			return MQTTDeserialize_subscribe(&dup, &packetid, 8, &count, topics, qoss, frame.data, frame.captured);
+		case SUBACK:
+			return MQTTDeserialize_suback(&packetid, 8, &count, qoss, frame.data, frame.captured);
+		case UNSUBSCRIBE:
+			return MQTTDeserialize_unsubscribe(&dup, &packetid, 8, &count, topics, frame.data, frame.captured);
+		case UNSUBACK:
+			return MQTTDeserialize_unsuback(&packetid, frame.data, frame.captured);
+		default:
+			return 1; // PINGREQ, PINGRESP and DISCONNECT are only a header
+	}
+}
+
+
+// feed one received frame to the client of its connection, connecting it first if need be
+static int dispatch(Client* client, ReplayStack& stack, CaptureFrame& frame)
+{
+	static MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+	unsigned char connack[4];
+
+	if (!client->isConnected())
+	{
+		if ((frame.data[0] >> 4) == CONNACK)
+			stack.feed(frame.data, frame.captured);
+		else // the capture started after the connect, so answer it with a CONNACK of our own
+			stack.feed(connack, MQTTSerialize_connack(connack, sizeof(connack), 0, 0));
+		data.keepAliveInterval = 0; // the capture holds the PINGRESPs, so don't add PINGREQs
+		if (client->connect(data) != MQTT::SUCCESS)
+			return -1;
+		if ((frame.data[0] >> 4) == CONNACK)
+			return 0;
+	}
+	else if ((frame.data[0] >> 4) == CONNACK)
+		return 0;
+	stack.feed(frame.data, frame.captured);
+	while (stack.pending() > 0)
+	{
+		if (client->poll() != MQTT::SUCCESS)
+			return -1;
+	}
+	return 0;
+}
+
+
+static int replay(CaptureFrame* frames, int count, unsigned int connections, unsigned long* fed)
+{
+	ReplayStack* stacks = new ReplayStack[connections];
+	Client** clients = new Client*[connections]();
+	double start = now_s();
+	int failures = 0;
+
+	for (int i = 0; i < count; ++i)
+	{
+		CaptureFrame& frame = frames[i];
+
+		if (frame.direction != CAPTURE_RECEIVED || frame.captured < frame.length)
+			continue;
+		if (opts.recorded)
+		{
+			double wait = (frame.time_us - frames[0].time_us) / 1000000.0 - (now_s() - start);
+
+			if (wait > 0)
+			{
+				struct timespec ts = {(time_t)wait, (long)((wait - (time_t)wait) * 1000000000)};
+				nanosleep(&ts, NULL);
+			}
+		}
+		if (clients[frame.connection] == NULL)
+		{
+			clients[frame.connection] = new Client(stacks[frame.connection], 1000);
+			clients[frame.connection]->setDefaultMessageHandler(messageArrived);
+		}
+		if (dispatch(clients[frame.connection], stacks[frame.connection], frame) != 0)
+			failures++;
+		(*fed)++;
+	}
+	for (unsigned int i = 0; i < connections; ++i)
+		delete clients[i];
+	delete[] clients;
+	delete[] stacks;
+	return failures;
+}
+
+
+static unsigned char* writeShort(unsigned char* ptr, unsigned int value)
+{
+	*ptr++ = (unsigned char)(value >> 8);
+	*ptr++ = (unsigned char)value;
+	return ptr;
+}
+
+
+static unsigned char* writeLong(unsigned char* ptr, unsigned int value)
+{
+	return writeShort(writeShort(ptr, value >> 16), value & 0xFFFF);
+}
+
+
+// a raw IPv4 (LINKTYPE_RAW) pcap, with a TCP segment for each frame
+static int export_pcap(const char* filename, CaptureFrame* frames, int count, unsigned int connections)
+{
+	struct { unsigned int magic; unsigned short major, minor; int thiszone; unsigned int sigfigs, snaplen, linktype; } file_header =
+		{0xa1b2c3d4, 2, 4, 0, 0, 65535, 101};
+	unsigned int* seq = (unsigned int*)calloc(connections * 2, sizeof(unsigned int));
+	FILE* f = fopen(filename, "wb");
+
+	if (f == NULL || seq == NULL)
+	{
+		if (f)
+			fclose(f);
+		free(seq);
+		return -1;
+	}
+	fwrite(&file_header, sizeof(file_header), 1, f);
+	for (int i = 0; i < count; ++i)
+	{
+		CaptureFrame& frame = frames[i];
+		struct { unsigned int ts_sec, ts_usec, incl_len, orig_len; } record_header;
+		unsigned char headers[40], *ptr = headers;
+		unsigned int client_port = 49152 + frame.connection % 16384, checksum = 0;
+		unsigned int* my_seq = &seq[frame.connection * 2 + frame.direction];
+		unsigned int* peer_seq = &seq[frame.connection * 2 + !frame.direction];
+		int length = (frame.length + 40 > 65535) ? 65535 : frame.length + 40;
+
+		record_header.ts_sec = (unsigned int)(frame.time_us / 1000000);
+		record_header.ts_usec = (unsigned int)(frame.time_us % 1000000);
+		record_header.incl_len = (frame.captured + 40 > length) ? length : frame.captured + 40;
+		record_header.orig_len = length;
+
+		*ptr++ = 0x45;           // IPv4, 20 byte header
+		*ptr++ = 0;
+		ptr = writeShort(ptr, length);
+		ptr = writeShort(ptr, i);
+		ptr = writeShort(ptr, 0x4000); // don't fragment
+		*ptr++ = 64;
+		*ptr++ = 6;              // TCP
+		ptr = writeShort(ptr, 0);
+		ptr = writeLong(ptr, 0x7F000001);
+		ptr = writeLong(ptr, 0x7F000001);
+		for (int j = 0; j < 20; j += 2)
+			checksum += (headers[j] << 8) | headers[j + 1];
+		while (checksum >> 16)
+			checksum = (checksum & 0xFFFF) + (checksum >> 16);
+		writeShort(&headers[10], ~checksum & 0xFFFF);
+
+		ptr = writeShort(ptr, (frame.direction == CAPTURE_SENT) ? client_port : 1883);
+		ptr = writeShort(ptr, (frame.direction == CAPTURE_SENT) ? 1883 : client_port);
+		ptr = writeLong(ptr, *my_seq);
+		ptr = writeLong(ptr, *peer_seq);
+		*ptr++ = 5 << 4;         // 20 byte header
+		*ptr++ = 0x18;           // PSH, ACK
+		ptr = writeShort(ptr, 65535);
+		ptr = writeShort(ptr, 0); // checksum, left out
+		ptr = writeShort(ptr, 0);
+		*my_seq += frame.length;
+
+		fwrite(&record_header, sizeof(record_header), 1, f);
+		fwrite(headers, 1, sizeof(headers), f);
+		fwrite(frame.data, 1, record_header.incl_len - 40, f);
+	}
+	free(seq);
+	return fclose(f);
+}
+
+
+int main(int argc, char** argv)
+{
+	CaptureFrame* frames = NULL;
+	unsigned int connections = 0;
+	unsigned long bytes = 0;
+	int count = 0, truncated = 0, rc = 0;
+
+	getopts(argc, argv);
+	if ((frames = load(opts.capture, &count)) == NULL)
+	{
+		printf("No frames read from %s\n", opts.capture);
+		return -1;
+	}
+	for (int i = 0; i < count; ++i)
+	{
+		if (frames[i].connection >= connections)
+			connections = frames[i].connection + 1;
+		if (frames[i].captured < frames[i].length)
+			truncated++;
+		bytes += frames[i].captured;
+	}
+	printf("%d frames, %lu bytes, on %u connections, %d truncated\n", count, bytes, connections, truncated);
+
+	if (opts.pcap)
+	{
+		if (export_pcap(opts.pcap, frames, count, connections) != 0)
+			printf("Failed to write %s\n", opts.pcap);
+		else
+			printf("Wrote %s\n", opts.pcap);
+	}
+
+	double start = now_s();
+	unsigned long decoded = 0;
+	int failures = 0;
+	bytes = 0;
+	for (int n = 0; n < opts.iterations; ++n)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			if (frames[i].captured < frames[i].length)
+				continue;
+			if (decode(frames[i]) <= 0)
+				failures++;
+			decoded++;
+			bytes += frames[i].captured;
+		}
+	}
+	double elapsed = now_s() - start;
+	printf("decode: %lu frames in %.3f s, %.0f frames/s, %.1f MB/s, %d failures\n", decoded, elapsed,
+		decoded / elapsed, bytes / elapsed / 1000000, failures);
+
+	unsigned long fed = 0;
+	start = now_s();
+	failures = 0;
+	for (int n = 0; n < (opts.recorded ? 1 : opts.iterations); ++n)
+		failures += replay(frames, count, connections, &fed);
+	elapsed = now_s() - start;
+	printf("dispatch: %lu frames fed in %.3f s, %.0f frames/s, %lu messages delivered, %d failures\n",
+		fed, elapsed, fed / elapsed, delivered, failures);
+	rc = (failures == 0) ? 0 : 1;
+
+	unload(frames, count);
+	return rc;
+}
@@ -0,0 +1,248 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial message handler policies
+ *******************************************************************************/
+
+#if !defined(MQTT_HANDLERS_H)
+#define MQTT_HANDLERS_H
+
+// Message handler types for the MessageHandler parameter of MQTT::Client, in place of FP.
+// Both have the methods of FP the client uses - attach(function), attached, detach and
+// operator() - so plain function pointers can still be passed to subscribe.
+//
+// Delegate holds any small callable in place - a lambda with captures, a function object
+// or an object and member function - without allocating:
+//
+//   typedef MQTT::Delegate<void, MQTT::MessageData&> Handler;
+//   MQTT::Client<IPStack, Countdown, 100, 5, Handler> client(ipstack);
+//   client.subscribe("sensors/#", MQTT::QOS1, Handler([&](MQTT::MessageData& md) { store.add(md); }));
+//
+// HandlerTable calls one of a set of handler types fixed at compile time, so the call is
+// resolved statically and can be inlined into the client's deliverMessage:
+//
+//   typedef MQTT::HandlerTable<MQTT::MessageData&, Telemetry, Commands> Handler;
+//   MQTT::Client<IPStack, Countdown, 100, 5, Handler> client(ipstack);
+//   client.subscribe("telemetry/#", MQTT::QOS0, Handler::of<Telemetry>());
+
+#include <new>
+
+#if __cplusplus >= 201103L
+#include <type_traits>
+#endif
+
+namespace MQTT
+{
+
+
+/**
+ * @class Delegate
+ * @brief A callable held in place, in SIZE bytes
+ *
+ * The callable is copied bytewise with the delegate, so must be trivially copyable: a
+ * lambda capturing references, pointers or plain values, or a simple function object.
+ * Calls go through one function pointer, as for FP, but the callable can carry state.
+ */
+template<class retT, class argT, int SIZE = 4 * sizeof(void*)>
+class Delegate
+{
+public:
+    Delegate() : invoker(0)
+    {
+
+    }
+
+    /** Create the delegate holding a callable */
+    template<class F>
+    explicit Delegate(const F& callable) : invoker(0)
+    {
+        attach(callable);
+    }
+
+    /** Hold a callable, replacing any held before
+     *  @param callable - a function object, lambda, or function pointer
+     */
+    template<class F>
+    void attach(const F& callable)
+    {
+        typedef char callable_fits[(sizeof(F) <= SIZE) ? 1 : -1]; // otherwise raise SIZE
+        (void)sizeof(callable_fits);
+#if __cplusplus >= 201103L
+        static_assert(std::is_trivially_copyable<F>::value, "a Delegate is copied bytewise");
+        static_assert(alignof(F) <= alignof(Storage), "over-aligned callable");
+#endif
+        new (storage.bytes) F(callable);
+        invoker = &invoke<F>;
+    }
+
+    /** Hold a global function, or nothing if it is 0 */
+    void attach(retT (*function)(argT))
+    {
+        if (function == 0)
+            detach();
+        else
+            attach<retT (*)(argT)>(function);
+    }
+
+    /** Hold a member function and the object to call it on */
+    template<class T>
+    void attach(T* item, retT (T::*method)(argT))
+    {
+        Member<T> member = { item, method };
+        attach(member);
+    }
+
+    retT operator()(argT arg) const
+    {
+        if (invoker != 0)
+            return invoker(storage.bytes, arg);
+        return (retT)0;
+    }
+
+    bool attached() const
+    {
+        return invoker != 0;
+    }
+
+    void detach()
+    {
+        invoker = 0;
+    }
+
+private:
+
+    template<class T>
+    struct Member
+    {
+        T* item;
+        retT (T::*method)(argT);
+
+        retT operator()(argT arg) const
+        {
+            return (item->*method)(arg);
+        }
+    };
+
+    template<class F>
+    static retT invoke(unsigned char* bytes, argT arg)
+    {
+        return (*reinterpret_cast<F*>(bytes))(arg);
+    }
+
+    union Storage
+    {
+        unsigned char bytes[SIZE];
+        void* align_pointer;
+        double align_double;
+        long align_long;
+        void (*align_function)();
+    };
+
+    mutable Storage storage; // a mutable lambda changes its captures when called
+    retT (*invoker)(unsigned char*, argT);
+};
+
+
+#if __cplusplus >= 201103L
+
+/**
+ * @class HandlerTable
+ * @brief One of a set of handler types, fixed at compile time
+ *
+ * Each handler type is default constructed for each call, so should keep any state it
+ * needs elsewhere.  A plain function pointer can also be attached, and is called through.
+ */
+template<class argT, class... Handlers>
+class HandlerTable
+{
+public:
+    HandlerTable() : index(NONE), function(0)
+    {
+
+    }
+
+    /** The table entry which calls handler type H */
+    template<class H>
+    static HandlerTable of()
+    {
+        static_assert(indexOf<H, Handlers...>() < FUNCTION, "not a handler type of this table");
+        HandlerTable entry;
+        entry.index = indexOf<H, Handlers...>();
+        return entry;
+    }
+
+    /** Call a global function, or nothing if it is 0 */
+    void attach(void (*f)(argT))
+    {
+        function = f;
+        index = (f == 0) ? NONE : FUNCTION;
+    }
+
+    void operator()(argT arg) const
+    {
+        call<0, Handlers...>(arg);
+    }
+
+    bool attached() const
+    {
+        return index != NONE;
+    }
+
+    void detach()
+    {
+        index = NONE;
+        function = 0;
+    }
+
+private:
+
+    static const int NONE = -1;
+    static const int FUNCTION = sizeof...(Handlers);
+
+    template<class H>
+    static constexpr int indexOf()
+    {
+        return 0; // not found: the index is then sizeof...(Handlers)
+    }
+
+    template<class H, class First, class... Rest>
+    static constexpr int indexOf()
+    {
+        return std::is_same<H, First>::value ? 0 : 1 + indexOf<H, Rest...>();
+    }
+
+    template<int I>
+    void call(argT arg) const
+    {
+        if (index == FUNCTION)
+            function(arg);
+    }
+
+    template<int I, class H, class... Rest>
+    void call(argT arg) const
+    {
+        if (index == I)
+            H()(arg);
+        else
+            call<I + 1, Rest...>(arg);
+    }
+
+    int index;
+    void (*function)(argT);
+};
+
+#endif
+
+}
+
+#endif
@@ -0,0 +1,418 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial binary logger
+ *******************************************************************************/
+
+#if !defined(MQTT_BINARY_LOG_H)
+#define MQTT_BINARY_LOG_H
+
+// A logging backend which keeps formatting and I/O off the logging thread.  Each log
+// call copies its format string pointer, its arguments and a timestamp into a fixed
+// size record in a lock-free ring, and a drain thread turns the records into text
+// later.  Packets are copied as bytes, and only formatted by the drain thread.
+// Selected for MQTTLogging.h by defining MQTT_LOG_BINARY:
+//
+//   MQTT::BinaryLog::instance().start(stderr);
+//   ... DEBUG, LOG and WARN now only take a record ...
+//   MQTT::BinaryLog::instance().stop();
+//
+// A full ring drops records rather than wait, and counts them.  Strings are copied
+// into the record, up to its data area.  Needs C++11, for atomics and threads.
+
+#if __cplusplus >= 201103L
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <type_traits>
+#include <stdio.h>
+#include <string.h>
+
+#if !defined(MQTT_LOG_RING_SIZE)
+#define MQTT_LOG_RING_SIZE 1024 // redefinable - records held, a power of 2
+#endif
+#if !defined(MQTT_LOG_RECORD_DATA)
+#define MQTT_LOG_RECORD_DATA 128 // redefinable - bytes of strings and packet data in each record
+#endif
+#if !defined(MQTT_LOG_MAX_ARGS)
+#define MQTT_LOG_MAX_ARGS 6 // redefinable - arguments kept for each record
+#endif
+#if !defined(MQTT_LOG_DRAIN_MS)
+#define MQTT_LOG_DRAIN_MS 10 // redefinable - how long the drain thread sleeps when the ring is empty
+#endif
+
+namespace MQTT
+{
+
+
+class BinaryLog
+{
+public:
+    typedef char* (*packetFormatter)(char* strbuf, int strbuflen, unsigned char* buf, int buflen);
+
+    BinaryLog() : head(0), tail(0), dropped_count(0), running(false), stream(0)
+    {
+        for (int i = 0; i < MQTT_LOG_RING_SIZE; ++i)
+            ring[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    ~BinaryLog()
+    {
+        stop();
+    }
+
+    /** The log the DEBUG, LOG, WARN and ERROR macros write to */
+    static BinaryLog& instance()
+    {
+        static BinaryLog log;
+        return log;
+    }
+
+    /** Take a record of a log call, for the drain thread to format with printf conventions */
+    template<class... Args>
+    void record(int level, const char* function, int line, const char* format, const Args&... args)
+    {
+        Record* r = claim();
+
+        if (r == 0)
+            return;
+        fill(*r, level, function, line, format);
+        put(*r, args...);
+        publish(r);
+    }
+
+    /** Take a record of a log call with an int and a packet, which is formatted for the last
+     *  %s of the format by the drain thread
+     */
+    void recordPacket(int level, const char* function, int line, const char* format, int rc,
+            const unsigned char* buf, int len, packetFormatter formatter)
+    {
+        Record* r = claim();
+
+        if (r == 0)
+            return;
+        fill(*r, level, function, line, format);
+        put(*r, rc);
+        r->formatter = formatter;
+        putBytes(*r, PACKET, buf, len);
+        publish(r);
+    }
+
+    /**
+     * Format and write out the records taken so far.  Called by the drain thread, or
+     * directly when there is none.  Must not be called from more than one thread at once.
+     * @return the number of records written
+     */
+    int drain(FILE* out)
+    {
+        unsigned long pos = tail.load(std::memory_order_relaxed);
+        int count = 0;
+
+        while (true)
+        {
+            Record& r = ring[pos & (MQTT_LOG_RING_SIZE - 1)];
+
+            if (r.sequence.load(std::memory_order_acquire) != pos + 1)
+                break; // not yet published
+            write(out, r);
+            r.sequence.store(pos + MQTT_LOG_RING_SIZE, std::memory_order_release); // the slot can be reused
+            tail.store(++pos, std::memory_order_relaxed);
+            ++count;
+        }
+        if (count > 0)
+            fflush(out);
+        return count;
+    }
+
+    /** Start a thread which drains the log to out
+     *  @return 0 on success, -1 if already started
+     */
+    int start(FILE* out)
+    {
+        if (running.exchange(true))
+            return -1;
+        stream = out;
+        drainer = std::thread(&BinaryLog::run, this);
+        return 0;
+    }
+
+    /** Stop the drain thread, once it has written out everything recorded */
+    void stop()
+    {
+        if (running.exchange(false))
+            drainer.join();
+    }
+
+    /** The number of records dropped because the ring was full */
+    unsigned long dropped()
+    {
+        return dropped_count.load(std::memory_order_relaxed);
+    }
+
+private:
+
+    enum Type { INT, UINT, DOUBLE, STRING, POINTER, PACKET };
+
+    struct Record
+    {
+        std::atomic<unsigned long> sequence; // pos when free, pos + 1 when published, for the pos of this lap
+        const char* format;
+        const char* function;
+        packetFormatter formatter;
+        long long time_us;
+        int line;
+        unsigned char level;
+        unsigned char argc;
+        unsigned char types[MQTT_LOG_MAX_ARGS];
+        union
+        {
+            long long i;
+            unsigned long long u;
+            double d;
+            const void* p;
+            struct { unsigned short offset, len; unsigned int whole; } bytes; // whole: the length before it was cut to fit
+        } args[MQTT_LOG_MAX_ARGS];
+        unsigned short datalen;
+        unsigned char data[MQTT_LOG_RECORD_DATA];
+    };
+
+    // claim the next slot for a producer - any thread - or 0 if the ring is full
+    Record* claim()
+    {
+        unsigned long pos = head.load(std::memory_order_relaxed);
+
+        while (true)
+        {
+            Record& r = ring[pos & (MQTT_LOG_RING_SIZE - 1)];
+            long diff = (long)(r.sequence.load(std::memory_order_acquire) - pos);
+
+            if (diff == 0)
+            {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    return &r;
+            }
+            else if (diff < 0)
+            {
+                dropped_count.fetch_add(1, std::memory_order_relaxed);
+                return 0;
+            }
+            else
+                pos = head.load(std::memory_order_relaxed);
+        }
+    }
+
+    void publish(Record* r)
+    {
+        r->sequence.store(r->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    void fill(Record& r, int level, const char* function, int line, const char* format)
+    {
+        r.format = format;
+        r.function = function;
+        r.formatter = 0;
+        r.time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        r.line = line;
+        r.level = (unsigned char)level;
+        r.argc = 0;
+        r.datalen = 0;
+    }
+
+    void put(Record&)
+    {
+    }
+
+    template<class T, class... Rest>
+    void put(Record& r, const T& arg, const Rest&... rest)
+    {
+        if (r.argc < MQTT_LOG_MAX_ARGS)
+            putArg(r, arg);
+        put(r, rest...);
+    }
+
+    template<class T>
+    typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type putArg(Record& r, const T& arg)
+    {
+        if (std::is_signed<T>::value || std::is_enum<T>::value)
+        {
+            r.types[r.argc] = INT;
+            r.args[r.argc++].i = (long long)arg;
+        }
+        else
+        {
+            r.types[r.argc] = UINT;
+            r.args[r.argc++].u = (unsigned long long)arg;
+        }
+    }
+
+    template<class T>
+    typename std::enable_if<std::is_floating_point<T>::value>::type putArg(Record& r, const T& arg)
+    {
+        r.types[r.argc] = DOUBLE;
+        r.args[r.argc++].d = arg;
+    }
+
+    template<class T>
+    typename std::enable_if<std::is_pointer<T>::value>::type putArg(Record& r, const T& arg)
+    {
+        r.types[r.argc] = POINTER;
+        r.args[r.argc++].p = (const void*)arg;
+    }
+
+    void putArg(Record& r, const char* arg)
+    {
+        putBytes(r, STRING, (const unsigned char*)(arg ? arg : "(null)"), strlen(arg ? arg : "(null)"));
+    }
+
+    void putArg(Record& r, char* arg)
+    {
+        putArg(r, (const char*)arg);
+    }
+
+    // copy bytes into the data area, as much as fits
+    void putBytes(Record& r, Type type, const unsigned char* bytes, size_t len)
+    {
+        r.args[r.argc].bytes.whole = (unsigned int)len;
+        if (len > (size_t)(MQTT_LOG_RECORD_DATA - r.datalen))
+            len = MQTT_LOG_RECORD_DATA - r.datalen;
+        memcpy(&r.data[r.datalen], bytes, len);
+        r.types[r.argc] = type;
+        r.args[r.argc].bytes.offset = r.datalen;
+        r.args[r.argc++].bytes.len = (unsigned short)len;
+        r.datalen += len;
+    }
+
+    void run()
+    {
+        while (running.load())
+        {
+            if (drain(stream) == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(MQTT_LOG_DRAIN_MS));
+        }
+        drain(stream);
+    }
+
+    // write a record as the text macros would, after its timestamp
+    void write(FILE* out, Record& r)
+    {
+        static const char* names[] = {"", "DEBUG:  ", "LOG:  ", "WARN: ", "ERROR:"};
+        const char* f = r.format;
+        int arg = 0;
+
+        fprintf(out, "%lld.%06lld %s %s L#%d ", r.time_us / 1000000, r.time_us % 1000000,
+                names[(r.level < 5) ? r.level : 0], r.function, r.line);
+        while (*f)
+        {
+            char spec[32];
+            int len = 0;
+
+            if (*f != '%' || f[1] == '%')
+            {
+                fputc(*f, out);
+                f += (*f == '%') ? 2 : 1;
+                continue;
+            }
+            spec[len++] = *f++;
+            while (*f && strchr("-+ #0123456789.*", *f) && len < 24)
+                spec[len++] = *f++;
+            while (*f && strchr("hlLqjzt", *f))
+                ++f;  // length modifiers are replaced to suit the type recorded
+            if (*f == '\0')
+                break;
+            writeArg(out, r, spec, len, *f++, arg++);
+        }
+    }
+
+    // a packet cut to fit its record cannot be formatted, as its lengths point past what was
+    // kept, so write out its length and its first bytes instead
+    static char* cutPacket(char* strbuf, int strbuflen, const unsigned char* buf, int buflen, unsigned int whole)
+    {
+        int pos = snprintf(strbuf, strbuflen, "cut, %u bytes:", whole);
+
+        for (int i = 0; i < buflen && i < 16 && pos < strbuflen; ++i)
+            pos += snprintf(&strbuf[pos], strbuflen - pos, " %02x", buf[i]);
+        if (pos < strbuflen)
+            snprintf(&strbuf[pos], strbuflen - pos, " ...");
+        return strbuf;
+    }
+
+    void writeArg(FILE* out, Record& r, char* spec, int len, char conversion, int arg)
+    {
+        char text[MQTT_LOG_RECORD_DATA + 1];
+        char packet[256];
+
+        if (arg >= r.argc)
+        {
+            fputs("?", out);
+            return;
+        }
+        switch (r.types[arg])
+        {
+            case INT:
+            case UINT:
+                if (strchr("diouxXc", conversion) == 0)
+                    conversion = (r.types[arg] == INT) ? 'd' : 'u';
+                if (conversion != 'c')
+                {
+                    spec[len++] = 'l';
+                    spec[len++] = 'l';
+                }
+                spec[len++] = conversion;
+                spec[len] = '\0';
+                if (conversion == 'c')
+                    fprintf(out, spec, (int)r.args[arg].i);
+                else
+                    fprintf(out, spec, r.args[arg].i);
+                break;
+            case DOUBLE:
+                spec[len++] = strchr("fFeEgGaA", conversion) ? conversion : 'g';
+                spec[len] = '\0';
+                fprintf(out, spec, r.args[arg].d);
+                break;
+            case POINTER:
+                fprintf(out, "%p", r.args[arg].p);
+                break;
+            case STRING:
+            case PACKET:
+                memcpy(text, &r.data[r.args[arg].bytes.offset], r.args[arg].bytes.len);
+                text[r.args[arg].bytes.len] = '\0';
+                spec[len++] = 's';
+                spec[len] = '\0';
+                if (r.types[arg] == PACKET && r.args[arg].bytes.len < r.args[arg].bytes.whole)
+                    fprintf(out, spec, cutPacket(packet, sizeof(packet), (unsigned char*)text, r.args[arg].bytes.len,
+                            r.args[arg].bytes.whole));
+                else if (r.types[arg] == PACKET && r.formatter)
+                    fprintf(out, spec, r.formatter(packet, sizeof(packet), (unsigned char*)text, r.args[arg].bytes.len));
+                else
+                    fprintf(out, spec, text);
+                break;
+        }
+    }
+
+    Record ring[MQTT_LOG_RING_SIZE];
+    std::atomic<unsigned long> head;  // next slot to claim
+    std::atomic<unsigned long> tail;  // next slot to drain
+    std::atomic<unsigned long> dropped_count;
+    std::atomic<bool> running;
+    FILE* stream;
+    std::thread drainer;
+};
+
+
+}
+
+#endif
+
+#endif
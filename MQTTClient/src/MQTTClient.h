@@ -27,8 +27,17 @@
 #include "FP.h"
 #include "MQTTPacket.h"
 #include <stdio.h>
+#include <string.h>
 #include "MQTTLogging.h"
 
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+#if __cplusplus >= 202002L
+#include <cstddef>
+#include <span>
+#endif
+
 #if !defined(MQTTCLIENT_QOS1)
     #define MQTTCLIENT_QOS1 1
 #endif
@@ -46,6 +55,113 @@ enum QoS { QOS0, QOS1, QOS2 };
 enum returnCode { BUFFER_OVERFLOW = -2, FAILURE = -1, SUCCESS = 0 };
 
 
+/**
+ * A string with its length, which need not be null terminated.  Topic names and filters are
+ * carried through the client, and into the packets, as these, so are measured at most once -
+ * when made from a C string.  Converts to and from std::string_view from C++17.
+ */
+class StringView
+{
+public:
+    StringView() : ptr(0), len(0)
+    {
+
+    }
+
+    StringView(const char* string) : ptr(string), len(string ? strlen(string) : 0)
+    {
+
+    }
+
+    StringView(const char* string, size_t length) : ptr(string), len(length)
+    {
+
+    }
+
+#if __cplusplus >= 201703L
+    StringView(std::string_view string) : ptr(string.data()), len(string.size())
+    {
+
+    }
+
+    operator std::string_view() const
+    {
+        return std::string_view(ptr, len);
+    }
+#endif
+
+    const char* data() const
+    {
+        return ptr;
+    }
+
+    size_t size() const
+    {
+        return len;
+    }
+
+    bool operator==(const StringView& other) const
+    {
+        return len == other.len && memcmp(ptr, other.ptr, len) == 0;
+    }
+
+    /** The string as the MQTTPacket functions take it, with its length */
+    MQTTString mqttString() const
+    {
+        MQTTString string = {0, {(int)len, (char*)ptr}};
+        return string;
+    }
+
+private:
+    const char* ptr;
+    size_t len;
+};
+
+
+/**
+ * Bytes with their length, for payloads.  Converts to and from std::span<const std::byte> from C++20.
+ */
+class ByteView
+{
+public:
+    ByteView() : ptr(0), len(0)
+    {
+
+    }
+
+    ByteView(const void* bytes, size_t length) : ptr(static_cast<const unsigned char*>(bytes)), len(length)
+    {
+
+    }
+
+#if __cplusplus >= 202002L
+    ByteView(std::span<const std::byte> bytes) : ptr(reinterpret_cast<const unsigned char*>(bytes.data())), len(bytes.size())
+    {
+
+    }
+
+    operator std::span<const std::byte>() const
+    {
+        return std::span<const std::byte>(reinterpret_cast<const std::byte*>(ptr), len);
+    }
+#endif
+
+    const unsigned char* data() const
+    {
+        return ptr;
+    }
+
+    size_t size() const
+    {
+        return len;
+    }
+
+private:
+    const unsigned char* ptr;
+    size_t len;
+};
+
+
 struct Message
 {
     enum QoS qos;
@@ -59,11 +175,22 @@ struct Message
 
 struct MessageData
 {
-    MessageData(MQTTString &aTopicName, struct Message &aMessage)  : message(aMessage), topicName(aTopicName)
+    MessageData(const MQTTString &aTopicName, struct Message &aMessage)  : message(aMessage), topicName(aTopicName)
     { }
 
+    /** The topic name, which is not null terminated */
+    StringView topic() const
+    {
+        return StringView(topicName.lenstring.data, topicName.lenstring.len);
+    }
+
+    ByteView payload() const
+    {
+        return ByteView(message.payload, message.payloadlen);
+    }
+
     struct Message &message;
-    MQTTString &topicName;
+    const MQTTString &topicName;
 };
 
 
@@ -107,8 +234,15 @@ private:
  * MQTT request can be in process at any one time.
  * @param Network a network class which supports send, receive
  * @param Timer a timer class with the methods:
+ *     expired, countdown_ms, countdown, left_ms, and countdown_us if MQTTCLIENT_TIMER_US is defined -
+ *     otherwise the age of batched publishes is rounded up to whole milliseconds
+ * @param MessageHandler the type each message handler is held as, with the methods of FP:
+ *     attach(messageHandler), attached, detach and operator()(MessageData&).  Delegate, from
+ *     Handlers.h, also holds lambdas and other callables without allocating, and HandlerTable
+ *     calls handler types fixed at compile time, so each call can be inlined into deliverMessage
  */
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE = 100, int MAX_MESSAGE_HANDLERS = 5>
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE = 100, int MAX_MESSAGE_HANDLERS = 5,
+         class MessageHandler = FP<void, MessageData&> >
 class Client
 {
 
@@ -134,11 +268,25 @@ public:
             defaultMessageHandler.detach();
     }
 
+    /** Set the default message handling callback - used for any message which does not match a subscription message handler
+     *  @param mh - the handler.  If not attached, removes the default handler.
+     */
+    void setDefaultMessageHandler(const MessageHandler& mh)
+    {
+        defaultMessageHandler = mh;
+    }
+
     /** Set a message handling callback.  This can be used outside of the the subscribe method.
      *  @param topicFilter - a topic pattern which can include wildcards
      *  @param mh - pointer to the callback function. If 0, removes the callback if any
      */
-    int setMessageHandler(const char* topicFilter, messageHandler mh);
+    int setMessageHandler(StringView topicFilter, messageHandler mh);
+
+    /** Set a message handler.  This can be used outside of the the subscribe method.
+     *  @param topicFilter - a topic pattern which can include wildcards
+     *  @param mh - the handler. If not attached, removes the handler if any
+     */
+    int setMessageHandler(StringView topicFilter, const MessageHandler& mh);
 
     /** MQTT Connect - send an MQTT connect packet down the network and wait for a Connack
      *  The nework object must be connected to the network endpoint before calling this
@@ -167,7 +315,7 @@ public:
      *  @param message - the message to send
      *  @return success code -
      */
-    int publish(const char* topicName, Message& message);
+    int publish(StringView topicName, Message& message);
 
     /** MQTT Publish - send an MQTT publish packet and wait for all acks to complete for all QoSs
      *  @param topic - the topic to publish to
@@ -177,7 +325,7 @@ public:
      *  @param retained - whether the message should be retained
      *  @return success code -
      */
-    int publish(const char* topicName, void* payload, size_t payloadlen, enum QoS qos = QOS0, bool retained = false);
+    int publish(StringView topicName, void* payload, size_t payloadlen, enum QoS qos = QOS0, bool retained = false);
 
     /** MQTT Publish - send an MQTT publish packet and wait for all acks to complete for all QoSs
      *  @param topic - the topic to publish to
@@ -188,7 +336,51 @@ public:
      *  @param retained - whether the message should be retained
      *  @return success code -
      */
-    int publish(const char* topicName, void* payload, size_t payloadlen, unsigned short& id, enum QoS qos = QOS1, bool retained = false);
+    int publish(StringView topicName, void* payload, size_t payloadlen, unsigned short& id, enum QoS qos = QOS1, bool retained = false);
+
+    /** MQTT Publish - send an MQTT publish packet and wait for all acks to complete for all QoSs
+     *  @param topicName - the topic to publish to, which need not be null terminated
+     *  @param payload - the data to send
+     *  @param qos - the QoS to send the publish at
+     *  @param retained - whether the message should be retained
+     *  @return success code -
+     */
+    int publish(StringView topicName, ByteView payload, enum QoS qos = QOS0, bool retained = false)
+    {
+        unsigned short id = 0;
+        return publish(topicName, (void*)payload.data(), payload.size(), id, qos, retained);
+    }
+
+    /** MQTT Publish Batch - send a number of publishes with one write where they fit, then wait
+     *  for the acks of those at QoS 1 and 2.  Unlike publish, these are not kept for resending
+     *  on reconnect.
+     *  @param topicNames - the topic to publish each message to
+     *  @param messages - the messages to send, the packet ids used are returned
+     *  @param count - the number of messages
+     *  @return success code -
+     */
+    int publishBatch(const char* const* topicNames, Message* messages, int count);
+
+    /** MQTT Publish Batch, with topic names which need not be null terminated */
+    int publishBatch(const StringView* topicNames, Message* messages, int count);
+
+    /** Coalesce outbound QoS 0 publishes and acknowledgements.  Rather than being written one
+     *  by one, they are serialized back to back into buf, which is written when threshold bytes
+     *  are waiting, when the oldest has waited max_age_us, on flush, before any other packet is
+     *  sent, and when no more incoming packets have already arrived - so the acks for a burst
+     *  of QoS 1 or 2 publishes are written together after it is read.
+     *  @param buf - the buffer, or 0 to stop batching after flushing what is waiting
+     *  @param size - the size of buf
+     *  @param threshold - flush once this many bytes are waiting, 0 for the size of buf
+     *  @param max_age_us - flush once the oldest waiting publish is this old
+     *  @return success code -
+     */
+    int setBatching(unsigned char* buf, size_t size, size_t threshold = 0, unsigned long max_age_us = 1000);
+
+    /** Write any batched publishes now
+     *  @return success code -
+     */
+    int flush();
 
     /** MQTT Subscribe - send an MQTT subscribe packet and wait for the suback
      *  @param topicFilter - a topic pattern which can include wildcards
@@ -196,7 +388,7 @@ public:
      *  @param mh - the callback function to be invoked when a message is received for this subscription
      *  @return success code -
      */
-    int subscribe(const char* topicFilter, enum QoS qos, messageHandler mh);
+    int subscribe(StringView topicFilter, enum QoS qos, messageHandler mh);
 
     /** MQTT Subscribe - send an MQTT subscribe packet and wait for the suback
      *  @param topicFilter - a topic pattern which can include wildcards
@@ -205,13 +397,30 @@ public:
      *  @param
      *  @return success code -
      */
-    int subscribe(const char* topicFilter, enum QoS qos, messageHandler mh, subackData &data);
+    int subscribe(StringView topicFilter, enum QoS qos, messageHandler mh, subackData &data);
+
+    /** MQTT Subscribe - send an MQTT subscribe packet and wait for the suback
+     *  @param topicFilter - a topic pattern which can include wildcards
+     *  @param qos - the MQTT QoS to subscribe at
+     *  @param mh - the handler to be invoked when a message is received for this subscription
+     *  @return success code -
+     */
+    int subscribe(StringView topicFilter, enum QoS qos, const MessageHandler& mh);
+
+    /** MQTT Subscribe - send an MQTT subscribe packet and wait for the suback
+     *  @param topicFilter - a topic pattern which can include wildcards
+     *  @param qos - the MQTT QoS to subscribe at
+     *  @param mh - the handler to be invoked when a message is received for this subscription
+     *  @param data - suback granted QoS returned
+     *  @return success code -
+     */
+    int subscribe(StringView topicFilter, enum QoS qos, const MessageHandler& mh, subackData &data);
 
     /** MQTT Unsubscribe - send an MQTT unsubscribe packet and wait for the unsuback
      *  @param topicFilter - a topic pattern which can include wildcards
      *  @return success code -
      */
-    int unsubscribe(const char* topicFilter);
+    int unsubscribe(StringView topicFilter);
 
     /** MQTT Disconnect - send an MQTT disconnect packet, and clean up any state
      *  @return success code -
@@ -226,6 +435,19 @@ public:
      */
     int yield(unsigned long timeout_ms = 1000L);
 
+    /** One pass of yield which does not wait: handle a packet if one has started to arrive, and
+     *  send a ping or detect a lost connection if keepalive is due.  For a driver which waits on
+     *  the sockets of many clients at once, and calls this when one is readable or keepaliveLeft_ms
+     *  has run out.
+     *  @return success code - on failure, this means the client has disconnected
+     */
+    int poll();
+
+    /** The time until keepalive is next due - to send a ping, or to find the response overdue
+     *  @return milliseconds, or -1 if not connected or there is no keepalive
+     */
+    int keepaliveLeft_ms();
+
     /** Is the client connected?
      *  @return flag - is the client connected or not?
      */
@@ -238,16 +460,23 @@ private:
 
     void closeSession();
     void cleanSession();
-    int cycle(Timer& timer);
+    int cycle(Timer& timer, int wait_ms = -1);
     int waitfor(int packet_type, Timer& timer);
     int keepalive();
     int publish(int len, Timer& timer, enum QoS qos);
 
     int decodePacket(int* value, int timeout);
-    int readPacket(Timer& timer);
+    int readPacket(Timer& timer, int wait_ms);
     int sendPacket(int length, Timer& timer);
+    int sendBuffer(unsigned char* buf, int length, Timer& timer);
+    int flushBatch(Timer& timer);
+    int batchPublish(MQTTString& topicName, Message& message, Timer& timer);
+    int batchAdded(int len, Timer& timer);
+    int sendAck(unsigned char type, unsigned short packetid, Timer& timer);
     int deliverMessage(MQTTString& topicName, Message& message);
-    bool isTopicMatched(char* topicFilter, MQTTString& topicName);
+    bool isTopicMatched(const StringView& topicFilter, MQTTString& topicName);
+    template<class Name>
+    int publishNamed(const Name* topicNames, Message* messages, int count);
 
     Network& ipstack;
     unsigned long command_timeout_ms;
@@ -255,7 +484,7 @@ private:
     unsigned char sendbuf[MAX_MQTT_PACKET_SIZE];
     unsigned char readbuf[MAX_MQTT_PACKET_SIZE];
 
-    Timer last_sent, last_received;
+    Timer last_sent, last_received, ping_sent;
     unsigned int keepAliveInterval;
     bool ping_outstanding;
     bool cleansession;
@@ -264,14 +493,21 @@ private:
 
     struct MessageHandlers
     {
-        const char* topicFilter;
-        FP<void, MessageData&> fp;
+        StringView topicFilter;    // a null data pointer for an unused slot
+        MessageHandler fp;
     } messageHandlers[MAX_MESSAGE_HANDLERS];      // Message handlers are indexed by subscription topic
 
-    FP<void, MessageData&> defaultMessageHandler;
+    MessageHandler defaultMessageHandler;
 
     bool isconnected;
 
+    unsigned char* batchbuf;      // outbound QoS 0 publishes and acks are coalesced here, 0 to send each at once
+    size_t batchbuf_size;
+    size_t batch_len;             // bytes of publishes waiting in batchbuf
+    size_t batch_threshold;       // flush once this many bytes are waiting
+    unsigned long batch_age_us;   // flush once the oldest waiting publish is this old
+    Timer batch_timer;
+
 #if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
     unsigned char pubbuf[MAX_MQTT_PACKET_SIZE];  // store the last publish for sending on reconnect
     int inflightLen;
@@ -281,13 +517,7 @@ private:
 
 #if MQTTCLIENT_QOS2
     bool pubrel;
-    #if !defined(MAX_INCOMING_QOS2_MESSAGES)
-        #define MAX_INCOMING_QOS2_MESSAGES 10
-    #endif
-    unsigned short incomingQoS2messages[MAX_INCOMING_QOS2_MESSAGES];
-    bool isQoS2msgidFree(unsigned short id);
-    bool useQoS2msgid(unsigned short id);
-	void freeQoS2msgid(unsigned short id);
+    MQTTPacketIdSet incomingQoS2messages; // delivered, and not yet released by a PUBREL
 #endif
 
 };
@@ -295,11 +525,11 @@ private:
 }
 
 
-template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS>
-void MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::cleanSession()
+template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS, class MessageHandler>
+void MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS, MessageHandler>::cleanSession()
 {
     for (int i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
-        messageHandlers[i].topicFilter = 0;
+        messageHandlers[i].topicFilter = StringView();
 
 #if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
     inflightMsgid = 0;
@@ -308,24 +538,25 @@ void MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::cleanSession()
 
 #if MQTTCLIENT_QOS2
     pubrel = false;
-    for (int i = 0; i < MAX_INCOMING_QOS2_MESSAGES; ++i)
-        incomingQoS2messages[i] = 0;
+    MQTTPacketIdSet_clear(&incomingQoS2messages);
 #endif
 }
 
 
-template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS>
-void MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::closeSession()
+template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS, class MessageHandler>
+void MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS, MessageHandler>::closeSession()
 {
     ping_outstanding = false;
     isconnected = false;
+    batch_len = 0; // QoS 0 publishes not yet written are lost with the connection
     if (cleansession)
         cleanSession();
 }
 
 
-template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS>
-MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::Client(Network& network, unsigned int command_timeout_ms)  : ipstack(network), packetid()
+template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS, class MessageHandler>
+MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS, MessageHandler>::Client(Network& network, unsigned int command_timeout_ms)  : ipstack(network), packetid(),
+    batchbuf(0), batchbuf_size(0), batch_len(0), batch_threshold(0), batch_age_us(0)
 {
     this->command_timeout_ms = command_timeout_ms;
     cleansession = true;
@@ -333,58 +564,17 @@ MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::Client(Network& network,
 }
 
 
-#if MQTTCLIENT_QOS2
-template<class Network, class Timer, int a, int b>
-bool MQTT::Client<Network, Timer, a, b>::isQoS2msgidFree(unsigned short id)
-{
-    for (int i = 0; i < MAX_INCOMING_QOS2_MESSAGES; ++i)
-    {
-        if (incomingQoS2messages[i] == id)
-            return false;
-    }
-    return true;
-}
 
 
-template<class Network, class Timer, int a, int b>
-bool MQTT::Client<Network, Timer, a, b>::useQoS2msgid(unsigned short id)
-{
-    for (int i = 0; i < MAX_INCOMING_QOS2_MESSAGES; ++i)
-    {
-        if (incomingQoS2messages[i] == 0)
-        {
-            incomingQoS2messages[i] = id;
-            return true;
-        }
-    }
-    return false;
-}
-
-
-template<class Network, class Timer, int a, int b>
-void MQTT::Client<Network, Timer, a, b>::freeQoS2msgid(unsigned short id)
-{
-    for (int i = 0; i < MAX_INCOMING_QOS2_MESSAGES; ++i)
-    {
-        if (incomingQoS2messages[i] == id)
-        {
-            incomingQoS2messages[i] = 0;
-            return;
-        }
-    }
-}
-#endif
-
-
-template<class Network, class Timer, int a, int b>
-int MQTT::Client<Network, Timer, a, b>::sendPacket(int length, Timer& timer)
+template<class Network, class Timer, int a, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, a, b, MessageHandler>::sendBuffer(unsigned char* buf, int length, Timer& timer)
 {
     int rc = FAILURE,
         sent = 0;
 
     while (sent < length)
     {
-        rc = ipstack.write(&sendbuf[sent], length - sent, timer.left_ms());
+        rc = ipstack.write(&buf[sent], length - sent, timer.left_ms());
         if (rc < 0)  // there was an error writing the data
             break;
         sent += rc;
@@ -400,17 +590,96 @@ int MQTT::Client<Network, Timer, a, b>::sendPacket(int length, Timer& timer)
     else
         rc = FAILURE;
 
-#if defined(MQTT_DEBUG)
-    char printbuf[150];
-    DEBUG("Rc %d from sending packet %s\r\n", rc,
-        MQTTFormat_toServerString(printbuf, sizeof(printbuf), sendbuf, length));
+    DEBUG_PACKET("Rc %d from sending packet %s\r\n", rc, buf, length, MQTTFormat_toServerString);
+    return rc;
+}
+
+
+template<class Network, class Timer, int a, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, a, b, MessageHandler>::flushBatch(Timer& timer)
+{
+    int rc = SUCCESS;
+
+    if (batch_len > 0)
+    {
+        rc = sendBuffer(batchbuf, batch_len, timer);
+        batch_len = 0;
+    }
+    return rc;
+}
+
+
+template<class Network, class Timer, int a, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, a, b, MessageHandler>::sendPacket(int length, Timer& timer)
+{
+    int rc = flushBatch(timer); // batched publishes go first, to keep the order they were made in
+
+    if (rc == SUCCESS)
+        rc = sendBuffer(sendbuf, length, timer);
+    return rc;
+}
+
+
+// Account for len bytes just serialized onto the end of the batch
+template<class Network, class Timer, int a, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, a, b, MessageHandler>::batchAdded(int len, Timer& timer)
+{
+    if (batch_len == 0)
+    {
+#if defined(MQTTCLIENT_TIMER_US)
+        batch_timer.countdown_us(batch_age_us);
+#else
+        batch_timer.countdown_ms((batch_age_us + 999) / 1000);
 #endif
+    }
+    batch_len += len;
+    return (batch_len >= batch_threshold) ? flushBatch(timer) : SUCCESS;
+}
+
+
+// Serialize a publish onto the end of the batch, flushing as needed.  Returns
+// BUFFER_OVERFLOW, with nothing waiting, if it does not fit even an empty batch.
+template<class Network, class Timer, int a, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, a, b, MessageHandler>::batchPublish(MQTTString& topicName, Message& message, Timer& timer)
+{
+    int rc = SUCCESS,
+        len = 0;
+
+    len = MQTTSerialize_publish(batchbuf + batch_len, batchbuf_size - batch_len, 0, message.qos, message.retained,
+              message.id, topicName, (unsigned char*)message.payload, message.payloadlen);
+    if (len <= 0 && batch_len > 0 && (rc = flushBatch(timer)) == SUCCESS)
+        len = MQTTSerialize_publish(batchbuf, batchbuf_size, 0, message.qos, message.retained,
+                  message.id, topicName, (unsigned char*)message.payload, message.payloadlen);
+    if (rc == SUCCESS)
+        rc = (len <= 0) ? BUFFER_OVERFLOW : batchAdded(len, timer);
     return rc;
 }
 
 
-template<class Network, class Timer, int a, int b>
-int MQTT::Client<Network, Timer, a, b>::decodePacket(int* value, int timeout)
+// Send an acknowledgement.  When batching, it is added to the batch, so that the acks
+// for a burst of incoming publishes are written together once the burst has been read.
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MessageHandler>::sendAck(unsigned char type, unsigned short packetid, Timer& timer)
+{
+    int rc = SUCCESS,
+        len = 0;
+
+    if (batchbuf != 0)
+    {
+        len = MQTTSerialize_ack(batchbuf + batch_len, batchbuf_size - batch_len, type, 0, packetid);
+        if (len <= 0 && batch_len > 0 && (rc = flushBatch(timer)) == SUCCESS)
+            len = MQTTSerialize_ack(batchbuf, batchbuf_size, type, 0, packetid);
+        if (rc != SUCCESS || len > 0)
+            return (rc == SUCCESS) ? batchAdded(len, timer) : rc;
+    }
+    if ((len = MQTTSerialize_ack(sendbuf, MAX_MQTT_PACKET_SIZE, type, 0, packetid)) <= 0)
+        return FAILURE;
+    return sendPacket(len, timer);
+}
+
+
+template<class Network, class Timer, int a, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, a, b, MessageHandler>::decodePacket(int* value, int timeout)
 {
     unsigned char c;
     int multiplier = 1;
@@ -441,11 +710,12 @@ exit:
 /**
  * If any read fails in this method, then we should disconnect from the network, as on reconnect
  * the packets can be retried.
- * @param timeout the max time to wait for the packet read to complete, in milliseconds
+ * @param timer the time allowed for the packet read to complete
+ * @param wait_ms the max time to wait for the packet to start arriving, in milliseconds
  * @return the MQTT packet type, 0 if none, -1 if error
  */
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::readPacket(Timer& timer)
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MessageHandler>::readPacket(Timer& timer, int wait_ms)
 {
     int rc = FAILURE;
     MQTTHeader header = {0};
@@ -453,7 +723,7 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::readPacket(Timer& tim
     int rem_len = 0;
 
     /* 1. read the header byte.  This has the packet type in it */
-    rc = ipstack.read(readbuf, 1, timer.left_ms());
+    rc = ipstack.read(readbuf, 1, wait_ms);
     if (rc != 1)
         goto exit;
 
@@ -478,14 +748,8 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::readPacket(Timer& tim
         last_received.countdown(this->keepAliveInterval); // record the fact that we have successfully received a packet
 exit:
 
-#if defined(MQTT_DEBUG)
-    if (rc >= 0)
-    {
-        char printbuf[50];
-        DEBUG("Rc %d receiving packet %s\r\n", rc,
-            MQTTFormat_toClientString(printbuf, sizeof(printbuf), readbuf, len));
-    }
-#endif
+    if (rc > 0)
+        DEBUG_PACKET("Rc %d receiving packet %s\r\n", rc, readbuf, len + rem_len, MQTTFormat_toClientString);
     return rc;
 }
 
@@ -493,14 +757,17 @@ exit:
 // assume topic filter and name is in correct format
 // # can only be at end
 // + and # can only be next to separator
-template<class Network, class Timer, int a, int b>
-bool MQTT::Client<Network, Timer, a, b>::isTopicMatched(char* topicFilter, MQTTString& topicName)
+template<class Network, class Timer, int a, int b, class MessageHandler>
+bool MQTT::Client<Network, Timer, a, b, MessageHandler>::isTopicMatched(const StringView& topicFilter, MQTTString& topicName)
 {
-    char* curf = topicFilter;
+    const char* curf = topicFilter.data();
+    const char* curf_end = curf + topicFilter.size();
     char* curn = topicName.lenstring.data;
     char* curn_end = curn + topicName.lenstring.len;
 
-    while (*curf && curn < curn_end)
+    if (topicFilter == StringView(curn, topicName.lenstring.len))
+        return true;
+    while (curf < curf_end && curn < curn_end)
     {
         if (*curn == '/' && *curf != '/')
             break;
@@ -518,21 +785,20 @@ bool MQTT::Client<Network, Timer, a, b>::isTopicMatched(char* topicFilter, MQTTS
         curn++;
     };
 
-    return (curn == curn_end) && (*curf == '\0');
+    return (curn == curn_end) && (curf == curf_end);
 }
 
 
 
-template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS>
-int MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::deliverMessage(MQTTString& topicName, Message& message)
+template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS, class MessageHandler>
+int MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS, MessageHandler>::deliverMessage(MQTTString& topicName, Message& message)
 {
     int rc = FAILURE;
 
     // we have to find the right message handler - indexed by topic
     for (int i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
     {
-        if (messageHandlers[i].topicFilter != 0 && (MQTTPacket_equals(&topicName, (char*)messageHandlers[i].topicFilter) ||
-                isTopicMatched((char*)messageHandlers[i].topicFilter, topicName)))
+        if (messageHandlers[i].topicFilter.data() != 0 && isTopicMatched(messageHandlers[i].topicFilter, topicName))
         {
             if (messageHandlers[i].fp.attached())
             {
@@ -555,8 +821,8 @@ int MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::deliverMessage(MQTTSt
 
 
 
-template<class Network, class Timer, int a, int b>
-int MQTT::Client<Network, Timer, a, b>::yield(unsigned long timeout_ms)
+template<class Network, class Timer, int a, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, a, b, MessageHandler>::yield(unsigned long timeout_ms)
 {
     int rc = SUCCESS;
     Timer timer;
@@ -575,14 +841,55 @@ int MQTT::Client<Network, Timer, a, b>::yield(unsigned long timeout_ms)
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::cycle(Timer& timer)
+template<class Network, class Timer, int a, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, a, b, MessageHandler>::poll()
+{
+    Timer timer(command_timeout_ms); // for the rest of a packet, once it has started to arrive
+
+    return (cycle(timer, 0) < 0) ? FAILURE : SUCCESS;
+}
+
+
+template<class Network, class Timer, int a, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, a, b, MessageHandler>::keepaliveLeft_ms()
+{
+    int left = 0;
+
+    if (!isconnected || keepAliveInterval == 0)
+        return -1;
+    if (ping_outstanding)
+        return ping_sent.left_ms();
+    left = last_sent.left_ms();
+    return (last_received.left_ms() < left) ? last_received.left_ms() : left;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MessageHandler>::cycle(Timer& timer, int wait_ms)
 {
     // get one piece of work off the wire and one pass through
-    int len = 0,
-        rc = SUCCESS;
+    int rc = SUCCESS;
+    int packet_type = 0;
 
-    int packet_type = readPacket(timer);    // read the socket, see what work is due
+    if (wait_ms < 0)
+        wait_ms = timer.left_ms();
+
+    if (batch_len > 0)
+    {   // only take packets which have already arrived, and write the batch once there are none
+        if (batch_timer.expired())
+            rc = flushBatch(timer);
+        else
+            wait_ms = 0;
+    }
+    if (rc == SUCCESS)
+        packet_type = readPacket(timer, wait_ms);    // read the socket, see what work is due
+    if (rc == SUCCESS && packet_type == 0)
+        rc = flushBatch(timer);
+    if (rc != SUCCESS)
+    {
+        rc = FAILURE;
+        goto exit;
+    }
 
     switch (packet_type)
     {
@@ -608,29 +915,13 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::cycle(Timer& timer)
                 goto exit;
             msg.qos = (enum QoS)intQoS;
 #if MQTTCLIENT_QOS2
-            if (msg.qos != QOS2)
+            if (msg.qos != QOS2 || MQTTPacketIdSet_add(&incomingQoS2messages, msg.id)) // not a duplicate
 #endif
                 deliverMessage(topicName, msg);
-#if MQTTCLIENT_QOS2
-            else if (isQoS2msgidFree(msg.id))
-            {
-                if (useQoS2msgid(msg.id))
-                    deliverMessage(topicName, msg);
-                else
-                    WARN("Maximum number of incoming QoS2 messages exceeded");
-            }
-#endif
 #if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
             if (msg.qos != QOS0)
             {
-                if (msg.qos == QOS1)
-                    len = MQTTSerialize_ack(sendbuf, MAX_MQTT_PACKET_SIZE, PUBACK, 0, msg.id);
-                else if (msg.qos == QOS2)
-                    len = MQTTSerialize_ack(sendbuf, MAX_MQTT_PACKET_SIZE, PUBREC, 0, msg.id);
-                if (len <= 0)
-                    rc = FAILURE;
-                else
-                    rc = sendPacket(len, timer);
+                rc = sendAck((msg.qos == QOS1) ? PUBACK : PUBREC, msg.id, timer);
                 if (rc == FAILURE)
                     goto exit; // there was a problem
             }
@@ -644,15 +935,12 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::cycle(Timer& timer)
             unsigned char dup, type;
             if (MQTTDeserialize_ack(&type, &dup, &mypacketid, readbuf, MAX_MQTT_PACKET_SIZE) != 1)
                 rc = FAILURE;
-            else if ((len = MQTTSerialize_ack(sendbuf, MAX_MQTT_PACKET_SIZE,
-						         (packet_type == PUBREC) ? PUBREL : PUBCOMP, 0, mypacketid)) <= 0)
-                rc = FAILURE;
-            else if ((rc = sendPacket(len, timer)) != SUCCESS) // send the PUBREL packet
+            else if ((rc = sendAck((packet_type == PUBREC) ? PUBREL : PUBCOMP, mypacketid, timer)) != SUCCESS)
                 rc = FAILURE; // there was a problem
             if (rc == FAILURE)
                 goto exit; // there was a problem
             if (packet_type == PUBREL)
-                freeQoS2msgid(mypacketid);
+                MQTTPacketIdSet_remove(&incomingQoS2messages, mypacketid);
             break;
 
         case PUBCOMP:
@@ -676,11 +964,10 @@ exit:
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::keepalive()
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MessageHandler>::keepalive()
 {
     int rc = SUCCESS;
-    static Timer ping_sent;
 
     if (keepAliveInterval == 0)
         goto exit;
@@ -690,9 +977,7 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::keepalive()
         if (ping_sent.expired())
         {
             rc = FAILURE; // session failure
-            #if defined(MQTT_DEBUG)
-                DEBUG("PINGRESP not received in keepalive interval\r\n");
-            #endif
+            DEBUG("PINGRESP not received in keepalive interval\r\n");
         }
     }
     else if (last_sent.expired() || last_received.expired())
@@ -711,8 +996,8 @@ exit:
 
 
 // only used in single-threaded mode where one command at a time is in process
-template<class Network, class Timer, int a, int b>
-int MQTT::Client<Network, Timer, a, b>::waitfor(int packet_type, Timer& timer)
+template<class Network, class Timer, int a, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, a, b, MessageHandler>::waitfor(int packet_type, Timer& timer)
 {
     int rc = FAILURE;
 
@@ -728,8 +1013,8 @@ int MQTT::Client<Network, Timer, a, b>::waitfor(int packet_type, Timer& timer)
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::connect(MQTTPacket_connectData& options, connackData& data)
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MessageHandler>::connect(MQTTPacket_connectData& options, connackData& data)
 {
     Timer connect_timer(command_timeout_ms);
     int rc = FAILURE;
@@ -740,6 +1025,10 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::connect(MQTTPacket_co
 
     this->keepAliveInterval = options.keepAliveInterval;
     this->cleansession = options.cleansession;
+#if MQTTCLIENT_QOS2
+    if (this->cleansession) // a new session, which has no QoS 2 messages in flight
+        MQTTPacketIdSet_clear(&incomingQoS2messages);
+#endif
     if ((len = MQTTSerialize_connect(sendbuf, MAX_MQTT_PACKET_SIZE, &options)) <= 0)
         goto exit;
     if ((rc = sendPacket(len, connect_timer)) != SUCCESS)  // send the connect packet
@@ -790,36 +1079,48 @@ exit:
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::connect(MQTTPacket_connectData& options)
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MessageHandler>::connect(MQTTPacket_connectData& options)
 {
     connackData data;
     return connect(options, data);
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::connect()
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MessageHandler>::connect()
 {
     MQTTPacket_connectData default_options = MQTTPacket_connectData_initializer;
     return connect(default_options);
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::setMessageHandler(const char* topicFilter, messageHandler messageHandler)
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS, class MessageHandler>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS, MessageHandler>::setMessageHandler(StringView topicFilter, messageHandler messageHandler)
+{
+    MessageHandler mh;
+
+    if (messageHandler != 0)
+        mh.attach(messageHandler);
+    return setMessageHandler(topicFilter, mh);
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS, class MessageHandler>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS, MessageHandler>::setMessageHandler(StringView topicFilter, const MessageHandler& messageHandler)
 {
     int rc = FAILURE;
     int i = -1;
+    bool attached = const_cast<MessageHandler&>(messageHandler).attached(); // FP::attached is not const
 
     // first check for an existing matching slot
     for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
     {
-        if (messageHandlers[i].topicFilter != 0 && strcmp(messageHandlers[i].topicFilter, topicFilter) == 0)
+        if (messageHandlers[i].topicFilter.data() != 0 && messageHandlers[i].topicFilter == topicFilter)
         {
-            if (messageHandler == 0) // remove existing
+            if (!attached) // remove existing
             {
-                messageHandlers[i].topicFilter = 0;
+                messageHandlers[i].topicFilter = StringView();
                 messageHandlers[i].fp.detach();
             }
             rc = SUCCESS; // return i when adding new subscription
@@ -827,12 +1128,12 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::se
         }
     }
     // if no existing, look for empty slot (unless we are removing)
-    if (messageHandler != 0) {
+    if (attached) {
         if (rc == FAILURE)
         {
             for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
             {
-                if (messageHandlers[i].topicFilter == 0)
+                if (messageHandlers[i].topicFilter.data() == 0)
                 {
                     rc = SUCCESS;
                     break;
@@ -842,21 +1143,33 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::se
         if (i < MAX_MESSAGE_HANDLERS)
         {
             messageHandlers[i].topicFilter = topicFilter;
-            messageHandlers[i].fp.attach(messageHandler);
+            messageHandlers[i].fp = messageHandler;
         }
     }
     return rc;
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::subscribe(const char* topicFilter,
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS, class MessageHandler>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS, MessageHandler>::subscribe(StringView topicFilter,
      enum QoS qos, messageHandler messageHandler, subackData& data)
+{
+    MessageHandler mh;
+
+    if (messageHandler != 0)
+        mh.attach(messageHandler);
+    return subscribe(topicFilter, qos, mh, data);
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS, class MessageHandler>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS, MessageHandler>::subscribe(StringView topicFilter,
+     enum QoS qos, const MessageHandler& messageHandler, subackData& data)
 {
     int rc = FAILURE;
     Timer timer(command_timeout_ms);
     int len = 0;
-    MQTTString topic = {(char*)topicFilter, {0, 0}};
+    MQTTString topic = topicFilter.mqttString();
 
     if (!isconnected)
         goto exit;
@@ -888,20 +1201,28 @@ exit:
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::subscribe(const char* topicFilter, enum QoS qos, messageHandler messageHandler)
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS, class MessageHandler>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS, MessageHandler>::subscribe(StringView topicFilter, enum QoS qos, messageHandler messageHandler)
 {
     subackData data;
     return subscribe(topicFilter, qos, messageHandler, data);
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::unsubscribe(const char* topicFilter)
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS, class MessageHandler>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS, MessageHandler>::subscribe(StringView topicFilter, enum QoS qos, const MessageHandler& messageHandler)
+{
+    subackData data;
+    return subscribe(topicFilter, qos, messageHandler, data);
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS, class MessageHandler>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS, MessageHandler>::unsubscribe(StringView topicFilter)
 {
     int rc = FAILURE;
     Timer timer(command_timeout_ms);
-    MQTTString topic = {(char*)topicFilter, {0, 0}};
+    MQTTString topic = topicFilter.mqttString();
     int len = 0;
 
     if (!isconnected)
@@ -931,8 +1252,8 @@ exit:
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::publish(int len, Timer& timer, enum QoS qos)
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MessageHandler>::publish(int len, Timer& timer, enum QoS qos)
 {
     int rc;
 
@@ -980,23 +1301,33 @@ exit:
 
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::publish(const char* topicName, void* payload, size_t payloadlen, unsigned short& id, enum QoS qos, bool retained)
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MessageHandler>::publish(StringView topicName, void* payload, size_t payloadlen, unsigned short& id, enum QoS qos, bool retained)
 {
     int rc = FAILURE;
     Timer timer(command_timeout_ms);
-    MQTTString topicString = MQTTString_initializer;
+    MQTTString topicString = topicName.mqttString();
     int len = 0;
 
     if (!isconnected)
         goto exit;
 
-    topicString.cstring = (char*)topicName;
-
 #if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
     if (qos == QOS1 || qos == QOS2)
         id = packetid.getNext();
+    else
 #endif
+    if (batchbuf != 0)
+    {
+        Message message = {qos, retained, false, id, payload, payloadlen};
+        rc = (batch_len > 0 && batch_timer.expired()) ? flushBatch(timer) : SUCCESS;
+        if (rc != SUCCESS || (rc = batchPublish(topicString, message, timer)) != BUFFER_OVERFLOW)
+        {
+            if (rc != SUCCESS)
+                closeSession();
+            goto exit; // batched, or failed - anything too big for the batch is sent on its own
+        }
+    }
 
     len = MQTTSerialize_publish(sendbuf, MAX_MQTT_PACKET_SIZE, 0, qos, retained, id,
               topicString, (unsigned char*)payload, payloadlen);
@@ -1022,23 +1353,139 @@ exit:
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::publish(const char* topicName, void* payload, size_t payloadlen, enum QoS qos, bool retained)
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MessageHandler>::publish(StringView topicName, void* payload, size_t payloadlen, enum QoS qos, bool retained)
 {
     unsigned short id = 0;  // dummy - not used for anything
     return publish(topicName, payload, payloadlen, id, qos, retained);
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::publish(const char* topicName, Message& message)
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MessageHandler>::publish(StringView topicName, Message& message)
 {
     return publish(topicName, message.payload, message.payloadlen, message.qos, message.retained);
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::disconnect()
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MessageHandler>::publishBatch(const char* const* topicNames, Message* messages, int count)
+{
+    return publishNamed(topicNames, messages, count);
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MessageHandler>::publishBatch(const StringView* topicNames, Message* messages, int count)
+{
+    return publishNamed(topicNames, messages, count);
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class MessageHandler>
+template<class Name>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MessageHandler>::publishNamed(const Name* topicNames, Message* messages, int count)
+{
+    int rc = FAILURE;
+    Timer timer(command_timeout_ms);
+    MQTTString topicString = MQTTString_initializer;
+    unsigned char* saved_batchbuf = batchbuf;
+    size_t saved_size = batchbuf_size,
+        saved_threshold = batch_threshold;
+    int acks = 0;
+
+    if (!isconnected)
+        goto exit;
+
+    if (batchbuf == 0)
+    {   // no batch buffer set, so coalesce in the send buffer for the length of this call
+        batchbuf = sendbuf;
+        batchbuf_size = batch_threshold = MAX_MQTT_PACKET_SIZE;
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        topicString = StringView(topicNames[i]).mqttString();
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+        if (messages[i].qos == QOS1 || messages[i].qos == QOS2)
+        {
+            messages[i].id = packetid.getNext();
+            ++acks;
+        }
+#endif
+        rc = batchPublish(topicString, messages[i], timer);
+        if (rc == BUFFER_OVERFLOW && batchbuf != sendbuf)
+        {   // too big for the batch buffer, but it may fit the send buffer
+            int len = MQTTSerialize_publish(sendbuf, MAX_MQTT_PACKET_SIZE, 0, messages[i].qos, messages[i].retained,
+                          messages[i].id, topicString, (unsigned char*)messages[i].payload, messages[i].payloadlen);
+            rc = (len <= 0) ? BUFFER_OVERFLOW : sendPacket(len, timer);
+        }
+        if (rc != SUCCESS)
+            goto exit;
+    }
+    if ((rc = flushBatch(timer)) != SUCCESS)
+        goto exit;
+    if (batchbuf == sendbuf)
+    {   // the send buffer is needed for acks from here on
+        batchbuf = saved_batchbuf;
+        batchbuf_size = saved_size;
+        batch_threshold = saved_threshold;
+    }
+
+    // a PUBACK or PUBCOMP for each message at QoS 1 or 2
+    while (acks > 0)
+    {
+        int packet_type = timer.expired() ? FAILURE : cycle(timer);
+
+        if (packet_type < 0)
+        {
+            rc = FAILURE;
+            break;
+        }
+        if (packet_type == PUBACK || packet_type == PUBCOMP)
+            --acks;
+    }
+
+exit:
+    if (batchbuf == sendbuf)
+    {
+        batchbuf = saved_batchbuf;
+        batchbuf_size = saved_size;
+        batch_threshold = saved_threshold;
+    }
+    if (rc == FAILURE)
+        closeSession();
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MessageHandler>::setBatching(unsigned char* buf, size_t size, size_t threshold, unsigned long max_age_us)
+{
+    int rc = flush();
+
+    batchbuf = buf;
+    batchbuf_size = (buf == 0) ? 0 : size;
+    batch_threshold = (threshold == 0 || threshold > batchbuf_size) ? batchbuf_size : threshold;
+    batch_age_us = max_age_us;
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MessageHandler>::flush()
+{
+    Timer timer(command_timeout_ms);
+    int rc = flushBatch(timer);
+
+    if (rc != SUCCESS)
+        closeSession();
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class MessageHandler>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MessageHandler>::disconnect()
 {
     int rc = FAILURE;
     Timer timer(command_timeout_ms);     // we might wait for incomplete incoming publishes to complete
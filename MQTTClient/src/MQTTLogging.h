@@ -17,8 +17,38 @@
 #if !defined(MQTT_LOGGING_H)
 #define MQTT_LOGGING_H
 
+#define MQTT_LOG_LEVEL_DEBUG 1
+#define MQTT_LOG_LEVEL_LOG 2
+#define MQTT_LOG_LEVEL_WARN 3
+#define MQTT_LOG_LEVEL_ERROR 4
+#define MQTT_LOG_LEVEL_NONE 5
+
+/* Calls below the level are compiled out, arguments and all.  ERROR still exits. */
+#if !defined(MQTT_LOG_LEVEL)
+#if defined(MQTT_DEBUG)
+#define MQTT_LOG_LEVEL MQTT_LOG_LEVEL_DEBUG // redefinable - the lowest level logged
+#else
+#define MQTT_LOG_LEVEL MQTT_LOG_LEVEL_LOG
+#endif
+#endif
+
 #define STREAM      stdout
+
+#if defined(MQTT_LOG_BINARY)
+/* Records are taken into the ring of MQTT::BinaryLog::instance(), and written out by its drain thread */
+#include "MQTTBinaryLog.h"
+#define MQTT_LOG_RECORD(level, ...) \
+    MQTT::BinaryLog::instance().record(level, __PRETTY_FUNCTION__, __LINE__, ##__VA_ARGS__)
+#define MQTT_LOG_PACKET(level, format, rc, buf, len, formatter) \
+    MQTT::BinaryLog::instance().recordPacket(level, __PRETTY_FUNCTION__, __LINE__, format, rc, buf, len, formatter)
+#endif
+
 #if !defined(DEBUG)
+#if MQTT_LOG_LEVEL > MQTT_LOG_LEVEL_DEBUG
+#define DEBUG(...) {}
+#elif defined(MQTT_LOG_BINARY)
+#define DEBUG(...) MQTT_LOG_RECORD(MQTT_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
 #define DEBUG(...)    \
     {\
     fprintf(STREAM, "DEBUG:   %s L#%d ", __PRETTY_FUNCTION__, __LINE__);  \
@@ -26,7 +56,13 @@
     fflush(STREAM); \
     }
 #endif
+#endif
 #if !defined(LOG)
+#if MQTT_LOG_LEVEL > MQTT_LOG_LEVEL_LOG
+#define LOG(...) {}
+#elif defined(MQTT_LOG_BINARY)
+#define LOG(...) MQTT_LOG_RECORD(MQTT_LOG_LEVEL_LOG, __VA_ARGS__)
+#else
 #define LOG(...)    \
     {\
     fprintf(STREAM, "LOG:   %s L#%d ", __PRETTY_FUNCTION__, __LINE__);  \
@@ -34,15 +70,33 @@
     fflush(STREAM); \
     }
 #endif
+#endif
 #if !defined(WARN)
+#if MQTT_LOG_LEVEL > MQTT_LOG_LEVEL_WARN
+#define WARN(...) {}
+#elif defined(MQTT_LOG_BINARY)
+#define WARN(...) MQTT_LOG_RECORD(MQTT_LOG_LEVEL_WARN, __VA_ARGS__)
+#else
 #define WARN(...)   \
     { \
     fprintf(STREAM, "WARN:  %s L#%d ", __PRETTY_FUNCTION__, __LINE__);  \
     fprintf(STREAM, ##__VA_ARGS__); \
     fflush(STREAM); \
     }
+#endif
 #endif 
 #if !defined(ERROR)
+#if MQTT_LOG_LEVEL > MQTT_LOG_LEVEL_ERROR
+#define ERROR(...) { exit(1); }
+#elif defined(MQTT_LOG_BINARY)
+/* the drain thread is stopped, so everything recorded is written out before exiting */
+#define ERROR(...)  \
+    { \
+    MQTT_LOG_RECORD(MQTT_LOG_LEVEL_ERROR, __VA_ARGS__); \
+    MQTT::BinaryLog::instance().stop(); \
+    exit(1); \
+    }
+#else
 #define ERROR(...)  \
     { \
     fprintf(STREAM, "ERROR: %s L#%d ", __PRETTY_FUNCTION__, __LINE__); \
@@ -51,5 +105,23 @@
     exit(1); \
     }
 #endif
+#endif
+
+/* A debug log of a packet with the rc of sending or receiving it.  The binary backend copies
+   the packet bytes, and formats them with formatter - an MQTTFormat_ function - when draining. */
+#if !defined(DEBUG_PACKET)
+#if MQTT_LOG_LEVEL > MQTT_LOG_LEVEL_DEBUG
+#define DEBUG_PACKET(format, rc, buf, len, formatter) {}
+#elif defined(MQTT_LOG_BINARY)
+#define DEBUG_PACKET(format, rc, buf, len, formatter) \
+    MQTT_LOG_PACKET(MQTT_LOG_LEVEL_DEBUG, format, rc, buf, len, formatter)
+#else
+#define DEBUG_PACKET(format, rc, buf, len, formatter) \
+    { \
+    char printbuf[150]; \
+    DEBUG(format, rc, formatter(printbuf, sizeof(printbuf), buf, len)); \
+    }
+#endif
+#endif
 
 #endif
@@ -0,0 +1,385 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial compile-time packets and topic filters
+ *******************************************************************************/
+
+#if !defined(MQTT_STATIC_PACKETS_H)
+#define MQTT_STATIC_PACKETS_H
+
+// Packets and topic filters built by the compiler, from string literals, for traffic which
+// is fixed ahead of time.  Each packet is a byte array in read-only data, sized from the
+// lengths of its strings, and byte for byte what the MQTTSerialize_ function would write:
+//
+//   static constexpr auto hello = MQTT::Static::connect("sensor-17", 60);
+//   static constexpr auto status = MQTT::Static::subscribe("status/#", 1, 1);
+//   ipstack.write(hello.data, hello.size(), timeout);
+//
+// A Topic holds the encoded name for publishes with payloads known only at run time, and
+// a TopicFilter splits a filter into its levels once, so matching a topic name only walks
+// the name:
+//
+//   static constexpr MQTT::Static::TopicFilter<sizeof("sensors/+/temp")> temps("sensors/+/temp");
+//   if (temps.matches(md.topicName)) ...
+//
+// Needs C++14, for constexpr functions with loops.
+
+#if __cplusplus >= 201402L
+
+#include <string.h>
+
+#include "MQTTPacket.h"
+
+namespace MQTT
+{
+namespace Static
+{
+
+
+template<int N>
+struct Packet
+{
+    unsigned char data[N];
+
+    static constexpr int size()
+    {
+        return N;
+    }
+};
+
+
+// bytes taken by the remaining length, as MQTTPacket_encode writes it
+constexpr int remainingLengthBytes(int rem_len)
+{
+    return (rem_len < 128) ? 1 : (rem_len < 16384) ? 2 : (rem_len < 2097152) ? 3 : 4;
+}
+
+
+constexpr int packetLength(int rem_len)
+{
+    return 1 + remainingLengthBytes(rem_len) + rem_len;
+}
+
+
+// a packet being written at compile time, with the writeChar, writeInt and writeMQTTString of MQTTPacket
+template<int N>
+class Writer
+{
+public:
+    constexpr Writer() : packet(), pos(0)
+    {
+
+    }
+
+    constexpr void writeChar(unsigned char c)
+    {
+        packet.data[pos++] = c;
+    }
+
+    constexpr void writeInt(int value)
+    {
+        writeChar((unsigned char)(value / 256));
+        writeChar((unsigned char)(value % 256));
+    }
+
+    constexpr void writeString(const char* string, int len)
+    {
+        writeInt(len);
+        for (int i = 0; i < len; ++i)
+            writeChar((unsigned char)string[i]);
+    }
+
+    constexpr void encode(int rem_len) // MQTTPacket_encode
+    {
+        do
+        {
+            unsigned char d = rem_len % 128;
+
+            rem_len /= 128;
+            if (rem_len > 0)
+                d |= 0x80;
+            writeChar(d);
+        } while (rem_len > 0);
+    }
+
+    Packet<N> packet;
+    int pos;
+};
+
+
+constexpr int connectLength(int clientID, int username, int password)
+{
+    return 10 + 2 + clientID + ((username >= 0) ? 2 + username : 0) + ((password >= 0) ? 2 + password : 0);
+}
+
+
+/** A CONNECT packet, for MQTT 3.1.1
+ *  @param clientID - a string literal
+ *  @param keepAliveInterval - in seconds
+ *  @param cleansession - start a new session
+ */
+template<int C>
+constexpr Packet<packetLength(connectLength(C - 1, -1, -1))> connect(const char (&clientID)[C],
+        unsigned short keepAliveInterval = 60, bool cleansession = true)
+{
+    Writer<packetLength(connectLength(C - 1, -1, -1))> w;
+
+    w.writeChar(CONNECT << 4);
+    w.encode(connectLength(C - 1, -1, -1));
+    w.writeString("MQTT", 4);
+    w.writeChar(4);
+    w.writeChar(cleansession ? 0x02 : 0);
+    w.writeInt(keepAliveInterval);
+    w.writeString(clientID, C - 1);
+    return w.packet;
+}
+
+
+/** A CONNECT packet with a username and password, for MQTT 3.1.1 */
+template<int C, int U, int P>
+constexpr Packet<packetLength(connectLength(C - 1, U - 1, P - 1))> connect(const char (&clientID)[C],
+        const char (&username)[U], const char (&password)[P], unsigned short keepAliveInterval = 60, bool cleansession = true)
+{
+    Writer<packetLength(connectLength(C - 1, U - 1, P - 1))> w;
+
+    w.writeChar(CONNECT << 4);
+    w.encode(connectLength(C - 1, U - 1, P - 1));
+    w.writeString("MQTT", 4);
+    w.writeChar(4);
+    w.writeChar(0x80 | 0x40 | (cleansession ? 0x02 : 0));
+    w.writeInt(keepAliveInterval);
+    w.writeString(clientID, C - 1);
+    w.writeString(username, U - 1);
+    w.writeString(password, P - 1);
+    return w.packet;
+}
+
+
+/** A SUBSCRIBE packet for one topic filter
+ *  @param topicFilter - a string literal
+ *  @param qos - the requested QoS
+ *  @param packetid - the packet id, which must not be in use for another packet when this is sent
+ */
+template<int C>
+constexpr Packet<packetLength(2 + 2 + C - 1 + 1)> subscribe(const char (&topicFilter)[C], int qos, unsigned short packetid)
+{
+    Writer<packetLength(2 + 2 + C - 1 + 1)> w;
+
+    w.writeChar((SUBSCRIBE << 4) | 0x02);
+    w.encode(2 + 2 + C - 1 + 1);
+    w.writeInt(packetid);
+    w.writeString(topicFilter, C - 1);
+    w.writeChar((unsigned char)qos);
+    return w.packet;
+}
+
+
+/** An UNSUBSCRIBE packet for one topic filter */
+template<int C>
+constexpr Packet<packetLength(2 + 2 + C - 1)> unsubscribe(const char (&topicFilter)[C], unsigned short packetid)
+{
+    Writer<packetLength(2 + 2 + C - 1)> w;
+
+    w.writeChar((UNSUBSCRIBE << 4) | 0x02);
+    w.encode(2 + 2 + C - 1);
+    w.writeInt(packetid);
+    w.writeString(topicFilter, C - 1);
+    return w.packet;
+}
+
+
+/** A QoS 0 PUBLISH packet, with a string literal payload - without its terminating null */
+template<int C, int P>
+constexpr Packet<packetLength(2 + C - 1 + P - 1)> publish(const char (&topicName)[C], const char (&payload)[P],
+        bool retained = false)
+{
+    Writer<packetLength(2 + C - 1 + P - 1)> w;
+
+    w.writeChar((PUBLISH << 4) | (retained ? 0x01 : 0));
+    w.encode(2 + C - 1 + P - 1);
+    w.writeString(topicName, C - 1);
+    for (int i = 0; i < P - 1; ++i)
+        w.writeChar((unsigned char)payload[i]);
+    return w.packet;
+}
+
+
+constexpr Packet<2> pingreq()
+{
+    return Packet<2>{ { PINGREQ << 4, 0 } };
+}
+
+
+constexpr Packet<2> disconnect()
+{
+    return Packet<2>{ { DISCONNECT << 4, 0 } };
+}
+
+
+/**
+ * @class Topic
+ * @brief A topic name encoded at compile time, for publishes with payloads known at run time
+ */
+template<int C>
+class Topic
+{
+public:
+    constexpr Topic(const char (&topicName)[C]) : bytes()
+    {
+        bytes[0] = (C - 1) / 256;
+        bytes[1] = (C - 1) % 256;
+        for (int i = 0; i < C - 1; ++i)
+            bytes[2 + i] = (unsigned char)topicName[i];
+    }
+
+    /** Serialize a PUBLISH packet to this topic into buf, as MQTTSerialize_publish does
+     *  @return the length of the packet, or MQTTPACKET_BUFFER_TOO_SHORT
+     */
+    int serialize(unsigned char* buf, int buflen, unsigned char dup, int qos, unsigned char retained,
+            unsigned short packetid, const unsigned char* payload, int payloadlen) const
+    {
+        int rem_len = sizeof(bytes) + ((qos > 0) ? 2 : 0) + payloadlen;
+        unsigned char* ptr = buf;
+
+        if (MQTTPacket_len(rem_len) > buflen)
+            return MQTTPACKET_BUFFER_TOO_SHORT;
+        *ptr++ = (PUBLISH << 4) | (dup << 3) | (qos << 1) | retained;
+        ptr += MQTTPacket_encode(ptr, rem_len);
+        memcpy(ptr, bytes, sizeof(bytes));
+        ptr += sizeof(bytes);
+        if (qos > 0)
+        {
+            *ptr++ = packetid / 256;
+            *ptr++ = packetid % 256;
+        }
+        memcpy(ptr, payload, payloadlen);
+        return ptr + payloadlen - buf;
+    }
+
+    unsigned char bytes[2 + C - 1]; // the length, then the name
+};
+
+
+/**
+ * @class TopicFilter
+ * @brief A topic filter split into its levels at compile time
+ *
+ * Matches as in the MQTT 3.1.1 specification, section 4.7: "a/#" matches "a", "a/+" matches
+ * "a/", and names starting with $ are only matched by filters starting with a literal level.
+ * The filter is assumed to be well formed, as the client assumes of those it is given.
+ */
+template<int C>
+class TopicFilter
+{
+public:
+    constexpr TopicFilter(const char (&topicFilter)[C]) : filter(), levels(), level_count(0), wildcards(false)
+    {
+        int start = 0;
+
+        for (int i = 0; i < C - 1; ++i)
+            filter[i] = topicFilter[i];
+        for (int i = 0; i <= C - 1; ++i)
+        {
+            if (i == C - 1 || topicFilter[i] == '/')
+            {
+                Level& level = levels[level_count++];
+
+                level.start = start;
+                level.len = i - start;
+                level.kind = LITERAL;
+                if (level.len == 1 && topicFilter[start] == '+')
+                    level.kind = ONE;
+                else if (level.len == 1 && topicFilter[start] == '#')
+                    level.kind = REST;
+                wildcards = wildcards || level.kind != LITERAL;
+                start = i + 1;
+            }
+        }
+    }
+
+    /** Does a topic name match the filter
+     *  @param topicName - the topic name, which is not null terminated
+     *  @param len - its length
+     */
+    constexpr bool matches(const char* topicName, int len) const
+    {
+        int pos = 0;
+
+        if (!wildcards)
+            return len == C - 1 && equal(topicName, filter, len);
+        if (len > 0 && topicName[0] == '$' && levels[0].kind != LITERAL)
+            return false;
+        for (int i = 0; i < level_count; ++i)
+        {
+            const Level& level = levels[i];
+            int end = pos;
+
+            if (level.kind == REST)
+                return true; // the rest of the name, which may be no levels at all
+            if (pos > len)
+                return false; // the name has fewer levels
+            while (end < len && topicName[end] != '/')
+                ++end;
+            if (level.kind == LITERAL && (end - pos != level.len || !equal(topicName + pos, filter + level.start, level.len)))
+                return false;
+            pos = end + 1;
+        }
+        return pos == len + 1; // and the name has no more levels
+    }
+
+    bool matches(const MQTTString& topicName) const
+    {
+        if (topicName.cstring)
+            return matches(topicName.cstring, strlen(topicName.cstring));
+        return matches(topicName.lenstring.data, topicName.lenstring.len);
+    }
+
+    /** The number of levels in the filter */
+    constexpr int levelCount() const
+    {
+        return level_count;
+    }
+
+private:
+
+    enum Kind { LITERAL, ONE, REST };
+
+    struct Level
+    {
+        int start = 0, len = 0;
+        Kind kind = LITERAL;
+    };
+
+    static constexpr bool equal(const char* a, const char* b, int len)
+    {
+        for (int i = 0; i < len; ++i)
+        {
+            if (a[i] != b[i])
+                return false;
+        }
+        return true;
+    }
+
+    char filter[C];
+    Level levels[C];  // at most one for each character, and one more
+    int level_count;
+    bool wildcards;   // without any, a name matches by comparing the whole filter
+};
+
+
+}
+}
+
+#endif
+
+#endif
@@ -15,8 +15,12 @@
  *    Ian Craggs - ensure read returns if no bytes read
  *******************************************************************************/
 
+#if !defined(MQTT_LINUX_CPP)
+#define MQTT_LINUX_CPP
+
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/param.h>
 #include <sys/time.h>
 #include <sys/select.h>
@@ -28,78 +32,186 @@
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
 
 
+#if !defined(NETWORK_CONNECT_TIMEOUT_MS)
+#define NETWORK_CONNECT_TIMEOUT_MS 10000 // redefinable - default limit on connect
+#endif
+#if !defined(CONNECTION_ATTEMPT_DELAY_MS)
+#define CONNECTION_ATTEMPT_DELAY_MS 250 // RFC 8305 - time before racing the next address
+#endif
+#if !defined(DNS_CACHE_TTL)
+#define DNS_CACHE_TTL 60 // redefinable - seconds resolved addresses are reused for
+#endif
+#if !defined(MAX_DNS_CACHE_ENTRIES)
+#define MAX_DNS_CACHE_ENTRIES 8 // redefinable - how many hostnames are cached
+#endif
+#define MAX_DNS_ADDRESSES 8 // candidate addresses kept per hostname
+
+
+// Durations of the phases of the last connect, in microseconds
+struct NetworkTimings
+{
+  NetworkTimings() : resolve_us(0), connect_us(0), connack_us(0) { }
+
+  long resolve_us;   // name resolution, 0 when answered from the DNS cache
+  long connect_us;   // TCP connect, including racing the candidate addresses
+  long connack_us;   // from TCP connect to the first byte received - the CONNACK
+};
+
+
+// Low-latency socket profile, for traffic where jitter matters more than CPU
+struct LatencyOptions
+{
+  LatencyOptions() : spin_us(50), busy_poll_us(50), nodelay(true), quickack(true) { }
+
+  int spin_us;       // budget for spinning on non-blocking recv before blocking, 0 to block at once
+  int busy_poll_us;  // SO_BUSY_POLL - how long the kernel polls the device queue, 0 to leave unset
+  bool nodelay;      // TCP_NODELAY - send small packets without waiting to coalesce them
+  bool quickack;     // TCP_QUICKACK, rearmed after every read - no delayed acks
+};
+
+
 class IPStack
 {
 public:
-  IPStack()
+  IPStack() : mysock(-1), lowLatency(false)
   {
 		signal(SIGPIPE, SIG_IGN);
+		timerclear(&connected);
   }
 
-  int connect(const char* hostname, int port)
+  // hostname can be a name, tcp://name, or unix:///path/to/socket for a
+  // Unix domain stream socket (a broker on the same host) - port is then ignored.
+  // IPv6 and IPv4 addresses of the host are raced (RFC 8305 Happy Eyeballs),
+  // and the fastest to connect within timeout_ms is used.
+  int connect(const char* hostname, int port, int timeout_ms = NETWORK_CONNECT_TIMEOUT_MS)
   {
-		int type = SOCK_STREAM;
-		struct sockaddr_in address;
-		int rc = -1;
-		sa_family_t family = AF_INET;
-		struct addrinfo *result = NULL;
-		struct addrinfo hints = {0, AF_UNSPEC, SOCK_STREAM, IPPROTO_TCP, 0, NULL, NULL, NULL};
+		DNSEntry entry;
+		struct timeval start;
+		int index = 0;
 
-		if ((rc = getaddrinfo(hostname, NULL, &hints, &result)) == 0)
+		timings = NetworkTimings();
+		timerclear(&connected);
+
+		if (strncmp(hostname, "unix://", 7) == 0)
+		{
+			gettimeofday(&start, NULL);
+			if (connectUnix(hostname + 7) != 0)
+				return -1;
+		}
+		else
 		{
-			struct addrinfo* res = result;
+			if (strncmp(hostname, "tcp://", 6) == 0)
+				hostname += 6;
+			if (resolve(hostname, entry, timings.resolve_us) != 0)
+				return -1;
+			gettimeofday(&start, NULL);
+			if ((index = connectRace(entry, port, timeout_ms)) < 0)
+				return -1;
+			if (index > 0)
+				prefer(hostname, entry.addresses[index]);
+		}
+		timings.connect_us = elapsed_us(start);
+		gettimeofday(&connected, NULL);
+		applyLatency(); // best effort - SO_BUSY_POLL may need privileges
+		return 0;
+  }
 
-			/* prefer ip4 addresses */
-			while (res)
-			{
-				if (res->ai_family == AF_INET)
-				{
-					result = res;
-					break;
-				}
-				res = res->ai_next;
-			}
+  /** The socket, for waiting on it with others - as PollDriver does */
+  int getSocket()
+  {
+		return mysock;
+  }
 
-			if (result->ai_family == AF_INET)
-			{
-				address.sin_port = htons(port);
-				address.sin_family = family = AF_INET;
-				address.sin_addr = ((struct sockaddr_in*)(result->ai_addr))->sin_addr;
-			}
-			else
-				rc = -1;
+  /** Durations of the phases of the last connect */
+  const NetworkTimings& getTimings()
+  {
+		return timings;
+  }
 
-			freeaddrinfo(result);
-		}
+  /**
+   * Select the low-latency socket profile, applied to the current connection
+   * and to those made later.
+   * @return 0 on success, -1 if an option could not be applied to the current connection
+   */
+  int setLowLatency(const LatencyOptions& options = LatencyOptions())
+  {
+		latency = options;
+		lowLatency = true;
+		return (mysock != -1) ? applyLatency() : 0;
+  }
 
-		if (rc == 0)
-		{
-			mysock = socket(family, type, 0);
-			if (mysock != -1)
-			{
-				int opt = 1;
+  /** Return to the default socket profile for later connections */
+  void clearLowLatency()
+  {
+		lowLatency = false;
+  }
 
-				//if (setsockopt(mysock, SOL_SOCKET, SO_NOSIGPIPE, (void*)&opt, sizeof(opt)) != 0)
-				//	printf("Could not set SO_NOSIGPIPE for socket %d", mysock);
+  /** Pin the calling thread, normally the one calling yield, to a CPU core */
+  static int pinThread(int cpu)
+  {
+		cpu_set_t cpus;
 
-				rc = ::connect(mysock, (struct sockaddr*)&address, sizeof(address));
-			}
-		}
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0 ? 0 : -1;
+  }
+
+  /** Set how long resolved addresses are cached for, 0 to disable the cache */
+  static void setDNSCacheTTL(unsigned int seconds)
+  {
+		dnsCache().ttl = seconds;
+  }
+
+  static void clearDNSCache()
+  {
+		DNSCache& cache = dnsCache();
 
-        return rc;
-    }
+		pthread_mutex_lock(&cache.mutex);
+		for (int i = 0; i < MAX_DNS_CACHE_ENTRIES; ++i)
+			cache.entries[i].count = 0;
+		pthread_mutex_unlock(&cache.mutex);
+  }
 
   // return -1 on error, or the number of bytes read
   // which could be 0 on a read timeout
   int read(unsigned char* buffer, int len, int timeout_ms)
   {
 		struct timeval interval = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+		int bytes = 0;
+
+		if (lowLatency && latency.spin_us > 0)
+		{
+			long spin_us = latency.spin_us;
+			if (timeout_ms > 0 && spin_us > timeout_ms * 1000L)
+				spin_us = timeout_ms * 1000L;
+			if ((bytes = spinRead(buffer, len, spin_us)) < 0)
+				return -1;
+			if (bytes == len)
+				return readDone(bytes);
+			if (timeout_ms * 1000L <= spin_us)
+				return bytes;  // the whole timeout has been spent spinning
+			interval.tv_sec = (timeout_ms * 1000L - spin_us) / 1000000;
+			interval.tv_usec = (timeout_ms * 1000L - spin_us) % 1000000;
+		}
+		if (timeout_ms <= 0 && bytes == 0)
+		{
+			// don't wait at all when nothing has arrived - a receive timeout is at least a
+			// scheduler tick, which adds up when one thread polls many clients
+			int rc = ::recv(mysock, buffer, (size_t)len, MSG_DONTWAIT);
+			if (rc < 0)
+				return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+			if (rc == 0 || (bytes = rc) == len)
+				return readDone(bytes);
+		}
 		if (interval.tv_sec < 0 || (interval.tv_sec == 0 && interval.tv_usec <= 0))
 		{
 			interval.tv_sec = 0;
@@ -108,7 +220,6 @@ public:
 
 		setsockopt(mysock, SOL_SOCKET, SO_RCVTIMEO, (char *)&interval, sizeof(struct timeval));
 
-		int bytes = 0;
     int i = 0; const int max_tries = 10;
 		while (bytes < len)
 		{
@@ -126,7 +237,7 @@ public:
       if (rc == 0)
         break;
 		}
-		return bytes;
+		return readDone(bytes);
   }
 
   int write(unsigned char* buffer, int len, int timeout)
@@ -147,9 +258,264 @@ public:
 		return ::close(mysock);
 	}
 
-private:
+protected:
+
+  static long elapsed_us(struct timeval& start)
+  {
+		struct timeval now, res;
+		gettimeofday(&now, NULL);
+		timersub(&now, &start, &res);
+		return res.tv_sec * 1000000L + res.tv_usec;
+  }
+
+  void connackReceived()
+  {
+		timings.connack_us = elapsed_us(connected);
+		timerclear(&connected);
+  }
+
+  int readDone(int bytes)
+  {
+		if (bytes > 0 && lowLatency && latency.quickack)
+		{
+			int on = 1; // the kernel clears quickack mode as it sees fit, so keep rearming it
+			setsockopt(mysock, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+		}
+		if (bytes > 0 && connected.tv_sec != 0)
+			connackReceived();
+		return bytes;
+  }
+
+  // Spin on non-blocking reads for up to spin_us, so that data arriving within the
+  // budget is picked up without the thread being put to sleep and woken again.
+  // Returns the bytes read, or -1 on error.
+  int spinRead(unsigned char* buffer, int len, long spin_us)
+  {
+		struct timeval start;
+		int bytes = 0;
+
+		gettimeofday(&start, NULL);
+		do
+		{
+			int rc = ::recv(mysock, &buffer[bytes], (size_t)(len - bytes), MSG_DONTWAIT);
+			if (rc > 0)
+				bytes += rc;
+			else if (rc == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+				return -1;
+			else
+				sched_yield(); // lets a peer sharing this core run
+		} while (bytes < len && elapsed_us(start) < spin_us);
+		return bytes;
+  }
+
+  // Apply the socket options of the low-latency profile.  The TCP options fail on
+  // Unix domain sockets, which have no Nagle or delayed acks to turn off anyway.
+  int applyLatency()
+  {
+		int domain = 0, on = 1, rc = 0;
+		socklen_t len = sizeof(domain);
+
+		if (!lowLatency)
+			return 0;
+		if (getsockopt(mysock, SOL_SOCKET, SO_DOMAIN, &domain, &len) != 0)
+			return -1;
+		bool tcp = (domain == AF_INET || domain == AF_INET6);
+		if (tcp && latency.nodelay && setsockopt(mysock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) != 0)
+			rc = -1;
+		if (tcp && latency.quickack && setsockopt(mysock, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on)) != 0)
+			rc = -1;
+#if defined(SO_BUSY_POLL)
+		if (latency.busy_poll_us > 0 &&
+		    setsockopt(mysock, SOL_SOCKET, SO_BUSY_POLL, &latency.busy_poll_us, sizeof(int)) != 0)
+			rc = -1;
+#endif
+		return rc;
+  }
+
+  int connectUnix(const char* path)
+  {
+		struct sockaddr_un address;
+		int rc = -1;
+
+		if (strlen(path) >= sizeof(address.sun_path))
+			return rc;
+		memset(&address, '\0', sizeof(address));
+		address.sun_family = AF_UNIX;
+		strcpy(address.sun_path, path);
+
+		mysock = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (mysock != -1)
+			rc = ::connect(mysock, (struct sockaddr*)&address, sizeof(address));
+		return rc;
+  }
+
+  // Resolved addresses are cached per hostname so that reconnects skip DNS.
+  // Addresses are kept in the RFC 8305 order in which connections are attempted:
+  // families interleaved, IPv6 first, with the address that last connected moved
+  // to the front.
+  struct DNSEntry
+  {
+		DNSEntry() : count(0) { host[0] = '\0'; timerclear(&expires); }
+
+		char host[NI_MAXHOST];
+		struct sockaddr_storage addresses[MAX_DNS_ADDRESSES];
+		socklen_t addrlens[MAX_DNS_ADDRESSES];
+		int count;
+		struct timeval expires;
+  };
+
+  struct DNSCache
+  {
+		DNSCache() : ttl(DNS_CACHE_TTL)
+		{
+			pthread_mutex_init(&mutex, 0);
+		}
+
+		DNSEntry* find(const char* host)
+		{
+			struct timeval now;
+
+			gettimeofday(&now, NULL);
+			for (int i = 0; i < MAX_DNS_CACHE_ENTRIES; ++i)
+			{
+				if (entries[i].count > 0 && timercmp(&now, &entries[i].expires, <) &&
+				    strcmp(entries[i].host, host) == 0)
+					return &entries[i];
+			}
+			return 0;
+		}
+
+		DNSEntry entries[MAX_DNS_CACHE_ENTRIES];
+		unsigned int ttl;
+		pthread_mutex_t mutex;
+  };
+
+  static DNSCache& dnsCache()
+  {
+		static DNSCache cache;
+		return cache;
+  }
+
+  static int resolve(const char* host, DNSEntry& entry, long& resolve_us)
+  {
+		struct addrinfo hints = {0, AF_UNSPEC, SOCK_STREAM, IPPROTO_TCP, 0, NULL, NULL, NULL};
+		struct addrinfo *result = NULL, *res = NULL;
+		struct addrinfo* byfamily[2][MAX_DNS_ADDRESSES];
+		int counts[2] = {0, 0};
+		struct timeval start;
+		DNSCache& cache = dnsCache();
+		DNSEntry* cached = 0;
+
+		resolve_us = 0;
+		pthread_mutex_lock(&cache.mutex);
+		if (cache.ttl > 0 && (cached = cache.find(host)) != 0)
+			entry = *cached;
+		pthread_mutex_unlock(&cache.mutex);
+		if (cached)
+			return 0;
+
+		gettimeofday(&start, NULL);
+		if (getaddrinfo(host, NULL, &hints, &result) != 0)
+			return -1;
+		resolve_us = elapsed_us(start);
+
+		for (res = result; res; res = res->ai_next)
+		{
+			int family = (res->ai_family == AF_INET6) ? 0 : (res->ai_family == AF_INET) ? 1 : -1;
+			if (family >= 0 && counts[family] < MAX_DNS_ADDRESSES)
+				byfamily[family][counts[family]++] = res;
+		}
+
+		entry = DNSEntry();
+		strncpy(entry.host, host, sizeof(entry.host) - 1);
+		for (int i = 0; entry.count < MAX_DNS_ADDRESSES && (i < counts[0] || i < counts[1]); ++i)
+		{
+			for (int family = 0; family < 2 && entry.count < MAX_DNS_ADDRESSES; ++family)
+			{
+				if (i < counts[family])
+				{
+					memcpy(&entry.addresses[entry.count], byfamily[family][i]->ai_addr, byfamily[family][i]->ai_addrlen);
+					entry.addrlens[entry.count++] = byfamily[family][i]->ai_addrlen;
+				}
+			}
+		}
+		freeaddrinfo(result);
+		if (entry.count == 0)
+			return -1;
+
+		if (cache.ttl > 0)
+		{
+			struct timeval ttl = {(time_t)cache.ttl, 0};
+			DNSEntry* slot = &cache.entries[0];
+
+			gettimeofday(&start, NULL);
+			timeradd(&start, &ttl, &entry.expires);
+			pthread_mutex_lock(&cache.mutex);
+			for (int i = 0; i < MAX_DNS_CACHE_ENTRIES; ++i)
+			{
+				if (strcmp(cache.entries[i].host, host) == 0 || cache.entries[i].count == 0)
+				{
+					slot = &cache.entries[i];
+					break;
+				}
+				if (timercmp(&cache.entries[i].expires, &slot->expires, <))
+					slot = &cache.entries[i]; // otherwise replace the entry closest to expiry
+			}
+			*slot = entry;
+			pthread_mutex_unlock(&cache.mutex);
+		}
+		return 0;
+  }
+
+  // the same host address, whatever the port - the cache holds addresses without one
+  static bool sameAddress(const struct sockaddr_storage& a, const struct sockaddr_storage& b)
+  {
+		if (a.ss_family != b.ss_family)
+			return false;
+		if (a.ss_family == AF_INET6)
+			return memcmp(&((const struct sockaddr_in6*)&a)->sin6_addr, &((const struct sockaddr_in6*)&b)->sin6_addr,
+				sizeof(struct in6_addr)) == 0;
+		return memcmp(&((const struct sockaddr_in*)&a)->sin_addr, &((const struct sockaddr_in*)&b)->sin_addr,
+			sizeof(struct in_addr)) == 0;
+  }
+
+  // move the address which has just connected to the front of the cached list
+  static void prefer(const char* host, const struct sockaddr_storage& address)
+  {
+		DNSCache& cache = dnsCache();
+		DNSEntry* entry = 0;
+
+		pthread_mutex_lock(&cache.mutex);
+		if ((entry = cache.find(host)) != 0)
+		{
+			for (int i = 1; i < entry->count; ++i)
+			{
+				if (sameAddress(entry->addresses[i], address))
+				{
+					struct sockaddr_storage preferred = entry->addresses[i];
+					socklen_t preferred_len = entry->addrlens[i];
+
+					memmove(&entry->addresses[1], &entry->addresses[0], i * sizeof(entry->addresses[0]));
+					memmove(&entry->addrlens[1], &entry->addrlens[0], i * sizeof(entry->addrlens[0]));
+					entry->addresses[0] = preferred;
+					entry->addrlens[0] = preferred_len;
+					break;
+				}
+			}
+		}
+		pthread_mutex_unlock(&cache.mutex);
+  }
+
+  // Race non-blocking connects to the candidate addresses (RFC 8305), starting the
+  // next attempt when the previous one fails or CONNECTION_ATTEMPT_DELAY_MS passes.
+  // Returns the index of the address connected to, or -1.
+  int connectRace(DNSEntry& entry, int port, int timeout_ms);
 
     int mysock;
+    NetworkTimings timings;
+    struct timeval connected;
+    LatencyOptions latency;
+    bool lowLatency;
 };
 
 
@@ -158,7 +524,7 @@ class Countdown
 public:
   Countdown()
   {
-
+		timerclear(&end_time);
   }
 
   Countdown(int ms)
@@ -189,6 +555,15 @@ public:
   }
 
 
+  void countdown_us(long us)
+  {
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		struct timeval interval = {us / 1000000, us % 1000000};
+		timeradd(&now, &interval, &end_time);
+  }
+
+
   void countdown(int seconds)
   {
 		struct timeval now;
@@ -211,3 +586,81 @@ private:
 
 	struct timeval end_time;
 };
+
+inline int IPStack::connectRace(DNSEntry& entry, int port, int timeout_ms)
+{
+	struct pollfd fds[MAX_DNS_ADDRESSES];
+	int which[MAX_DNS_ADDRESSES];
+	Countdown timer(timeout_ms), attempt_timer;
+	int next = 0, pending = 0, winner = -1;
+
+	while (winner < 0 && (next < entry.count || pending > 0) && !timer.expired())
+	{
+		if (next < entry.count && (pending == 0 || attempt_timer.expired()))
+		{
+			struct sockaddr_storage* address = &entry.addresses[next];
+			int s = socket(address->ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+			if (address->ss_family == AF_INET6)
+				((struct sockaddr_in6*)address)->sin6_port = htons(port);
+			else
+				((struct sockaddr_in*)address)->sin_port = htons(port);
+			if (s != -1)
+			{
+				if (::connect(s, (struct sockaddr*)address, entry.addrlens[next]) == 0)
+				{
+					fds[pending].fd = s;
+					which[pending++] = next;
+					winner = pending - 1;
+				}
+				else if (errno == EINPROGRESS)
+				{
+					fds[pending].fd = s;
+					fds[pending].events = POLLOUT;
+					which[pending++] = next;
+				}
+				else
+					::close(s);
+			}
+			++next;
+			attempt_timer.countdown_ms(CONNECTION_ATTEMPT_DELAY_MS);
+			continue;
+		}
+
+		int wait_ms = timer.left_ms();
+		if (next < entry.count && attempt_timer.left_ms() < wait_ms)
+			wait_ms = attempt_timer.left_ms();
+		if (poll(fds, pending, wait_ms) <= 0)
+			continue;
+		for (int i = pending - 1; i >= 0; --i)
+		{
+			int error = 0;
+			socklen_t len = sizeof(error);
+
+			if (fds[i].revents == 0)
+				continue;
+			if (getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0)
+			{
+				winner = i;
+				break;
+			}
+			::close(fds[i].fd); // this attempt failed - so the next can start straight away
+			fds[i] = fds[--pending];
+			which[i] = which[pending];
+			attempt_timer.countdown_ms(0);
+		}
+	}
+
+	for (int i = 0; i < pending; ++i)
+	{
+		if (i != winner)
+			::close(fds[i].fd);
+	}
+	if (winner < 0)
+		return -1;
+	mysock = fds[winner].fd;
+	fcntl(mysock, F_SETFL, fcntl(mysock, F_GETFL) & ~O_NONBLOCK);
+	return which[winner];
+}
+
+#endif
@@ -0,0 +1,370 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial packet capture
+ *******************************************************************************/
+
+#if !defined(MQTT_LINUXCAPTURE_CPP)
+#define MQTT_LINUXCAPTURE_CPP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "MQTTPacket.h"
+
+#if !defined(MAX_CAPTURE_FRAME)
+#define MAX_CAPTURE_FRAME 1024 // redefinable - bytes kept of each frame, the rest are only counted
+#endif
+
+/*
+ A capture file is the 8 bytes "MQTTCAP1", then a record for each MQTT frame:
+
+   8 bytes   timestamp, in microseconds since the epoch
+   4 bytes   connection id, a new one for each CONNECT sent
+   1 byte    CAPTURE_SENT or CAPTURE_RECEIVED
+   4 bytes   length of the frame
+   4 bytes   length captured, followed by the bytes captured
+
+ with integers little-endian.  mqttreplay in samples/linux reads them back.
+*/
+#define CAPTURE_MAGIC "MQTTCAP1"
+#define CAPTURE_RECORD_HEADER 21
+
+enum captureDirection { CAPTURE_SENT = 0, CAPTURE_RECEIVED = 1 };
+
+
+struct CaptureFrame
+{
+  unsigned long long time_us;
+  unsigned int connection;
+  int direction;
+  int length;           // of the frame as it was sent
+  int captured;         // bytes of it in data, which is less than length for a truncated frame
+  unsigned char* data;
+};
+
+
+/**
+ * A capture file being written, which any number of CaptureNetworks can share.
+ * Records are written whole, so threads can share it as well.
+ */
+class CaptureFile
+{
+public:
+  CaptureFile() : file(0), connections(0)
+  {
+
+  }
+
+  ~CaptureFile()
+  {
+		close();
+  }
+
+  /** Create a capture file, replacing any of the same name
+   *  @return 0 on success, -1 on failure
+   */
+  int open(const char* filename)
+  {
+		if ((file = fopen(filename, "wb")) == 0)
+			return -1;
+		if (fwrite(CAPTURE_MAGIC, 1, 8, file) != 8)
+		{
+			close();
+			return -1;
+		}
+		return 0;
+  }
+
+  /** Take the next connection id */
+  unsigned int newConnection()
+  {
+		return __sync_fetch_and_add(&connections, 1);
+  }
+
+  /** Append the record of a frame */
+  void write(unsigned int connection, int direction, const unsigned char* frame, int length, int captured)
+  {
+		unsigned char header[CAPTURE_RECORD_HEADER];
+		unsigned char* ptr = header;
+		struct timeval now;
+
+		if (file == 0)
+			return;
+		gettimeofday(&now, NULL);
+		ptr = writeInt(ptr, now.tv_sec * 1000000ULL + now.tv_usec, 8);
+		ptr = writeInt(ptr, connection, 4);
+		*ptr++ = (unsigned char)direction;
+		ptr = writeInt(ptr, length, 4);
+		writeInt(ptr, captured, 4);
+		flockfile(file);
+		fwrite(header, 1, sizeof(header), file);
+		fwrite(frame, 1, captured, file);
+		funlockfile(file);
+  }
+
+  int flush()
+  {
+		return (file) ? fflush(file) : -1;
+  }
+
+  int close()
+  {
+		int rc = (file) ? fclose(file) : 0;
+
+		file = 0;
+		return rc;
+  }
+
+private:
+
+  static unsigned char* writeInt(unsigned char* ptr, unsigned long long value, int bytes)
+  {
+		for (int i = 0; i < bytes; ++i)
+			*ptr++ = (unsigned char)(value >> (8 * i));
+		return ptr;
+  }
+
+  FILE* file;
+  unsigned int connections;
+};
+
+
+/**
+ * Reads the frames of a capture file in turn.  The data of each frame is only
+ * valid until the next is read.
+ */
+class CaptureReader
+{
+public:
+  CaptureReader() : file(0), buf(0), buflen(0)
+  {
+
+  }
+
+  ~CaptureReader()
+  {
+		if (file)
+			fclose(file);
+		free(buf);
+  }
+
+  /** @return 0 on success, -1 if the file can't be read or is not a capture */
+  int open(const char* filename)
+  {
+		char magic[8];
+
+		if ((file = fopen(filename, "rb")) == 0)
+			return -1;
+		if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0)
+			return -1;
+		return 0;
+  }
+
+  /**
+   * Read the next frame
+   * @return 1 for a frame, 0 at the end of the file, -1 for a bad or cut off record
+   */
+  int next(CaptureFrame& frame)
+  {
+		unsigned char header[CAPTURE_RECORD_HEADER];
+		size_t rc = fread(header, 1, sizeof(header), file);
+
+		if (rc == 0)
+			return 0;
+		if (rc != sizeof(header))
+			return -1;
+		frame.time_us = readInt(&header[0], 8);
+		frame.connection = (unsigned int)readInt(&header[8], 4);
+		frame.direction = header[12];
+		frame.length = (int)readInt(&header[13], 4);
+		frame.captured = (int)readInt(&header[17], 4);
+		if (frame.captured < 0 || frame.captured > frame.length)
+			return -1;
+		if (frame.captured > buflen)
+		{
+			unsigned char* newbuf = (unsigned char*)realloc(buf, frame.captured);
+
+			if (newbuf == 0)
+				return -1;
+			buf = newbuf;
+			buflen = frame.captured;
+		}
+		frame.data = buf;
+		return (fread(buf, 1, frame.captured, file) == (size_t)frame.captured) ? 1 : -1;
+  }
+
+private:
+
+  static unsigned long long readInt(const unsigned char* ptr, int bytes)
+  {
+		unsigned long long value = 0;
+
+		for (int i = bytes - 1; i >= 0; --i)
+			value = (value << 8) | ptr[i];
+		return value;
+  }
+
+  FILE* file;
+  unsigned char* buf;
+  int buflen;
+};
+
+
+/**
+ * A Network for MQTT::Client which passes reads and writes to another, and captures
+ * each whole MQTT frame they carry:
+ *
+ *   CaptureFile capture;
+ *   capture.open("session.cap");
+ *   IPStack ipstack;
+ *   CaptureNetwork<IPStack> network(ipstack, capture);
+ *   MQTT::Client<CaptureNetwork<IPStack>, Countdown> client(network);
+ *   ipstack.connect(hostname, port);
+ *
+ * The client reads a frame in pieces, so frames are put back together before they
+ * are written, and stamped with the time the last piece arrived.  At most MAX_FRAME
+ * bytes of each are kept.  A frame cut off by a lost connection is forgotten when
+ * the next CONNECT is written, or by reset().
+ */
+template<class Network, int MAX_FRAME = MAX_CAPTURE_FRAME>
+class CaptureNetwork
+{
+public:
+  CaptureNetwork(Network& network, CaptureFile& file) : network(network), file(file), connection(-1)
+  {
+
+  }
+
+  int read(unsigned char* buffer, int len, int timeout_ms)
+  {
+		int rc = network.read(buffer, len, timeout_ms);
+
+		if (rc > 0)
+			add(received, buffer, rc, CAPTURE_RECEIVED);
+		return rc;
+  }
+
+  int write(unsigned char* buffer, int len, int timeout)
+  {
+		int rc = network.write(buffer, len, timeout);
+
+		if (rc > 0)
+		{
+			if (isConnect(buffer, rc))
+				reset(); // a new connection, so nothing more of any frame cut off
+			add(sent, buffer, rc, CAPTURE_SENT);
+		}
+		return rc;
+  }
+
+  int disconnect()
+  {
+		reset();
+		return network.disconnect();
+  }
+
+  /** Forget any frame part sent or received, as when the network underneath is reconnected */
+  void reset()
+  {
+		sent = Frame();
+		received = Frame();
+  }
+
+  /** The id of the connection frames are being captured for, or -1 before the first frame */
+  long connectionId()
+  {
+		return connection;
+  }
+
+private:
+
+  struct Frame
+  {
+		Frame() : len(0), total(0), rem_len(0), multiplier(1)
+		{
+
+		}
+
+		unsigned char data[MAX_FRAME];
+		int len;         // bytes of the frame so far
+		int total;       // the length of the frame, once its remaining length is complete
+		int rem_len;
+		int multiplier;
+  };
+
+  // whether bytes start with a whole CONNECT, its protocol name and all
+  static bool isConnect(const unsigned char* bytes, int len)
+  {
+		int rem_len = 0, header = 0;
+
+		if (len < 12 || bytes[0] != (CONNECT << 4))
+			return false;
+		header = 1 + MQTTPacket_decodeBuf((unsigned char*)&bytes[1], &rem_len);
+		if (header + rem_len != len || rem_len < 8)
+			return false;
+		return memcmp(&bytes[header], "\0\4MQTT", 6) == 0 || memcmp(&bytes[header], "\0\6MQIsdp", 8) == 0;
+  }
+
+  void add(Frame& frame, const unsigned char* bytes, int len, int direction)
+  {
+		while (len > 0)
+		{
+			int count = 1;
+
+			if (frame.total == 0) // the fixed header, a byte at a time
+			{
+				if (frame.len < MAX_FRAME)
+					frame.data[frame.len] = *bytes;
+				if (++frame.len >= 2)
+				{
+					frame.rem_len += (*bytes & 127) * frame.multiplier;
+					frame.multiplier *= 128;
+					if ((*bytes & 128) == 0 || frame.len == 5)
+						frame.total = frame.len + frame.rem_len;
+				}
+			}
+			else
+			{
+				int keep = 0;
+
+				if ((count = frame.total - frame.len) > len)
+					count = len;
+				if ((keep = MAX_FRAME - frame.len) > count)
+					keep = count;
+				if (keep > 0)
+					memcpy(&frame.data[frame.len], bytes, keep);
+				frame.len += count;
+			}
+			bytes += count;
+			len -= count;
+			if (frame.total > 0 && frame.len == frame.total)
+			{
+				if (connection == -1 || (direction == CAPTURE_SENT && (frame.data[0] >> 4) == CONNECT))
+					connection = file.newConnection();
+				file.write(connection, direction, frame.data, frame.total, (frame.total < MAX_FRAME) ? frame.total : MAX_FRAME);
+				frame.len = frame.total = frame.rem_len = 0;
+				frame.multiplier = 1;
+			}
+		}
+  }
+
+  Network& network;
+  CaptureFile& file;
+  long connection;
+  Frame sent, received;
+};
+
+#endif
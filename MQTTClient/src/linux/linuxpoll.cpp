@@ -0,0 +1,261 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial poll driver for many clients
+ *******************************************************************************/
+
+#if !defined(MQTT_LINUXPOLL_CPP)
+#define MQTT_LINUXPOLL_CPP
+
+#include "linux.cpp"
+
+#include <sys/epoll.h>
+#include <time.h>
+#include <limits.h>
+
+#if !defined(MAX_POLL_EVENTS)
+#define MAX_POLL_EVENTS 256 // redefinable - readable sockets taken from epoll at a time
+#endif
+
+
+/**
+ * Drives many connected MQTT::Client objects from one thread, in place of calling
+ * yield on each: one epoll set holds their sockets, and one timer heap holds their
+ * keepalive deadlines, so a pass only touches the clients which are readable or due.
+ *
+ *   PollDriver<MQTT::Client<IPStack, Countdown> > driver(10000);
+ *   driver.add(client, ipstack.getSocket());
+ *   while (driver.count() > 0)
+ *     driver.run(1000);
+ *
+ * Clients whose connections are lost are removed, and passed to the lost handler.
+ * A TLSIPStack can hold decrypted bytes the socket no longer shows as readable, so
+ * this is for plain TCP and Unix domain sockets.
+ */
+template<class Client>
+class PollDriver
+{
+public:
+  typedef void (*lostHandler)(Client& client, void* context);
+
+  PollDriver(int max_clients) : epfd(epoll_create1(EPOLL_CLOEXEC)), clients(0),
+    lost(0), lost_context(0)
+  {
+		slots = (Slot*)calloc(max_clients, sizeof(Slot));
+		heap = (int*)malloc(max_clients * sizeof(int));
+		free_slots = (int*)malloc(max_clients * sizeof(int));
+		for (int i = 0; free_slots && i < max_clients; ++i)
+			free_slots[i] = max_clients - 1 - i;
+		free_count = (free_slots) ? max_clients : 0;
+  }
+
+  ~PollDriver()
+  {
+		if (epfd != -1)
+			::close(epfd);
+		free(slots);
+		free(heap);
+		free(free_slots);
+  }
+
+  /** Called for each client removed because its connection was lost */
+  void setLostHandler(lostHandler handler, void* context)
+  {
+		lost = handler;
+		lost_context = context;
+  }
+
+  /**
+   * Start driving a connected client
+   * @param fd - the socket of its network
+   * @return 0 on success, -1 if the driver is full or the socket could not be added
+   */
+  int add(Client& client, int fd)
+  {
+		struct epoll_event event;
+
+		if (epfd == -1 || slots == 0 || heap == 0 || free_count == 0)
+			return -1;
+		int slot = free_slots[--free_count];
+		event.events = EPOLLIN | EPOLLRDHUP;
+		event.data.u32 = slot;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) != 0)
+		{
+			free_count++;
+			return -1;
+		}
+		slots[slot].client = &client;
+		slots[slot].fd = fd;
+		slots[slot].pos = clients;
+		heap[clients++] = slot;
+		schedule(slot, now_ms());
+		return 0;
+  }
+
+  /** Stop driving a client, which is left as it is */
+  void remove(Client& client)
+  {
+		for (int i = 0; i < clients; ++i)
+		{
+			if (slots[heap[i]].client == &client)
+			{
+				release(heap[i]);
+				break;
+			}
+		}
+  }
+
+  /** The number of clients being driven */
+  int count()
+  {
+		return clients;
+  }
+
+  /**
+   * Wait for up to timeout_ms, or until the first keepalive deadline, then service
+   * the clients which are readable and those whose keepalive is due.
+   * @return the number of clients serviced, or -1 on error
+   */
+  int run(int timeout_ms)
+  {
+		struct epoll_event events[MAX_POLL_EVENTS];
+		unsigned long now = now_ms();
+		int serviced = 0, n = 0;
+
+		if (clients > 0 && slots[heap[0]].deadline <= now)
+			timeout_ms = 0;
+		else if (clients > 0 && slots[heap[0]].deadline - now < (unsigned long)timeout_ms)
+			timeout_ms = (int)(slots[heap[0]].deadline - now);
+		if ((n = epoll_wait(epfd, events, MAX_POLL_EVENTS, timeout_ms)) < 0)
+			return (errno == EINTR) ? 0 : -1;
+
+		now = now_ms();
+		for (int i = 0; i < n; ++i)
+		{
+			int slot = events[i].data.u32;
+
+			if (slots[slot].client != 0) // not lost while servicing an earlier event
+				serviced += service(slot, now, (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0);
+		}
+		while (clients > 0 && slots[heap[0]].deadline <= now)
+			serviced += service(heap[0], now, false);
+		return serviced;
+  }
+
+private:
+
+  struct Slot
+  {
+		Client* client;      // 0 for a free slot
+		int fd;
+		int pos;             // index in the heap
+		unsigned long deadline;
+  };
+
+  static unsigned long now_ms()
+  {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+  }
+
+  // a read of 0 bytes is taken as a timeout by the client, so a closed socket is
+  // noticed here instead, once the packet at the front has been handled
+  int service(int slot, unsigned long now, bool hangup)
+  {
+		Client* client = slots[slot].client;
+
+		if (client->poll() != MQTT::SUCCESS || !client->isConnected() || hangup)
+		{
+			release(slot);
+			if (lost)
+				lost(*client, lost_context);
+		}
+		else
+			schedule(slot, now);
+		return 1;
+  }
+
+  // set the deadline of a slot from its client's keepalive, and move it to its place in the heap
+  void schedule(int slot, unsigned long now)
+  {
+		int left = slots[slot].client->keepaliveLeft_ms();
+
+		// a millisecond more than left, which is rounded down, so the deadline is never early
+		slots[slot].deadline = (left < 0) ? ULONG_MAX : now + left + 1;
+		siftDown(siftUp(slots[slot].pos));
+  }
+
+  void release(int slot)
+  {
+		int pos = slots[slot].pos;
+
+		epoll_ctl(epfd, EPOLL_CTL_DEL, slots[slot].fd, 0);
+		slots[slot].client = 0;
+		free_slots[free_count++] = slot;
+		if (pos != --clients)
+		{
+			place(heap[clients], pos);
+			siftDown(siftUp(pos));
+		}
+  }
+
+  void place(int slot, int pos)
+  {
+		heap[pos] = slot;
+		slots[slot].pos = pos;
+  }
+
+  int siftUp(int pos)
+  {
+		int slot = heap[pos];
+
+		while (pos > 0 && slots[heap[(pos - 1) / 2]].deadline > slots[slot].deadline)
+		{
+			place(heap[(pos - 1) / 2], pos);
+			pos = (pos - 1) / 2;
+		}
+		place(slot, pos);
+		return pos;
+  }
+
+  void siftDown(int pos)
+  {
+		int slot = heap[pos];
+
+		while (2 * pos + 1 < clients)
+		{
+			int child = 2 * pos + 1;
+
+			if (child + 1 < clients && slots[heap[child + 1]].deadline < slots[heap[child]].deadline)
+				child++;
+			if (slots[heap[child]].deadline >= slots[slot].deadline)
+				break;
+			place(heap[child], pos);
+			pos = child;
+		}
+		place(slot, pos);
+  }
+
+  int epfd;
+  int clients;          // in the heap, ordered by deadline
+  Slot* slots;
+  int* heap;            // slot indices
+  int* free_slots;
+  int free_count;
+  lostHandler lost;
+  void* lost_context;
+};
+
+#endif
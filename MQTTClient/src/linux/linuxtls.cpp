@@ -0,0 +1,492 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial OpenSSL network implementation
+ *******************************************************************************/
+
+#if !defined(MQTT_LINUXTLS_CPP)
+#define MQTT_LINUXTLS_CPP
+
+#include "linux.cpp"
+
+#include <pthread.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+
+#if !defined(MAX_TLS_SESSIONS)
+#define MAX_TLS_SESSIONS 8 /* redefinable - how many brokers to keep resumable sessions for */
+#endif
+#if !defined(MAX_TLS_CONTEXTS)
+#define MAX_TLS_CONTEXTS 4 /* redefinable - how many different sets of options to keep an SSL_CTX for */
+#endif
+
+
+struct TLSOptions
+{
+  TLSOptions() : trustStore(0), keyStore(0), privateKey(0), enabledCipherSuites(0),
+    enableServerCertAuth(true), sessionResumption(true), kernelTLS(true)
+  { }
+
+  const char* trustStore;          // PEM file of trusted CA certificates, 0 for the system defaults
+  const char* keyStore;            // PEM file of the client certificate chain, 0 if not used
+  const char* privateKey;          // PEM file of the client private key, 0 if it is in keyStore
+  const char* enabledCipherSuites; // OpenSSL cipher list, 0 for the library default
+  bool enableServerCertAuth;       // verify the server certificate chain and hostname
+  bool sessionResumption;          // cache session tickets per broker and offer them on reconnect
+  bool kernelTLS;                  // hand the record layer to the kernel (kTLS) where it is supported
+};
+
+
+/**
+ * An IPStack which runs TLS over the TCP connection, for use as the Network
+ * parameter of MQTT::Client.  Session tickets are cached per broker so that
+ * reconnects resume the session, and once the handshake is complete sends go
+ * straight to the socket if the kernel has taken over the record layer.
+ * Addresses are as for IPStack::connect: over a Unix domain socket no server name
+ * is sent, and the certificate chain is verified but not its hostname.
+ */
+class TLSIPStack : public IPStack
+{
+public:
+  TLSIPStack() : ctx(0), ssl(0), ktls_send(false)
+  {
+    session_key[0] = '\0';
+  }
+
+  ~TLSIPStack()
+  {
+    release();
+  }
+
+  int connect(const char* hostname, int port, const TLSOptions& options = TLSOptions())
+  {
+    const char* servername = hostname; // for SNI and verification: without the transport, none for a Unix socket
+    int rc = -1;
+
+    release();
+    if (IPStack::connect(hostname, port) != 0)
+      return -1;
+    if (strncmp(hostname, "unix://", 7) == 0)
+      servername = 0;
+    else if (strncmp(hostname, "tcp://", 6) == 0)
+      servername += 6;
+    snprintf(session_key, sizeof(session_key), "%s:%d", servername ? servername : hostname, port);
+
+    if ((ctx = context(options)) == 0)
+      goto exit;
+    if ((ssl = SSL_new(ctx)) == 0)
+      goto exit;
+    SSL_set_app_data(ssl, this);
+    SSL_set_fd(ssl, mysock);
+    if (servername)
+    {
+      SSL_set_tlsext_host_name(ssl, servername);
+      if (options.enableServerCertAuth)
+        SSL_set1_host(ssl, servername);
+    }
+    if (options.sessionResumption)
+      restoreSession();
+
+    if (SSL_connect(ssl) == 1)
+    {
+      ktls_send = BIO_get_ktls_send(SSL_get_wbio(ssl));
+      rc = 0;
+    }
+
+exit:
+    if (rc != 0)
+    {
+      ERR_clear_error();
+      release();
+      IPStack::disconnect();
+    }
+    return rc;
+  }
+
+  // return -1 on error, or the number of bytes read
+  // which could be 0 on a read timeout
+  int read(unsigned char* buffer, int len, int timeout_ms)
+  {
+    struct timeval interval = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+    if (interval.tv_sec < 0 || (interval.tv_sec == 0 && interval.tv_usec <= 0))
+    {
+      interval.tv_sec = 0;
+      interval.tv_usec = 100;
+    }
+
+    setsockopt(mysock, SOL_SOCKET, SO_RCVTIMEO, (char *)&interval, sizeof(struct timeval));
+
+    int bytes = 0;
+    while (bytes < len)
+    {
+      int rc = SSL_read(ssl, &buffer[bytes], len - bytes);
+      if (rc > 0)
+        bytes += rc;
+      else
+      {
+        int err = SSL_get_error(ssl, rc);
+        if (err == SSL_ERROR_ZERO_RETURN)
+          bytes = 0;  // close_notify from the server
+        else if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE)
+          bytes = -1; // anything but a read timeout is fatal
+        break;
+      }
+    }
+    if (bytes > 0 && connected.tv_sec != 0)
+      connackReceived();
+    return bytes;
+  }
+
+  int write(unsigned char* buffer, int len, int timeout)
+  {
+    struct timeval tv;
+    int rc;
+
+    tv.tv_sec = 0;
+    tv.tv_usec = timeout * 1000;
+
+    setsockopt(mysock, SOL_SOCKET, SO_SNDTIMEO, (char *)&tv,sizeof(struct timeval));
+    if (ktls_send)
+      // the kernel owns the record layer, so write the plaintext straight to the socket
+      rc = ::write(mysock, buffer, len);
+    else if ((rc = SSL_write(ssl, buffer, len)) <= 0)
+    {
+      int err = SSL_get_error(ssl, rc);
+      rc = (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) ? 0 : -1;
+    }
+    return rc;
+  }
+
+  int disconnect()
+  {
+    if (ssl)
+      SSL_shutdown(ssl);
+    release();
+    return IPStack::disconnect();
+  }
+
+  /** Was the TLS session of the current connection resumed from the session cache? */
+  bool sessionReused()
+  {
+    return ssl && SSL_session_reused(ssl);
+  }
+
+  /** Are sends on the current connection encrypted by the kernel (kTLS)? */
+  bool kernelOffload()
+  {
+    return ktls_send;
+  }
+
+  /** Discard all cached TLS sessions, forcing full handshakes on the next connects */
+  static void clearSessions()
+  {
+    SessionCache& cache = sessions();
+
+    pthread_mutex_lock(&cache.mutex);
+    for (int i = 0; i < MAX_TLS_SESSIONS; ++i)
+    {
+      if (cache.entries[i].session)
+        SSL_SESSION_free(cache.entries[i].session);
+      cache.entries[i].session = 0;
+    }
+    pthread_mutex_unlock(&cache.mutex);
+  }
+
+  /** Discard the cached SSL_CTXs, so the next connects read the trust and key stores
+   *  again.  Connections already made keep theirs until they are disconnected.
+   */
+  static void clearContexts()
+  {
+    ContextCache& cache = contexts();
+
+    pthread_mutex_lock(&cache.mutex);
+    for (int i = 0; i < MAX_TLS_CONTEXTS; ++i)
+      cache.release(i);
+    pthread_mutex_unlock(&cache.mutex);
+  }
+
+private:
+
+  TLSIPStack(const TLSIPStack&);
+  TLSIPStack& operator=(const TLSIPStack&);
+
+  // Session tickets received from each broker, keyed by "host:port" and the SSL_CTX
+  // of the options connected with, so that a session is only resumed with the
+  // verification and certificate it was made with.  Least recently used entry
+  // replaced when full.
+  struct SessionCache
+  {
+    SessionCache() : clock(0)
+    {
+      pthread_mutex_init(&mutex, 0);
+      for (int i = 0; i < MAX_TLS_SESSIONS; ++i)
+        entries[i].session = 0;
+    }
+
+    int find(const char* key, SSL_CTX* ctx)
+    {
+      for (int i = 0; i < MAX_TLS_SESSIONS; ++i)
+      {
+        if (entries[i].session && entries[i].ctx == ctx && strcmp(entries[i].key, key) == 0)
+          return i;
+      }
+      return -1;
+    }
+
+    // drop the sessions made with an SSL_CTX which is being freed, as another could get its address
+    void forget(SSL_CTX* ctx)
+    {
+      pthread_mutex_lock(&mutex);
+      for (int i = 0; i < MAX_TLS_SESSIONS; ++i)
+      {
+        if (entries[i].session && entries[i].ctx == ctx)
+        {
+          SSL_SESSION_free(entries[i].session);
+          entries[i].session = 0;
+        }
+      }
+      pthread_mutex_unlock(&mutex);
+    }
+
+    struct
+    {
+      char key[NI_MAXHOST + 8];
+      SSL_CTX* ctx;
+      SSL_SESSION* session;
+      unsigned long last_used;
+    } entries[MAX_TLS_SESSIONS];
+    unsigned long clock;
+    pthread_mutex_t mutex;
+  };
+
+  static SessionCache& sessions()
+  {
+    static SessionCache cache;
+    return cache;
+  }
+
+  // An SSL_CTX for each set of options in use, so that connects don't parse the trust
+  // store again.  Each connection holds its own reference to its SSL_CTX.
+  struct ContextCache
+  {
+    ContextCache() : clock(0)
+    {
+      pthread_mutex_init(&mutex, 0);
+      for (int i = 0; i < MAX_TLS_CONTEXTS; ++i)
+        entries[i].ctx = 0;
+    }
+
+    static bool same(const char* a, const char* b)
+    {
+      return (a == 0 || b == 0) ? a == b : strcmp(a, b) == 0;
+    }
+
+    static const char* copy(const char* str)
+    {
+      return str ? strdup(str) : 0;
+    }
+
+    int find(const TLSOptions& options)
+    {
+      for (int i = 0; i < MAX_TLS_CONTEXTS; ++i)
+      {
+        const TLSOptions& o = entries[i].options;
+
+        if (entries[i].ctx && same(o.trustStore, options.trustStore) && same(o.keyStore, options.keyStore) &&
+            same(o.privateKey, options.privateKey) && same(o.enabledCipherSuites, options.enabledCipherSuites) &&
+            o.enableServerCertAuth == options.enableServerCertAuth &&
+            o.sessionResumption == options.sessionResumption && o.kernelTLS == options.kernelTLS)
+          return i;
+      }
+      return -1;
+    }
+
+    void release(int slot)
+    {
+      if (entries[slot].ctx == 0)
+        return;
+      sessions().forget(entries[slot].ctx);
+      SSL_CTX_free(entries[slot].ctx);
+      free((char*)entries[slot].options.trustStore);
+      free((char*)entries[slot].options.keyStore);
+      free((char*)entries[slot].options.privateKey);
+      free((char*)entries[slot].options.enabledCipherSuites);
+      entries[slot].ctx = 0;
+      entries[slot].options = TLSOptions();
+    }
+
+    struct
+    {
+      SSL_CTX* ctx;
+      TLSOptions options; // with the strings copied
+      unsigned long last_used;
+    } entries[MAX_TLS_CONTEXTS];
+    unsigned long clock;
+    pthread_mutex_t mutex;
+  };
+
+  static ContextCache& contexts()
+  {
+    static ContextCache cache;
+    return cache;
+  }
+
+  static SSL_CTX* newContext(const TLSOptions& options)
+  {
+    SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+
+    if (ctx == 0)
+      return 0;
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    if (options.trustStore)
+    {
+      if (SSL_CTX_load_verify_locations(ctx, options.trustStore, 0) != 1)
+        goto error;
+    }
+    else
+      SSL_CTX_set_default_verify_paths(ctx);
+    if (options.keyStore)
+    {
+      if (SSL_CTX_use_certificate_chain_file(ctx, options.keyStore) != 1 ||
+          SSL_CTX_use_PrivateKey_file(ctx, options.privateKey ? options.privateKey : options.keyStore,
+            SSL_FILETYPE_PEM) != 1)
+        goto error;
+    }
+    if (options.enabledCipherSuites && SSL_CTX_set_cipher_list(ctx, options.enabledCipherSuites) != 1)
+      goto error;
+    SSL_CTX_set_verify(ctx, options.enableServerCertAuth ? SSL_VERIFY_PEER : SSL_VERIFY_NONE, 0);
+#if defined(SSL_OP_ENABLE_KTLS)
+    if (options.kernelTLS)
+      SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS); // OpenSSL sets TCP_ULP "tls" after the handshake
+#endif
+    if (options.sessionResumption)
+    {
+      SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+      SSL_CTX_sess_set_new_cb(ctx, newSession);
+    }
+    return ctx;
+
+error:
+    SSL_CTX_free(ctx);
+    return 0;
+  }
+
+  // the SSL_CTX for a set of options, made on first use, with a reference for the caller
+  static SSL_CTX* context(const TLSOptions& options)
+  {
+    ContextCache& cache = contexts();
+    SSL_CTX* ctx = 0;
+    int slot;
+
+    pthread_mutex_lock(&cache.mutex);
+    if ((slot = cache.find(options)) < 0 && (ctx = newContext(options)) != 0)
+    {
+      slot = 0;
+      for (int i = 0; i < MAX_TLS_CONTEXTS; ++i)
+      {
+        if (cache.entries[i].ctx == 0)
+        {
+          slot = i;
+          break;
+        }
+        if (cache.entries[i].last_used < cache.entries[slot].last_used)
+          slot = i;
+      }
+      cache.release(slot);
+      cache.entries[slot].ctx = ctx;
+      cache.entries[slot].options = options;
+      cache.entries[slot].options.trustStore = ContextCache::copy(options.trustStore);
+      cache.entries[slot].options.keyStore = ContextCache::copy(options.keyStore);
+      cache.entries[slot].options.privateKey = ContextCache::copy(options.privateKey);
+      cache.entries[slot].options.enabledCipherSuites = ContextCache::copy(options.enabledCipherSuites);
+    }
+    if (slot >= 0)
+    {
+      ctx = cache.entries[slot].ctx;
+      cache.entries[slot].last_used = ++cache.clock;
+      SSL_CTX_up_ref(ctx);
+    }
+    pthread_mutex_unlock(&cache.mutex);
+    return ctx;
+  }
+
+  // called by OpenSSL for each session ticket the server sends - we keep the reference
+  static int newSession(SSL* ssl, SSL_SESSION* session)
+  {
+    TLSIPStack* stack = (TLSIPStack*)SSL_get_app_data(ssl);
+    SessionCache& cache = sessions();
+    int slot;
+
+    if (stack == 0 || !SSL_SESSION_is_resumable(session))
+      return 0;
+
+    pthread_mutex_lock(&cache.mutex);
+    if ((slot = cache.find(stack->session_key, stack->ctx)) < 0)
+    {
+      slot = 0;
+      for (int i = 0; i < MAX_TLS_SESSIONS; ++i)
+      {
+        if (cache.entries[i].session == 0)
+        {
+          slot = i;
+          break;
+        }
+        if (cache.entries[i].last_used < cache.entries[slot].last_used)
+          slot = i;
+      }
+    }
+    if (cache.entries[slot].session)
+      SSL_SESSION_free(cache.entries[slot].session);
+    strncpy(cache.entries[slot].key, stack->session_key, sizeof(cache.entries[slot].key) - 1);
+    cache.entries[slot].key[sizeof(cache.entries[slot].key) - 1] = '\0';
+    cache.entries[slot].ctx = stack->ctx;
+    cache.entries[slot].session = session;
+    cache.entries[slot].last_used = ++cache.clock;
+    pthread_mutex_unlock(&cache.mutex);
+    return 1;
+  }
+
+  void restoreSession()
+  {
+    SessionCache& cache = sessions();
+    int slot;
+
+    pthread_mutex_lock(&cache.mutex);
+    if ((slot = cache.find(session_key, ctx)) >= 0)
+    {
+      SSL_set_session(ssl, cache.entries[slot].session); // takes its own reference
+      cache.entries[slot].last_used = ++cache.clock;
+    }
+    pthread_mutex_unlock(&cache.mutex);
+  }
+
+  void release()
+  {
+    if (ssl)
+      SSL_free(ssl);
+    if (ctx)
+      SSL_CTX_free(ctx);
+    ssl = 0;
+    ctx = 0;
+    ktls_send = false;
+  }
+
+  SSL_CTX* ctx;
+  SSL* ssl;
+  bool ktls_send;
+  char session_key[NI_MAXHOST + 8];
+};
+
+#endif
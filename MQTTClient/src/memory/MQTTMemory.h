@@ -0,0 +1,400 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial in-memory platform
+ *******************************************************************************/
+
+#if !defined(MQTT_MEMORY_H)
+#define MQTT_MEMORY_H
+
+// An in-process platform for MQTT::Client: MemoryStack (the Network parameter)
+// reads and writes ring buffers shared with a ScriptedBroker, and VirtualCountdown
+// (the Timer parameter) runs on a virtual clock.  Nothing blocks - a read which
+// finds too little data advances the virtual clock by its timeout, as if it had
+// waited that long - so runs are deterministic, and keepalive intervals pass at
+// full speed.
+
+#include <string.h>
+
+#include "MQTTPacket.h"
+
+#if !defined(MEMORY_RING_SIZE)
+#define MEMORY_RING_SIZE 4096 // redefinable - bytes buffered in each direction, a power of 2
+#endif
+
+
+class VirtualClock
+{
+public:
+  /** The virtual clock, in milliseconds since it was last reset */
+  static unsigned long now()
+  {
+    return clock();
+  }
+
+  static void advance(unsigned long ms)
+  {
+    clock() += ms;
+  }
+
+  static void reset()
+  {
+    clock() = 0;
+  }
+
+private:
+  static unsigned long& clock()
+  {
+    static unsigned long ms = 0;
+    return ms;
+  }
+};
+
+
+class VirtualCountdown
+{
+public:
+  VirtualCountdown() : end_time(0)
+  {
+
+  }
+
+  VirtualCountdown(int ms)
+  {
+    countdown_ms(ms);
+  }
+
+  bool expired()
+  {
+    return (long)(end_time - VirtualClock::now()) <= 0;
+  }
+
+  void countdown_ms(int ms)
+  {
+    end_time = VirtualClock::now() + ms;
+  }
+
+  void countdown_us(long us)
+  {
+    end_time = VirtualClock::now() + (us + 999) / 1000; // the clock ticks in milliseconds
+  }
+
+  void countdown(int seconds)
+  {
+    end_time = VirtualClock::now() + seconds * 1000UL;
+  }
+
+  int left_ms()
+  {
+    long left = (long)(end_time - VirtualClock::now());
+    return (left < 0) ? 0 : (int)left;
+  }
+
+private:
+
+  unsigned long end_time;
+};
+
+
+// Indices run freely and are masked on access, so head - tail is the number of bytes held
+class MemoryRing
+{
+public:
+  MemoryRing() : head(0), tail(0) { }
+
+  unsigned int used()
+  {
+    return head - tail;
+  }
+
+  int put(const unsigned char* buf, unsigned int len)
+  {
+    unsigned int start = head & (MEMORY_RING_SIZE - 1);
+    unsigned int first = MEMORY_RING_SIZE - start;
+
+    if (len > MEMORY_RING_SIZE - used())
+      return -1;
+    if (first > len)
+      first = len;
+    memcpy(&data[start], buf, first);
+    memcpy(data, buf + first, len - first);
+    head += len;
+    return 0;
+  }
+
+  void peek(unsigned char* buf, unsigned int len)
+  {
+    unsigned int start = tail & (MEMORY_RING_SIZE - 1);
+    unsigned int first = MEMORY_RING_SIZE - start;
+
+    if (first > len)
+      first = len;
+    memcpy(buf, &data[start], first);
+    memcpy(buf + first, data, len - first);
+  }
+
+  void get(unsigned char* buf, unsigned int len)
+  {
+    peek(buf, len);
+    tail += len;
+  }
+
+private:
+  unsigned char data[MEMORY_RING_SIZE];
+  unsigned int head, tail;
+};
+
+
+/**
+ * The peer at the other end of a MemoryStack.  Each packet the client writes is
+ * answered at once, as set up by the public fields, and bursts of PUBLISH packets
+ * can be queued for the client to read.
+ */
+class ScriptedBroker
+{
+public:
+  ScriptedBroker() : connack_rc(0), session_present(false), granted_qos(2), respond_pings(true),
+    respond_publishes(true), max_inflight(10), writes(0), burst_len(0), burst_packetid_offset(0), burst_remaining(0),
+    inflight(0), next_packetid(0)
+  {
+    memset(received, '\0', sizeof(received));
+    memset(sent, '\0', sizeof(sent));
+  }
+
+  /** Queue a packet, or any bytes, for the client to read */
+  int send(const unsigned char* buf, int len)
+  {
+    if (len <= 0 || toclient.put(buf, len) != 0)
+      return -1;
+    sent[buf[0] >> 4]++;
+    return 0;
+  }
+
+  /**
+   * Queue a burst of PUBLISH packets for the client to read.  They are written
+   * into the ring as the client reads, so a burst can be of any length.
+   */
+  int publish(const char* topicName, int qos, unsigned char* payload, int payloadlen, unsigned long count)
+  {
+    MQTTString topic = MQTTString_initializer;
+    int len = 0;
+
+    topic.cstring = (char*)topicName;
+    if ((len = MQTTSerialize_publish(burst, sizeof(burst), 0, qos, 0, 1, topic, payload, payloadlen)) <= 0)
+      return -1;
+    burst_len = len;
+    burst_packetid_offset = (qos > 0) ? len - payloadlen - 2 : 0;
+    burst_remaining = count;
+    inflight = 0;
+    refill();
+    return 0;
+  }
+
+  // called by MemoryStack
+  int read(unsigned char* buffer, int len)
+  {
+    refill();
+    int bytes = (toclient.used() < (unsigned int)len) ? toclient.used() : len;
+    toclient.get(buffer, bytes);
+    return bytes;
+  }
+
+  int write(const unsigned char* buffer, int len)
+  {
+    if (tobroker.put(buffer, len) != 0)
+      return -1;
+    writes++;
+    return (receive() != 0) ? -1 : len;
+  }
+
+  int connack_rc;             // return code of the CONNACK sent for each CONNECT
+  bool session_present;       // session present flag of the CONNACK
+  int granted_qos;            // granted QoS of the SUBACK for each SUBSCRIBE, 0x80 to refuse
+  bool respond_pings;         // answer PINGREQ with PINGRESP, false to play a dead broker
+  bool respond_publishes;     // answer PUBLISH with PUBACK or PUBREC, and PUBREL with PUBCOMP
+  int max_inflight;           // QoS 1 and 2 burst messages sent and not yet acknowledged, at most
+  unsigned long received[16]; // packets received from the client, by type
+  unsigned long sent[16];     // packets sent to the client, by type
+  unsigned long writes;       // writes made by the client - the system calls a socket would take
+
+private:
+
+  // top up the client's ring from the PUBLISH burst, as far as it will go
+  void refill()
+  {
+    while (burst_remaining > 0 && toclient.used() + burst_len <= MEMORY_RING_SIZE)
+    {
+      if (burst_packetid_offset > 0)
+      {
+        if (inflight >= max_inflight)
+          break;
+        inflight++;
+        if (++next_packetid == 0)
+          next_packetid = 1;
+        burst[burst_packetid_offset] = next_packetid >> 8;
+        burst[burst_packetid_offset + 1] = next_packetid & 0xFF;
+      }
+      send(burst, burst_len);
+      burst_remaining--;
+    }
+  }
+
+  // take each complete packet the client has written and answer it
+  int receive()
+  {
+    while (tobroker.used() >= 2)
+    {
+      unsigned char header[5];
+      int rem_len = 0, multiplier = 1, len = 1;
+      unsigned int avail = tobroker.used() < sizeof(header) ? tobroker.used() : sizeof(header);
+
+      tobroker.peek(header, avail);
+      do
+      {
+        if ((unsigned int)len >= avail)
+          return (avail == sizeof(header)) ? -1 : 0; // bad length, or not all here yet
+        rem_len += (header[len] & 127) * multiplier;
+        multiplier *= 128;
+      } while ((header[len++] & 128) != 0);
+
+      if (len + rem_len > (int)sizeof(packet))
+        return -1;
+      if (tobroker.used() < (unsigned int)(len + rem_len))
+        break;
+      tobroker.get(packet, len + rem_len);
+      handle(len + rem_len);
+    }
+    return 0;
+  }
+
+  // answer one complete packet from the client, which is in packet
+  void handle(int len)
+  {
+    unsigned char reply[16];
+    unsigned char type = packet[0] >> 4, dup = 0;
+    unsigned short packetid = 0;
+    MQTTString topics[8];
+    int granted[8];
+    int count = 0, qos = 0;
+
+    received[type]++;
+    switch (type)
+    {
+      case CONNECT:
+        send(reply, MQTTSerialize_connack(reply, sizeof(reply), connack_rc, session_present));
+        break;
+      case SUBSCRIBE:
+        if (MQTTDeserialize_subscribe(&dup, &packetid, 8, &count, topics, granted, packet, len) == 1)
+        {
+          for (int i = 0; i < count; ++i)
+            granted[i] = granted_qos;
+          send(reply, MQTTSerialize_suback(reply, sizeof(reply), packetid, count, granted));
+        }
+        break;
+      case UNSUBSCRIBE:
+        if (MQTTDeserialize_unsubscribe(&dup, &packetid, 8, &count, topics, packet, len) == 1)
+          send(reply, MQTTSerialize_unsuback(reply, sizeof(reply), packetid));
+        break;
+      case PUBLISH:
+      {
+        unsigned char retained;
+        unsigned char* payload;
+        int payloadlen;
+
+        if (respond_publishes &&
+            MQTTDeserialize_publish(&dup, &qos, &retained, &packetid, &topics[0], &payload, &payloadlen, packet, len) == 1 &&
+            qos > 0)
+          send(reply, MQTTSerialize_ack(reply, sizeof(reply), (qos == 1) ? PUBACK : PUBREC, 0, packetid));
+        break;
+      }
+      case PUBREC:
+      case PUBREL:
+        if (respond_publishes && MQTTDeserialize_ack(&type, &dup, &packetid, packet, len) == 1)
+          send(reply, MQTTSerialize_ack(reply, sizeof(reply), (type == PUBREC) ? PUBREL : PUBCOMP, 0, packetid));
+        break;
+      case PUBACK:
+      case PUBCOMP:
+        if (inflight > 0)
+          inflight--;
+        break;
+      case PINGREQ:
+        if (respond_pings)
+        {
+          reply[0] = PINGRESP << 4;
+          reply[1] = 0;
+          send(reply, 2);
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  MemoryRing toclient, tobroker;
+  unsigned char burst[MEMORY_RING_SIZE / 2];
+  int burst_len;
+  int burst_packetid_offset;  // 0 for QoS 0
+  unsigned long burst_remaining;
+  int inflight;
+  unsigned short next_packetid;
+  unsigned char packet[MEMORY_RING_SIZE]; // the packet being handled
+};
+
+
+/**
+ * The Network parameter of MQTT::Client on the in-memory platform, connected to
+ * a ScriptedBroker instead of a socket.
+ */
+class MemoryStack
+{
+public:
+  MemoryStack() : broker(0)
+  {
+
+  }
+
+  int connect(ScriptedBroker& peer)
+  {
+    broker = &peer;
+    return 0;
+  }
+
+  // return -1 on error, or the number of bytes read
+  // which could be 0 on a read timeout
+  int read(unsigned char* buffer, int len, int timeout_ms)
+  {
+    if (broker == 0)
+      return -1;
+    int bytes = broker->read(buffer, len);
+    if (bytes < len && timeout_ms > 0)
+      VirtualClock::advance(timeout_ms); // a real read would have waited this long for the rest
+    return bytes;
+  }
+
+  int write(unsigned char* buffer, int len, int timeout)
+  {
+    return (broker == 0) ? -1 : broker->write(buffer, len);
+  }
+
+  int disconnect()
+  {
+    broker = 0;
+    return 0;
+  }
+
+private:
+
+  ScriptedBroker* broker;
+};
+
+#endif
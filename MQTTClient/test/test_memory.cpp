@@ -0,0 +1,1115 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial implementation
+ *******************************************************************************/
+
+
+/**
+ * @file
+ * Tests for the Paho embedded C++ client on the in-memory platform, against the
+ * scripted broker and the virtual clock.  No MQTT server is needed.
+ */
+
+
+#include "MQTTMemory.h"
+#include "MQTTClient.h"
+#include "Handlers.h"
+#include "StaticPackets.h"
+#include "MQTTBinaryLog.h"
+#include "linuxcapture.cpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sys/time.h>
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
+
+struct Options
+{
+	int verbose;
+	int test_no;
+} options =
+{
+	0,
+	0,
+};
+
+void getopts(int argc, char** argv)
+{
+	int count = 1;
+
+	while (count < argc)
+	{
+		if (strcmp(argv[count], "--test_no") == 0)
+		{
+			if (++count < argc)
+				options.test_no = atoi(argv[count]);
+		}
+		else if (strcmp(argv[count], "--verbose") == 0)
+			options.verbose = 1;
+		count++;
+	}
+}
+
+
+#define LOGA_DEBUG 0
+#define LOGA_INFO 1
+void MyLog(int LOGA_level, const char* format, ...)
+{
+	static char msg_buf[256];
+	va_list args;
+	struct timeval ts;
+	struct tm *timeinfo;
+
+	if (LOGA_level == LOGA_DEBUG && options.verbose == 0)
+	  return;
+
+	gettimeofday(&ts, NULL);
+	timeinfo = localtime(&ts.tv_sec);
+	strftime(msg_buf, 80, "%Y%m%d %H%M%S", timeinfo);
+
+	sprintf(&msg_buf[strlen(msg_buf)], ".%.3d ", (int)(ts.tv_usec / 1000));
+
+	va_start(args, format);
+	vsnprintf(&msg_buf[strlen(msg_buf)], sizeof(msg_buf) - strlen(msg_buf), format, args);
+	va_end(args);
+
+	printf("%s\n", msg_buf);
+	fflush(stdout);
+}
+
+
+#define assert(a, b, ...) myassert(__FILE__, __LINE__, a, b, __VA_ARGS__)
+
+int tests = 0;
+int failures = 0;
+
+
+void myassert(const char* filename, int lineno, const char* description, int value, const char* format, ...)
+{
+	++tests;
+	if (!value)
+	{
+		va_list args;
+
+		++failures;
+		MyLog(LOGA_INFO, "Assertion failed, file %s, line %d, description: %s\n", filename, lineno, description);
+
+		va_start(args, format);
+		vprintf(format, args);
+		va_end(args);
+	}
+	else
+		MyLog(LOGA_DEBUG, "Assertion succeeded, file %s, line %d, description: %s", filename, lineno, description);
+}
+
+
+typedef MQTT::Client<MemoryStack, VirtualCountdown, 256> Client;
+
+static int messages_arrived = 0;
+
+void messageArrived(MQTT::MessageData& md)
+{
+	++messages_arrived;
+}
+
+
+template<class C>
+static int connect_client(C& client, MemoryStack& ipstack, ScriptedBroker& broker, int keepalive)
+{
+	MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+
+	VirtualClock::reset();
+	ipstack.connect(broker);
+	data.keepAliveInterval = keepalive;
+	data.clientID.cstring = (char*)"test_memory";
+	return client.connect(data);
+}
+
+
+/*********************************************************************
+
+Test 1: the request/response flows against the scripted broker
+
+*********************************************************************/
+int test1(struct Options options)
+{
+	ScriptedBroker broker;
+	MemoryStack ipstack;
+	Client client(ipstack, 1000);
+	const char* payload = "a QoS message";
+	int rc = 0, qos;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 1 - connect, subscribe, publish and unsubscribe");
+
+	rc = connect_client(client, ipstack, broker, 60);
+	assert("Good rc from connect", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+	assert("CONNECT received", broker.received[CONNECT] == 1, "received %lu\n", broker.received[CONNECT]);
+
+	rc = client.subscribe("test/+", MQTT::QOS2, messageArrived);
+	assert("Good rc from subscribe", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+
+	for (qos = MQTT::QOS0; qos <= MQTT::QOS2; ++qos)
+	{
+		rc = client.publish("test/memory", (void*)payload, strlen(payload), (enum MQTT::QoS)qos);
+		assert("Good rc from publish", rc == MQTT::SUCCESS, "qos %d rc was %d\n", qos, rc);
+	}
+	assert("All publishes received", broker.received[PUBLISH] == 3, "received %lu\n", broker.received[PUBLISH]);
+	assert("QoS 2 flow completed", broker.received[PUBREL] == 1 && broker.sent[PUBCOMP] == 1,
+	    "PUBREL %lu PUBCOMP %lu\n", broker.received[PUBREL], broker.sent[PUBCOMP]);
+
+	rc = client.unsubscribe("test/+");
+	assert("Good rc from unsubscribe", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+	rc = client.disconnect();
+	assert("Good rc from disconnect", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+	assert("DISCONNECT received", broker.received[DISCONNECT] == 1, "received %lu\n", broker.received[DISCONNECT]);
+	assert("No virtual time passed", VirtualClock::now() == 0, "clock was %lu\n", VirtualClock::now());
+
+	MyLog(LOGA_INFO, "TEST1: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 2: a burst of incoming publishes, each acknowledged
+
+*********************************************************************/
+int test2(struct Options options)
+{
+	unsigned char payload[32];
+	int rc = 0, qos;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 2 - incoming PUBLISH bursts");
+
+	memset(payload, 'x', sizeof(payload));
+	for (qos = MQTT::QOS0; qos <= MQTT::QOS2; ++qos)
+	{
+		ScriptedBroker broker;
+		MemoryStack ipstack;
+		Client client(ipstack, 1000);
+
+		rc = connect_client(client, ipstack, broker, 60);
+		assert("Good rc from connect", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		rc = client.subscribe("burst/#", MQTT::QOS2, messageArrived);
+		assert("Good rc from subscribe", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+
+		messages_arrived = 0;
+		rc = broker.publish("burst/test", qos, payload, sizeof(payload), 1000);
+		assert("Burst queued", rc == 0, "rc was %d\n", rc);
+		rc = client.yield(100);
+		assert("Good rc from yield", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		assert("All messages delivered", messages_arrived == 1000, "qos %d arrived %d\n", qos, messages_arrived);
+		if (qos == MQTT::QOS1)
+			assert("All PUBACKs sent", broker.received[PUBACK] == 1000, "received %lu\n", broker.received[PUBACK]);
+		else if (qos == MQTT::QOS2)
+			assert("All PUBCOMPs sent", broker.received[PUBREC] == 1000 && broker.received[PUBCOMP] == 1000,
+			    "PUBREC %lu PUBCOMP %lu\n", broker.received[PUBREC], broker.received[PUBCOMP]);
+		client.disconnect();
+	}
+
+	MyLog(LOGA_INFO, "TEST2: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 3: keepalive, over minutes of virtual time
+
+*********************************************************************/
+int test3(struct Options options)
+{
+	ScriptedBroker broker;
+	MemoryStack ipstack;
+	Client client(ipstack, 1000);
+	int i, rc = 0;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 3 - keepalive on the virtual clock");
+
+	rc = connect_client(client, ipstack, broker, 10);
+	assert("Good rc from connect", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+
+	/* yield a second at a time, as an application loop would */
+	for (i = 0; i < 65 && rc == MQTT::SUCCESS; ++i)
+		rc = client.yield(1000);
+	assert("Good rc from yield", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+	assert("65 seconds of virtual time passed", VirtualClock::now() == 65000, "clock was %lu\n", VirtualClock::now());
+	assert("A ping every keepalive interval", broker.received[PINGREQ] == 6,
+	    "received %lu PINGREQs\n", broker.received[PINGREQ]);
+	assert("Still connected", client.isConnected(), "isconnected was %d\n", client.isConnected());
+
+	/* the broker stops answering - the client must notice within two intervals */
+	broker.respond_pings = false;
+	for (i = 0; i < 30 && rc == MQTT::SUCCESS; ++i)
+		rc = client.yield(1000);
+	assert("Yield fails on missing PINGRESP", rc == MQTT::FAILURE, "rc was %d\n", rc);
+	assert("Within two keepalive intervals", VirtualClock::now() <= 65000 + 20000,
+	    "clock was %lu\n", VirtualClock::now());
+
+	MyLog(LOGA_INFO, "TEST3: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 4: outbound batching, counting the writes made to the network
+
+*********************************************************************/
+int test4(struct Options options)
+{
+	ScriptedBroker broker;
+	MemoryStack ipstack;
+	Client client(ipstack, 1000);
+	unsigned char batchbuf[1024];
+	const char* topics[20];
+	MQTT::Message messages[20];
+	const char* payload = "0123456789";
+	unsigned long writes = 0;
+	int i, rc = 0;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 4 - outbound batching");
+
+	rc = connect_client(client, ipstack, broker, 60);
+	assert("Good rc from connect", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+	rc = client.setBatching(batchbuf, sizeof(batchbuf), 0, 1000000);
+	assert("Good rc from set batching", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+
+	/* 100 publishes of 25 bytes each are written as whole buffers */
+	writes = broker.writes;
+	for (i = 0; i < 100 && rc == MQTT::SUCCESS; ++i)
+		rc = client.publish("test/memory", (void*)payload, strlen(payload), MQTT::QOS0);
+	assert("Good rc from publish", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+	assert("Only full buffers written", broker.received[PUBLISH] == 80, "received %lu\n", broker.received[PUBLISH]);
+	rc = client.flush();
+	assert("Good rc from flush", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+	assert("All publishes received", broker.received[PUBLISH] == 100, "received %lu\n", broker.received[PUBLISH]);
+	assert("Three writes", broker.writes - writes == 3, "writes %lu\n", broker.writes - writes);
+
+	/* the age threshold, and waiting for the network, flush */
+	client.publish("test/memory", (void*)payload, strlen(payload), MQTT::QOS0);
+	VirtualClock::advance(1000);
+	client.publish("test/memory", (void*)payload, strlen(payload), MQTT::QOS0);
+	assert("Aged publish written", broker.received[PUBLISH] == 101, "received %lu\n", broker.received[PUBLISH]);
+	rc = client.yield(10);
+	assert("Good rc from yield", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+	assert("Yield flushed", broker.received[PUBLISH] == 102, "received %lu\n", broker.received[PUBLISH]);
+
+	/* a mixed QoS batch, coalesced in the send buffer when batching is off */
+	rc = client.setBatching(0, 0);
+	assert("Good rc from set batching", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+	for (i = 0; i < (int)ARRAY_SIZE(messages); ++i)
+	{
+		topics[i] = "test/batch";
+		messages[i].qos = (enum MQTT::QoS)(i % 2);
+		messages[i].retained = false;
+		messages[i].dup = false;
+		messages[i].payload = (void*)payload;
+		messages[i].payloadlen = strlen(payload);
+	}
+	writes = broker.writes;
+	rc = client.publishBatch(topics, messages, ARRAY_SIZE(messages));
+	assert("Good rc from publish batch", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+	assert("All publishes received", broker.received[PUBLISH] == 122, "received %lu\n", broker.received[PUBLISH]);
+	assert("All acknowledged", broker.sent[PUBACK] == 10, "sent %lu PUBACKs\n", broker.sent[PUBACK]);
+	assert("Two writes", broker.writes - writes == 2, "writes %lu\n", broker.writes - writes);
+
+	rc = client.disconnect();
+	assert("Good rc from disconnect", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+
+	MyLog(LOGA_INFO, "TEST4: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 5: the acks for an incoming burst are coalesced
+
+*********************************************************************/
+int test5(struct Options options)
+{
+	unsigned char batchbuf[256];
+	unsigned char payload[32];
+	unsigned long writes = 0;
+	int rc = 0, qos;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 5 - coalesced acknowledgements");
+
+	memset(payload, 'x', sizeof(payload));
+	for (qos = MQTT::QOS1; qos <= MQTT::QOS2; ++qos)
+	{
+		ScriptedBroker broker;
+		MemoryStack ipstack;
+		Client client(ipstack, 1000);
+
+		rc = connect_client(client, ipstack, broker, 60);
+		assert("Good rc from connect", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		rc = client.subscribe("burst/#", MQTT::QOS2, messageArrived);
+		assert("Good rc from subscribe", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		rc = client.setBatching(batchbuf, sizeof(batchbuf), 0, 1000);
+		assert("Good rc from set batching", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+
+		messages_arrived = 0;
+		writes = broker.writes;
+		rc = broker.publish("burst/test", qos, payload, sizeof(payload), 1000);
+		assert("Burst queued", rc == 0, "rc was %d\n", rc);
+		rc = client.yield(100);
+		assert("Good rc from yield", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		assert("All messages delivered", messages_arrived == 1000, "qos %d arrived %d\n", qos, messages_arrived);
+		if (qos == MQTT::QOS1)
+			assert("All PUBACKs sent", broker.received[PUBACK] == 1000, "received %lu\n", broker.received[PUBACK]);
+		else
+			assert("All PUBCOMPs sent", broker.received[PUBREC] == 1000 && broker.received[PUBCOMP] == 1000,
+			    "PUBREC %lu PUBCOMP %lu\n", broker.received[PUBREC], broker.received[PUBCOMP]);
+		/* each window of 10 messages in flight is acknowledged with one write per ack type */
+		assert("One write per window", broker.writes - writes == (unsigned long)(qos * 1000 / broker.max_inflight),
+		    "qos %d writes %lu\n", qos, broker.writes - writes);
+		client.disconnect();
+	}
+
+	MyLog(LOGA_INFO, "TEST5: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 6: handlers held as delegates, and as a compile-time table
+
+*********************************************************************/
+typedef MQTT::Delegate<void, MQTT::MessageData&> Delegate;
+
+class Counter
+{
+public:
+	Counter() : count(0) { }
+
+	void arrived(MQTT::MessageData& md)
+	{
+		++count;
+	}
+
+	int count;
+};
+
+static int telemetry_arrived = 0, commands_arrived = 0;
+
+struct Telemetry
+{
+	void operator()(MQTT::MessageData& md)
+	{
+		++telemetry_arrived;
+	}
+};
+
+struct Commands
+{
+	void operator()(MQTT::MessageData& md)
+	{
+		++commands_arrived;
+	}
+};
+
+typedef MQTT::HandlerTable<MQTT::MessageData&, Telemetry, Commands> Table;
+
+int test6(struct Options options)
+{
+	unsigned char payload[8] = "payload";
+	int rc = 0;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 6 - handler policies");
+
+	{
+		ScriptedBroker broker;
+		MemoryStack ipstack;
+		MQTT::Client<MemoryStack, VirtualCountdown, 256, 5, Delegate> client(ipstack, 1000);
+		Counter counter;
+		Delegate member;
+		size_t bytes = 0;
+
+		rc = connect_client(client, ipstack, broker, 60);
+		assert("Good rc from connect", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		rc = client.subscribe("lambda/#", MQTT::QOS0, Delegate([&bytes](MQTT::MessageData& md) { bytes += md.message.payloadlen; }));
+		assert("Good rc from subscribe", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		member.attach(&counter, &Counter::arrived);
+		rc = client.subscribe("member/#", MQTT::QOS0, member);
+		assert("Good rc from subscribe", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		rc = client.subscribe("function/#", MQTT::QOS0, messageArrived);
+		assert("Good rc from subscribe", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+
+		messages_arrived = 0;
+		broker.publish("lambda/a", 0, payload, sizeof(payload), 3);
+		rc = client.yield(10);
+		broker.publish("member/a", 0, payload, sizeof(payload), 2);
+		rc = client.yield(10);
+		broker.publish("function/a", 0, payload, sizeof(payload), 1);
+		rc = client.yield(10);
+		assert("Good rc from yield", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		assert("Lambda captured state", bytes == 3 * sizeof(payload), "bytes %lu\n", (unsigned long)bytes);
+		assert("Member function called", counter.count == 2, "count %d\n", counter.count);
+		assert("Function called", messages_arrived == 1, "arrived %d\n", messages_arrived);
+
+		rc = client.setMessageHandler("lambda/#", Delegate());
+		assert("Good rc from removing handler", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		broker.publish("lambda/a", 0, payload, sizeof(payload), 1);
+		rc = client.yield(10);
+		assert("Removed handler not called", bytes == 3 * sizeof(payload), "bytes %lu\n", (unsigned long)bytes);
+		client.disconnect();
+	}
+
+	{
+		ScriptedBroker broker;
+		MemoryStack ipstack;
+		MQTT::Client<MemoryStack, VirtualCountdown, 256, 5, Table> client(ipstack, 1000);
+
+		rc = connect_client(client, ipstack, broker, 60);
+		assert("Good rc from connect", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		rc = client.subscribe("telemetry/#", MQTT::QOS1, Table::of<Telemetry>());
+		assert("Good rc from subscribe", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		rc = client.subscribe("commands/#", MQTT::QOS1, Table::of<Commands>());
+		assert("Good rc from subscribe", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		client.setDefaultMessageHandler(messageArrived);
+
+		messages_arrived = 0;
+		broker.publish("telemetry/a", 1, payload, sizeof(payload), 5);
+		rc = client.yield(10);
+		broker.publish("commands/a", 1, payload, sizeof(payload), 2);
+		rc = client.yield(10);
+		broker.publish("other/a", 1, payload, sizeof(payload), 1);
+		rc = client.yield(10);
+		assert("Good rc from yield", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		assert("Telemetry handler called", telemetry_arrived == 5, "arrived %d\n", telemetry_arrived);
+		assert("Commands handler called", commands_arrived == 2, "arrived %d\n", commands_arrived);
+		assert("Default handler called", messages_arrived == 1, "arrived %d\n", messages_arrived);
+		client.disconnect();
+	}
+
+	MyLog(LOGA_INFO, "TEST6: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 7: packets and topic filters built at compile time
+
+*********************************************************************/
+static constexpr auto static_connect = MQTT::Static::connect("test_memory", 30);
+static constexpr auto static_login = MQTT::Static::connect("test_memory", "user", "secret", 30, false);
+static constexpr auto static_subscribe = MQTT::Static::subscribe("sensors/+/temp", 1, 7);
+static constexpr auto static_unsubscribe = MQTT::Static::unsubscribe("sensors/+/temp", 8);
+static constexpr auto static_status = MQTT::Static::publish("status/test_memory", "online", true);
+static constexpr MQTT::Static::Topic<sizeof("sensors/1/temp")> static_topic("sensors/1/temp");
+static constexpr MQTT::Static::TopicFilter<sizeof("sensors/+/temp")> static_temps("sensors/+/temp");
+static constexpr MQTT::Static::TopicFilter<sizeof("sensors/#")> static_sensors("sensors/#");
+static constexpr MQTT::Static::TopicFilter<sizeof("sensors/1/temp")> static_exact("sensors/1/temp");
+static constexpr MQTT::Static::TopicFilter<sizeof("+/+")> static_two("+/+");
+
+/* the first byte of a packet is its type, and the filter is split when compiled */
+static_assert(static_connect.data[0] == CONNECT << 4, "CONNECT built at compile time");
+static_assert(static_temps.levelCount() == 3, "filter levels counted at compile time");
+static_assert(static_temps.matches("sensors/9/temp", 14), "filter matched at compile time");
+
+/* compare a packet with the one MQTTSerialize_ writes */
+template<int N>
+static bool same_packet(const MQTT::Static::Packet<N>& packet, unsigned char* buf, int len)
+{
+	return len == packet.size() && memcmp(packet.data, buf, len) == 0;
+}
+
+int test7(struct Options options)
+{
+	MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+	MQTTString topic = MQTTString_initializer;
+	unsigned char buf[128], staticbuf[128];
+	unsigned char payload[] = "21.5";
+	int qos = 1, len = 0, staticlen = 0;
+	struct { const char* name; bool temps, sensors, exact, two; } names[] = {
+		{"sensors/1/temp", true, true, true, false},
+		{"sensors/22/temp", true, true, false, false},
+		{"sensors//temp", true, true, false, false},
+		{"sensors/1/temp/x", false, true, false, false},
+		{"sensors/1", false, true, false, true},
+		{"sensors", false, true, false, false},
+		{"sensor/1/temp", false, false, false, false},
+		{"$SYS/1", false, false, false, false},
+		{"a/", false, false, false, true},
+	};
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 7 - compile-time packets and topic filters");
+
+	data.clientID.cstring = (char*)"test_memory";
+	data.keepAliveInterval = 30;
+	len = MQTTSerialize_connect(buf, sizeof(buf), &data);
+	assert("CONNECT matches", same_packet(static_connect, buf, len), "len %d\n", len);
+	data.username.cstring = (char*)"user";
+	data.password.cstring = (char*)"secret";
+	data.cleansession = 0;
+	len = MQTTSerialize_connect(buf, sizeof(buf), &data);
+	assert("CONNECT with login matches", same_packet(static_login, buf, len), "len %d\n", len);
+
+	topic.cstring = (char*)"sensors/+/temp";
+	len = MQTTSerialize_subscribe(buf, sizeof(buf), 0, 7, 1, &topic, &qos);
+	assert("SUBSCRIBE matches", same_packet(static_subscribe, buf, len), "len %d\n", len);
+	len = MQTTSerialize_unsubscribe(buf, sizeof(buf), 0, 8, 1, &topic);
+	assert("UNSUBSCRIBE matches", same_packet(static_unsubscribe, buf, len), "len %d\n", len);
+	topic.cstring = (char*)"status/test_memory";
+	len = MQTTSerialize_publish(buf, sizeof(buf), 0, 0, 1, 0, topic, (unsigned char*)"online", 6);
+	assert("PUBLISH matches", same_packet(static_status, buf, len), "len %d\n", len);
+	len = MQTTSerialize_pingreq(buf, sizeof(buf));
+	assert("PINGREQ matches", same_packet(MQTT::Static::pingreq(), buf, len), "len %d\n", len);
+	len = MQTTSerialize_disconnect(buf, sizeof(buf));
+	assert("DISCONNECT matches", same_packet(MQTT::Static::disconnect(), buf, len), "len %d\n", len);
+
+	for (qos = 0; qos <= 2; ++qos)
+	{
+		topic.cstring = (char*)"sensors/1/temp";
+		len = MQTTSerialize_publish(buf, sizeof(buf), 0, qos, 0, 9, topic, payload, 4);
+		staticlen = static_topic.serialize(staticbuf, sizeof(staticbuf), 0, qos, 0, 9, payload, 4);
+		assert("PUBLISH to a static topic matches", len == staticlen && memcmp(buf, staticbuf, len) == 0,
+		    "qos %d len %d\n", qos, staticlen);
+	}
+	staticlen = static_topic.serialize(staticbuf, 8, 0, 0, 0, 0, payload, 4);
+	assert("Short buffer refused", staticlen == MQTTPACKET_BUFFER_TOO_SHORT, "len %d\n", staticlen);
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(names); ++i)
+	{
+		MQTTString name = MQTTString_initializer;
+
+		name.lenstring.data = (char*)names[i].name;
+		name.lenstring.len = strlen(names[i].name);
+		assert("sensors/+/temp", static_temps.matches(name) == names[i].temps, "name %s\n", names[i].name);
+		assert("sensors/#", static_sensors.matches(name) == names[i].sensors, "name %s\n", names[i].name);
+		assert("sensors/1/temp", static_exact.matches(name) == names[i].exact, "name %s\n", names[i].name);
+		assert("+/+", static_two.matches(name) == names[i].two, "name %s\n", names[i].name);
+	}
+
+	MyLog(LOGA_INFO, "TEST7: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 8: topics and payloads passed as views, with their lengths
+
+*********************************************************************/
+static char view_topic[64];
+static size_t view_payloadlen = 0;
+
+void viewArrived(MQTT::MessageData& md)
+{
+	MQTT::StringView topic = md.topic();
+
+	if (topic.size() < sizeof(view_topic))
+	{
+		memcpy(view_topic, topic.data(), topic.size());
+		view_topic[topic.size()] = '\0';
+	}
+	view_payloadlen = md.payload().size();
+	++messages_arrived;
+}
+
+int test8(struct Options options)
+{
+	const char names[] = "sensors/#status/online";
+	unsigned char payload[8] = "payload";
+	int rc = 0;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 8 - string and byte views");
+
+	{
+		ScriptedBroker broker;
+		MemoryStack ipstack;
+		Client client(ipstack, 1000);
+		MQTT::StringView filter(names, 9); // "sensors/#", not null terminated
+
+		rc = connect_client(client, ipstack, broker, 60);
+		assert("Good rc from connect", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		rc = client.subscribe(filter, MQTT::QOS1, viewArrived);
+		assert("Good rc from subscribe", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+
+		messages_arrived = 0;
+		broker.publish("sensors/a", 1, payload, 5, 2);
+		rc = client.yield(10);
+		assert("Good rc from yield", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		assert("Messages arrived", messages_arrived == 2, "arrived %d\n", messages_arrived);
+		assert("Topic view", strcmp(view_topic, "sensors/a") == 0, "topic %s\n", view_topic);
+		assert("Payload view", view_payloadlen == 5, "payloadlen %lu\n", (unsigned long)view_payloadlen);
+
+		broker.publish("sensorsX/a", 0, payload, 5, 1);
+		rc = client.yield(10);
+		assert("Other topic not matched", messages_arrived == 2, "arrived %d\n", messages_arrived);
+
+		rc = client.publish(MQTT::StringView(names + 9, 6), MQTT::ByteView(payload, 5), MQTT::QOS1);
+		assert("Good rc from publish", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		assert("PUBLISH sent", broker.received[PUBLISH] == 1, "received %lu\n", broker.received[PUBLISH]);
+#if __cplusplus >= 201703L
+		std::string_view online(names + 9);
+		rc = client.publish(online, MQTT::ByteView(payload, 5));
+		assert("Good rc from publish", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		assert("PUBLISH sent", broker.received[PUBLISH] == 2, "received %lu\n", broker.received[PUBLISH]);
+		assert("Converts back to string_view", std::string_view(MQTT::StringView(online)) == "status/online",
+		    "size %lu\n", (unsigned long)online.size());
+#endif
+
+		rc = client.unsubscribe(MQTT::StringView(names, 9));
+		assert("Good rc from unsubscribe", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		broker.publish("sensors/a", 0, payload, 5, 1);
+		rc = client.yield(10);
+		assert("Unsubscribed handler not called", messages_arrived == 2, "arrived %d\n", messages_arrived);
+		client.disconnect();
+	}
+
+	MyLog(LOGA_INFO, "TEST8: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 9: keepalive state is per client, and poll does one pass without waiting
+
+*********************************************************************/
+int test9(struct Options options)
+{
+	int rc = 0;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 9 - keepalive of many clients");
+
+	{
+		ScriptedBroker dead, alive;
+		MemoryStack deadstack, alivestack;
+		Client a(deadstack, 1000), b(alivestack, 1000);
+
+		dead.respond_pings = false;
+		rc = connect_client(b, alivestack, alive, 10);
+		assert("Good rc from connect", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		rc = connect_client(a, deadstack, dead, 10); // resets the clock for both
+		assert("Good rc from connect", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		assert("Keepalive due in the interval", a.keepaliveLeft_ms() == 10000, "left %d\n", a.keepaliveLeft_ms());
+
+		VirtualClock::advance(10000);
+		rc = a.poll();
+		assert("Good rc from poll", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		assert("Ping sent", dead.received[PINGREQ] == 1, "pings %lu\n", dead.received[PINGREQ]);
+		assert("Response due in the interval", a.keepaliveLeft_ms() == 10000, "left %d\n", a.keepaliveLeft_ms());
+
+		VirtualClock::advance(5000);
+		rc = b.poll();
+		assert("Good rc from poll", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		assert("Ping sent", alive.received[PINGREQ] == 1, "pings %lu\n", alive.received[PINGREQ]);
+		assert("No wait in poll", VirtualClock::now() == 15000, "now %lu\n", VirtualClock::now());
+
+		VirtualClock::advance(5001); // past the first client's deadline, but not the second's
+		rc = a.poll();
+		assert("Bad rc from poll", rc == MQTT::FAILURE, "rc was %d\n", rc);
+		assert("Unanswered ping disconnects", !a.isConnected(), "connected %d\n", a.isConnected());
+		assert("No keepalive once disconnected", a.keepaliveLeft_ms() == -1, "left %d\n", a.keepaliveLeft_ms());
+		rc = b.poll();
+		assert("Good rc from poll", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		assert("Answered ping keeps the connection", b.isConnected(), "connected %d\n", b.isConnected());
+		b.disconnect();
+	}
+
+	MyLog(LOGA_INFO, "TEST9: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 10: inbound QoS 2 duplicates, with many messages waiting for their PUBREL
+
+*********************************************************************/
+int test10(struct Options options)
+{
+	MQTTString topic = MQTTString_initializer;
+	unsigned char payload[16], packet[64];
+	int len = 0, rc = 0;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 10 - QoS 2 duplicate detection");
+
+	{
+		ScriptedBroker broker;
+		MemoryStack ipstack;
+		Client client(ipstack, 1000);
+
+		memset(payload, 'x', sizeof(payload));
+		broker.respond_publishes = false; // hold back the PUBRELs, so every id stays in flight
+		broker.max_inflight = 1000;
+		rc = connect_client(client, ipstack, broker, 60);
+		assert("Good rc from connect", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		rc = client.subscribe("dup/#", MQTT::QOS2, messageArrived);
+		assert("Good rc from subscribe", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+
+		messages_arrived = 0;
+		broker.publish("dup/a", 2, payload, sizeof(payload), 1000);
+		rc = client.yield(100);
+		assert("Good rc from yield", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		assert("Every message delivered", messages_arrived == 1000, "arrived %d\n", messages_arrived);
+
+		topic.cstring = (char*)"dup/a";
+		len = MQTTSerialize_publish(packet, sizeof(packet), 1, 2, 0, 500, topic, payload, sizeof(payload));
+		broker.send(packet, len);
+		rc = client.yield(100);
+		assert("Duplicate not delivered", messages_arrived == 1000, "arrived %d\n", messages_arrived);
+		assert("Duplicate acknowledged", broker.received[PUBREC] == 1001, "PUBREC %lu\n", broker.received[PUBREC]);
+
+		broker.send(packet, MQTTSerialize_ack(packet, sizeof(packet), PUBREL, 0, 500));
+		rc = client.yield(100);
+		assert("Release completed", broker.received[PUBCOMP] == 1, "PUBCOMP %lu\n", broker.received[PUBCOMP]);
+		len = MQTTSerialize_publish(packet, sizeof(packet), 0, 2, 0, 500, topic, payload, sizeof(payload));
+		broker.send(packet, len);
+		rc = client.yield(100);
+		assert("Released id reused", messages_arrived == 1001, "arrived %d\n", messages_arrived);
+		client.disconnect();
+	}
+
+	MyLog(LOGA_INFO, "TEST10: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 11: compile-time log levels, and the binary log ring and its drain
+
+*********************************************************************/
+static MQTT::BinaryLog binary_log; // 1024 records, too large for the stack
+static char text[65536];
+
+static int read_log(FILE* f, char* buf, int buflen)
+{
+	int len = 0;
+
+	fflush(f);
+	rewind(f);
+	len = fread(buf, 1, buflen - 1, f);
+	buf[len] = '\0';
+	return len;
+}
+
+
+int test11(struct Options options)
+{
+	MQTTString topicFilter = MQTTString_initializer;
+	unsigned char packet[64];
+	char name[16] = "sensor-17";
+	int qos = 1, evaluated = 0, len = 0;
+	FILE* f = tmpfile();
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 11 - log levels and the binary log");
+
+#if defined(MQTT_LOG_BINARY)
+	/* the client's own log calls go to the ring of the binary log, for draining later */
+	{
+		ScriptedBroker broker;
+		MemoryStack ipstack;
+		Client client(ipstack, 1000);
+		FILE* g = fopen("/dev/null", "w");
+		unsigned long dropped = 0;
+		int i, rc = 0;
+
+		MQTT::BinaryLog::instance().drain(g); // what the earlier tests left
+		fclose(g);
+		g = tmpfile();
+		dropped = MQTT::BinaryLog::instance().dropped();
+		DEBUG("%d\n", ++evaluated);
+		assert("Debug recorded", MQTT_LOG_LEVEL == MQTT_LOG_LEVEL_DEBUG && evaluated == 1,
+				"level %d, evaluated %d\n", MQTT_LOG_LEVEL, evaluated);
+		broker.respond_pings = false;
+		rc = connect_client(client, ipstack, broker, 10);
+		assert("Good rc from connect", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		for (i = 0; i < 30 && rc == MQTT::SUCCESS; ++i)
+			rc = client.yield(1000);
+		assert("Yield fails on missing PINGRESP", rc == MQTT::FAILURE, "rc was %d\n", rc);
+		len = MQTT::BinaryLog::instance().drain(g);
+		assert("Client records drained", len >= 4, "drained %d\n", len);
+		read_log(g, text, sizeof(text));
+		assert("Test record written", strstr(text, "DEBUG:   int test11(Options) L#") != 0, "text was %.400s\n", text);
+		assert("Packets formatted", strstr(text, "Rc 0 from sending packet CONNECT MQTT version 4, client id test_memory") != 0 &&
+				strstr(text, "PINGREQ") != 0, "text was %.400s\n", text);
+		assert("Client record written", strstr(text, "::keepalive() [with ") != 0 &&
+				strstr(text, "PINGRESP not received in keepalive interval\r\n") != 0, "text was %.400s\n", text);
+		assert("None dropped", MQTT::BinaryLog::instance().dropped() == dropped, "dropped %lu\n",
+				MQTT::BinaryLog::instance().dropped() - dropped);
+		fclose(g);
+	}
+#else
+	DEBUG("%d\n", ++evaluated);
+	assert("Debug compiled out", MQTT_LOG_LEVEL > MQTT_LOG_LEVEL_DEBUG && evaluated == 0,
+			"level %d, evaluated %d\n", MQTT_LOG_LEVEL, evaluated);
+#endif
+
+	binary_log.record(MQTT_LOG_LEVEL_WARN, "test11", 1, "%s has %d%% left, %5.2f %lu %x%c\n",
+			name, -3, 0.5, (unsigned long)4000000000UL, 255u, 'z');
+	strcpy(name, "overwritten"); // the record holds a copy
+	topicFilter.cstring = (char*)"sensors/#";
+	len = MQTTSerialize_subscribe(packet, sizeof(packet), 0, 7, 1, &topicFilter, &qos);
+	binary_log.recordPacket(MQTT_LOG_LEVEL_DEBUG, "test11", 2, "Rc %d from sending packet %s\n", 0,
+			packet, len, MQTTFormat_toServerString);
+	binary_log.record(MQTT_LOG_LEVEL_LOG, "test11", 3, "missing %d %s\n", 1);
+	assert("Nothing written before the drain", read_log(f, text, sizeof(text)) == 0, "wrote %s\n", text);
+	len = binary_log.drain(f);
+	assert("Three records drained", len == 3, "drained %d\n", len);
+	read_log(f, text, sizeof(text));
+	assert("Arguments formatted", strstr(text, "WARN:  test11 L#1 sensor-17 has -3% left,  0.50 4000000000 ffz\n") != 0,
+			"text was %s\n", text);
+	assert("Packet formatted when drained", strstr(text, "DEBUG:   test11 L#2 Rc 0 from sending packet SUBSCRIBE dup 0, packet id 7 count 1 topic sensors/# qos 1\n") != 0,
+			"text was %s\n", text);
+	assert("Missing arguments marked", strstr(text, "LOG:   test11 L#3 missing 1 ?\n") != 0, "text was %s\n", text);
+
+	/* a packet cut to fit its record is not formatted from the part kept */
+	{
+		MQTTString topicName = MQTTString_initializer;
+		unsigned char publish[512];
+		char longTopic[301];
+
+		memset(longTopic, 't', 300);
+		longTopic[300] = '\0';
+		topicName.cstring = longTopic;
+		len = MQTTSerialize_publish(publish, sizeof(publish), 0, 0, 0, 0, topicName, (unsigned char*)"payload", 7);
+		binary_log.recordPacket(MQTT_LOG_LEVEL_DEBUG, "test11", 5, "Rc %d from sending packet %s\n", 0,
+				publish, len, MQTTFormat_toServerString);
+		len = binary_log.drain(f);
+		read_log(f, text, sizeof(text));
+		assert("Cut packet marked", strstr(text, "test11 L#5 Rc 0 from sending packet cut, 312 bytes: 30 b5 02 01 2c 74 74") != 0,
+				"text was %s\n", text);
+	}
+
+	for (int i = 0; i < MQTT_LOG_RING_SIZE + 5; ++i)
+		binary_log.record(MQTT_LOG_LEVEL_LOG, "test11", 4, "record %d\n", i);
+	assert("Records dropped when the ring is full", binary_log.dropped() == 5, "dropped %lu\n", binary_log.dropped());
+
+	rewind(f);
+	assert("Drain thread started", binary_log.start(f) == 0, "already started%s\n", "");
+	binary_log.stop();
+	read_log(f, text, sizeof(text));
+	assert("Drain thread wrote the ring out", strstr(text, "record 0\n") != 0 && strstr(text, "record 1023\n") != 0,
+			"text was %.200s\n", text);
+	fclose(f);
+
+	MyLog(LOGA_INFO, "TEST11: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 12: capture of whole frames, put back together from the client's reads
+
+*********************************************************************/
+// a network which takes every write, and reads back bytes put in it
+struct LoopStack
+{
+	LoopStack() : len(0) { }
+
+	int read(unsigned char* buffer, int count, int timeout_ms)
+	{
+		count = (count < len) ? count : len;
+		memcpy(buffer, data, count);
+		memmove(data, &data[count], len -= count);
+		return count;
+	}
+
+	int write(unsigned char* buffer, int count, int timeout)
+	{
+		return count;
+	}
+
+	int disconnect()
+	{
+		return 0;
+	}
+
+	unsigned char data[64];
+	int len;
+};
+
+
+int test12(struct Options options)
+{
+	typedef CaptureNetwork<MemoryStack, 64> CaptureStack;
+	const char* filename = "test_memory.cap";
+	unsigned char payload[100];
+	int sent[16] = {0}, received[16] = {0};
+	int frames = 0, truncated = 0, connection = 0, rc = 0;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 12 - packet capture");
+
+	{
+		CaptureFile capture;
+		ScriptedBroker broker;
+		MemoryStack ipstack;
+		CaptureStack network(ipstack, capture);
+		MQTT::Client<CaptureStack, VirtualCountdown, 256> client(network, 1000);
+		MQTT::Message message;
+
+		memset(payload, 'x', sizeof(payload));
+		rc = capture.open(filename);
+		assert("Capture opened", rc == 0, "rc was %d\n", rc);
+		rc = connect_client(client, ipstack, broker, 60);
+		assert("Good rc from connect", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		rc = client.subscribe("cap/#", MQTT::QOS1, messageArrived);
+		assert("Good rc from subscribe", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		message.qos = MQTT::QOS1;
+		message.retained = false;
+		message.payload = payload;
+		message.payloadlen = sizeof(payload);
+		rc = client.publish("cap/big", message);
+		assert("Good rc from publish", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		broker.publish("cap/a", 1, payload, 10, 3);
+		rc = client.yield(100);
+		client.disconnect();
+		rc = connect_client(client, ipstack, broker, 60);
+		assert("Good rc from reconnect", rc == MQTT::SUCCESS, "rc was %d\n", rc);
+		assert("Reconnect is a new connection", network.connectionId() == 1, "id %ld\n", network.connectionId());
+		capture.close();
+	}
+
+	{
+		CaptureReader reader;
+		CaptureFrame frame;
+
+		rc = reader.open(filename);
+		assert("Capture read", rc == 0, "rc was %d\n", rc);
+		while ((rc = reader.next(frame)) == 1)
+		{
+			int type = frame.data[0] >> 4;
+
+			if (frames++ == 0)
+				assert("CONNECT first", frame.direction == CAPTURE_SENT && type == CONNECT, "type %d\n", type);
+			if (frame.direction == CAPTURE_SENT)
+				sent[type]++;
+			else
+				received[type]++;
+			if (frame.captured < frame.length)
+				truncated++;
+			if (type == PUBLISH && frame.direction == CAPTURE_RECEIVED)
+				assert("Received frame whole", frame.captured == frame.length &&
+						MQTTPacket_len(frame.length - 2) == frame.length, "length %d\n", frame.length);
+			if (type == CONNECT)
+				connection = frame.connection;
+			assert("Frames of their connection", frame.connection == (unsigned int)connection, "connection %u\n", frame.connection);
+		}
+		assert("Capture ended cleanly", rc == 0, "rc was %d\n", rc);
+	}
+	assert("Frames sent", sent[CONNECT] == 2 && sent[SUBSCRIBE] == 1 && sent[PUBLISH] == 1 && sent[PUBACK] == 3 &&
+			sent[DISCONNECT] == 1, "CONNECT %d SUBSCRIBE %d PUBLISH %d PUBACK %d\n", sent[CONNECT], sent[SUBSCRIBE],
+			sent[PUBLISH], sent[PUBACK]);
+	assert("Frames received", received[CONNACK] == 2 && received[SUBACK] == 1 && received[PUBACK] == 1 &&
+			received[PUBLISH] == 3, "CONNACK %d SUBACK %d PUBACK %d PUBLISH %d\n", received[CONNACK], received[SUBACK],
+			received[PUBACK], received[PUBLISH]);
+	assert("Large publish truncated", truncated == 1, "truncated %d\n", truncated);
+
+	/* frames cut off when a connection drops are not run into the next connection's */
+	{
+		CaptureFile capture;
+		LoopStack loop;
+		CaptureNetwork<LoopStack, 64> network(loop, capture);
+		MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+		MQTTString topic = MQTTString_initializer;
+		unsigned char buf[64], in[64];
+		int len = 0;
+
+		capture.open(filename);
+		topic.cstring = (char*)"cap/cut";
+		len = MQTTSerialize_publish(buf, sizeof(buf), 0, 0, 0, 0, topic, payload, 20);
+		network.write(buf, len - 10, 1000); // the connection drops part way through both
+		loop.len = MQTTSerialize_publish(loop.data, sizeof(loop.data), 0, 0, 0, 0, topic, payload, 20);
+		network.read(in, 8, 1000);
+		data.clientID.cstring = (char*)"test_memory";
+		len = MQTTSerialize_connect(buf, sizeof(buf), &data);
+		network.write(buf, len, 1000);
+		loop.len = MQTTSerialize_connack(loop.data, sizeof(loop.data), 0, 0);
+		network.read(in, 1, 1000);
+		network.read(&in[1], 3, 1000);
+		len = MQTTSerialize_publish(buf, sizeof(buf), 0, 0, 0, 0, topic, payload, 20);
+		network.write(buf, len - 10, 1000); // and again, before a reset
+		network.reset();
+		len = MQTTSerialize_disconnect(buf, sizeof(buf));
+		network.write(buf, len, 1000);
+		capture.close();
+
+		CaptureReader reader;
+		CaptureFrame frame;
+		int types[3] = {CONNECT, CONNACK, DISCONNECT}, count = 0;
+
+		reader.open(filename);
+		while ((rc = reader.next(frame)) == 1 && count < 3)
+		{
+			assert("Whole frames after the cut", (frame.data[0] >> 4) == types[count] && frame.captured == frame.length,
+					"frame %d type %d length %d\n", count, frame.data[0] >> 4, frame.length);
+			++count;
+		}
+		assert("Only the whole frames", rc == 0 && count == 3, "rc %d count %d\n", rc, count);
+	}
+	remove(filename);
+
+	MyLog(LOGA_INFO, "TEST12: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+int main(int argc, char** argv)
+{
+	int rc = 0;
+	int (*tests[])(struct Options) = {NULL, test1, test2, test3, test4, test5, test6, test7, test8, test9, test10, test11, test12};
+
+	getopts(argc, argv);
+
+	if (options.test_no == 0)
+	{ /* run all the tests */
+		for (options.test_no = 1; options.test_no < (int)ARRAY_SIZE(tests); ++options.test_no)
+			rc += tests[options.test_no](options); /* return number of failures.  0 = test succeeded */
+	}
+	else
+		rc = tests[options.test_no](options); /* run just the selected test */
+
+	if (rc == 0)
+		MyLog(LOGA_INFO, "verdict pass");
+	else
+		MyLog(LOGA_INFO, "verdict fail");
+	return rc;
+}
@@ -0,0 +1,477 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial implementation
+ *******************************************************************************/
+
+
+/**
+ * @file
+ * Tests for the OpenSSL network implementation of the Paho embedded C++ client,
+ * against an in-process TLS echo server.
+ */
+
+
+#include "linuxtls.cpp"
+#include "MQTTPacket.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
+
+struct Options
+{
+	int verbose;
+	int test_no;
+} options =
+{
+	0,
+	0,
+};
+
+void getopts(int argc, char** argv)
+{
+	int count = 1;
+
+	while (count < argc)
+	{
+		if (strcmp(argv[count], "--test_no") == 0)
+		{
+			if (++count < argc)
+				options.test_no = atoi(argv[count]);
+		}
+		else if (strcmp(argv[count], "--verbose") == 0)
+			options.verbose = 1;
+		count++;
+	}
+}
+
+
+#define LOGA_DEBUG 0
+#define LOGA_INFO 1
+void MyLog(int LOGA_level, const char* format, ...)
+{
+	static char msg_buf[256];
+	va_list args;
+	struct timeval ts;
+	struct tm *timeinfo;
+
+	if (LOGA_level == LOGA_DEBUG && options.verbose == 0)
+	  return;
+
+	gettimeofday(&ts, NULL);
+	timeinfo = localtime(&ts.tv_sec);
+	strftime(msg_buf, 80, "%Y%m%d %H%M%S", timeinfo);
+
+	sprintf(&msg_buf[strlen(msg_buf)], ".%.3d ", (int)(ts.tv_usec / 1000));
+
+	va_start(args, format);
+	vsnprintf(&msg_buf[strlen(msg_buf)], sizeof(msg_buf) - strlen(msg_buf), format, args);
+	va_end(args);
+
+	printf("%s\n", msg_buf);
+	fflush(stdout);
+}
+
+
+#define assert(a, b, ...) myassert(__FILE__, __LINE__, a, b, __VA_ARGS__)
+
+int tests = 0;
+int failures = 0;
+
+
+void myassert(const char* filename, int lineno, const char* description, int value, const char* format, ...)
+{
+	++tests;
+	if (!value)
+	{
+		va_list args;
+
+		++failures;
+		MyLog(LOGA_INFO, "Assertion failed, file %s, line %d, description: %s\n", filename, lineno, description);
+
+		va_start(args, format);
+		vprintf(format, args);
+		va_end(args);
+	}
+	else
+		MyLog(LOGA_DEBUG, "Assertion succeeded, file %s, line %d, description: %s", filename, lineno, description);
+}
+
+
+/*********************************************************************
+
+In-process TLS echo server, with a self-signed certificate for localhost
+
+*********************************************************************/
+static char cert_file[] = "/tmp/paho-tls-test-XXXXXX";
+static SSL_CTX* server_ctx = NULL;
+static int listen_socket = -1;
+static int listen_port = 0;
+static char unix_path[sizeof(cert_file) + 5];
+static int unix_listen_socket = -1;
+
+static int server_init(void)
+{
+	EVP_PKEY* pkey = NULL;
+	EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+	X509* x509 = X509_new();
+	X509_NAME* name = NULL;
+	X509_EXTENSION* ext = NULL;
+	struct sockaddr_in address;
+	struct sockaddr_un unix_address;
+	socklen_t addrlen = sizeof(address);
+	FILE* f = NULL;
+	int fd = -1;
+
+	EVP_PKEY_keygen_init(pctx);
+	EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1);
+	EVP_PKEY_keygen(pctx, &pkey);
+	EVP_PKEY_CTX_free(pctx);
+
+	ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+	X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+	X509_gmtime_adj(X509_getm_notAfter(x509), 3600L);
+	X509_set_pubkey(x509, pkey);
+	name = X509_get_subject_name(x509);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (unsigned char*)"localhost", -1, -1, 0);
+	X509_set_issuer_name(x509, name);
+	ext = X509V3_EXT_conf_nid(NULL, NULL, NID_subject_alt_name, (char*)"DNS:localhost");
+	X509_add_ext(x509, ext, -1);
+	X509_EXTENSION_free(ext);
+	X509_sign(x509, pkey, EVP_sha256());
+
+	if ((fd = mkstemp(cert_file)) < 0 || (f = fdopen(fd, "w")) == NULL)
+		return -1;
+	PEM_write_X509(f, x509);
+	fclose(f);
+
+	server_ctx = SSL_CTX_new(TLS_server_method());
+	SSL_CTX_use_certificate(server_ctx, x509);
+	SSL_CTX_use_PrivateKey(server_ctx, pkey);
+	SSL_CTX_set_session_id_context(server_ctx, (unsigned char*)"paho", 4);
+	X509_free(x509);
+	EVP_PKEY_free(pkey);
+
+	memset(&address, '\0', sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+	if (bind(listen_socket, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+	    listen(listen_socket, 5) != 0 ||
+	    getsockname(listen_socket, (struct sockaddr*)&address, &addrlen) != 0)
+		return -1;
+	listen_port = ntohs(address.sin_port);
+
+	/* and a Unix domain socket, next to the certificate */
+	memset(&unix_address, '\0', sizeof(unix_address));
+	unix_address.sun_family = AF_UNIX;
+	snprintf(unix_path, sizeof(unix_path), "%s.sock", cert_file);
+	strcpy(unix_address.sun_path, unix_path);
+	unix_listen_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (bind(unix_listen_socket, (struct sockaddr*)&unix_address, sizeof(unix_address)) != 0 ||
+	    listen(unix_listen_socket, 5) != 0)
+		return -1;
+	return 0;
+}
+
+
+/* accept one connection, on the Unix socket if arg is set, and echo everything until the client closes it */
+static void* server_echo(void* arg)
+{
+	int sock = accept(arg ? unix_listen_socket : listen_socket, NULL, NULL);
+	SSL* ssl = SSL_new(server_ctx);
+	unsigned char buf[256];
+	int rc = 0;
+
+	SSL_set_fd(ssl, sock);
+	if (SSL_accept(ssl) == 1)
+	{
+		while ((rc = SSL_read(ssl, buf, sizeof(buf))) > 0)
+			SSL_write(ssl, buf, rc);
+		SSL_shutdown(ssl);
+	}
+	SSL_free(ssl);
+	close(sock);
+	return NULL;
+}
+
+
+static int echo(TLSIPStack& ipstack, const char* data)
+{
+	unsigned char buf[256];
+	int len = (int)strlen(data);
+
+	if (ipstack.write((unsigned char*)data, len, 1000) != len)
+		return -1;
+	if (ipstack.read(buf, len, 2000) != len)
+		return -1;
+	return memcmp(buf, data, len) == 0 ? 0 : -1;
+}
+
+
+/* the number of file descriptors this process has open */
+static int open_fds(void)
+{
+	DIR* dir = opendir("/proc/self/fd");
+	int count = 0;
+
+	if (dir == NULL)
+		return -1;
+	while (readdir(dir) != NULL)
+		++count;
+	closedir(dir);
+	return count;
+}
+
+
+/*********************************************************************
+
+Test 1: full handshake, then session resumption on reconnect
+
+*********************************************************************/
+int test1(struct Options options)
+{
+	TLSOptions tlsopts;
+	TLSIPStack ipstack;
+	pthread_t server;
+	char uri[sizeof(unix_path) + 7];
+	int rc = 0;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 1 - TLS session resumption");
+
+	tlsopts.trustStore = cert_file;
+	TLSIPStack::clearSessions();
+	for (int i = 0; i < 3; ++i)
+	{
+		pthread_create(&server, NULL, server_echo, NULL);
+		rc = ipstack.connect("localhost", listen_port, tlsopts);
+		assert("Good rc from TLS connect", rc == 0, "rc was %d\n", rc);
+		if (rc == 0)
+		{
+			rc = echo(ipstack, "a message through TLS");
+			assert("Data echoed", rc == 0, "rc was %d\n", rc);
+			rc = ipstack.sessionReused();
+			assert("Session resumed only on reconnect", rc == (i > 0),
+			    "reused was %d on connect %d\n", rc, i);
+			MyLog(LOGA_INFO, "Connect %d: session %s, kTLS send offload %s", i,
+			    rc ? "resumed" : "new", ipstack.kernelOffload() ? "active" : "not available");
+			ipstack.disconnect();
+		}
+		pthread_join(server, NULL);
+	}
+
+	/* a session made without verifying the server is not resumed by a connect which verifies it */
+	TLSIPStack::clearSessions();
+	for (int i = 0; i < 3; ++i)
+	{
+		tlsopts.enableServerCertAuth = (i == 2);
+		pthread_create(&server, NULL, server_echo, NULL);
+		rc = ipstack.connect("localhost", listen_port, tlsopts);
+		assert("Good rc from TLS connect", rc == 0, "rc was %d\n", rc);
+		if (rc == 0)
+		{
+			echo(ipstack, "a message for the session ticket");
+			rc = ipstack.sessionReused();
+			assert("Resumed only with the options it was made with", rc == (i == 1),
+			    "reused was %d on connect %d\n", rc, i);
+			ipstack.disconnect();
+		}
+		pthread_join(server, NULL);
+	}
+
+	/* the server certificate is verified, so a wrong hostname must be rejected */
+	pthread_create(&server, NULL, server_echo, NULL);
+	rc = ipstack.connect("127.0.0.1", listen_port, tlsopts);
+	assert("Hostname mismatch rejected", rc != 0, "rc was %d\n", rc);
+	if (rc == 0)
+		ipstack.disconnect();
+	pthread_join(server, NULL);
+
+	/* a transport prefix is not part of the hostname verified */
+	pthread_create(&server, NULL, server_echo, NULL);
+	rc = ipstack.connect("tcp://localhost", listen_port, tlsopts);
+	assert("Good rc from TLS connect to tcp://localhost", rc == 0, "rc was %d\n", rc);
+	if (rc == 0)
+		ipstack.disconnect();
+	pthread_join(server, NULL);
+
+	/* over a Unix domain socket the chain is verified, but there is no hostname to check */
+	snprintf(uri, sizeof(uri), "unix://%s", unix_path);
+	pthread_create(&server, NULL, server_echo, (void*)1);
+	rc = ipstack.connect(uri, 0, tlsopts);
+	assert("Good rc from TLS connect over a Unix socket", rc == 0, "rc was %d\n", rc);
+	if (rc == 0)
+	{
+		rc = echo(ipstack, "a message through TLS over a Unix socket");
+		assert("Data echoed over the Unix socket", rc == 0, "rc was %d\n", rc);
+		ipstack.disconnect();
+	}
+	pthread_join(server, NULL);
+
+	MyLog(LOGA_INFO, "TEST1: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 2: an MQTT packet sent and read back through the TLS network
+
+*********************************************************************/
+int test2(struct Options options)
+{
+	TLSOptions tlsopts;
+	TLSIPStack ipstack;
+	pthread_t server;
+	unsigned char buf[100];
+	unsigned char readbuf[100];
+	unsigned char packettype = 0, dup = 0;
+	unsigned short packetid = 0;
+	int rc = 0, len = 0;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 2 - MQTT packets over TLS");
+
+	tlsopts.trustStore = cert_file;
+	pthread_create(&server, NULL, server_echo, NULL);
+	rc = ipstack.connect("localhost", listen_port, tlsopts);
+	assert("Good rc from TLS connect", rc == 0, "rc was %d\n", rc);
+	if (rc == 0)
+	{
+		len = MQTTSerialize_ack(buf, sizeof(buf), PUBACK, 0, 1234);
+		rc = ipstack.write(buf, len, 1000);
+		assert("PUBACK written", rc == len, "rc was %d\n", rc);
+		rc = ipstack.read(readbuf, len, 2000);
+		assert("PUBACK read back", rc == len, "rc was %d\n", rc);
+		rc = MQTTDeserialize_ack(&packettype, &dup, &packetid, readbuf, len);
+		assert("PUBACK deserialized", rc == 1 && packettype == PUBACK && packetid == 1234,
+		    "rc %d type %d packetid %d\n", rc, packettype, packetid);
+
+		/* nothing more to read - a timeout must not be reported as an error */
+		rc = ipstack.read(readbuf, 1, 10);
+		assert("Read timeout returns 0", rc == 0, "rc was %d\n", rc);
+		ipstack.disconnect();
+	}
+	pthread_join(server, NULL);
+
+	MyLog(LOGA_INFO, "TEST2: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test 3: SSL_CTXs shared between connects, and nothing left open when
+a connect fails
+
+*********************************************************************/
+int test3(struct Options options)
+{
+	TLSOptions tlsopts, other, missing;
+	TLSIPStack first, second;
+	pthread_t server, server2;
+	int fds = 0, rc = 0;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 3 - shared SSL contexts");
+
+	tlsopts.trustStore = cert_file;
+	other = tlsopts;
+	other.enabledCipherSuites = "HIGH";
+	missing.trustStore = "/nonexistent/paho-ca.pem";
+
+	/* two connections at once with the same options, and one with different options */
+	pthread_create(&server, NULL, server_echo, NULL);
+	pthread_create(&server2, NULL, server_echo, NULL);
+	rc = first.connect("localhost", listen_port, tlsopts);
+	assert("Good rc from first TLS connect", rc == 0, "rc was %d\n", rc);
+	rc = second.connect("localhost", listen_port, tlsopts);
+	assert("Good rc from second TLS connect", rc == 0, "rc was %d\n", rc);
+	assert("Both connections usable", echo(first, "first") == 0 && echo(second, "second") == 0, "%s\n", "echo failed");
+
+	/* the cached contexts can be dropped while connections still use them */
+	TLSIPStack::clearContexts();
+	assert("Connection usable after the contexts are cleared", echo(first, "first again") == 0, "%s\n", "echo failed");
+	first.disconnect();
+	second.disconnect();
+	pthread_join(server, NULL);
+	pthread_join(server2, NULL);
+
+	pthread_create(&server, NULL, server_echo, NULL);
+	rc = first.connect("localhost", listen_port, other);
+	assert("Good rc from TLS connect with other options", rc == 0, "rc was %d\n", rc);
+	if (rc == 0)
+		first.disconnect();
+	pthread_join(server, NULL);
+
+	/* a trust store which can't be read fails the connect, which must close its socket */
+	fds = open_fds();
+	pthread_create(&server, NULL, server_echo, NULL);
+	rc = first.connect("localhost", listen_port, missing);
+	assert("Connect with a missing trust store fails", rc != 0, "rc was %d\n", rc);
+	pthread_join(server, NULL);
+	assert("No file descriptors left open", open_fds() == fds, "open were %d, now %d\n", fds, open_fds());
+
+	MyLog(LOGA_INFO, "TEST3: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	return failures;
+}
+
+
+int main(int argc, char** argv)
+{
+	int rc = 0;
+	int (*tests[])(struct Options) = {NULL, test1, test2, test3};
+
+	getopts(argc, argv);
+	if (server_init() != 0)
+	{
+		MyLog(LOGA_INFO, "Could not start the TLS echo server");
+		return 1;
+	}
+
+	if (options.test_no == 0)
+	{ /* run all the tests */
+		for (options.test_no = 1; options.test_no < (int)ARRAY_SIZE(tests); ++options.test_no)
+			rc += tests[options.test_no](options); /* return number of failures.  0 = test succeeded */
+	}
+	else
+		rc = tests[options.test_no](options); /* run just the selected test */
+
+	TLSIPStack::clearContexts();
+	close(listen_socket);
+	close(unix_listen_socket);
+	SSL_CTX_free(server_ctx);
+	unlink(cert_file);
+	unlink(unix_path);
+
+	if (rc == 0)
+		MyLog(LOGA_INFO, "verdict pass");
+	else
+		MyLog(LOGA_INFO, "verdict fail");
+	return rc;
+}
@@ -0,0 +1,1517 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial reference broker
+ *******************************************************************************/
+
+/*
+ A small MQTT 3.1 and 3.1.1 broker, on the server side functions of MQTTPacket, for
+ local testing and load generation.  Linux only.
+
+ Each worker thread has its own listening socket on the port, bound with SO_REUSEPORT
+ so the kernel shares new connections between them, and its own epoll set.  A
+ connection stays on the worker which accepted it.  A message for a subscriber on
+ another worker goes through that worker's inbox, which is woken by an eventfd.
+
+ Subscriptions and retained messages are held in one tree of topic levels, under a
+ read-write lock: publishing only takes the read lock.  A level is removed once it has
+ no subscriptions, retained message or levels under it.  A client's session holds its
+ subscriptions across connections, unless it connects with cleansession set.
+
+ Supported: QoS 0, 1 and 2 both ways, + and # wildcards, retained messages, will
+ messages, persistent sessions and session takeover, and keepalive.  Not supported,
+ as for a test stand-in: authentication - any username and password are accepted -
+ messages for a persistent session while it is offline, which are dropped, and
+ resending unacknowledged messages.  A message which matches more than one of a
+ client's subscriptions is sent once for each.
+
+ usage: mqttbroker [--port 1883] [--unix <path>] [--threads <cpus>] [--max-packet 1048576]
+                   [--verbose] [--run <command> [args...]]
+
+ With --unix, the broker also listens on a Unix domain socket at path, for clients
+ connecting to unix://path.  Every worker waits on it, and the kernel wakes one.
+
+ With --run, the broker runs the command once it is listening, stops when the command
+ exits, and exits with its status - for running a test suite against it:
+
+   mqttbroker --port 18830 --run testc1 --port 18830 --test_no 1
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "MQTTPacket.h"
+
+#define MAX_EVENTS 256
+#define MAX_LEVELS 128       /* in a topic name or filter */
+#define MAX_FILTERS 16       /* in one SUBSCRIBE or UNSUBSCRIBE */
+#define SESSION_BUCKETS 4096
+#define MAX_OUTPUT (16 * 1024 * 1024) /* bytes queued for a client before it is disconnected as too slow */
+#define READ_SIZE 16384      /* bytes of input a connection's buffer holds, beyond a packet cut off at its end */
+
+
+struct
+{
+	int port;
+	char* unix_path;
+	int threads;
+	int max_packet;
+	int verbose;
+	char** run;
+} opts =
+{
+	1883, NULL, 0, 1024 * 1024, 0, NULL
+};
+
+static int stopping = 0; /* set by a signal or the end of the --run command, read by every worker */
+
+
+/* A published message, shared by every delivery of it */
+typedef struct
+{
+	int refs;
+	int qos;          /* published at, the most a retained copy is sent at */
+	int topiclen;
+	int payloadlen;
+	char* topic;
+	unsigned char* payload;
+} Message;
+
+struct Connection;
+struct TopicNode;
+
+typedef struct Subscription
+{
+	struct Subscription* next;
+	struct TopicNode* node;     /* where the filter ends in the topic tree */
+	struct Session* session;
+	int qos;
+} Subscription;
+
+/* The state of a client id, which outlives its connections unless cleansession is set */
+typedef struct Session
+{
+	struct Session* next;       /* in its hash bucket */
+	int refs;
+	char* clientid;
+	int clean;                  /* written under sessions_lock and lock */
+	int discarded;              /* removed from the table, for good */
+	pthread_mutex_t lock;       /* for conn and worker, which change when a client reconnects */
+	struct Connection* conn;    /* 0 while the client is not connected */
+	int worker;
+	Subscription* subscriptions; /* the nodes its filters end at, under tree_lock */
+} Session;
+
+typedef struct TopicNode
+{
+	struct TopicNode* parent;
+	struct TopicNode* children;
+	struct TopicNode* next;     /* sibling */
+	char* level;
+	Subscription* subscribers;  /* of the filter ending here, each holding a reference to its session */
+	Message* retained;
+} TopicNode;
+
+typedef struct Connection
+{
+	struct Connection* prev;
+	struct Connection* next;
+	struct Connection* next_dirty;
+	int fd;
+	int dirty;                  /* output queued since the last flush */
+	int closing;
+	int writable_wait;          /* EPOLLOUT is set */
+	unsigned long long id;
+	Session* session;
+	unsigned char* in;
+	int inlen, incap;
+	unsigned char* out;
+	int outlen, outpos, outcap;
+	int keepalive;
+	time_t last_received;
+	unsigned short next_packetid;
+	MQTTPacketIdSet* qos2_received; /* allocated on the first QoS 2 PUBLISH */
+	Message* will;
+	int will_qos, will_retained;
+	int graceful;               /* DISCONNECT received, so the will is not published */
+} Connection;
+
+typedef enum { ITEM_DELIVER, ITEM_CLOSE } ItemType;
+
+typedef struct Item
+{
+	struct Item* next;
+	ItemType type;
+	Session* session;
+	Message* message;
+	int qos;
+	int retained;
+	unsigned long long conn_id; /* for ITEM_CLOSE */
+} Item;
+
+typedef struct
+{
+	int index;
+	pthread_t thread;
+	int epfd;
+	int listen_fd;
+	int event_fd;
+	pthread_mutex_t inbox_lock;
+	Item* inbox;
+	Item* inbox_tail;
+	Connection* connections;
+	Connection* dirty;
+	Session** targets;          /* scratch space for the subscribers of a publish */
+	int* target_qos;
+	int target_count, target_max;
+	Message** found;            /* and for the retained messages a subscription matches */
+	int found_count, found_max;
+	unsigned long received, sent, connects;
+} Worker;
+
+static Worker* workers = NULL;
+static pthread_rwlock_t tree_lock = PTHREAD_RWLOCK_INITIALIZER;
+static TopicNode tree_root;
+static pthread_mutex_t sessions_lock = PTHREAD_MUTEX_INITIALIZER;
+static Session* sessions[SESSION_BUCKETS];
+static unsigned long long next_conn_id = 1;
+static int unix_listen_fd = -1;
+
+
+static void* xmalloc(size_t size)
+{
+	void* p = malloc(size);
+
+	if (p == NULL)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+
+static Message* message_new(const char* topic, int topiclen, const unsigned char* payload, int payloadlen, int qos)
+{
+	Message* m = xmalloc(sizeof(Message) + topiclen + 1 + payloadlen);
+
+	m->refs = 1;
+	m->qos = qos;
+	m->topic = (char*)(m + 1);
+	m->topiclen = topiclen;
+	memcpy(m->topic, topic, topiclen);
+	m->topic[topiclen] = '\0';
+	m->payload = (unsigned char*)m->topic + topiclen + 1;
+	m->payloadlen = payloadlen;
+	memcpy(m->payload, payload, payloadlen);
+	return m;
+}
+
+
+static Message* message_ref(Message* m)
+{
+	__sync_add_and_fetch(&m->refs, 1);
+	return m;
+}
+
+
+static void message_unref(Message* m)
+{
+	if (m && __sync_sub_and_fetch(&m->refs, 1) == 0)
+		free(m);
+}
+
+
+static Session* session_ref(Session* s)
+{
+	__sync_add_and_fetch(&s->refs, 1);
+	return s;
+}
+
+
+static void session_unref(Session* s)
+{
+	if (__sync_sub_and_fetch(&s->refs, 1) == 0)
+	{
+		pthread_mutex_destroy(&s->lock);
+		free(s->clientid);
+		free(s);
+	}
+}
+
+
+/**
+  * Splits a topic name or filter into its levels, in place
+  * @return the number of levels, or -1 if there are too many
+  */
+static int split_levels(char* topic, char** levels)
+{
+	int count = 0;
+
+	levels[count++] = topic;
+	for (; *topic; ++topic)
+	{
+		if (*topic == '/')
+		{
+			if (count == MAX_LEVELS)
+				return -1;
+			*topic = '\0';
+			levels[count++] = topic + 1;
+		}
+	}
+	return count;
+}
+
+
+/**
+  * Checks a topic filter: + and # must be whole levels, and # the last
+  * @return 1 if valid, 0 if not
+  */
+static int valid_filter(const char* filter, int len)
+{
+	int i;
+
+	if (len == 0)
+		return 0;
+	for (i = 0; i < len; ++i)
+	{
+		if (filter[i] == '+' || filter[i] == '#')
+		{
+			if ((i > 0 && filter[i - 1] != '/') || (i + 1 < len && filter[i + 1] != '/'))
+				return 0;
+			if (filter[i] == '#' && i + 1 != len)
+				return 0;
+		}
+	}
+	return 1;
+}
+
+
+static int valid_name(const char* name, int len)
+{
+	return len > 0 && memchr(name, '+', len) == NULL && memchr(name, '#', len) == NULL;
+}
+
+
+/* the child of node for a level, created if add is set, under the write lock */
+static TopicNode* tree_child(TopicNode* node, const char* level, int add)
+{
+	TopicNode* child = node->children;
+
+	while (child && strcmp(child->level, level) != 0)
+		child = child->next;
+	if (child == NULL && add)
+	{
+		child = xmalloc(sizeof(TopicNode));
+		memset(child, '\0', sizeof(TopicNode));
+		child->level = strdup(level);
+		child->parent = node;
+		child->next = node->children;
+		node->children = child;
+	}
+	return child;
+}
+
+
+/* the node for a topic name or filter, or NULL if it has none, or more than MAX_LEVELS levels */
+static TopicNode* tree_find(char* topic, int add)
+{
+	char* levels[MAX_LEVELS];
+	TopicNode* node = &tree_root;
+	int i, count = split_levels(topic, levels);
+
+	if (count < 0)
+		return NULL;
+	for (i = 0; node && i < count; ++i)
+		node = tree_child(node, levels[i], add);
+	return node;
+}
+
+
+/* add a target for a publish, to the worker's scratch list */
+static void add_target(Worker* w, Session* s, int qos)
+{
+	if (w->target_count == w->target_max)
+	{
+		w->target_max = (w->target_max == 0) ? 64 : w->target_max * 2;
+		w->targets = realloc(w->targets, w->target_max * sizeof(Session*));
+		w->target_qos = realloc(w->target_qos, w->target_max * sizeof(int));
+		if (w->targets == NULL || w->target_qos == NULL)
+		{
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+	w->targets[w->target_count] = session_ref(s);
+	w->target_qos[w->target_count++] = qos;
+}
+
+
+static void add_subscribers(Worker* w, TopicNode* node, int qos)
+{
+	Subscription* sub;
+
+	for (sub = node->subscribers; sub; sub = sub->next)
+		add_target(w, sub->session, (sub->qos < qos) ? sub->qos : qos);
+}
+
+
+/* collect the subscribers of the filters which match a topic name, under the read lock */
+static void tree_match(Worker* w, TopicNode* node, char** levels, int level, int count, int qos)
+{
+	TopicNode* child;
+
+	for (child = node->children; child; child = child->next)
+	{
+		int wildcard = (child->level[0] == '+' || child->level[0] == '#') && child->level[1] == '\0';
+
+		if (wildcard && level == 0 && levels[0][0] == '$')
+			continue; /* names starting with $ are not matched by wildcards at the first level */
+		if (child->level[0] == '#' && child->level[1] == '\0')
+			add_subscribers(w, child, qos); /* the rest of the name, which can be no levels at all */
+		else if (level < count && (strcmp(child->level, levels[level]) == 0 || wildcard))
+		{
+			if (level + 1 == count)
+				add_subscribers(w, child, qos);
+			tree_match(w, child, levels, level + 1, count, qos);
+		}
+	}
+}
+
+
+/* add a retained message to the worker's scratch list */
+static void add_found(Worker* w, Message* m)
+{
+	if (w->found_count == w->found_max)
+	{
+		w->found_max = (w->found_max == 0) ? 64 : w->found_max * 2;
+		if ((w->found = realloc(w->found, w->found_max * sizeof(Message*))) == NULL)
+		{
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+	w->found[w->found_count++] = message_ref(m);
+}
+
+
+/* collect the retained messages under node, in the tree order, under the read lock */
+static void tree_retained(Worker* w, TopicNode* node, char** levels, int level, int count)
+{
+	TopicNode* child;
+
+	if (level == count)
+	{
+		if (node->retained)
+			add_found(w, node->retained);
+		return;
+	}
+	if (levels[level][0] == '#' && levels[level][1] == '\0')
+	{
+		if (node->retained && node != &tree_root)
+			add_found(w, node->retained); /* "a/#" matches "a" */
+		for (child = node->children; child; child = child->next)
+		{
+			if (node == &tree_root && child->level[0] == '$')
+				continue;
+			tree_retained(w, child, levels, level, count);
+		}
+		return;
+	}
+	for (child = node->children; child; child = child->next)
+	{
+		if (levels[level][0] == '+' && levels[level][1] == '\0')
+		{
+			if (node == &tree_root && child->level[0] == '$')
+				continue;
+		}
+		else if (strcmp(child->level, levels[level]) != 0)
+			continue;
+		tree_retained(w, child, levels, level + 1, count);
+	}
+}
+
+
+/* remove node, and then its parents, while they hold nothing, under the write lock */
+static void tree_prune(TopicNode* node)
+{
+	while (node != &tree_root && node->subscribers == NULL && node->retained == NULL && node->children == NULL)
+	{
+		TopicNode* parent = node->parent;
+		TopicNode** link;
+
+		for (link = &parent->children; *link != node; link = &(*link)->next)
+			;
+		*link = node->next;
+		free(node->level);
+		free(node);
+		node = parent;
+	}
+}
+
+
+/**
+  * Removes a session's subscription to the filter which ends at node, under the write lock
+  * @return 1 if there was one, 0 if not
+  */
+static int tree_unsubscribe(Session* s, TopicNode* node)
+{
+	Subscription** link = &node->subscribers;
+	Subscription* entry = NULL;
+
+	while (*link && (*link)->session != s)
+		link = &(*link)->next;
+	if (*link == NULL)
+		return 0;
+	entry = *link;
+	*link = entry->next;
+	free(entry);
+	for (link = &s->subscriptions; *link && (*link)->node != node; link = &(*link)->next)
+		;
+	if (*link) /* the session's own list of where its subscriptions are */
+	{
+		entry = *link;
+		*link = entry->next;
+		free(entry);
+	}
+	session_unref(s); /* the node's reference */
+	tree_prune(node);
+	return 1;
+}
+
+
+static Session* sessions_find(const char* clientid, unsigned int* hash)
+{
+	const unsigned char* p = (const unsigned char*)clientid;
+	Session* s;
+
+	*hash = 5381;
+	while (*p)
+		*hash = *hash * 33 + *p++;
+	*hash %= SESSION_BUCKETS;
+	for (s = sessions[*hash]; s && strcmp(s->clientid, clientid) != 0; s = s->next)
+		;
+	return s;
+}
+
+
+/* take a session's subscriptions out of the tree, and drop the table's reference, once it is out of the table */
+static void session_clear(Session* s)
+{
+	pthread_rwlock_wrlock(&tree_lock);
+	while (s->subscriptions)
+		tree_unsubscribe(s, s->subscriptions->node);
+	pthread_rwlock_unlock(&tree_lock);
+	session_unref(s);
+}
+
+
+/* take a session out of the table, unless a new connection has replaced it already */
+static void session_discard(Session* s)
+{
+	int discard = 0;
+
+	pthread_mutex_lock(&sessions_lock);
+	if (!s->discarded)
+	{
+		unsigned int hash;
+		Session** link;
+
+		sessions_find(s->clientid, &hash);
+		for (link = &sessions[hash]; *link && *link != s; link = &(*link)->next)
+			;
+		if (*link)
+			*link = s->next;
+		s->discarded = discard = 1;
+	}
+	pthread_mutex_unlock(&sessions_lock);
+	if (discard)
+		session_clear(s);
+}
+
+
+static void inbox_add(Worker* w, Item* item)
+{
+	int wake = 0;
+	uint64_t one = 1;
+
+	item->next = NULL;
+	pthread_mutex_lock(&w->inbox_lock);
+	if (w->inbox == NULL)
+	{
+		w->inbox = item;
+		wake = 1;
+	}
+	else
+		w->inbox_tail->next = item;
+	w->inbox_tail = item;
+	pthread_mutex_unlock(&w->inbox_lock);
+	if (wake && write(w->event_fd, &one, sizeof(one)) != sizeof(one))
+		perror("eventfd write");
+}
+
+
+/* make room for len more bytes of output */
+static unsigned char* output_reserve(Connection* c, int len)
+{
+	if (c->outpos > 0 && c->outpos == c->outlen)
+		c->outpos = c->outlen = 0;
+	if (c->outlen + len > c->outcap)
+	{
+		if (c->outpos > 0)
+		{
+			memmove(c->out, &c->out[c->outpos], c->outlen - c->outpos);
+			c->outlen -= c->outpos;
+			c->outpos = 0;
+		}
+		if (c->outlen + len > c->outcap)
+		{
+			c->outcap = (c->outlen + len) * 2;
+			c->out = realloc(c->out, c->outcap);
+			if (c->out == NULL)
+			{
+				fprintf(stderr, "Out of memory\n");
+				exit(1);
+			}
+		}
+	}
+	return &c->out[c->outlen];
+}
+
+
+static void output_commit(Worker* w, Connection* c, int len)
+{
+	if (len <= 0)
+		return;
+	c->outlen += len;
+	if (!c->dirty && !c->closing)
+	{
+		c->dirty = 1;
+		c->next_dirty = w->dirty;
+		w->dirty = c;
+	}
+	if (c->outlen - c->outpos > MAX_OUTPUT)
+		c->closing = 1; /* not reading its messages */
+}
+
+
+static void send_ack(Worker* w, Connection* c, int type, unsigned short packetid)
+{
+	output_commit(w, c, MQTTSerialize_ack(output_reserve(c, 4), 4, type, 0, packetid));
+}
+
+
+static void send_publish(Worker* w, Connection* c, Message* m, int qos, int retained)
+{
+	MQTTString topic = MQTTString_initializer;
+	int len = MQTTPacket_len(2 + m->topiclen + ((qos > 0) ? 2 : 0) + m->payloadlen);
+	unsigned short packetid = 0;
+
+	if (qos > 0 && (packetid = ++c->next_packetid) == 0)
+		packetid = c->next_packetid = 1;
+	topic.lenstring.data = m->topic;
+	topic.lenstring.len = m->topiclen;
+	output_commit(w, c, MQTTSerialize_publish(output_reserve(c, len), len, 0, qos, retained, packetid,
+		topic, m->payload, m->payloadlen));
+	w->sent++;
+}
+
+
+/* send a message to a session's client, wherever it is connected */
+static void deliver(Worker* w, Session* s, Message* m, int qos, int retained)
+{
+	Item* item;
+	int owner;
+
+	pthread_mutex_lock(&s->lock);
+	owner = s->worker;
+	if (s->conn && owner == w->index)
+	{
+		if (!s->conn->closing)
+			send_publish(w, s->conn, m, qos, retained);
+		pthread_mutex_unlock(&s->lock);
+		return;
+	}
+	pthread_mutex_unlock(&s->lock);
+	if (owner < 0)
+		return; /* not connected */
+	item = xmalloc(sizeof(Item));
+	item->type = ITEM_DELIVER;
+	item->session = session_ref(s);
+	item->message = message_ref(m);
+	item->qos = qos;
+	item->retained = retained;
+	inbox_add(&workers[owner], item);
+}
+
+
+/* send a message to the subscribers of its topic, and keep it if it is retained */
+static void route(Worker* w, Message* m, int qos, int retained)
+{
+	char* levels[MAX_LEVELS];
+	char topic[m->topiclen + 1];
+	int i, count;
+
+	memcpy(topic, m->topic, m->topiclen + 1);
+	if ((count = split_levels(topic, levels)) < 0)
+		return;
+	if (retained)
+	{
+		char name[m->topiclen + 1];
+		TopicNode* node;
+
+		memcpy(name, m->topic, m->topiclen + 1);
+		pthread_rwlock_wrlock(&tree_lock);
+		if ((node = tree_find(name, m->payloadlen > 0)) != NULL)
+		{
+			message_unref(node->retained);
+			node->retained = (m->payloadlen > 0) ? message_ref(m) : NULL; /* an empty message clears it */
+			tree_prune(node);
+		}
+		pthread_rwlock_unlock(&tree_lock);
+	}
+
+	w->target_count = 0;
+	pthread_rwlock_rdlock(&tree_lock);
+	tree_match(w, &tree_root, levels, 0, count, qos);
+	pthread_rwlock_unlock(&tree_lock);
+	for (i = 0; i < w->target_count; ++i)
+	{
+		deliver(w, w->targets[i], m, w->target_qos[i], 0);
+		session_unref(w->targets[i]);
+	}
+}
+
+
+static void close_connection(Worker* w, Connection* c)
+{
+	c->closing = 1;
+}
+
+
+static void handle_connect(Worker* w, Connection* c, unsigned char* buf, int len)
+{
+	MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+	unsigned char connack_rc = 0, present = 0;
+	Session* s = NULL;
+	Session* replaced = NULL;
+	Connection* old_conn = NULL;
+	int old_worker = -1;
+	unsigned long long old_id = 0;
+	unsigned int hash;
+	char clientid[65536];
+
+	if (c->session) /* a second CONNECT is a protocol error */
+	{
+		close_connection(w, c);
+		return;
+	}
+	if (MQTTDeserialize_connect(&data, buf, len) != 1)
+	{
+		connack_rc = 1; /* unacceptable protocol version */
+		goto exit;
+	}
+	if (data.clientID.lenstring.len == 0)
+	{
+		if (!data.cleansession)
+		{
+			connack_rc = 2; /* identifier rejected */
+			goto exit;
+		}
+		snprintf(clientid, sizeof(clientid), "mqttbroker-%llu", c->id);
+	}
+	else
+	{
+		memcpy(clientid, data.clientID.lenstring.data, data.clientID.lenstring.len);
+		clientid[data.clientID.lenstring.len] = '\0';
+	}
+	c->keepalive = data.keepAliveInterval;
+	if (data.willFlag)
+	{
+		c->will = message_new(data.will.topicName.lenstring.data, data.will.topicName.lenstring.len,
+			(unsigned char*)data.will.message.lenstring.data, data.will.message.lenstring.len, data.will.qos);
+		c->will_qos = data.will.qos;
+		c->will_retained = data.will.retained;
+	}
+
+	pthread_mutex_lock(&sessions_lock);
+	s = sessions_find(clientid, &hash);
+	if (s && (data.cleansession || s->clean))
+	{
+		replaced = session_ref(s); /* the old state is dropped */
+		s = NULL;
+	}
+	if (s)
+		present = 1;
+	else
+	{
+		s = xmalloc(sizeof(Session));
+		memset(s, '\0', sizeof(Session));
+		s->refs = 1; /* the table's */
+		s->clientid = strdup(clientid);
+		s->worker = -1;
+		pthread_mutex_init(&s->lock, NULL);
+		if (replaced)
+		{
+			Session** link;
+
+			for (link = &sessions[hash]; *link != replaced; link = &(*link)->next)
+				;
+			*link = replaced->next; /* its subscriptions are removed below, once the lock is released */
+			replaced->discarded = 1;
+		}
+		s->next = sessions[hash];
+		sessions[hash] = s;
+	}
+	pthread_mutex_lock(&s->lock);
+	s->clean = data.cleansession;
+	pthread_mutex_unlock(&s->lock);
+	c->session = session_ref(s);
+	pthread_mutex_unlock(&sessions_lock);
+
+	if (replaced)
+	{
+		pthread_mutex_lock(&replaced->lock);
+		old_conn = replaced->conn;
+		old_worker = replaced->worker;
+		old_id = (old_conn) ? old_conn->id : 0;
+		pthread_mutex_unlock(&replaced->lock);
+		session_clear(replaced);
+		session_unref(replaced);
+	}
+	else
+	{
+		pthread_mutex_lock(&s->lock);
+		old_conn = s->conn;
+		old_worker = s->worker;
+		old_id = (old_conn) ? old_conn->id : 0;
+		pthread_mutex_unlock(&s->lock);
+	}
+	if (old_conn) /* the client is connected already: close that connection */
+	{
+		Item* item = xmalloc(sizeof(Item));
+
+		memset(item, '\0', sizeof(Item));
+		item->type = ITEM_CLOSE;
+		item->conn_id = old_id;
+		inbox_add(&workers[old_worker], item);
+	}
+	pthread_mutex_lock(&s->lock);
+	s->conn = c;
+	s->worker = w->index;
+	pthread_mutex_unlock(&s->lock);
+	w->connects++;
+
+exit:
+	output_commit(w, c, MQTTSerialize_connack(output_reserve(c, 4), 4, connack_rc, present));
+	if (connack_rc != 0)
+		close_connection(w, c);
+}
+
+
+static void handle_subscribe(Worker* w, Connection* c, unsigned char* buf, int len)
+{
+	MQTTString filters[MAX_FILTERS];
+	int qoss[MAX_FILTERS], granted[MAX_FILTERS];
+	unsigned char dup;
+	unsigned short packetid;
+	int i, count = 0;
+
+	if (MQTTDeserialize_subscribe(&dup, &packetid, MAX_FILTERS, &count, filters, qoss, buf, len) != 1)
+	{
+		close_connection(w, c);
+		return;
+	}
+	for (i = 0; i < count; ++i)
+	{
+		char filter[filters[i].lenstring.len + 1];
+		char copy[sizeof(filter)];
+		Session* s = c->session;
+		TopicNode* node;
+
+		granted[i] = 0x80;
+		if (!valid_filter(filters[i].lenstring.data, filters[i].lenstring.len) || qoss[i] < 0 || qoss[i] > 2)
+			continue;
+		memcpy(filter, filters[i].lenstring.data, filters[i].lenstring.len);
+		filter[filters[i].lenstring.len] = '\0';
+		granted[i] = qoss[i];
+
+		memcpy(copy, filter, sizeof(filter));
+		pthread_rwlock_wrlock(&tree_lock);
+		if ((node = tree_find(copy, 1)) == NULL)
+			granted[i] = 0x80; /* too many levels */
+		else
+		{
+			Subscription* sub;
+
+			for (sub = node->subscribers; sub && sub->session != s; sub = sub->next)
+				;
+			if (sub) /* the same filter again replaces the subscription */
+				sub->qos = qoss[i];
+			else
+			{
+				sub = xmalloc(sizeof(Subscription));
+				sub->node = node;
+				sub->session = session_ref(s);
+				sub->qos = qoss[i];
+				sub->next = node->subscribers;
+				node->subscribers = sub;
+				sub = xmalloc(sizeof(Subscription));
+				sub->node = node;
+				sub->session = s;
+				sub->qos = qoss[i];
+				sub->next = s->subscriptions;
+				s->subscriptions = sub;
+			}
+		}
+		pthread_rwlock_unlock(&tree_lock);
+	}
+	output_commit(w, c, MQTTSerialize_suback(output_reserve(c, 5 + count), 5 + count, packetid, count, granted));
+
+	for (i = 0; i < count; ++i) /* then the retained messages the new subscriptions match */
+	{
+		char filter[filters[i].lenstring.len + 1];
+		char* levels[MAX_LEVELS];
+		int levelcount, j;
+
+		if (granted[i] == 0x80)
+			continue;
+		memcpy(filter, filters[i].lenstring.data, filters[i].lenstring.len);
+		filter[filters[i].lenstring.len] = '\0';
+		if ((levelcount = split_levels(filter, levels)) < 0)
+			continue;
+		w->found_count = 0;
+		pthread_rwlock_rdlock(&tree_lock);
+		tree_retained(w, &tree_root, levels, 0, levelcount);
+		pthread_rwlock_unlock(&tree_lock);
+		for (j = 0; j < w->found_count; ++j)
+		{
+			send_publish(w, c, w->found[j], (w->found[j]->qos < granted[i]) ? w->found[j]->qos : granted[i], 1);
+			message_unref(w->found[j]);
+		}
+	}
+}
+
+
+static void handle_unsubscribe(Worker* w, Connection* c, unsigned char* buf, int len)
+{
+	MQTTString filters[MAX_FILTERS];
+	unsigned char dup;
+	unsigned short packetid;
+	int i, count = 0;
+
+	if (MQTTDeserialize_unsubscribe(&dup, &packetid, MAX_FILTERS, &count, filters, buf, len) != 1)
+	{
+		close_connection(w, c);
+		return;
+	}
+	pthread_rwlock_wrlock(&tree_lock);
+	for (i = 0; i < count; ++i)
+	{
+		char filter[filters[i].lenstring.len + 1];
+		TopicNode* node;
+
+		memcpy(filter, filters[i].lenstring.data, filters[i].lenstring.len);
+		filter[filters[i].lenstring.len] = '\0';
+		if ((node = tree_find(filter, 0)) == NULL)
+			continue;
+		tree_unsubscribe(c->session, node);
+	}
+	pthread_rwlock_unlock(&tree_lock);
+	output_commit(w, c, MQTTSerialize_unsuback(output_reserve(c, 4), 4, packetid));
+}
+
+
+static void handle_publish(Worker* w, Connection* c, unsigned char* buf, int len)
+{
+	MQTTString topic = MQTTString_initializer;
+	unsigned char dup, retained, *payload;
+	unsigned short packetid;
+	int qos, payloadlen;
+	Message* m;
+
+	if (MQTTDeserialize_publish(&dup, &qos, &retained, &packetid, &topic, &payload, &payloadlen, buf, len) != 1 ||
+		qos > 2 || !valid_name(topic.lenstring.data, topic.lenstring.len))
+	{
+		close_connection(w, c);
+		return;
+	}
+	w->received++;
+	if (qos == 2)
+	{
+		if (c->qos2_received == NULL)
+		{
+			c->qos2_received = xmalloc(sizeof(MQTTPacketIdSet));
+			MQTTPacketIdSet_clear(c->qos2_received);
+		}
+		if (!MQTTPacketIdSet_add(c->qos2_received, packetid))
+		{
+			send_ack(w, c, PUBREC, packetid); /* a resend of one not yet released: not routed again */
+			return;
+		}
+	}
+	m = message_new(topic.lenstring.data, topic.lenstring.len, payload, payloadlen, qos);
+	route(w, m, qos, retained);
+	message_unref(m);
+	if (qos == 1)
+		send_ack(w, c, PUBACK, packetid);
+	else if (qos == 2)
+		send_ack(w, c, PUBREC, packetid);
+}
+
+
+static void handle_packet(Worker* w, Connection* c, unsigned char* buf, int len)
+{
+	unsigned char type, dup;
+	unsigned short packetid;
+	int packet_type = buf[0] >> 4;
+
+	c->last_received = time(NULL);
+	if (c->session == NULL && packet_type != CONNECT)
+	{
+		close_connection(w, c); /* the first packet must be CONNECT */
+		return;
+	}
+	switch (packet_type)
+	{
+		case CONNECT:
+			handle_connect(w, c, buf, len);
+			break;
+		case PUBLISH:
+			handle_publish(w, c, buf, len);
+			break;
+		case PUBREL:
+			if (MQTTDeserialize_ack(&type, &dup, &packetid, buf, len) == 1)
+			{
+				if (c->qos2_received)
+					MQTTPacketIdSet_remove(c->qos2_received, packetid);
+				send_ack(w, c, PUBCOMP, packetid);
+			}
+			break;
+		case PUBREC:
+			if (MQTTDeserialize_ack(&type, &dup, &packetid, buf, len) == 1)
+				output_commit(w, c, MQTTSerialize_ack(output_reserve(c, 4), 4, PUBREL, 0, packetid));
+			break;
+		case PUBACK:
+		case PUBCOMP:
+			break; /* nothing is kept to resend, so nothing to release */
+		case SUBSCRIBE:
+			handle_subscribe(w, c, buf, len);
+			break;
+		case UNSUBSCRIBE:
+			handle_unsubscribe(w, c, buf, len);
+			break;
+		case PINGREQ:
+		{
+			unsigned char* ptr = output_reserve(c, 2);
+
+			ptr[0] = PINGRESP << 4;
+			ptr[1] = 0;
+			output_commit(w, c, 2);
+			break;
+		}
+		case DISCONNECT:
+			c->graceful = 1;
+			close_connection(w, c);
+			break;
+		default:
+			close_connection(w, c);
+			break;
+	}
+}
+
+
+/* the length of the packet at the start of buf, 0 if it is not all there yet, or -1 if it's too long */
+static int packet_length(unsigned char* buf, int len)
+{
+	int rem_len = 0, multiplier = 1, i;
+
+	for (i = 1; i < len && i <= 4; ++i)
+	{
+		rem_len += (buf[i] & 127) * multiplier;
+		multiplier *= 128;
+		if ((buf[i] & 128) == 0)
+		{
+			if (1 + i + rem_len > opts.max_packet)
+				return -1;
+			return (len >= 1 + i + rem_len) ? 1 + i + rem_len : 0;
+		}
+	}
+	return (i > 4) ? -1 : 0;
+}
+
+
+static void read_connection(Worker* w, Connection* c)
+{
+	int pos = 0, rc;
+
+	while (!c->closing)
+	{
+		if (c->incap - c->inlen < 4096)
+		{
+			/* what is left after parsing is less than a packet, so the buffer need never
+			 * be larger than the biggest packet and a read more */
+			c->incap = (c->incap == 0) ? READ_SIZE : c->incap * 2;
+			if (c->incap > opts.max_packet + READ_SIZE)
+				c->incap = opts.max_packet + READ_SIZE;
+			if ((c->in = realloc(c->in, c->incap)) == NULL)
+			{
+				fprintf(stderr, "Out of memory\n");
+				exit(1);
+			}
+		}
+		if ((rc = read(c->fd, &c->in[c->inlen], c->incap - c->inlen)) <= 0)
+		{
+			if (rc == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+				close_connection(w, c);
+			break;
+		}
+		c->inlen += rc;
+		while (!c->closing && pos < c->inlen)
+		{
+			int len = packet_length(&c->in[pos], c->inlen - pos);
+
+			if (len < 0)
+				close_connection(w, c);
+			if (len <= 0)
+				break;
+			handle_packet(w, c, &c->in[pos], len);
+			pos += len;
+		}
+		if (pos > 0)
+		{
+			memmove(c->in, &c->in[pos], c->inlen - pos);
+			c->inlen -= pos;
+			pos = 0;
+		}
+		if (rc < c->incap - c->inlen)
+			break; /* drained */
+	}
+}
+
+
+static void flush_connection(Worker* w, Connection* c)
+{
+	struct epoll_event event;
+
+	c->dirty = 0;
+	while (c->outpos < c->outlen)
+	{
+		int rc = write(c->fd, &c->out[c->outpos], c->outlen - c->outpos);
+
+		if (rc < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				close_connection(w, c);
+			break;
+		}
+		c->outpos += rc;
+	}
+	if ((c->outpos < c->outlen) != c->writable_wait && !c->closing)
+	{
+		c->writable_wait = !c->writable_wait;
+		event.events = EPOLLIN | EPOLLRDHUP | (c->writable_wait ? EPOLLOUT : 0);
+		event.data.ptr = c;
+		epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &event);
+	}
+}
+
+
+static void free_connection(Worker* w, Connection* c)
+{
+	Session* s = c->session;
+
+	if (c->outpos < c->outlen) /* a last try, for a CONNACK refusing the connection */
+	{
+		int rc = write(c->fd, &c->out[c->outpos], c->outlen - c->outpos);
+		(void)rc;
+	}
+	if (c->dirty)
+	{
+		Connection** link;
+
+		for (link = &w->dirty; *link != c; link = &(*link)->next_dirty)
+			;
+		*link = c->next_dirty;
+	}
+	epoll_ctl(w->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	if (c->prev)
+		c->prev->next = c->next;
+	else
+		w->connections = c->next;
+	if (c->next)
+		c->next->prev = c->prev;
+	if (s)
+	{
+		int clean;
+
+		pthread_mutex_lock(&s->lock);
+		if (s->conn == c)
+		{
+			s->conn = NULL;
+			s->worker = -1;
+		}
+		clean = s->clean;
+		pthread_mutex_unlock(&s->lock);
+		if (c->will && !c->graceful)
+			route(w, c->will, c->will_qos, c->will_retained);
+		if (clean)
+			session_discard(s);
+		session_unref(s);
+	}
+	message_unref(c->will);
+	free(c->qos2_received);
+	free(c->in);
+	free(c->out);
+	free(c);
+}
+
+
+static void accept_connections(Worker* w, int listen_fd)
+{
+	struct epoll_event event;
+	int fd, one = 1;
+
+	while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+	{
+		Connection* c = xmalloc(sizeof(Connection));
+
+		memset(c, '\0', sizeof(Connection));
+		c->fd = fd;
+		c->id = __sync_fetch_and_add(&next_conn_id, 1);
+		c->last_received = time(NULL);
+		c->next = w->connections;
+		if (w->connections)
+			w->connections->prev = c;
+		w->connections = c;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); /* fails harmlessly on a Unix socket */
+		event.events = EPOLLIN | EPOLLRDHUP;
+		event.data.ptr = c;
+		epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &event);
+	}
+}
+
+
+static void process_inbox(Worker* w)
+{
+	uint64_t count;
+	Item* item;
+
+	if (read(w->event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		perror("eventfd read");
+	pthread_mutex_lock(&w->inbox_lock);
+	item = w->inbox;
+	w->inbox = w->inbox_tail = NULL;
+	pthread_mutex_unlock(&w->inbox_lock);
+
+	while (item)
+	{
+		Item* next = item->next;
+
+		if (item->type == ITEM_DELIVER)
+		{
+			Session* s = item->session;
+
+			pthread_mutex_lock(&s->lock);
+			if (s->conn && s->worker == w->index && !s->conn->closing)
+				send_publish(w, s->conn, item->message, item->qos, item->retained);
+			pthread_mutex_unlock(&s->lock);
+			message_unref(item->message);
+			session_unref(s);
+		}
+		else if (item->type == ITEM_CLOSE)
+		{
+			Connection* c;
+
+			for (c = w->connections; c && c->id != item->conn_id; c = c->next)
+				;
+			if (c)
+				close_connection(w, c);
+		}
+		free(item);
+		item = next;
+	}
+}
+
+
+static void* worker_run(void* arg)
+{
+	Worker* w = arg;
+	struct epoll_event events[MAX_EVENTS];
+	time_t last_check = time(NULL);
+
+	while (!__atomic_load_n(&stopping, __ATOMIC_RELAXED))
+	{
+		int i, n = epoll_wait(w->epfd, events, MAX_EVENTS, 1000);
+		Connection* c;
+		time_t now;
+
+		for (i = 0; i < n; ++i)
+		{
+			if (events[i].data.ptr == &w->listen_fd)
+				accept_connections(w, w->listen_fd);
+			else if (events[i].data.ptr == &unix_listen_fd)
+				accept_connections(w, unix_listen_fd);
+			else if (events[i].data.ptr == &w->event_fd)
+				process_inbox(w);
+			else
+			{
+				c = events[i].data.ptr;
+				if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+					read_connection(w, c);
+				if ((events[i].events & EPOLLOUT) && !c->dirty)
+				{
+					c->dirty = 1;
+					c->next_dirty = w->dirty;
+					w->dirty = c;
+				}
+			}
+		}
+		while (w->dirty) /* write out everything queued by this pass together */
+		{
+			c = w->dirty;
+			w->dirty = c->next_dirty;
+			flush_connection(w, c);
+		}
+		if ((now = time(NULL)) != last_check)
+		{
+			last_check = now;
+			for (c = w->connections; c; c = c->next)
+			{
+				if (c->keepalive > 0 && now - c->last_received > c->keepalive * 3 / 2)
+					close_connection(w, c);
+				else if (c->session == NULL && now - c->last_received > 30)
+					close_connection(w, c); /* no CONNECT */
+			}
+		}
+		for (c = w->connections; c; ) /* closed last, so no event or queue still refers to them */
+		{
+			Connection* next = c->next;
+
+			if (c->closing)
+				free_connection(w, c);
+			c = next;
+		}
+		while (w->dirty) /* wills published by those closed */
+		{
+			c = w->dirty;
+			w->dirty = c->next_dirty;
+			flush_connection(w, c);
+		}
+	}
+	return NULL;
+}
+
+
+static int listen_port(int port)
+{
+	struct sockaddr_in6 address;
+	int fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	int one = 1, zero = 0;
+
+	if (fd < 0)
+		return -1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+	setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero)); /* and IPv4 */
+	memset(&address, '\0', sizeof(address));
+	address.sin6_family = AF_INET6;
+	address.sin6_addr = in6addr_any;
+	address.sin6_port = htons(port);
+	if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+static int listen_unix(const char* path)
+{
+	struct sockaddr_un address;
+	int fd = -1;
+
+	if (strlen(path) >= sizeof(address.sun_path))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+		return -1;
+	memset(&address, '\0', sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+	unlink(path); /* left by an earlier run */
+	if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+static int worker_start(Worker* w, int index)
+{
+	struct epoll_event event;
+
+	memset(w, '\0', sizeof(Worker));
+	w->index = index;
+	pthread_mutex_init(&w->inbox_lock, NULL);
+	if ((w->listen_fd = listen_port(opts.port)) < 0)
+	{
+		fprintf(stderr, "Can't listen on port %d: %s\n", opts.port, strerror(errno));
+		return -1;
+	}
+	w->epfd = epoll_create1(EPOLL_CLOEXEC);
+	w->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	event.events = EPOLLIN;
+	event.data.ptr = &w->listen_fd;
+	epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->listen_fd, &event);
+	event.data.ptr = &w->event_fd;
+	epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->event_fd, &event);
+	if (unix_listen_fd >= 0)
+	{
+		event.events = EPOLLIN | EPOLLEXCLUSIVE; /* shared by every worker: wake only one */
+		event.data.ptr = &unix_listen_fd;
+		epoll_ctl(w->epfd, EPOLL_CTL_ADD, unix_listen_fd, &event);
+	}
+	return pthread_create(&w->thread, NULL, worker_run, w);
+}
+
+
+static void stop(int sig)
+{
+	__atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+}
+
+
+static void getopts(int argc, char** argv)
+{
+	int count = 1;
+
+	while (count < argc)
+	{
+		if (strcmp(argv[count], "--port") == 0 && ++count < argc)
+			opts.port = atoi(argv[count]);
+		else if (strcmp(argv[count], "--unix") == 0 && ++count < argc)
+			opts.unix_path = argv[count];
+		else if (strcmp(argv[count], "--threads") == 0 && ++count < argc)
+			opts.threads = atoi(argv[count]);
+		else if (strcmp(argv[count], "--max-packet") == 0 && ++count < argc)
+			opts.max_packet = atoi(argv[count]);
+		else if (strcmp(argv[count], "--verbose") == 0)
+			opts.verbose = 1;
+		else if (strcmp(argv[count], "--run") == 0 && ++count < argc)
+		{
+			opts.run = &argv[count];
+			break;
+		}
+		else
+		{
+			printf("Usage: mqttbroker [--port <port>] [--unix <path>] [--threads <n>] [--max-packet <bytes>] [--verbose] "
+				"[--run <command> [args...]]\n");
+			exit(-1);
+		}
+		count++;
+	}
+	if (opts.threads <= 0)
+		opts.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (opts.threads <= 0)
+		opts.threads = 1;
+}
+
+
+int main(int argc, char** argv)
+{
+	unsigned long received = 0, sent = 0, connects = 0;
+	int i, rc = 0;
+
+	getopts(argc, argv);
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+	signal(SIGPIPE, SIG_IGN);
+
+	if (opts.unix_path && (unix_listen_fd = listen_unix(opts.unix_path)) < 0)
+	{
+		fprintf(stderr, "Can't listen on %s: %s\n", opts.unix_path, strerror(errno));
+		exit(1);
+	}
+	workers = xmalloc(opts.threads * sizeof(Worker));
+	for (i = 0; i < opts.threads; ++i)
+	{
+		if (worker_start(&workers[i], i) != 0)
+			exit(1);
+	}
+	if (opts.verbose)
+		printf("Listening on port %d with %d workers\n", opts.port, opts.threads);
+
+	if (opts.run)
+	{
+		pid_t child = fork();
+		int status = 0;
+
+		if (child == 0)
+		{
+			execvp(opts.run[0], opts.run);
+			perror(opts.run[0]);
+			_exit(127);
+		}
+		while (child > 0 && waitpid(child, &status, 0) < 0 && errno == EINTR)
+			;
+		rc = (child < 0) ? 1 : WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+		__atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+	}
+	while (!__atomic_load_n(&stopping, __ATOMIC_RELAXED))
+		pause();
+
+	for (i = 0; i < opts.threads; ++i)
+	{
+		uint64_t one = 1;
+
+		if (write(workers[i].event_fd, &one, sizeof(one)) < 0)
+			perror("eventfd write");
+		pthread_join(workers[i].thread, NULL);
+		received += workers[i].received;
+		sent += workers[i].sent;
+		connects += workers[i].connects;
+	}
+	if (unix_listen_fd >= 0)
+	{
+		close(unix_listen_fd);
+		unlink(opts.unix_path);
+	}
+	if (opts.verbose)
+		printf("%lu connects, %lu messages received, %lu sent\n", connects, received, sent);
+	return rc;
+}
@@ -199,7 +199,7 @@ char* MQTTFormat_toServerString(char* strbuf, int strbuflen, unsigned char* buf,
 	{
 	case CONNECT:
 	{
-		MQTTPacket_connectData data;
+		MQTTPacket_connectData data = MQTTPacket_connectData_initializer; /* fields not in the packet stay empty */
 		int rc;
 		if ((rc = MQTTDeserialize_connect(&data, buf, buflen)) == 1)
 			strindex = MQTTStringFormat_connect(strbuf, strbuflen, &data);
@@ -98,22 +98,29 @@ int MQTTPacket_len(int rem_len)
 }
 
 
-static unsigned char* bufptr;
-
-int bufchar(unsigned char* c, int count)
-{
-	int i;
-
-	for (i = 0; i < count; ++i)
-		*c = *bufptr++;
-	return count;
-}
-
-
+/**
+ * Decodes the message length from a buffer, as MQTTPacket_decode does from a data source.
+ * Reads the buffer directly, with no static state, so can be called from many threads at once.
+ * @param buf the buffer holding the remaining length, after the header byte
+ * @param value the decoded length returned
+ * @return the number of bytes used from buf
+ */
 int MQTTPacket_decodeBuf(unsigned char* buf, int* value)
 {
-	bufptr = buf;
-	return MQTTPacket_decode(bufchar, value);
+	int multiplier = 1;
+	int len = 0;
+	unsigned char c;
+
+	*value = 0;
+	do
+	{
+		if (++len > MAX_NO_OF_REMAINING_LENGTH_BYTES)
+			break;	/* bad data */
+		c = *buf++;
+		*value += (c & 127) * multiplier;
+		multiplier *= 128;
+	} while ((c & 128) != 0);
+	return len;
 }
 
 
@@ -0,0 +1,132 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial packet id set
+ *******************************************************************************/
+
+#include "MQTTPacket.h"
+
+#include <string.h>
+
+#define ID_INDEX(packetid) ((packetid) & (MQTT_PACKET_ID_BITS - 1))
+#define ID_BYTE(set, packetid) ((set)->bits[ID_INDEX(packetid) >> 3])
+#define ID_MASK(packetid) (1 << (ID_INDEX(packetid) & 7))
+
+
+#if MQTT_PACKET_ID_BITS < 65536
+/* The overflow entry holding an id, or -1 */
+static int overflow_find(MQTTPacketIdSet* set, unsigned short packetid)
+{
+	int i;
+
+	for (i = 0; i < MQTT_PACKET_ID_OVERFLOW; ++i)
+	{
+		if (set->overflow[i] == packetid)
+			return i;
+	}
+	return -1;
+}
+#endif
+
+
+/**
+  * Empties a packet id set
+  * @param set the set
+  */
+void MQTTPacketIdSet_clear(MQTTPacketIdSet* set)
+{
+	memset(set, '\0', sizeof(*set));
+}
+
+
+/**
+  * Adds a packet id to a set
+  * @param set the set
+  * @param packetid the packet id
+  * @return 1 if the id was added, 0 if it was already in the set
+  */
+int MQTTPacketIdSet_add(MQTTPacketIdSet* set, unsigned short packetid)
+{
+	if (!(ID_BYTE(set, packetid) & ID_MASK(packetid)))
+	{
+		ID_BYTE(set, packetid) |= ID_MASK(packetid);
+#if MQTT_PACKET_ID_BITS < 65536
+		set->ids[ID_INDEX(packetid)] = packetid;
+#endif
+		return 1;
+	}
+#if MQTT_PACKET_ID_BITS < 65536
+	{
+		int i;
+
+		if (set->ids[ID_INDEX(packetid)] == packetid || overflow_find(set, packetid) != -1)
+			return 0;
+		if ((i = overflow_find(set, 0)) != -1)
+			set->overflow[i] = packetid;
+		return 1; /* a new id, whether or not there was room to hold it */
+	}
+#else
+	return 0;
+#endif
+}
+
+
+/**
+  * Looks for a packet id in a set
+  * @param set the set
+  * @param packetid the packet id
+  * @return 1 if the id is in the set, 0 if not
+  */
+int MQTTPacketIdSet_contains(MQTTPacketIdSet* set, unsigned short packetid)
+{
+	if (!(ID_BYTE(set, packetid) & ID_MASK(packetid)))
+		return 0;
+#if MQTT_PACKET_ID_BITS < 65536
+	return set->ids[ID_INDEX(packetid)] == packetid || overflow_find(set, packetid) != -1;
+#else
+	return 1;
+#endif
+}
+
+
+/**
+  * Removes a packet id from a set, if it is there
+  * @param set the set
+  * @param packetid the packet id
+  */
+void MQTTPacketIdSet_remove(MQTTPacketIdSet* set, unsigned short packetid)
+{
+#if MQTT_PACKET_ID_BITS < 65536
+	int i;
+
+	if (!(ID_BYTE(set, packetid) & ID_MASK(packetid)))
+		return;
+	if (set->ids[ID_INDEX(packetid)] != packetid)
+	{
+		if ((i = overflow_find(set, packetid)) != -1)
+			set->overflow[i] = 0;
+		return;
+	}
+	/* hand the bit to an id waiting in the overflow for it, if there is one */
+	for (i = 0; i < MQTT_PACKET_ID_OVERFLOW; ++i)
+	{
+		if (set->overflow[i] != 0 && ID_INDEX(set->overflow[i]) == ID_INDEX(packetid))
+		{
+			set->ids[ID_INDEX(packetid)] = set->overflow[i];
+			set->overflow[i] = 0;
+			return;
+		}
+	}
+#endif
+	ID_BYTE(set, packetid) &= ~ID_MASK(packetid);
+}
@@ -0,0 +1,63 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial packet id set
+ *******************************************************************************/
+
+#ifndef MQTTPACKETIDSET_H_
+#define MQTTPACKETIDSET_H_
+
+#if !defined(DLLImport)
+  #define DLLImport 
+#endif
+#if !defined(DLLExport)
+  #define DLLExport
+#endif
+
+/* A set of packet ids, one bit for each, so adding, removing and looking up an id
+ * are constant time.  Clients hold the ids of the inbound QoS 2 messages they have
+ * delivered and not yet had the PUBREL for, to recognize redelivered duplicates.
+ *
+ * The full set is 8 KB.  A smaller power of 2 folds ids onto bit (id mod bits),
+ * and keeps the id holding each bit, so a new message is never taken for a
+ * duplicate.  Ids in flight whose bit another already holds are kept exactly, up
+ * to MQTT_PACKET_ID_OVERFLOW of them; beyond that an id is not held, and a
+ * redelivery of its message would be delivered again.  As brokers number packets
+ * in sequence, two ids in flight only share a bit when that many apart.  The size
+ * must be the same for this library and the code using it.
+ */
+#if !defined(MQTT_PACKET_ID_BITS)
+#define MQTT_PACKET_ID_BITS 65536 /* redefinable - a power of 2, at most 65536 */
+#endif
+#if MQTT_PACKET_ID_BITS < 65536 && !defined(MQTT_PACKET_ID_OVERFLOW)
+#define MQTT_PACKET_ID_OVERFLOW 8 /* redefinable - ids held exactly when their bit is taken */
+#endif
+
+typedef struct
+{
+	unsigned char bits[MQTT_PACKET_ID_BITS / 8];
+#if MQTT_PACKET_ID_BITS < 65536
+	unsigned short ids[MQTT_PACKET_ID_BITS];          /* the id holding each bit */
+	unsigned short overflow[MQTT_PACKET_ID_OVERFLOW]; /* ids whose bit another holds, 0 if unused */
+#endif
+} MQTTPacketIdSet;
+
+DLLExport void MQTTPacketIdSet_clear(MQTTPacketIdSet* set);
+
+DLLExport int MQTTPacketIdSet_add(MQTTPacketIdSet* set, unsigned short packetid);
+
+DLLExport int MQTTPacketIdSet_contains(MQTTPacketIdSet* set, unsigned short packetid);
+
+DLLExport void MQTTPacketIdSet_remove(MQTTPacketIdSet* set, unsigned short packetid);
+
+#endif /* MQTTPACKETIDSET_H_ */
@@ -28,6 +28,8 @@
 DLLExport int MQTTSerialize_unsubscribe(unsigned char* buf, int buflen, unsigned char dup, unsigned short packetid,
 		int count, MQTTString topicFilters[]);
 
+DLLExport int MQTTSerialize_unsubscribeLength(int count, MQTTString topicFilters[]);
+
 DLLExport int MQTTDeserialize_unsubscribe(unsigned char* dup, unsigned short* packetid, int max_count, int* count, MQTTString topicFilters[],
 		unsigned char* buf, int len);
 
@@ -0,0 +1,361 @@
+/*******************************************************************************
+ * Copyright (c) 2026 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Paho contributors - initial function profiler
+ *******************************************************************************/
+
+/*
+ The FUNC_ENTRY and FUNC_EXIT hooks of StackTrace.h, for a build with MQTT_PROFILE defined.
+
+ Each thread has its own call tree, so recording a call takes no locks: a node for each
+ function under each caller, holding the number of calls, and the total and self time.
+ The trees are allocated on first use, and kept after their threads end, so they can
+ be dumped at any time - when the threads are quiet, for the counts to be consistent.
+
+ StackTrace_dump writes a table of the functions, summed over all threads and callers.
+ StackTrace_dumpFolded writes a line of self time for each call path, in the folded
+ format flamegraph.pl and speedscope read:
+
+   MQTTDeserialize_publish;readMQTTLenString 1820
+*/
+
+#include "StackTrace.h"
+
+#if defined(MQTT_PROFILE)
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if !defined(MQTT_PROFILE_CLOCK)
+/* redefinable - the time source, in any units: a cycle counter such as __rdtsc() costs less */
+#define MQTT_PROFILE_CLOCK() StackTrace_clock_ns()
+#endif
+#if !defined(MQTT_PROFILE_NODES)
+#define MQTT_PROFILE_NODES 256 /* redefinable - the number of distinct call paths kept for each thread */
+#endif
+#if !defined(MQTT_PROFILE_DEPTH)
+#define MQTT_PROFILE_DEPTH 32 /* redefinable - the deepest call stack followed */
+#endif
+#if !defined(MQTT_THREAD_LOCAL)
+#define MQTT_THREAD_LOCAL __thread /* redefinable - thread-local storage class */
+#endif
+
+typedef struct
+{
+	const char* name;       /* __func__, which is unique to each function, so compared by address */
+	int parent;             /* index of the caller's node, -1 at the root */
+	int first_child;
+	int next_sibling;
+	unsigned long calls;
+	unsigned long long total;
+	unsigned long long self;
+} ProfileNode;
+
+typedef struct
+{
+	int node;
+	unsigned long long start;
+	unsigned long long children; /* time spent in the calls made from this one */
+} ProfileFrame;
+
+typedef struct ProfileThread
+{
+	struct ProfileThread* next;
+	pthread_t thread;
+	int node_count;
+	int depth;              /* may be deeper than the frames held, when calls are too deep or too many */
+	unsigned long lost;     /* calls not recorded because the tree was full or too deep */
+	int first_root;
+	ProfileNode nodes[MQTT_PROFILE_NODES];
+	ProfileFrame stack[MQTT_PROFILE_DEPTH];
+} ProfileThread;
+
+static pthread_mutex_t profile_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ProfileThread* profile_threads = NULL;
+static MQTT_THREAD_LOCAL ProfileThread* profile_thread = NULL;
+
+
+static unsigned long long StackTrace_clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static ProfileThread* StackTrace_thread(void)
+{
+	if (profile_thread == NULL && (profile_thread = calloc(1, sizeof(ProfileThread))) != NULL)
+	{
+		profile_thread->thread = pthread_self();
+		profile_thread->first_root = -1;
+		pthread_mutex_lock(&profile_mutex);
+		profile_thread->next = profile_threads;
+		profile_threads = profile_thread;
+		pthread_mutex_unlock(&profile_mutex);
+	}
+	return profile_thread;
+}
+
+
+/* the node of name under the current caller, added if this is the first call on this path */
+static int StackTrace_child(ProfileThread* pt, const char* name)
+{
+	int parent = (pt->depth > 0) ? pt->stack[pt->depth - 1].node : -1;
+	int* link = (parent == -1) ? &pt->first_root : &pt->nodes[parent].first_child;
+	int node = *link;
+
+	while (node != -1 && pt->nodes[node].name != name)
+		node = pt->nodes[node].next_sibling;
+	if (node == -1 && pt->node_count < MQTT_PROFILE_NODES)
+	{
+		node = pt->node_count++;
+		memset(&pt->nodes[node], '\0', sizeof(ProfileNode));
+		pt->nodes[node].name = name;
+		pt->nodes[node].parent = parent;
+		pt->nodes[node].first_child = -1;
+		pt->nodes[node].next_sibling = *link;
+		*link = node;
+	}
+	return node;
+}
+
+
+void StackTrace_entry(const char* name, int line, int trace)
+{
+	ProfileThread* pt = StackTrace_thread();
+
+	if (pt == NULL)
+		return;
+	if (pt->depth < MQTT_PROFILE_DEPTH)
+	{
+		ProfileFrame* frame = &pt->stack[pt->depth];
+
+		if ((frame->node = StackTrace_child(pt, name)) == -1)
+			pt->lost++;
+		frame->children = 0;
+		frame->start = MQTT_PROFILE_CLOCK();
+	}
+	else
+		pt->lost++;
+	pt->depth++;
+}
+
+
+void StackTrace_exit(const char* name, int line, void* rc, int trace)
+{
+	ProfileThread* pt = profile_thread;
+	unsigned long long elapsed = 0;
+	ProfileFrame* frame = NULL;
+
+	if (pt == NULL || pt->depth == 0)
+		return;
+	if (--pt->depth >= MQTT_PROFILE_DEPTH || (frame = &pt->stack[pt->depth])->node == -1)
+		return;
+	elapsed = MQTT_PROFILE_CLOCK() - frame->start;
+	pt->nodes[frame->node].calls++;
+	pt->nodes[frame->node].total += elapsed;
+	pt->nodes[frame->node].self += elapsed - frame->children;
+	if (pt->depth > 0 && pt->depth - 1 < MQTT_PROFILE_DEPTH)
+		pt->stack[pt->depth - 1].children += elapsed;
+}
+
+
+/**
+  * Prints the functions being profiled on the calling thread's stack, innermost first
+  * @param dest the stream to print to
+  */
+void StackTrace_printStack(FILE* dest)
+{
+	ProfileThread* pt = profile_thread;
+	int i;
+
+	if (pt == NULL)
+		return;
+	for (i = ((pt->depth < MQTT_PROFILE_DEPTH) ? pt->depth : MQTT_PROFILE_DEPTH) - 1; i >= 0; --i)
+	{
+		if (pt->stack[i].node != -1)
+			fprintf(dest, "   at %s\n", pt->nodes[pt->stack[i].node].name);
+	}
+}
+
+
+/**
+  * Gets the functions being profiled on the stack of a thread, outermost first
+  * @param threadid the pthread_t of the thread
+  * @return the function names, separated by '/', in a buffer overwritten by the next call
+  */
+char* StackTrace_get(unsigned long threadid)
+{
+	static char buf[256];
+	ProfileThread* pt = NULL;
+	int i, len = 0;
+
+	buf[0] = '\0';
+	pthread_mutex_lock(&profile_mutex);
+	for (pt = profile_threads; pt != NULL; pt = pt->next)
+	{
+		if ((unsigned long)pt->thread == threadid)
+			break;
+	}
+	pthread_mutex_unlock(&profile_mutex);
+	for (i = 0; pt != NULL && i < pt->depth && i < MQTT_PROFILE_DEPTH && len < (int)sizeof(buf); ++i)
+	{
+		if (pt->stack[i].node != -1)
+			len += snprintf(&buf[len], sizeof(buf) - len, "%s%s", (len > 0) ? "/" : "", pt->nodes[pt->stack[i].node].name);
+	}
+	return buf;
+}
+
+
+/**
+  * Gets the profile of a function, summed over all threads and callers
+  * @param name the function name
+  * @param calls the number of calls returned
+  * @param total the time spent in the function and those it called returned, in MQTT_PROFILE_CLOCK units
+  * @param self the time spent in the function itself returned
+  * @return 1 if the function has been called, 0 if not
+  */
+int StackTrace_getStats(const char* name, unsigned long* calls, unsigned long long* total, unsigned long long* self)
+{
+	ProfileThread* pt = NULL;
+	int i, found = 0;
+
+	*calls = 0;
+	*total = *self = 0;
+	pthread_mutex_lock(&profile_mutex);
+	for (pt = profile_threads; pt != NULL; pt = pt->next)
+	{
+		for (i = 0; i < pt->node_count; ++i)
+		{
+			ProfileNode* node = &pt->nodes[i];
+			int ancestor = node->parent;
+
+			if (strcmp(node->name, name) != 0)
+				continue;
+			found = 1;
+			*calls += node->calls;
+			*self += node->self;
+			while (ancestor != -1 && pt->nodes[ancestor].name != node->name)
+				ancestor = pt->nodes[ancestor].parent;
+			if (ancestor == -1) /* a recursive call is already in the total of the outer one */
+				*total += node->total;
+		}
+	}
+	pthread_mutex_unlock(&profile_mutex);
+	return found;
+}
+
+
+/**
+  * Writes a table of the functions called, with their calls and times, summed over all
+  * threads and callers, in the order they were first called
+  * @param dest the stream to write to
+  */
+void StackTrace_dump(FILE* dest)
+{
+	const char* names[MQTT_PROFILE_NODES];
+	ProfileThread* pt = NULL;
+	unsigned long lost = 0;
+	int i, j, count = 0;
+
+	pthread_mutex_lock(&profile_mutex);
+	for (pt = profile_threads; pt != NULL; pt = pt->next)
+	{
+		lost += pt->lost;
+		for (i = 0; i < pt->node_count; ++i)
+		{
+			for (j = 0; j < count && strcmp(names[j], pt->nodes[i].name) != 0; ++j)
+				;
+			if (j == count && count < MQTT_PROFILE_NODES)
+				names[count++] = pt->nodes[i].name;
+		}
+	}
+	pthread_mutex_unlock(&profile_mutex);
+
+	fprintf(dest, "%-36s %12s %16s %16s %10s\n", "function", "calls", "total", "self", "self/call");
+	for (i = 0; i < count; ++i)
+	{
+		unsigned long calls;
+		unsigned long long total, self;
+
+		StackTrace_getStats(names[i], &calls, &total, &self);
+		fprintf(dest, "%-36s %12lu %16llu %16llu %10.1f\n", names[i], calls, total, self,
+			(calls > 0) ? (double)self / calls : 0.0);
+	}
+	if (lost > 0)
+		fprintf(dest, "%lu calls not recorded: raise MQTT_PROFILE_NODES or MQTT_PROFILE_DEPTH\n", lost);
+}
+
+
+static void StackTrace_writePath(FILE* dest, ProfileThread* pt, int node)
+{
+	if (pt->nodes[node].parent != -1)
+	{
+		StackTrace_writePath(dest, pt, pt->nodes[node].parent);
+		fputc(';', dest);
+	}
+	fputs(pt->nodes[node].name, dest);
+}
+
+
+/**
+  * Writes the self time of each call path, one per line in the folded stack format
+  * of flamegraph.pl.  Paths are written for each thread, for the tool to sum.
+  * @param dest the stream to write to
+  */
+void StackTrace_dumpFolded(FILE* dest)
+{
+	ProfileThread* pt = NULL;
+	int i;
+
+	pthread_mutex_lock(&profile_mutex);
+	for (pt = profile_threads; pt != NULL; pt = pt->next)
+	{
+		for (i = 0; i < pt->node_count; ++i)
+		{
+			if (pt->nodes[i].calls == 0)
+				continue;
+			StackTrace_writePath(dest, pt, i);
+			fprintf(dest, " %llu\n", pt->nodes[i].self);
+		}
+	}
+	pthread_mutex_unlock(&profile_mutex);
+}
+
+
+/**
+  * Zeroes the counts and times of every thread, which should be between calls
+  */
+void StackTrace_reset(void)
+{
+	ProfileThread* pt = NULL;
+	int i;
+
+	pthread_mutex_lock(&profile_mutex);
+	for (pt = profile_threads; pt != NULL; pt = pt->next)
+	{
+		for (i = 0; i < pt->node_count; ++i)
+		{
+			pt->nodes[i].calls = 0;
+			pt->nodes[i].total = pt->nodes[i].self = 0;
+		}
+		pt->lost = 0;
+	}
+	pthread_mutex_unlock(&profile_mutex);
+}
+
+#endif
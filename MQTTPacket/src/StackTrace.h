@@ -19,7 +19,12 @@
 #define STACKTRACE_H_
 
 #include <stdio.h>
+
+/* Define MQTT_PROFILE to have FUNC_ENTRY and FUNC_EXIT count the calls of each function and
+   the time spent in it, for StackTrace_dump to report (StackTrace.c) */
+#if !defined(MQTT_PROFILE)
 #define NOSTACKTRACE 1
+#endif
 
 #if defined(NOSTACKTRACE)
 #define FUNC_ENTRY
@@ -36,6 +41,12 @@
 
 #else
 
+#if !defined(TRACE_MINIMUM)
+#define TRACE_MAXIMUM 1
+#define TRACE_MEDIUM 2
+#define TRACE_MINIMUM 3
+#endif
+
 #if defined(WIN32)
 #define inline __inline
 #define FUNC_ENTRY StackTrace_entry(__FUNCTION__, __LINE__, TRACE_MINIMUM)
@@ -68,6 +79,11 @@ void StackTrace_exit(const char* name, int line, void* return_value, int trace);
 void StackTrace_printStack(FILE* dest);
 char* StackTrace_get(unsigned long);
 
+void StackTrace_dump(FILE* dest);
+void StackTrace_dumpFolded(FILE* dest);
+int StackTrace_getStats(const char* name, unsigned long* calls, unsigned long long* total, unsigned long long* self);
+void StackTrace_reset(void);
+
 #endif
 
 #endif